@@ -16,10 +16,20 @@
 ** You should have received a copy of the GNU General Public License
 ** along with msprime.  If not, see <http://www.gnu.org/licenses/>.
 */
+#ifndef _WIN32
+/* Needed for mmap */
+#define _POSIX_C_SOURCE 200809L
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <float.h>
 #include <math.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include <gsl/gsl_rng.h>
 #include <gsl/gsl_math.h>
@@ -34,12 +44,23 @@
 #include "fenwick.h"
 #include "msprime.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 /* State machine for the simulator object. */
 #define MSP_STATE_NEW 0
 #define MSP_STATE_INITIALISED 1
 #define MSP_STATE_SIMULATING 2
 #define MSP_STATE_DEBUGGING 3
 
+/* The first source of events in a DTWF generation that is conditioned
+ * to be non-quiet. */
+#define MSP_DTWF_EVENT_ANY 0
+#define MSP_DTWF_EVENT_MIGRATION 1
+#define MSP_DTWF_EVENT_COALESCENCE 2
+#define MSP_DTWF_EVENT_RECOMBINATION 3
+
 /* Draw a random variable from a truncated Beta(a, b) distribution,
  * by rejecting draws above the truncation point x.
  */
@@ -112,15 +133,16 @@ cmp_individual(const void *a, const void *b)
 }
 
 /* For pedigree individuals we sort on time and to break ties
- * we arbitrarily use the ID */
+ * we arbitrarily use the ID. The items are pointers into the
+ * pedigree's time column, so the ID order is the address order. */
 static int
 cmp_pedigree_individual(const void *a, const void *b)
 {
-    const individual_t *ia = (const individual_t *) a;
-    const individual_t *ib = (const individual_t *) b;
-    int ret = (ia->time > ib->time) - (ia->time < ib->time);
+    const double *ia = (const double *) a;
+    const double *ib = (const double *) b;
+    int ret = (*ia > *ib) - (*ia < *ib);
     if (ret == 0) {
-        ret = (ia->id > ib->id) - (ia->id < ib->id);
+        ret = (ia > ib) - (ia < ib);
     }
     return ret;
 }
@@ -185,12 +207,7 @@ msp_get_num_node_mapping_blocks(msp_t *self)
 size_t
 msp_get_num_segment_blocks(msp_t *self)
 {
-    uint32_t j;
-    size_t total = 0;
-    for (j = 0; j < self->num_labels; j++) {
-        total += self->segment_heap[j].num_blocks;
-    }
-    return total;
+    return self->segment_heap.num_blocks;
 }
 
 size_t
@@ -245,6 +262,86 @@ msp_set_store_full_arg(msp_t *self, bool store_full_arg)
     return 0;
 }
 
+int
+msp_set_dtwf_generation_skipping(msp_t *self, bool dtwf_generation_skipping)
+{
+    self->dtwf_generation_skipping = dtwf_generation_skipping;
+    return 0;
+}
+
+int
+msp_set_dtwf_num_threads(msp_t *self, size_t num_threads)
+{
+    int ret = 0;
+
+    if (num_threads < 1) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    self->dtwf_num_threads = num_threads;
+out:
+    return ret;
+}
+
+static void
+msp_free_sweep_trajectory_bank(msp_t *self)
+{
+    sweep_trajectory_bank_t *bank = self->sweep_trajectory_bank;
+
+    if (bank != NULL) {
+        msp_safe_free(bank->offset);
+        msp_safe_free(bank->time);
+        msp_safe_free(bank->allele_frequency);
+        free(bank);
+        self->sweep_trajectory_bank = NULL;
+    }
+}
+
+static bool
+msp_sweep_in_progress(msp_t *self)
+{
+    return self->sweep_state.time != NULL;
+}
+
+static void
+msp_free_sweep_state(msp_t *self)
+{
+    sweep_state_t *state = &self->sweep_state;
+
+    msp_safe_free(state->time);
+    msp_safe_free(state->allele_frequency);
+    msp_safe_free(state->cum_coal_b);
+    msp_safe_free(state->cum_coal_B);
+    state->num_steps = 0;
+    state->curr_step = 0;
+}
+
+/* If size > 0, sweeps draw their trajectories from a bank of this many
+ * trajectories, generated the first time it is needed. */
+int
+msp_set_sweep_trajectory_bank_size(msp_t *self, size_t size)
+{
+    if (size != self->sweep_trajectory_bank_size) {
+        msp_free_sweep_trajectory_bank(self);
+    }
+    self->sweep_trajectory_bank_size = size;
+    return 0;
+}
+
+int
+msp_set_pedigree_num_threads(msp_t *self, size_t num_threads)
+{
+    int ret = 0;
+
+    if (num_threads < 1) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    self->pedigree_num_threads = num_threads;
+out:
+    return ret;
+}
+
 int
 msp_set_ploidy(msp_t *self, int ploidy)
 {
@@ -423,7 +520,8 @@ msp_setup_mass_indexes(msp_t *self)
         self->gc_mass_index = NULL;
     }
 
-    /* We never build indexes for the DTWF and Pedigree models */
+    /* We never build indexes for the DTWF and Pedigree models. The DTWF
+     * hybrid maintains them so that it can switch to the coalescent. */
     if (self->model.type == MSP_MODEL_DTWF || self->model.type == MSP_MODEL_WF_PED) {
         build_recomb_mass_index = false;
         build_gc_mass_index = false;
@@ -434,7 +532,7 @@ msp_setup_mass_indexes(msp_t *self)
         build_gc_mass_index = rate_map_get_total_mass(&self->gc_map) > 0;
     }
 
-    num_segments = self->segment_heap->size;
+    num_segments = self->segment_heap.size;
     if (build_recomb_mass_index) {
         self->recomb_mass_index
             = calloc(self->num_labels, sizeof(*self->recomb_mass_index));
@@ -520,14 +618,8 @@ msp_set_num_labels(msp_t *self, size_t num_labels)
     for (j = 0; j < self->num_populations; j++) {
         msp_safe_free(self->populations[j].ancestors);
     }
-    msp_safe_free(self->segment_heap);
 
     self->num_labels = (uint32_t) num_labels;
-    self->segment_heap = calloc(self->num_labels, sizeof(*self->segment_heap));
-    if (self->segment_heap == NULL) {
-        ret = MSP_ERR_NO_MEMORY;
-        goto out;
-    }
 
     for (j = 0; j < self->num_populations; j++) {
         self->populations[j].ancestors
@@ -644,25 +736,29 @@ msp_alloc_segment(msp_t *self, double left, double right, tsk_id_t value,
     population_id_t population, label_id_t label, segment_t *prev, segment_t *next)
 {
     segment_t *seg = NULL;
+    uint32_t j;
 
-    if (object_heap_empty(&self->segment_heap[label])) {
-        if (object_heap_expand(&self->segment_heap[label]) != 0) {
+    if (object_heap_empty(&self->segment_heap)) {
+        if (object_heap_expand(&self->segment_heap) != 0) {
             goto out;
         }
-        if (self->recomb_mass_index != NULL) {
-            if (fenwick_expand(&self->recomb_mass_index[label], self->segment_block_size)
-                != 0) {
-                goto out;
+        /* The mass indexes for all labels cover the whole id space */
+        for (j = 0; j < self->num_labels; j++) {
+            if (self->recomb_mass_index != NULL) {
+                if (fenwick_expand(&self->recomb_mass_index[j], self->segment_block_size)
+                    != 0) {
+                    goto out;
+                }
             }
-        }
-        if (self->gc_mass_index != NULL) {
-            if (fenwick_expand(&self->gc_mass_index[label], self->segment_block_size)
-                != 0) {
-                goto out;
+            if (self->gc_mass_index != NULL) {
+                if (fenwick_expand(&self->gc_mass_index[j], self->segment_block_size)
+                    != 0) {
+                    goto out;
+                }
             }
         }
     }
-    seg = (segment_t *) object_heap_alloc_object(&self->segment_heap[label]);
+    seg = (segment_t *) object_heap_alloc_object(&self->segment_heap);
     if (seg == NULL) {
         goto out;
     }
@@ -744,6 +840,9 @@ msp_alloc(msp_t *self, tsk_table_collection_t *tables, gsl_rng *rng)
     /* Set the memory defaults */
     self->store_migrations = false;
     self->store_full_arg = false;
+    self->dtwf_generation_skipping = false;
+    self->dtwf_num_threads = 1;
+    self->pedigree_num_threads = 1;
     self->avl_node_block_size = 1024;
     self->node_mapping_block_size = 1024;
     self->segment_block_size = 1024;
@@ -751,10 +850,6 @@ msp_alloc(msp_t *self, tsk_table_collection_t *tables, gsl_rng *rng)
     avl_init_tree(&self->breakpoints, cmp_node_mapping, NULL);
     avl_init_tree(&self->overlap_counts, cmp_node_mapping, NULL);
     avl_init_tree(&self->non_empty_populations, cmp_pointer, NULL);
-    /* Set up the demographic events */
-    self->demographic_events_head = NULL;
-    self->demographic_events_tail = NULL;
-    self->next_demographic_event = NULL;
     self->state = MSP_STATE_NEW;
     /* Set up pedigree */
     self->pedigree = NULL;
@@ -770,6 +865,18 @@ msp_alloc_memory_blocks(msp_t *self)
     int ret = 0;
     uint32_t j;
 
+    self->ancestor_count_index
+        = calloc(self->num_labels, sizeof(*self->ancestor_count_index));
+    if (self->ancestor_count_index == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    for (j = 0; j < self->num_labels; j++) {
+        ret = fenwick_alloc(&self->ancestor_count_index[j], self->num_populations);
+        if (ret != 0) {
+            goto out;
+        }
+    }
     /* Allocate the memory heaps */
     ret = object_heap_init(
         &self->avl_node_heap, sizeof(avl_node_t), self->avl_node_block_size, NULL);
@@ -782,12 +889,10 @@ msp_alloc_memory_blocks(msp_t *self)
         goto out;
     }
     /* allocate the segments */
-    for (j = 0; j < self->num_labels; j++) {
-        ret = object_heap_init(&self->segment_heap[j], sizeof(segment_t),
-            self->segment_block_size, segment_init);
-        if (ret != 0) {
-            goto out;
-        }
+    ret = object_heap_init(&self->segment_heap, sizeof(segment_t),
+        self->segment_block_size, segment_init);
+    if (ret != 0) {
+        goto out;
     }
     /* Allocate the edge records */
     self->num_buffered_edges = 0;
@@ -816,20 +921,17 @@ msp_is_completed(msp_t *self)
 static int
 msp_free_pedigree(msp_t *self)
 {
-    individual_t *ind = NULL;
-    size_t i;
-
-    ind = self->pedigree->inds;
-    if (ind != NULL) {
-        tsk_bug_assert(self->pedigree->num_inds > 0);
-        for (i = 0; i < self->pedigree->num_inds; i++) {
-            msp_safe_free(ind->parents);
-            msp_safe_free(ind->segments);
-            ind++;
-        }
-    }
-    msp_safe_free(self->pedigree->inds);
-    msp_safe_free(self->pedigree->samples);
+    pedigree_t *pedigree = self->pedigree;
+
+    msp_safe_free(pedigree->parents);
+    msp_safe_free(pedigree->time);
+    msp_safe_free(pedigree->segments);
+    msp_safe_free(pedigree->queued);
+    msp_safe_free(pedigree->next_queued);
+    msp_safe_free(pedigree->samples);
+    msp_safe_free(pedigree->bucket_head);
+    msp_safe_free(pedigree->bucket_tail);
+    object_heap_free(&pedigree->segment_set_heap);
     msp_safe_free(self->pedigree);
     return 0;
 }
@@ -840,14 +942,6 @@ msp_free(msp_t *self)
     int ret = -1;
     uint32_t j;
 
-    demographic_event_t *de = self->demographic_events_head;
-    demographic_event_t *tmp;
-
-    while (de != NULL) {
-        tmp = de->next;
-        free(de);
-        de = tmp;
-    }
     for (j = 0; j < self->num_labels; j++) {
         if (self->recomb_mass_index != NULL) {
             fenwick_free(&self->recomb_mass_index[j]);
@@ -855,27 +949,37 @@ msp_free(msp_t *self)
         if (self->gc_mass_index != NULL) {
             fenwick_free(&self->gc_mass_index[j]);
         }
-        if (self->segment_heap != NULL) {
-            object_heap_free(&self->segment_heap[j]);
+        if (self->ancestor_count_index != NULL) {
+            fenwick_free(&self->ancestor_count_index[j]);
         }
     }
     for (j = 0; j < self->num_populations; j++) {
         msp_safe_free(self->populations[j].ancestors);
         msp_safe_free(self->populations[j].potential_destinations);
+        if (self->dtwf_rngs != NULL && self->dtwf_rngs[j] != NULL) {
+            gsl_rng_free(self->dtwf_rngs[j]);
+        }
     }
+    msp_safe_free(self->dtwf_rngs);
+    msp_free_sweep_trajectory_bank(self);
+    msp_free_sweep_state(self);
     msp_safe_free(self->recomb_mass_index);
     msp_safe_free(self->gc_mass_index);
-    msp_safe_free(self->segment_heap);
+    msp_safe_free(self->ancestor_count_index);
     msp_safe_free(self->initial_migration_matrix);
     msp_safe_free(self->migration_matrix);
     msp_safe_free(self->num_migration_events);
     msp_safe_free(self->initial_populations);
     msp_safe_free(self->populations);
     msp_safe_free(self->sampling_events);
+    msp_safe_free(self->demographic_events);
     msp_safe_free(self->buffered_edges);
+    msp_safe_free(self->bottleneck_ids);
+    msp_safe_free(self->bottleneck_nodes);
     msp_safe_free(self->root_segments);
     msp_safe_free(self->initial_overlaps);
     /* free the object heaps */
+    object_heap_free(&self->segment_heap);
     object_heap_free(&self->avl_node_heap);
     object_heap_free(&self->node_mapping_heap);
     rate_map_free(&self->recomb_map);
@@ -938,17 +1042,18 @@ msp_free_node_mapping(msp_t *self, node_mapping_t *nm)
 static segment_t *
 msp_get_segment(msp_t *self, size_t id, label_id_t label)
 {
-    segment_t *u = object_heap_get_object(&self->segment_heap[label], id - 1);
+    segment_t *u = object_heap_get_object(&self->segment_heap, id - 1);
 
     tsk_bug_assert(u != NULL);
     tsk_bug_assert(u->id == id);
+    tsk_bug_assert(u->label == label);
     return u;
 }
 
 static void
 msp_free_segment(msp_t *self, segment_t *seg)
 {
-    object_heap_free_object(&self->segment_heap[seg->label], seg);
+    object_heap_free_object(&self->segment_heap, seg);
     if (self->recomb_mass_index != NULL) {
         fenwick_set_value(&self->recomb_mass_index[seg->label], seg->id, 0);
     }
@@ -963,6 +1068,33 @@ msp_get_segment_population(msp_t *self, segment_t *u)
     return &self->populations[u->population].ancestors[u->label];
 }
 
+/* All changes to the populations' ancestor sets go through
+ * msp_link_ancestor and msp_unlink_ancestor, so that the ancestor count
+ * index stays up to date. */
+static inline avl_node_t *
+msp_link_ancestor(msp_t *self, avl_node_t *node)
+{
+    segment_t *u = (segment_t *) node->item;
+
+    node = avl_insert_node(msp_get_segment_population(self, u), node);
+    if (node != NULL) {
+        fenwick_increment(
+            &self->ancestor_count_index[u->label], (size_t) u->population + 1, 1);
+    }
+    return node;
+}
+
+static inline void
+msp_unlink_ancestor(msp_t *self, avl_tree_t *ancestors, avl_node_t *node)
+{
+    segment_t *u = (segment_t *) node->item;
+
+    tsk_bug_assert(ancestors == msp_get_segment_population(self, u));
+    avl_unlink_node(ancestors, node);
+    fenwick_increment(
+        &self->ancestor_count_index[u->label], (size_t) u->population + 1, -1);
+}
+
 static inline int MSP_WARN_UNUSED
 msp_insert_individual(msp_t *self, segment_t *u)
 {
@@ -976,7 +1108,7 @@ msp_insert_individual(msp_t *self, segment_t *u)
         goto out;
     }
     avl_init_node(node, u);
-    node = avl_insert_node(msp_get_segment_population(self, u), node);
+    node = msp_link_ancestor(self, node);
     tsk_bug_assert(node != NULL);
 out:
     return ret;
@@ -991,7 +1123,7 @@ msp_remove_individual(msp_t *self, segment_t *u)
     tsk_bug_assert(u != NULL);
     node = avl_search(pop, u);
     tsk_bug_assert(node != NULL);
-    avl_unlink_node(pop, node);
+    msp_unlink_ancestor(self, pop, node);
     msp_free_avl_node(self, node);
 }
 
@@ -1110,7 +1242,7 @@ static void
 msp_verify_segments(msp_t *self, bool verify_breakpoints)
 {
     size_t j, k;
-    size_t label_segments = 0;
+    size_t total_segments;
     size_t total_avl_nodes = 0;
     size_t num_root_segments = 0;
     avl_node_t *node;
@@ -1122,18 +1254,15 @@ msp_verify_segments(msp_t *self, bool verify_breakpoints)
         }
     }
 
+    total_segments = num_root_segments;
     for (k = 0; k < self->num_labels; k++) {
-        label_segments = 0;
-        if (k == 0) {
-            label_segments += num_root_segments;
-        }
         for (j = 0; j < self->num_populations; j++) {
             node = (&self->populations[j].ancestors[k])->head;
             while (node != NULL) {
                 u = (segment_t *) node->item;
                 tsk_bug_assert(u->prev == NULL);
                 while (u != NULL) {
-                    label_segments++;
+                    total_segments++;
                     tsk_bug_assert(u->population == (population_id_t) j);
                     tsk_bug_assert(u->label == (label_id_t) k);
                     tsk_bug_assert(u->left < u->right);
@@ -1152,9 +1281,9 @@ msp_verify_segments(msp_t *self, bool verify_breakpoints)
                 node = node->next;
             }
         }
-        tsk_bug_assert(
-            label_segments == object_heap_get_num_allocated(&self->segment_heap[k]));
     }
+    tsk_bug_assert(
+        total_segments == object_heap_get_num_allocated(&self->segment_heap));
     total_avl_nodes = msp_get_num_ancestors(self) + avl_count(&self->breakpoints)
                       + avl_count(&self->overlap_counts)
                       + avl_count(&self->non_empty_populations);
@@ -1163,6 +1292,13 @@ msp_verify_segments(msp_t *self, bool verify_breakpoints)
     tsk_bug_assert(total_avl_nodes - msp_get_num_ancestors(self)
                        - avl_count(&self->non_empty_populations)
                    == object_heap_get_num_allocated(&self->node_mapping_heap));
+    for (k = 0; k < self->num_labels; k++) {
+        for (j = 0; j < self->num_populations; j++) {
+            tsk_bug_assert(
+                fenwick_get_value(&self->ancestor_count_index[k], j + 1)
+                == (double) avl_count(&self->populations[j].ancestors[k]));
+        }
+    }
     if (self->recomb_mass_index != NULL) {
         msp_verify_segment_index(
             self, self->recomb_mass_index, &self->recomb_map, false);
@@ -1445,15 +1581,17 @@ msp_verify(msp_t *self, int options)
 }
 
 static void
-msp_print_individual(msp_t *self, individual_t *ind, FILE *out)
+msp_print_individual(msp_t *self, tsk_id_t ind, FILE *out)
 {
     size_t j;
+    tsk_id_t parent;
 
-    fprintf(out, "\tID: %d - Time: %f, Parents: [", ind->id, ind->time);
+    fprintf(out, "\tID: %d - Time: %f, Parents: [", ind, self->pedigree->time[ind]);
 
     for (j = 0; j < self->ploidy; j++) {
-        if (ind->parents[j] != NULL) {
-            fprintf(out, " %d", ind->parents[j]->id);
+        parent = self->pedigree->parents[(size_t) ind * self->ploidy + j];
+        if (parent != TSK_NULL) {
+            fprintf(out, " %d", parent);
         } else {
             fprintf(out, " None");
         }
@@ -1464,17 +1602,15 @@ msp_print_individual(msp_t *self, individual_t *ind, FILE *out)
 static void
 msp_print_pedigree_inds(msp_t *self, FILE *out)
 {
-    individual_t *ind;
     size_t i;
 
     tsk_bug_assert(self->pedigree != NULL);
-    tsk_bug_assert(self->pedigree->inds != NULL);
     tsk_bug_assert(self->pedigree->num_inds > 0);
-    fprintf(out, "Pedigree:\n");
+    fprintf(out, "Pedigree: queue = %s\n",
+        self->pedigree->use_buckets ? "generation buckets" : "avl");
 
     for (i = 0; i < self->pedigree->num_inds; i++) {
-        ind = &self->pedigree->inds[i];
-        msp_print_individual(self, ind, out);
+        msp_print_individual(self, (tsk_id_t) i, out);
     }
 }
 
@@ -1543,12 +1679,23 @@ msp_print_state(msp_t *self, FILE *out)
         fprintf(out, "\tdirac coalescent parameters: psi = %f, c = %f\n",
             self->model.params.dirac_coalescent.psi,
             self->model.params.dirac_coalescent.c);
+    } else if (self->model.type == MSP_MODEL_DTWF_HYBRID) {
+        fprintf(out, "\tdtwf hybrid parameters: duration = %f, max_lineage_ratio = %f\n",
+            self->model.params.dtwf_hybrid.duration,
+            self->model.params.dtwf_hybrid.max_lineage_ratio);
     } else if (self->model.type == MSP_MODEL_SWEEP) {
         fprintf(out, "\tsweep @ locus = %f\n", self->model.params.sweep.position);
         self->model.params.sweep.print_state(&self->model.params.sweep, out);
+        fprintf(out, "\tsweep step = %d / %d\n", (int) self->sweep_state.curr_step,
+            (int) self->sweep_state.num_steps);
     }
     fprintf(out, "L = %.14g\n", self->sequence_length);
     fprintf(out, "discrete_genome = %d\n", self->discrete_genome);
+    fprintf(out, "dtwf_generation_skipping = %d\n", self->dtwf_generation_skipping);
+    fprintf(out, "dtwf_num_threads = %d\n", (int) self->dtwf_num_threads);
+    fprintf(out, "pedigree_num_threads = %d\n", (int) self->pedigree_num_threads);
+    fprintf(out, "sweep_trajectory_bank_size = %d\n",
+        (int) self->sweep_trajectory_bank_size);
     fprintf(out, "start_time = %f\n", self->start_time);
     fprintf(out, "recombination map:\n");
     rate_map_print_state(&self->recomb_map, out);
@@ -1572,10 +1719,11 @@ msp_print_state(msp_t *self, FILE *out)
             (int) se->population);
     }
     fprintf(out, "Demographic events:\n");
-    for (de = self->demographic_events_head; de != NULL; de = de->next) {
-        if (de == self->next_demographic_event) {
+    for (j = 0; j < self->num_demographic_events; j++) {
+        if (j == self->next_demographic_event) {
             fprintf(out, "  ***");
         }
+        de = &self->demographic_events[j];
         fprintf(out, "\t");
         de->print_state(self, de, out);
     }
@@ -1681,10 +1829,8 @@ msp_print_state(msp_t *self, FILE *out)
             edge->child);
     }
     fprintf(out, "Memory heaps\n");
-    for (j = 0; j < self->num_labels; j++) {
-        fprintf(out, "segment_heap[%d]:", j);
-        object_heap_print_state(&self->segment_heap[j], out);
-    }
+    fprintf(out, "segment_heap:");
+    object_heap_print_state(&self->segment_heap, out);
     fprintf(out, "avl_node_heap:");
     object_heap_print_state(&self->avl_node_heap, out);
     fprintf(out, "node_mapping_heap:");
@@ -1837,17 +1983,12 @@ out:
     return ret;
 }
 
+/* Stores the migration event node for the specified individual in
+ * dest_pop and its edges, if we are storing the full ARG. */
 static int MSP_WARN_UNUSED
-msp_move_individual(msp_t *self, avl_node_t *node, avl_tree_t *source,
-    population_id_t dest_pop, label_id_t dest_label)
+msp_store_arg_migration(msp_t *self, segment_t *ind, population_id_t dest_pop)
 {
     int ret = 0;
-    segment_t *ind, *x, *y, *new_ind;
-    double recomb_mass, gc_mass;
-
-    ind = (segment_t *) node->item;
-    avl_unlink_node(source, node);
-    msp_free_avl_node(self, node);
 
     if (self->store_full_arg) {
         ret = msp_store_node(
@@ -1860,43 +2001,78 @@ msp_move_individual(msp_t *self, avl_node_t *node, avl_tree_t *source,
             goto out;
         }
     }
+out:
+    return ret;
+}
+
+/* Stores the migration of the specified individual into dest_pop: the
+ * ARG node and edges if we are storing the full ARG, and the migration
+ * records for each segment if we are storing migrations. The population
+ * of each segment is then set to dest_pop. */
+static int MSP_WARN_UNUSED
+msp_migrate_segments(msp_t *self, segment_t *ind, population_id_t dest_pop)
+{
+    int ret = 0;
+    segment_t *x;
+
+    ret = msp_store_arg_migration(self, ind, dest_pop);
+    if (ret != 0) {
+        goto out;
+    }
+    for (x = ind; x != NULL; x = x->next) {
+        if (self->store_migrations) {
+            ret = msp_record_migration(
+                self, x->left, x->right, x->value, x->population, dest_pop);
+            if (ret != 0) {
+                goto out;
+            }
+        }
+        x->population = dest_pop;
+    }
+out:
+    return ret;
+}
+
+static int MSP_WARN_UNUSED
+msp_move_individual(msp_t *self, avl_node_t *node, avl_tree_t *source,
+    population_id_t dest_pop, label_id_t dest_label)
+{
+    int ret = 0;
+    segment_t *ind, *x, *new_ind;
+    double recomb_mass, gc_mass;
+
+    ind = (segment_t *) node->item;
+    msp_unlink_ancestor(self, source, node);
+    msp_free_avl_node(self, node);
+
     if (ind->label == dest_label) {
-        /* Need to set the population and label for each segment. */
         new_ind = ind;
-        for (x = ind; x != NULL; x = x->next) {
-            if (self->store_migrations) {
-                ret = msp_record_migration(
-                    self, x->left, x->right, x->value, x->population, dest_pop);
-                if (ret != 0) {
-                    goto out;
-                }
-            }
-            x->population = dest_pop;
+        ret = msp_migrate_segments(self, ind, dest_pop);
+        if (ret != 0) {
+            goto out;
         }
     } else {
-        /* Because we are changing to a different Fenwick tree we must allocate
-         * new segments each time. */
-        new_ind = NULL;
-        y = NULL;
+        ret = msp_store_arg_migration(self, ind, dest_pop);
+        if (ret != 0) {
+            goto out;
+        }
+        /* Segment ids are shared by all labels, so we only need to move each
+         * segment's mass to the Fenwick tree for the new label. */
+        new_ind = ind;
         for (x = ind; x != NULL; x = x->next) {
-            y = msp_alloc_segment(
-                self, x->left, x->right, x->value, x->population, dest_label, y, NULL);
-            if (new_ind == NULL) {
-                new_ind = y;
-            } else {
-                y->prev->next = y;
-            }
             if (self->recomb_mass_index != NULL) {
                 recomb_mass
                     = fenwick_get_value(&self->recomb_mass_index[x->label], x->id);
+                fenwick_set_value(&self->recomb_mass_index[x->label], x->id, 0);
                 fenwick_set_value(
-                    &self->recomb_mass_index[y->label], y->id, recomb_mass);
+                    &self->recomb_mass_index[dest_label], x->id, recomb_mass);
             }
             if (self->gc_mass_index != NULL) {
                 gc_mass = fenwick_get_value(&self->gc_mass_index[x->label], x->id);
-                fenwick_set_value(&self->gc_mass_index[y->label], y->id, gc_mass);
+                fenwick_set_value(&self->gc_mass_index[x->label], x->id, 0);
+                fenwick_set_value(&self->gc_mass_index[dest_label], x->id, gc_mass);
             }
-            msp_free_segment(self, x);
+            x->label = dest_label;
         }
     }
     ret = msp_insert_individual(self, new_ind);
@@ -2068,13 +2244,13 @@ msp_defrag_segment_chain(msp_t *self, segment_t *z)
 }
 
 static double
-msp_dtwf_generate_breakpoint(msp_t *self, double start)
+msp_dtwf_draw_breakpoint(msp_t *self, gsl_rng *rng, double start)
 {
     double left_bound, mass_to_next_recomb, breakpoint;
 
     left_bound = self->discrete_genome ? start + 1 : start;
     do {
-        mass_to_next_recomb = gsl_ran_exponential(self->rng, 1.0);
+        mass_to_next_recomb = gsl_ran_exponential(rng, 1.0);
     } while (mass_to_next_recomb == 0.0);
 
     breakpoint
@@ -2082,158 +2258,189 @@ msp_dtwf_generate_breakpoint(msp_t *self, double start)
     return self->discrete_genome ? floor(breakpoint) : breakpoint;
 }
 
-static int MSP_WARN_UNUSED
-alloc_individual(individual_t *ind, size_t ploidy)
+static double
+msp_dtwf_generate_breakpoint(msp_t *self, double start)
 {
-    int ret;
-    size_t i;
+    return msp_dtwf_draw_breakpoint(self, self->rng, start);
+}
 
-    ind->sex = -1;
-    ind->time = -1;
-    ind->queued = false;
-    ind->merged = false;
+/* Returns the segment sets for the specified pedigree individual,
+ * allocating them from the pool if the individual does not currently
+ * hold any ancestral material. */
+static avl_tree_t *
+msp_pedigree_alloc_segments(msp_t *self, tsk_id_t ind)
+{
+    pedigree_t *pedigree = self->pedigree;
+    avl_tree_t *segments = pedigree->segments[ind];
+    size_t j;
 
-    // Better to allocate these as a block?
-    ind->parents = malloc(ploidy * sizeof(individual_t *));
-    ind->segments = malloc(ploidy * sizeof(avl_tree_t));
-    if (ind->parents == NULL || ind->segments == NULL) {
-        ret = MSP_ERR_NO_MEMORY;
-        goto out;
-    }
-    for (i = 0; i < ploidy; i++) {
-        avl_init_tree(&ind->segments[i], cmp_segment_queue, NULL);
-        ind->parents[i] = NULL;
+    if (segments == NULL) {
+        if (object_heap_empty(&pedigree->segment_set_heap)) {
+            if (object_heap_expand(&pedigree->segment_set_heap) != 0) {
+                goto out;
+            }
+        }
+        segments = (avl_tree_t *) object_heap_alloc_object(&pedigree->segment_set_heap);
+        for (j = 0; j < self->ploidy; j++) {
+            avl_init_tree(&segments[j], cmp_segment_queue, NULL);
+        }
+        pedigree->segments[ind] = segments;
     }
-    ret = 0;
 out:
-    return ret;
+    return segments;
 }
 
-static int MSP_WARN_UNUSED
-msp_reset_individual(msp_t *self, individual_t *ind)
+/* Returns the segment sets of the specified individual to the pool. */
+static void
+msp_pedigree_free_segments(msp_t *self, tsk_id_t ind)
 {
-    int ret = 0;
-    size_t i;
-
-    ind->queued = false;
-    ind->merged = false;
+    pedigree_t *pedigree = self->pedigree;
+    avl_tree_t *segments = pedigree->segments[ind];
+    size_t j;
 
-    for (i = 0; i < self->ploidy; i++) {
-        /* TODO: We don't yet support terminating pedigree simulations before
-           reaching the pedigree founders, which means all segments are moved
-           back into the population pool before a reset is possible. Might need
-           more here when we support early termination. */
-        tsk_bug_assert(avl_count(&ind->segments[i]) == 0);
+    if (segments != NULL) {
+        for (j = 0; j < self->ploidy; j++) {
+            tsk_bug_assert(avl_count(&segments[j]) == 0);
+        }
+        object_heap_free_object(&pedigree->segment_set_heap, segments);
+        pedigree->segments[ind] = NULL;
     }
-    return ret;
 }
 
 static int MSP_WARN_UNUSED
 msp_reset_pedigree(msp_t *self)
 {
-    int ret;
     size_t i;
-    /* avl_node_t *node; */
-    individual_t *ind;
+    pedigree_t *pedigree = self->pedigree;
 
-    ind = self->pedigree->inds;
-    for (i = 0; i < self->pedigree->num_inds; i++) {
-        ret = msp_reset_individual(self, ind);
-        if (ret != 0) {
-            goto out;
-        }
-        ind++;
+    for (i = 0; i < pedigree->num_inds; i++) {
+        /* TODO: We don't yet support terminating pedigree simulations before
+           reaching the pedigree founders, which means all segments are moved
+           back into the population pool before a reset is possible. Might need
+           more here when we support early termination. */
+        tsk_bug_assert(pedigree->segments[i] == NULL);
+        pedigree->queued[i] = false;
     }
-    /* TODO: We don't yet support terminating pedigree simulations before
-       reaching the pedigree founders, which means no individuals will remain in
-       the pedigree heap when a reset is possibile. Might need more here when we
-       support early termination. */
-    tsk_bug_assert(avl_count(&self->pedigree->ind_heap) == 0);
+    /* Similarly, no individuals will remain in the pedigree queue when a
+     * reset is possible. */
+    tsk_bug_assert(avl_count(&pedigree->ind_heap) == 0);
+    tsk_bug_assert(pedigree->num_queued == 0);
+    tsk_bug_assert(object_heap_get_num_allocated(&pedigree->segment_set_heap) == 0);
+    pedigree->current_bucket = 0;
 
-    self->pedigree->state = MSP_PED_STATE_UNCLIMBED;
-
-    ret = 0;
-out:
-    return ret;
+    pedigree->state = MSP_PED_STATE_UNCLIMBED;
+    return 0;
 }
 
 static int MSP_WARN_UNUSED
 msp_alloc_pedigree(msp_t *self, size_t num_inds, size_t ploidy)
 {
     int ret;
-    size_t i;
-    individual_t *ind;
+    pedigree_t *pedigree;
 
-    self->pedigree = malloc(sizeof(pedigree_t));
+    if (self->pedigree != NULL) {
+        msp_free_pedigree(self);
+    }
+    self->pedigree = calloc(1, sizeof(pedigree_t));
     if (self->pedigree == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
-    self->pedigree->inds = calloc(num_inds, sizeof(individual_t));
-    if (self->pedigree->inds == NULL) {
+    pedigree = self->pedigree;
+    pedigree->parents = malloc(num_inds * ploidy * sizeof(*pedigree->parents));
+    pedigree->time = malloc(num_inds * sizeof(*pedigree->time));
+    pedigree->segments = calloc(num_inds, sizeof(*pedigree->segments));
+    pedigree->queued = calloc(num_inds, sizeof(*pedigree->queued));
+    pedigree->next_queued = malloc(num_inds * sizeof(*pedigree->next_queued));
+    pedigree->samples = malloc(num_inds * sizeof(*pedigree->samples));
+    if (pedigree->parents == NULL || pedigree->time == NULL
+        || pedigree->segments == NULL || pedigree->queued == NULL
+        || pedigree->next_queued == NULL || pedigree->samples == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
-    ind = self->pedigree->inds;
-    for (i = 0; i < num_inds; i++) {
-        ret = alloc_individual(ind, ploidy);
-        if (ret != 0) {
-            goto out;
-        }
-        ind++;
-    }
-    self->pedigree->samples = malloc(num_inds * sizeof(individual_t *));
-    if (self->pedigree->samples == NULL) {
-        ret = MSP_ERR_NO_MEMORY;
+    ret = object_heap_init(&pedigree->segment_set_heap, ploidy * sizeof(avl_tree_t),
+        self->segment_block_size, NULL);
+    if (ret != 0) {
         goto out;
     }
-    avl_init_tree(&self->pedigree->ind_heap, cmp_pedigree_individual, NULL);
+    avl_init_tree(&pedigree->ind_heap, cmp_pedigree_individual, NULL);
 
-    self->pedigree->num_inds = num_inds;
-    self->pedigree->state = MSP_PED_STATE_UNCLIMBED;
+    pedigree->num_inds = num_inds;
+    pedigree->state = MSP_PED_STATE_UNCLIMBED;
 
     ret = 0;
 out:
     return ret;
 }
 
+/* Use the generation-bucketed queue if all times are integers and the
+ * range of generations isn't much larger than the pedigree itself. */
+static int MSP_WARN_UNUSED
+msp_pedigree_alloc_buckets(msp_t *self)
+{
+    int ret = 0;
+    size_t i;
+    pedigree_t *pedigree = self->pedigree;
+    const double *times = pedigree->time;
+    double min_time = DBL_MAX;
+    double max_time = -DBL_MAX;
+    bool integer_times = true;
+
+    for (i = 0; i < pedigree->num_inds; i++) {
+        integer_times = integer_times && floor(times[i]) == times[i];
+        min_time = GSL_MIN(min_time, times[i]);
+        max_time = GSL_MAX(max_time, times[i]);
+    }
+    pedigree->use_buckets = false;
+    if (integer_times && max_time - min_time < (double) pedigree->num_inds) {
+        pedigree->use_buckets = true;
+        pedigree->min_time = min_time;
+        pedigree->num_buckets = 1 + (size_t)(max_time - min_time);
+        pedigree->current_bucket = 0;
+        pedigree->num_queued = 0;
+        pedigree->bucket_head = malloc(pedigree->num_buckets * sizeof(tsk_id_t));
+        pedigree->bucket_tail = malloc(pedigree->num_buckets * sizeof(tsk_id_t));
+        if (pedigree->bucket_head == NULL || pedigree->bucket_tail == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        for (i = 0; i < pedigree->num_buckets; i++) {
+            pedigree->bucket_head[i] = TSK_NULL;
+            pedigree->bucket_tail[i] = TSK_NULL;
+        }
+    }
+out:
+    return ret;
+}
+
 /* TODO merge this method into where it's called - we don't really need these
  * arrays any more. */
 static int MSP_WARN_UNUSED
-msp_set_pedigree(msp_t *self, tsk_id_t *parents, double *times, tsk_flags_t *is_sample)
+msp_set_pedigree(msp_t *self, const tsk_id_t *parents, const double *times,
+    const tsk_flags_t *is_sample)
 {
-    size_t i, j;
-    tsk_id_t parent_ix;
+    size_t i;
     tsk_flags_t sample_flag;
     size_t sample_num;
-    individual_t *ind = NULL;
+    pedigree_t *pedigree = self->pedigree;
 
-    tsk_bug_assert(self->pedigree != NULL);
+    tsk_bug_assert(pedigree != NULL);
 
-    ind = self->pedigree->inds;
+    memcpy(pedigree->parents, parents,
+        pedigree->num_inds * self->ploidy * sizeof(*parents));
+    memcpy(pedigree->time, times, pedigree->num_inds * sizeof(*times));
     sample_num = 0;
-    for (i = 0; i < self->pedigree->num_inds; i++) {
-        ind = &self->pedigree->inds[i];
-        ind->id = (tsk_id_t) i;
-        ind->time = times[i];
-
-        // Link individuals to parents
-        for (j = 0; j < self->ploidy; j++) {
-            parent_ix = parents[i * self->ploidy + j];
-            if (parent_ix != TSK_NULL) {
-                ind->parents[j] = &self->pedigree->inds[parent_ix];
-            }
-        }
-        // Set samples
+    for (i = 0; i < pedigree->num_inds; i++) {
         sample_flag = is_sample[i];
         if (sample_flag != 0) {
             tsk_bug_assert(sample_flag == 1);
-            self->pedigree->samples[sample_num] = ind;
+            pedigree->samples[sample_num] = (tsk_id_t) i;
             sample_num++;
         }
     }
-    self->pedigree->num_samples = sample_num;
-    return 0;
+    pedigree->num_samples = sample_num;
+    return msp_pedigree_alloc_buckets(self);
 }
 
 static void
@@ -2241,33 +2448,35 @@ msp_check_samples(msp_t *self)
 {
     // Samples should have a single segment for each copy of their genome
     size_t i, j;
-    individual_t *sample;
+    avl_tree_t *segments;
 
     for (i = 0; i < self->pedigree->num_samples; i++) {
-        sample = self->pedigree->samples[i];
+        segments = self->pedigree->segments[self->pedigree->samples[i]];
+        tsk_bug_assert(segments != NULL);
         for (j = 0; j < self->ploidy; j++) {
-            tsk_bug_assert(avl_count(&sample->segments[j]) == 1);
+            tsk_bug_assert(avl_count(&segments[j]) == 1);
         }
     }
 }
 
 static int MSP_WARN_UNUSED
 msp_pedigree_add_individual_segment(
-    msp_t *self, individual_t *ind, segment_t *segment, size_t parent_ix)
+    msp_t *self, tsk_id_t ind, segment_t *segment, size_t parent_ix)
 {
     int ret;
     avl_node_t *node;
+    avl_tree_t *segments;
 
-    tsk_bug_assert(ind->segments != NULL);
     tsk_bug_assert(parent_ix < self->ploidy);
 
+    segments = msp_pedigree_alloc_segments(self, ind);
     node = msp_alloc_avl_node(self);
-    if (node == NULL) {
+    if (segments == NULL || node == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
     avl_init_node(node, segment);
-    node = avl_insert_node(&ind->segments[parent_ix], node);
+    node = avl_insert_node(&segments[parent_ix], node);
     tsk_bug_assert(node != NULL);
 
     ret = 0;
@@ -2281,7 +2490,7 @@ msp_pedigree_load_pop(msp_t *self)
     int ret;
     size_t i, sample_ix, parent_ix, ploidy;
     population_t *pop;
-    individual_t *sample_ind;
+    tsk_id_t sample_ind;
     segment_t *segment;
     avl_node_t *node;
     label_id_t label = 0;
@@ -2306,7 +2515,7 @@ msp_pedigree_load_pop(msp_t *self)
         sample_ind = self->pedigree->samples[sample_ix];
         parent_ix = i % ploidy;
         segment = node->item;
-        avl_unlink_node(&pop->ancestors[label], node);
+        msp_unlink_ancestor(self, &pop->ancestors[label], node);
         msp_free_avl_node(self, node);
 
         ret = msp_pedigree_add_individual_segment(self, sample_ind, segment, parent_ix);
@@ -2321,23 +2530,52 @@ out:
     return ret;
 }
 
+static size_t
+msp_pedigree_get_num_queued(msp_t *self)
+{
+    if (self->pedigree->use_buckets) {
+        return self->pedigree->num_queued;
+    }
+    return avl_count(&self->pedigree->ind_heap);
+}
+
 static int MSP_WARN_UNUSED
-msp_pedigree_push_ind(msp_t *self, individual_t *ind)
+msp_pedigree_push_ind(msp_t *self, tsk_id_t ind)
 {
     int ret;
+    size_t bucket;
     avl_node_t *node;
+    pedigree_t *pedigree = self->pedigree;
 
-    tsk_bug_assert(ind->queued == false);
+    tsk_bug_assert(pedigree->queued[ind] == false);
+
+    if (pedigree->use_buckets) {
+        bucket = (size_t)(pedigree->time[ind] - pedigree->min_time);
+        tsk_bug_assert(bucket < pedigree->num_buckets);
+        tsk_bug_assert(bucket >= pedigree->current_bucket);
+        pedigree->next_queued[ind] = TSK_NULL;
+        if (pedigree->bucket_head[bucket] == TSK_NULL) {
+            pedigree->bucket_head[bucket] = ind;
+        } else {
+            pedigree->next_queued[pedigree->bucket_tail[bucket]] = ind;
+        }
+        pedigree->bucket_tail[bucket] = ind;
+        pedigree->num_queued++;
+        pedigree->queued[ind] = true;
+        ret = 0;
+        goto out;
+    }
 
     node = msp_alloc_avl_node(self);
     if (node == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
-    avl_init_node(node, ind);
-    node = avl_insert_node(&self->pedigree->ind_heap, node);
+    /* See cmp_pedigree_individual */
+    avl_init_node(node, &pedigree->time[ind]);
+    node = avl_insert_node(&pedigree->ind_heap, node);
     tsk_bug_assert(node != NULL);
-    ind->queued = true;
+    pedigree->queued[ind] = true;
 
     ret = 0;
 out:
@@ -2349,14 +2587,12 @@ msp_pedigree_build_ind_queue(msp_t *self)
 {
     int ret;
     size_t i;
-    individual_t *ind;
 
     tsk_bug_assert(self->pedigree->num_samples > 0);
     tsk_bug_assert(self->pedigree->samples != NULL);
 
     for (i = 0; i < self->pedigree->num_samples; i++) {
-        ind = self->pedigree->samples[i];
-        ret = msp_pedigree_push_ind(self, ind);
+        ret = msp_pedigree_push_ind(self, self->pedigree->samples[i]);
         if (ret != 0) {
             goto out;
         }
@@ -2367,39 +2603,239 @@ out:
 }
 
 static int MSP_WARN_UNUSED
-msp_pedigree_pop_ind(msp_t *self, individual_t **ind)
+msp_pedigree_pop_ind(msp_t *self, tsk_id_t *ind)
 {
     int ret;
     avl_node_t *node;
+    pedigree_t *pedigree = self->pedigree;
 
-    tsk_bug_assert(avl_count(&self->pedigree->ind_heap) > 0);
+    tsk_bug_assert(msp_pedigree_get_num_queued(self) > 0);
 
-    node = self->pedigree->ind_heap.head;
-    tsk_bug_assert(node != NULL);
-    *ind = node->item;
-    tsk_bug_assert((*ind)->queued);
-    (*ind)->queued = false;
-    msp_free_avl_node(self, node);
-    avl_unlink_node(&self->pedigree->ind_heap, node);
-
-    ret = 0;
+    if (pedigree->use_buckets) {
+        while (pedigree->bucket_head[pedigree->current_bucket] == TSK_NULL) {
+            pedigree->current_bucket++;
+            tsk_bug_assert(pedigree->current_bucket < pedigree->num_buckets);
+        }
+        *ind = pedigree->bucket_head[pedigree->current_bucket];
+        pedigree->bucket_head[pedigree->current_bucket] = pedigree->next_queued[*ind];
+        pedigree->num_queued--;
+    } else {
+        node = pedigree->ind_heap.head;
+        tsk_bug_assert(node != NULL);
+        *ind = (tsk_id_t)((const double *) node->item - pedigree->time);
+        avl_unlink_node(&pedigree->ind_heap, node);
+        msp_free_avl_node(self, node);
+    }
+    tsk_bug_assert(pedigree->queued[*ind]);
+    pedigree->queued[*ind] = false;
+
+    ret = 0;
+    return ret;
+}
+
+/* Returns the time of the individual that will be popped next. */
+static double
+msp_pedigree_get_next_time(msp_t *self)
+{
+    pedigree_t *pedigree = self->pedigree;
+    tsk_id_t ind;
+
+    tsk_bug_assert(msp_pedigree_get_num_queued(self) > 0);
+
+    if (pedigree->use_buckets) {
+        while (pedigree->bucket_head[pedigree->current_bucket] == TSK_NULL) {
+            pedigree->current_bucket++;
+            tsk_bug_assert(pedigree->current_bucket < pedigree->num_buckets);
+        }
+        ind = pedigree->bucket_head[pedigree->current_bucket];
+    } else {
+        tsk_bug_assert(pedigree->ind_heap.head != NULL);
+        ind = (tsk_id_t)((const double *) pedigree->ind_heap.head->item
+                         - pedigree->time);
+    }
+    return pedigree->time[ind];
+}
+
+/* A transmission of a lineage to its parents that has been drawn in
+ * advance: the parental chromosome the lineage starts on, followed by
+ * the breakpoints in increasing order. */
+typedef struct {
+    int first_parent;
+    double *breakpoints;
+    size_t num_breakpoints;
+    size_t max_breakpoints;
+} recomb_plan_t;
+
+/* Segments taken from the main heap in advance, so that recombinations
+ * can be carried out concurrently for lineages that share no segments.
+ * The recombination mass index is shared, and so the segments whose mass
+ * changes are recorded and updated later by msp_commit_recombinations.
+ * If heap is not NULL, segments are instead allocated from it, and the
+ * caller must copy them into the main heap and set their masses. */
+typedef struct {
+    object_heap_t *heap;
+    segment_t **segments;
+    size_t num_segments;
+    size_t max_segments;
+    segment_t **changed;
+    size_t num_changed;
+    size_t max_changed;
+    size_t num_re_events;
+} recomb_buffer_t;
+
+static void
+recomb_buffer_free(recomb_buffer_t *self)
+{
+    msp_safe_free(self->segments);
+    msp_safe_free(self->changed);
+}
+
+/* Reserves enough segments in the buffer to carry out recombinations
+ * with up to the specified total number of breakpoints. Each breakpoint
+ * creates at most one segment and changes the mass of at most two. */
+static int MSP_WARN_UNUSED
+msp_reserve_recombinations(
+    msp_t *self, recomb_buffer_t *buffer, size_t num_breakpoints, label_id_t label)
+{
+    int ret = 0;
+    segment_t **tmp;
+    segment_t *seg;
+
+    if (num_breakpoints > buffer->max_segments) {
+        tmp = realloc(buffer->segments, num_breakpoints * sizeof(*buffer->segments));
+        if (tmp == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        buffer->segments = tmp;
+        buffer->max_segments = num_breakpoints;
+    }
+    if (2 * num_breakpoints > buffer->max_changed) {
+        tmp = realloc(buffer->changed, 2 * num_breakpoints * sizeof(*buffer->changed));
+        if (tmp == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        buffer->changed = tmp;
+        buffer->max_changed = 2 * num_breakpoints;
+    }
+    while (buffer->num_segments < num_breakpoints) {
+        seg = msp_alloc_segment(
+            self, 0, self->sequence_length, TSK_NULL, 0, label, NULL, NULL);
+        if (seg == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        buffer->segments[buffer->num_segments] = seg;
+        buffer->num_segments++;
+    }
+out:
     return ret;
 }
 
+/* Returns the unused segments in the buffer to the main heap, in the
+ * reverse order of their allocation, and updates the recombination mass
+ * index and event count for the recombinations carried out. */
+static void
+msp_commit_recombinations(msp_t *self, recomb_buffer_t *buffer)
+{
+    size_t j;
+
+    while (buffer->num_segments > 0) {
+        buffer->num_segments--;
+        msp_free_segment(self, buffer->segments[buffer->num_segments]);
+    }
+    for (j = 0; j < buffer->num_changed; j++) {
+        msp_set_segment_mass(self, buffer->changed[j]);
+    }
+    buffer->num_changed = 0;
+    self->num_re_events += buffer->num_re_events;
+    buffer->num_re_events = 0;
+}
+
+static segment_t *MSP_WARN_UNUSED
+msp_recomb_alloc_segment(msp_t *self, recomb_buffer_t *buffer, double left,
+    double right, tsk_id_t value, population_id_t population, label_id_t label,
+    segment_t *prev, segment_t *next)
+{
+    segment_t *seg;
+
+    if (buffer == NULL) {
+        return msp_alloc_segment(
+            self, left, right, value, population, label, prev, next);
+    }
+    if (buffer->heap != NULL) {
+        if (object_heap_empty(buffer->heap) && object_heap_expand(buffer->heap) != 0) {
+            return NULL;
+        }
+        seg = (segment_t *) object_heap_alloc_object(buffer->heap);
+    } else {
+        tsk_bug_assert(buffer->num_segments > 0);
+        buffer->num_segments--;
+        seg = buffer->segments[buffer->num_segments];
+    }
+    tsk_bug_assert(left < right);
+    seg->prev = prev;
+    seg->next = next;
+    seg->left = left;
+    seg->right = right;
+    seg->value = value;
+    seg->population = population;
+    seg->label = label;
+    return seg;
+}
+
+static void
+msp_recomb_set_segment_mass(msp_t *self, recomb_buffer_t *buffer, segment_t *seg)
+{
+    if (buffer == NULL) {
+        msp_set_segment_mass(self, seg);
+    } else if (buffer->heap == NULL) {
+        tsk_bug_assert(buffer->num_changed < buffer->max_changed);
+        buffer->changed[buffer->num_changed] = seg;
+        buffer->num_changed++;
+    }
+}
+
+static double
+msp_dtwf_next_breakpoint(msp_t *self, const recomb_plan_t *plan, size_t *index, double k)
+{
+    if (plan == NULL) {
+        return msp_dtwf_generate_breakpoint(self, k);
+    }
+    if (*index < plan->num_breakpoints) {
+        (*index)++;
+        return plan->breakpoints[*index - 1];
+    }
+    return DBL_MAX;
+}
+
+/* Recombines the lineage starting at x back-and-forth between the two
+ * parental chromosomes u and v, starting with the breakpoint k. If plan
+ * is not NULL the starting chromosome and all breakpoints, including the
+ * first, are taken from it rather than drawn from self->rng. If buffer is
+ * not NULL, new segments are taken from it and the shared simulation
+ * state is left untouched until msp_commit_recombinations is called. */
 static int MSP_WARN_UNUSED
-msp_dtwf_recombine(msp_t *self, segment_t *x, segment_t **u, segment_t **v)
+msp_dtwf_recombine(msp_t *self, segment_t *x, double k, const recomb_plan_t *plan,
+    recomb_buffer_t *buffer, segment_t **u, segment_t **v)
 {
     int ret = 0;
     int ix;
-    double k;
+    size_t next_breakpoint = 0;
+    size_t num_re_events = 0;
     segment_t *y, *z, *tail;
     segment_t s1, s2;
     segment_t *seg_tails[] = { &s1, &s2 };
 
-    k = msp_dtwf_generate_breakpoint(self, x->left);
     s1.next = NULL;
     s2.next = NULL;
-    ix = (int) gsl_rng_uniform_int(self->rng, 2);
+    if (plan == NULL) {
+        ix = (int) gsl_rng_uniform_int(self->rng, 2);
+    } else {
+        ix = plan->first_parent;
+        k = msp_dtwf_next_breakpoint(self, plan, &next_breakpoint, k);
+    }
     seg_tails[ix]->next = x;
     tsk_bug_assert(x->prev == NULL);
 
@@ -2410,7 +2846,7 @@ msp_dtwf_recombine(msp_t *self, segment_t *x, segment_t **u, segment_t **v)
         if (x->right > k) {
             // Make new segment
             tsk_bug_assert(x->left < k);
-            self->num_re_events++;
+            num_re_events++;
             ix = (ix + 1) % 2;
 
             if (seg_tails[ix] == &s1 || seg_tails[ix] == &s2) {
@@ -2418,13 +2854,13 @@ msp_dtwf_recombine(msp_t *self, segment_t *x, segment_t **u, segment_t **v)
             } else {
                 tail = seg_tails[ix];
             }
-            z = msp_alloc_segment(
-                self, k, x->right, x->value, x->population, x->label, tail, x->next);
+            z = msp_recomb_alloc_segment(self, buffer, k, x->right, x->value,
+                x->population, x->label, tail, x->next);
             if (z == NULL) {
                 ret = MSP_ERR_NO_MEMORY;
                 goto out;
             }
-            msp_set_segment_mass(self, z);
+            msp_recomb_set_segment_mass(self, buffer, z);
             tsk_bug_assert(z->left < z->right);
             if (x->next != NULL) {
                 x->next->prev = z;
@@ -2433,18 +2869,18 @@ msp_dtwf_recombine(msp_t *self, segment_t *x, segment_t **u, segment_t **v)
             seg_tails[ix] = z;
             x->next = NULL;
             x->right = k;
-            msp_set_segment_mass(self, x);
+            msp_recomb_set_segment_mass(self, buffer, x);
             tsk_bug_assert(x->left < x->right);
             x = z;
-            k = msp_dtwf_generate_breakpoint(self, k);
+            k = msp_dtwf_next_breakpoint(self, plan, &next_breakpoint, k);
         } else if (x->right <= k && y != NULL && y->left >= k) {
             // Recombine in gap between segment and the next
             x->next = NULL;
             y->prev = NULL;
             while (y->left >= k) {
-                self->num_re_events++;
+                num_re_events++;
                 ix = (ix + 1) % 2;
-                k = msp_dtwf_generate_breakpoint(self, k);
+                k = msp_dtwf_next_breakpoint(self, plan, &next_breakpoint, k);
             }
             seg_tails[ix]->next = y;
             if (seg_tails[ix] == &s1 || seg_tails[ix] == &s2) {
@@ -2453,7 +2889,7 @@ msp_dtwf_recombine(msp_t *self, segment_t *x, segment_t **u, segment_t **v)
                 tail = seg_tails[ix];
             }
             y->prev = tail;
-            msp_set_segment_mass(self, y);
+            msp_recomb_set_segment_mass(self, buffer, y);
             seg_tails[ix] = y;
             x = y;
         } else {
@@ -2465,6 +2901,11 @@ msp_dtwf_recombine(msp_t *self, segment_t *x, segment_t **u, segment_t **v)
     *u = s1.next;
     *v = s2.next;
 out:
+    if (buffer == NULL) {
+        self->num_re_events += num_re_events;
+    } else {
+        buffer->num_re_events += num_re_events;
+    }
     return ret;
 }
 
@@ -2505,51 +2946,46 @@ msp_choose_uniform_breakpoint(msp_t *self, int label, rate_map_t *rate_map,
 
     int ret = 0;
     double breakpoint, breakpoint_mass, random_mass, y_cumulative_mass, y_right_mass,
-        left_bound;
+        lower, upper;
     segment_t *x, *y;
     fenwick_t *tree = &mass_index_array[label];
-    int num_breakpoint_resamplings = 0;
-    do {
-        /* Choose a recombination mass uniformly from the total and find the
-         * segment y that is associated with this *cumulative* value. */
-        random_mass = gsl_ran_flat(self->rng, 0, fenwick_get_total(tree));
-        y = msp_get_segment(self, fenwick_find(tree, random_mass), label);
-        tsk_bug_assert(fenwick_get_value(tree, y->id) > 0);
-        x = y->prev;
-        y_cumulative_mass = fenwick_get_cumulative_sum(tree, y->id);
-        y_right_mass = rate_map_position_to_mass(rate_map, y->right);
-        breakpoint_mass = y_right_mass - (y_cumulative_mass - random_mass);
-        breakpoint = rate_map_mass_to_position(rate_map, breakpoint_mass);
-        if (self->discrete_genome) {
-            breakpoint = floor(breakpoint);
-        }
-
-        /* Deal with various quirks that can happen with numerical
-         * imprecision from going back and forth between rate mass
-         * and physical positions. We try to make this robust by making
-         * resampling the default case and only break out of the loop
-         * when the conditions we need are explicitly met. */
-        if (x == NULL) {
-            left_bound = left_at_zero ? 0 : y->left;
-            /* if there is no previous segment we cannot have breakpoint
-             * <= y->left (or zero, if the left limit is zero) */
-            if (left_bound < breakpoint && breakpoint < y->right) {
-                break;
-            }
-        } else {
-            tsk_bug_assert(x->right <= y->left);
-            if (x->right <= breakpoint && breakpoint < y->right) {
-                break;
-            }
-        }
-        num_breakpoint_resamplings++;
-        /* Arbitrary limit - if we hit this many resamplings then there's
-         * definitely something wrong. */
-        if (num_breakpoint_resamplings == 10) {
-            ret = MSP_ERR_BREAKPOINT_RESAMPLE_OVERFLOW;
-            goto out;
-        }
-    } while (true);
+
+    /* Choose a recombination mass uniformly from the total and find the
+     * segment y that is associated with this *cumulative* value. */
+    random_mass = gsl_ran_flat(self->rng, 0, fenwick_get_total(tree));
+    y = msp_get_segment(self, fenwick_find(tree, random_mass), label);
+    tsk_bug_assert(fenwick_get_value(tree, y->id) > 0);
+    x = y->prev;
+    y_cumulative_mass = fenwick_get_cumulative_sum(tree, y->id);
+    y_right_mass = rate_map_position_to_mass(rate_map, y->right);
+    breakpoint_mass = y_right_mass - (y_cumulative_mass - random_mass);
+    breakpoint = rate_map_mass_to_position(rate_map, breakpoint_mass);
+
+    /* The breakpoint must be in [x->right, y->right), or in
+     * (left_bound, y->right) if y is the first segment, where the left
+     * bound is zero if the left limit is zero. Going back and forth
+     * between rate mass and physical positions can take it just outside
+     * this interval through numerical imprecision, so we clamp it to the
+     * nearest valid position. The interval can only be empty in
+     * pathological cases where there is no representable position in it. */
+    if (x == NULL) {
+        lower = left_at_zero ? 0 : y->left;
+        lower = self->discrete_genome ? lower + 1 : nextafter(lower, DBL_MAX);
+    } else {
+        tsk_bug_assert(x->right <= y->left);
+        lower = x->right;
+    }
+    if (self->discrete_genome) {
+        breakpoint = floor(breakpoint);
+        upper = y->right - 1;
+    } else {
+        upper = nextafter(y->right, -DBL_MAX);
+    }
+    if (!(lower <= upper)) {
+        ret = MSP_ERR_BREAKPOINT_RESAMPLE_OVERFLOW;
+        goto out;
+    }
+    breakpoint = GSL_MIN(GSL_MAX(breakpoint, lower), upper);
 
     *ret_breakpoint = breakpoint;
     *ret_seg = y;
@@ -2631,6 +3067,22 @@ out:
     return ret;
 }
 
+/* Returns a gene conversion tract length, drawn from the exponential
+ * distribution by inversion. As u is in (0, 1) the length is always
+ * positive unless the mean is zero. In a discrete genome we want the
+ * tract length to be at least 1, and use floor(tl) + 1, which equals
+ * ceil(tl) with probability one. */
+static double
+msp_generate_gc_tract_length(msp_t *self)
+{
+    double tl = -self->gc_tract_length * log(gsl_rng_uniform_pos(self->rng));
+
+    if (self->discrete_genome) {
+        tl = floor(tl) + 1;
+    }
+    return tl;
+}
+
 static int MSP_WARN_UNUSED
 msp_gene_conversion_event(msp_t *self, label_id_t label)
 {
@@ -2638,7 +3090,6 @@ msp_gene_conversion_event(msp_t *self, label_id_t label)
     segment_t *x, *y, *alpha, *head, *tail, *z, *new_individual_head;
     double left_breakpoint, right_breakpoint, tl;
     bool insert_alpha;
-    int num_resamplings = 0;
 
     tsk_bug_assert(self->gc_mass_index != NULL);
     self->num_gc_events++;
@@ -2650,19 +3101,11 @@ msp_gene_conversion_event(msp_t *self, label_id_t label)
 
     x = y->prev;
 
-    /* generate tract length */
-    do {
-        tl = gsl_ran_exponential(self->rng, self->gc_tract_length);
-        if (self->discrete_genome) {
-            /* We want the tract length to be at least 1 */
-            tl = ceil(tl);
-        }
-        if (num_resamplings == 10) {
-            ret = MSP_ERR_TRACTLEN_RESAMPLE_OVERFLOW;
-            goto out;
-        }
-        num_resamplings++;
-    } while (tl <= 0);
+    tl = msp_generate_gc_tract_length(self);
+    if (tl <= 0) {
+        ret = MSP_ERR_TRACTLEN_RESAMPLE_OVERFLOW;
+        goto out;
+    }
     right_breakpoint = left_breakpoint + tl;
 
     if (y->left >= right_breakpoint) {
@@ -3058,125 +3501,495 @@ msp_priority_queue_pop(msp_t *self, avl_tree_t *Q)
     return seg;
 }
 
-/* Merge the specified set of ancestors into a single ancestor. This is a
- * generalisation of the msp_common_ancestor_event method where we allow
- * any number of ancestors to merge. The AVL tree is a priority queue in
- * sorted by left coordinate.
- */
+/* The change to the overlap counts over [left, right) made by merging the
+ * specified number of lineages. If these were the only lineages left over
+ * the interval it has reached its MRCA, and the count drops to zero. The
+ * counts are split at left and r_max first. */
+typedef struct {
+    double left;
+    double right;
+    double r_max;
+    uint32_t num_lineages;
+    bool mrca;
+} overlap_update_t;
+
+/* An edge to the node of a buffered merge, whose ID is not known until the
+ * merge is committed. */
+typedef struct {
+    double left;
+    double right;
+    tsk_id_t child;
+} pending_edge_t;
+
+/* Records a merge without modifying any state that it shares with other
+ * merges, so that merges of disjoint sets of lineages can be carried out
+ * concurrently and committed later. New segments and the AVL nodes of the
+ * merge queue come from local heaps; segments from the local heap are
+ * zeroed on allocation of their block and so have id 0, which no segment
+ * from the main heap has. The overlap counts are only read, and the node
+ * for the merge is denoted by TSK_NULL in the segments and edges until the
+ * merge is committed. */
+typedef struct {
+    object_heap_t segment_heap;
+    object_heap_t avl_node_heap;
+    segment_t **merging;
+    size_t max_merging;
+    pending_edge_t *edges;
+    size_t num_edges;
+    size_t max_edges;
+    overlap_update_t *updates;
+    size_t num_updates;
+    size_t max_updates;
+    size_t first_update;
+    segment_t **freed_segments;
+    size_t num_freed_segments;
+    size_t max_freed_segments;
+    avl_node_t **freed_nodes;
+    size_t num_freed_nodes;
+    size_t max_freed_nodes;
+    /* Summary of the last merge */
+    bool coalescence;
+    double l_min;
+    double r_max;
+} merge_buffer_t;
+
+/* Makes room for at least one more element in the specified array,
+ * doubling its capacity as required. */
 static int MSP_WARN_UNUSED
-msp_merge_ancestors(msp_t *self, avl_tree_t *Q, population_id_t population_id,
-    label_id_t label, segment_t **merged_segment, tsk_id_t individual)
+msp_expand_array(void **array, size_t *max_size, size_t size, size_t element_size)
 {
-    int ret = MSP_ERR_GENERIC;
-    bool coalescence = false;
-    bool defrag_required = false;
-    bool set_merged = false;
-    tsk_id_t v;
-    uint32_t j, h;
-    double l, r, r_max, next_l, l_min;
-    avl_node_t *node;
-    node_mapping_t *nm, search;
-    segment_t *x, *z, *alpha;
-    segment_t **H = NULL;
+    int ret = 0;
+    size_t new_size;
+    void *tmp;
 
-    H = malloc(avl_count(Q) * sizeof(segment_t *));
-    if (H == NULL) {
-        ret = MSP_ERR_NO_MEMORY;
+    if (size == *max_size) {
+        new_size = GSL_MAX(2 * *max_size, 64);
+        tmp = realloc(*array, new_size * element_size);
+        if (tmp == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        *array = tmp;
+        *max_size = new_size;
+    }
+out:
+    return ret;
+}
+
+static int MSP_WARN_UNUSED
+merge_buffer_init(merge_buffer_t *self, size_t block_size)
+{
+    int ret = 0;
+
+    memset(self, 0, sizeof(*self));
+    ret = object_heap_init(&self->segment_heap, sizeof(segment_t), block_size, NULL);
+    if (ret != 0) {
         goto out;
     }
-    r_max = 0; /* keep compiler happy */
-    l_min = 0;
-    z = NULL;
-    while (avl_count(Q) > 0) {
-        h = 0;
-        node = Q->head;
-        l = ((segment_t *) node->item)->left;
-        r_max = self->sequence_length;
-        while (node != NULL && ((segment_t *) node->item)->left == l) {
-            H[h] = (segment_t *) node->item;
-            r_max = GSL_MIN(r_max, H[h]->right);
-            h++;
-            msp_free_avl_node(self, node);
-            avl_unlink_node(Q, node);
-            node = node->next;
+    ret = object_heap_init(&self->avl_node_heap, sizeof(avl_node_t), block_size, NULL);
+    if (ret != 0) {
+        goto out;
+    }
+out:
+    return ret;
+}
+
+static void
+merge_buffer_free(merge_buffer_t *self)
+{
+    object_heap_free(&self->segment_heap);
+    object_heap_free(&self->avl_node_heap);
+    msp_safe_free(self->merging);
+    msp_safe_free(self->edges);
+    msp_safe_free(self->updates);
+    msp_safe_free(self->freed_segments);
+    msp_safe_free(self->freed_nodes);
+}
+
+static void
+merge_buffer_clear(merge_buffer_t *self)
+{
+    self->num_edges = 0;
+    self->num_updates = 0;
+    self->num_freed_segments = 0;
+    self->num_freed_nodes = 0;
+}
+
+/* The functions below carry out a step of msp_merge_segments on the
+ * simulation state if buffer is NULL, and record it in the buffer
+ * otherwise. */
+
+static segment_t *MSP_WARN_UNUSED
+msp_merge_alloc_segment(msp_t *self, merge_buffer_t *buffer, double left,
+    double right, tsk_id_t value, population_id_t population, label_id_t label)
+{
+    segment_t *seg;
+
+    if (buffer == NULL) {
+        return msp_alloc_segment(
+            self, left, right, value, population, label, NULL, NULL);
+    }
+    if (object_heap_empty(&buffer->segment_heap)
+        && object_heap_expand(&buffer->segment_heap) != 0) {
+        return NULL;
+    }
+    seg = (segment_t *) object_heap_alloc_object(&buffer->segment_heap);
+    tsk_bug_assert(left < right);
+    seg->prev = NULL;
+    seg->next = NULL;
+    seg->left = left;
+    seg->right = right;
+    seg->value = value;
+    seg->population = population;
+    seg->label = label;
+    return seg;
+}
+
+static int MSP_WARN_UNUSED
+msp_merge_free_segment(msp_t *self, merge_buffer_t *buffer, segment_t *seg)
+{
+    int ret = 0;
+
+    if (buffer == NULL) {
+        msp_free_segment(self, seg);
+    } else if (seg->id == 0) {
+        object_heap_free_object(&buffer->segment_heap, seg);
+    } else {
+        ret = msp_expand_array((void **) &buffer->freed_segments,
+            &buffer->max_freed_segments, buffer->num_freed_segments,
+            sizeof(*buffer->freed_segments));
+        if (ret != 0) {
+            goto out;
         }
-        next_l = 0;
-        if (node != NULL) {
-            next_l = ((segment_t *) node->item)->left;
-            r_max = GSL_MIN(r_max, next_l);
+        buffer->freed_segments[buffer->num_freed_segments] = seg;
+        buffer->num_freed_segments++;
+    }
+out:
+    return ret;
+}
+
+static int MSP_WARN_UNUSED
+msp_merge_free_avl_node(msp_t *self, merge_buffer_t *buffer, avl_node_t *node)
+{
+    int ret = 0;
+
+    if (buffer == NULL) {
+        msp_free_avl_node(self, node);
+    } else {
+        ret = msp_expand_array((void **) &buffer->freed_nodes, &buffer->max_freed_nodes,
+            buffer->num_freed_nodes, sizeof(*buffer->freed_nodes));
+        if (ret != 0) {
+            goto out;
         }
-        alpha = NULL;
-        if (h == 1) {
-            x = H[0];
-            if (node != NULL && next_l < x->right) {
-                alpha = msp_alloc_segment(self, x->left, next_l, x->value, x->population,
-                    x->label, NULL, NULL);
-                if (alpha == NULL) {
-                    ret = MSP_ERR_NO_MEMORY;
-                    goto out;
-                }
-                x->left = next_l;
-            } else {
-                alpha = x;
-                x = x->next;
-                alpha->next = NULL;
-            }
-            if (x != NULL) {
-                ret = msp_priority_queue_insert(self, Q, x);
-                if (ret != 0) {
-                    goto out;
-                }
-            }
-        } else {
-            if (!coalescence) {
-                coalescence = true;
-                l_min = l;
-                ret = msp_store_node(self, 0, self->time, population_id, individual);
-                if (ret != 0) {
-                    goto out;
-                }
-            }
-            v = (tsk_id_t) msp_get_num_nodes(self) - 1;
-            /* Insert overlap counts for bounds, if necessary */
-            search.position = l;
-            node = avl_search(&self->overlap_counts, &search);
-            if (node == NULL) {
-                ret = msp_copy_overlap_count(self, l);
-                if (ret < 0) {
-                    goto out;
-                }
+        buffer->freed_nodes[buffer->num_freed_nodes] = node;
+        buffer->num_freed_nodes++;
+    }
+out:
+    return ret;
+}
+
+static int MSP_WARN_UNUSED
+msp_merge_queue_insert(msp_t *self, merge_buffer_t *buffer, avl_tree_t *Q, segment_t *u)
+{
+    int ret = 0;
+    avl_node_t *node;
+
+    if (buffer == NULL) {
+        return msp_priority_queue_insert(self, Q, u);
+    }
+    if (object_heap_empty(&buffer->avl_node_heap)
+        && object_heap_expand(&buffer->avl_node_heap) != 0) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    node = (avl_node_t *) object_heap_alloc_object(&buffer->avl_node_heap);
+    avl_init_node(node, u);
+    node = avl_insert_node(Q, node);
+    tsk_bug_assert(node != NULL);
+out:
+    return ret;
+}
+
+static void
+msp_merge_queue_free_node(msp_t *self, merge_buffer_t *buffer, avl_node_t *node)
+{
+    if (buffer == NULL) {
+        msp_free_avl_node(self, node);
+    } else {
+        object_heap_free_object(&buffer->avl_node_heap, node);
+    }
+}
+
+static int MSP_WARN_UNUSED
+msp_merge_store_edge(msp_t *self, merge_buffer_t *buffer, double left, double right,
+    tsk_id_t parent, tsk_id_t child)
+{
+    int ret = 0;
+
+    if (buffer == NULL) {
+        return msp_store_edge(self, left, right, parent, child);
+    }
+    ret = msp_expand_array((void **) &buffer->edges, &buffer->max_edges,
+        buffer->num_edges, sizeof(*buffer->edges));
+    if (ret != 0) {
+        goto out;
+    }
+    buffer->edges[buffer->num_edges].left = left;
+    buffer->edges[buffer->num_edges].right = right;
+    buffer->edges[buffer->num_edges].child = child;
+    buffer->num_edges++;
+out:
+    return ret;
+}
+
+/* Updates the overlap counts for the merge of h lineages over [l, r_max),
+ * returning the end r of the interval over which they have all reached
+ * their MRCA or over which none of them has. */
+static int MSP_WARN_UNUSED
+msp_merge_overlap_counts(msp_t *self, merge_buffer_t *buffer, double l, double r_max,
+    uint32_t h, double *r, bool *mrca)
+{
+    int ret = 0;
+    avl_node_t *node;
+    node_mapping_t *nm, search;
+    overlap_update_t *update;
+
+    if (buffer == NULL) {
+        /* Insert overlap counts for bounds, if necessary */
+        search.position = l;
+        node = avl_search(&self->overlap_counts, &search);
+        if (node == NULL) {
+            ret = msp_copy_overlap_count(self, l);
+            if (ret < 0) {
+                goto out;
             }
-            search.position = r_max;
-            node = avl_search(&self->overlap_counts, &search);
-            if (node == NULL) {
-                ret = msp_copy_overlap_count(self, r_max);
-                if (ret < 0) {
-                    goto out;
-                }
+        }
+        search.position = r_max;
+        node = avl_search(&self->overlap_counts, &search);
+        if (node == NULL) {
+            ret = msp_copy_overlap_count(self, r_max);
+            if (ret < 0) {
+                goto out;
             }
-            /* Update the extant segments and allocate alpha if the interval
-             * has not coalesced. */
-            search.position = l;
-            node = avl_search(&self->overlap_counts, &search);
+        }
+        search.position = l;
+        node = avl_search(&self->overlap_counts, &search);
+        tsk_bug_assert(node != NULL);
+        nm = (node_mapping_t *) node->item;
+        *mrca = nm->value == h;
+        if (*mrca) {
+            nm->value = 0;
+            node = node->next;
             tsk_bug_assert(node != NULL);
             nm = (node_mapping_t *) node->item;
-            if (nm->value == h) {
-                nm->value = 0;
+            *r = nm->position;
+        } else {
+            *r = l;
+            while (nm->value != h && *r < r_max) {
+                nm->value -= h - 1;
                 node = node->next;
                 tsk_bug_assert(node != NULL);
                 nm = (node_mapping_t *) node->item;
-                r = nm->position;
+                *r = nm->position;
+            }
+        }
+        ret = 0;
+        goto out;
+    }
+
+    ret = msp_expand_array((void **) &buffer->updates, &buffer->max_updates,
+        buffer->num_updates, sizeof(*buffer->updates));
+    if (ret != 0) {
+        goto out;
+    }
+    /* Find the overlap count at l */
+    search.position = l;
+    avl_search_closest(&self->overlap_counts, &search, &node);
+    tsk_bug_assert(node != NULL);
+    nm = (node_mapping_t *) node->item;
+    if (nm->position > l) {
+        node = node->prev;
+        tsk_bug_assert(node != NULL);
+        nm = (node_mapping_t *) node->item;
+    }
+    update = buffer->updates + buffer->num_updates;
+    *mrca = nm->value == h;
+    if (*mrca) {
+        node = node->next;
+        tsk_bug_assert(node != NULL);
+        *r = GSL_MIN(((node_mapping_t *) node->item)->position, r_max);
+        /* The counts may since have been compressed, so extend the
+         * previous update rather than splitting them at l. */
+        if (buffer->num_updates > buffer->first_update && update[-1].mrca
+            && update[-1].num_lineages == h && update[-1].right == l) {
+            update--;
+            buffer->num_updates--;
+            l = update->left;
+        }
+    } else {
+        *r = l;
+        while (nm->value != h && *r < r_max) {
+            node = node->next;
+            tsk_bug_assert(node != NULL);
+            nm = (node_mapping_t *) node->item;
+            *r = GSL_MIN(nm->position, r_max);
+        }
+    }
+    update->left = l;
+    update->right = *r;
+    update->r_max = r_max;
+    update->num_lineages = h;
+    update->mrca = *mrca;
+    buffer->num_updates++;
+out:
+    return ret;
+}
+
+/* Stores the edges from the node of a merge to the lineages in the chain
+ * ending in z that passed through it without coalescing, as required for
+ * the full ARG. */
+static int MSP_WARN_UNUSED
+msp_merge_store_arg_edges(msp_t *self, merge_buffer_t *buffer, segment_t *z)
+{
+    int ret = 0;
+    segment_t *x;
+
+    if (buffer == NULL) {
+        return msp_store_arg_edges(self, z);
+    }
+    for (x = z; x != NULL; x = x->prev) {
+        if (x->value != TSK_NULL) {
+            ret = msp_merge_store_edge(
+                self, buffer, x->left, x->right, TSK_NULL, x->value);
+            if (ret != 0) {
+                goto out;
+            }
+            x->value = TSK_NULL;
+        }
+    }
+out:
+    return ret;
+}
+
+static int MSP_WARN_UNUSED
+msp_merge_defrag_segment_chain(msp_t *self, merge_buffer_t *buffer, segment_t *z)
+{
+    int ret = 0;
+    segment_t *y, *x;
+
+    if (buffer == NULL) {
+        return msp_defrag_segment_chain(self, z);
+    }
+    y = z;
+    while (y->prev != NULL) {
+        x = y->prev;
+        if (x->right == y->left && x->value == y->value) {
+            x->right = y->right;
+            x->next = y->next;
+            if (y->next != NULL) {
+                y->next->prev = x;
+            }
+            ret = msp_merge_free_segment(self, buffer, y);
+            if (ret != 0) {
+                goto out;
+            }
+        }
+        y = x;
+    }
+out:
+    return ret;
+}
+
+/* Merges the segments in the priority queue Q, sorted by left coordinate,
+ * into a single lineage whose first segment is returned in *lineage, or
+ * NULL if the segments have all reached their MRCA. The node for the merge
+ * is stored on the first coalescence. The simulation state is updated
+ * directly if buffer is NULL, and the merge is recorded in the buffer
+ * otherwise. H must have room for all the segments in Q.
+ */
+static int MSP_WARN_UNUSED
+msp_merge_segments(msp_t *self, avl_tree_t *Q, segment_t **H,
+    population_id_t population_id, label_id_t label, tsk_id_t individual,
+    merge_buffer_t *buffer, segment_t **lineage)
+{
+    int ret = 0;
+    bool coalescence = false;
+    bool defrag_required = false;
+    bool mrca;
+    tsk_id_t v = TSK_NULL;
+    uint32_t j, h;
+    double l, r, r_max, next_l, l_min;
+    avl_node_t *node, *next;
+    segment_t *x, *y, *z, *alpha;
+
+    if (buffer != NULL) {
+        buffer->first_update = buffer->num_updates;
+    }
+    r_max = 0; /* keep compiler happy */
+    l_min = 0;
+    z = NULL;
+    *lineage = NULL;
+    while (avl_count(Q) > 0) {
+        h = 0;
+        node = Q->head;
+        l = ((segment_t *) node->item)->left;
+        r_max = self->sequence_length;
+        while (node != NULL && ((segment_t *) node->item)->left == l) {
+            H[h] = (segment_t *) node->item;
+            r_max = GSL_MIN(r_max, H[h]->right);
+            h++;
+            next = node->next;
+            avl_unlink_node(Q, node);
+            msp_merge_queue_free_node(self, buffer, node);
+            node = next;
+        }
+        next_l = 0;
+        if (node != NULL) {
+            next_l = ((segment_t *) node->item)->left;
+            r_max = GSL_MIN(r_max, next_l);
+        }
+        alpha = NULL;
+        if (h == 1) {
+            x = H[0];
+            if (node != NULL && next_l < x->right) {
+                alpha = msp_merge_alloc_segment(
+                    self, buffer, x->left, next_l, x->value, x->population, x->label);
+                if (alpha == NULL) {
+                    ret = MSP_ERR_NO_MEMORY;
+                    goto out;
+                }
+                x->left = next_l;
             } else {
-                r = l;
-                while (nm->value != h && r < r_max) {
-                    nm->value -= h - 1;
-                    node = node->next;
-                    tsk_bug_assert(node != NULL);
-                    nm = (node_mapping_t *) node->item;
-                    r = nm->position;
+                alpha = x;
+                x = x->next;
+                alpha->next = NULL;
+            }
+            if (x != NULL) {
+                ret = msp_merge_queue_insert(self, buffer, Q, x);
+                if (ret != 0) {
+                    goto out;
+                }
+            }
+        } else {
+            if (!coalescence) {
+                coalescence = true;
+                l_min = l;
+                if (buffer == NULL) {
+                    ret = msp_store_node(self, 0, self->time, population_id, individual);
+                    if (ret != 0) {
+                        goto out;
+                    }
+                    v = (tsk_id_t) msp_get_num_nodes(self) - 1;
                 }
-                alpha
-                    = msp_alloc_segment(self, l, r, v, population_id, label, NULL, NULL);
+            }
+            ret = msp_merge_overlap_counts(self, buffer, l, r_max, h, &r, &mrca);
+            if (ret != 0) {
+                goto out;
+            }
+            /* Allocate alpha if the interval has not coalesced */
+            if (!mrca) {
+                alpha = msp_merge_alloc_segment(
+                    self, buffer, l, r, v, population_id, label);
                 if (alpha == NULL) {
                     ret = MSP_ERR_NO_MEMORY;
                     goto out;
@@ -3186,49 +3999,32 @@ msp_merge_ancestors(msp_t *self, avl_tree_t *Q, population_id_t population_id,
             for (j = 0; j < h; j++) {
                 x = H[j];
                 tsk_bug_assert(v != x->value);
-                ret = msp_store_edge(self, l, r, v, x->value);
+                ret = msp_merge_store_edge(self, buffer, l, r, v, x->value);
                 if (ret != 0) {
                     goto out;
                 }
                 if (x->right == r) {
-                    msp_free_segment(self, x);
+                    y = x;
                     x = x->next;
+                    ret = msp_merge_free_segment(self, buffer, y);
+                    if (ret != 0) {
+                        goto out;
+                    }
                 } else if (x->right > r) {
                     x->left = r;
                 }
                 if (x != NULL) {
-                    ret = msp_priority_queue_insert(self, Q, x);
+                    ret = msp_merge_queue_insert(self, buffer, Q, x);
                     if (ret != 0) {
                         goto out;
                     }
-                } else {
-                    /* If we've fully coalesced, we stop tracking the segment in
-                       the pedigree. */
-                    if (self->pedigree != NULL
-                        && self->pedigree->state == MSP_PED_STATE_CLIMBING) {
-                        if (!set_merged) {
-                            *merged_segment = NULL;
-                        }
-                    }
                 }
             }
         }
-        /* Loop tail; integrate alpha into the global state */
+        /* Loop tail; integrate alpha into the lineage */
         if (alpha != NULL) {
             if (z == NULL) {
-                /* Pedigree doesn't currently track lineages in Populations, so
-                   keep reference to merged segments instead */
-                if (self->pedigree != NULL
-                    && self->pedigree->state == MSP_PED_STATE_CLIMBING) {
-                    tsk_bug_assert(merged_segment != NULL);
-                    set_merged = true; // TODO: Must be better way of checking this
-                    *merged_segment = alpha;
-                } else {
-                    ret = msp_insert_individual(self, alpha);
-                    if (ret != 0) {
-                        goto out;
-                    }
-                }
+                *lineage = alpha;
             } else {
                 if (self->store_full_arg) {
                     // we pre-empt the fact that values will be set equal later
@@ -3240,31 +4036,77 @@ msp_merge_ancestors(msp_t *self, avl_tree_t *Q, population_id_t population_id,
                 z->next = alpha;
             }
             alpha->prev = z;
-            msp_set_segment_mass(self, alpha);
+            if (buffer == NULL) {
+                msp_set_segment_mass(self, alpha);
+            }
             z = alpha;
         }
     }
     if (self->store_full_arg) {
-        if (!coalescence) {
+        if (!coalescence && buffer == NULL) {
             ret = msp_store_node(
                 self, MSP_NODE_IS_CA_EVENT, self->time, population_id, individual);
             if (ret != 0) {
                 goto out;
             }
         }
-        ret = msp_store_arg_edges(self, z);
+        ret = msp_merge_store_arg_edges(self, buffer, z);
         if (ret != 0) {
             goto out;
         }
     }
     if (defrag_required) {
-        ret = msp_defrag_segment_chain(self, z);
+        ret = msp_merge_defrag_segment_chain(self, buffer, z);
         if (ret != 0) {
             goto out;
         }
     }
-    if (coalescence) {
-        ret = msp_conditional_compress_overlap_counts(self, l_min, r_max);
+    if (buffer == NULL) {
+        if (coalescence) {
+            ret = msp_conditional_compress_overlap_counts(self, l_min, r_max);
+            if (ret != 0) {
+                goto out;
+            }
+        }
+    } else {
+        buffer->coalescence = coalescence;
+        buffer->l_min = l_min;
+        buffer->r_max = r_max;
+    }
+out:
+    return ret;
+}
+
+/* Merge the specified set of ancestors into a single ancestor. This is a
+ * generalisation of the msp_common_ancestor_event method where we allow
+ * any number of ancestors to merge. The AVL tree is a priority queue in
+ * sorted by left coordinate.
+ */
+static int MSP_WARN_UNUSED
+msp_merge_ancestors(msp_t *self, avl_tree_t *Q, population_id_t population_id,
+    label_id_t label, segment_t **merged_segment, tsk_id_t individual)
+{
+    int ret = MSP_ERR_GENERIC;
+    segment_t *lineage;
+    segment_t **H = NULL;
+
+    H = malloc(avl_count(Q) * sizeof(segment_t *));
+    if (H == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    ret = msp_merge_segments(
+        self, Q, H, population_id, label, individual, NULL, &lineage);
+    if (ret != 0) {
+        goto out;
+    }
+    /* Pedigree doesn't currently track lineages in Populations, so
+       keep reference to merged segments instead */
+    if (self->pedigree != NULL && self->pedigree->state == MSP_PED_STATE_CLIMBING) {
+        tsk_bug_assert(merged_segment != NULL);
+        *merged_segment = lineage;
+    } else if (lineage != NULL) {
+        ret = msp_insert_individual(self, lineage);
         if (ret != 0) {
             goto out;
         }
@@ -3316,7 +4158,7 @@ msp_reset_memory_state(msp_t *self)
                     msp_free_segment(self, u);
                     u = v;
                 }
-                avl_unlink_node(&pop->ancestors[label], node);
+                msp_unlink_ancestor(self, &pop->ancestors[label], node);
                 msp_free_avl_node(self, node);
             }
         }
@@ -3565,46 +4407,79 @@ msp_apply_demographic_events(msp_t *self)
     int ret = 0;
     demographic_event_t *event;
 
-    tsk_bug_assert(self->next_demographic_event != NULL);
+    tsk_bug_assert(self->next_demographic_event < self->num_demographic_events);
     /* Process all events with equal time in one block. */
-    self->time = self->next_demographic_event->time;
-    while (self->next_demographic_event != NULL
-           && self->next_demographic_event->time == self->time) {
+    self->time = self->demographic_events[self->next_demographic_event].time;
+    while (self->next_demographic_event < self->num_demographic_events
+           && self->demographic_events[self->next_demographic_event].time
+                  == self->time) {
         /* We skip ahead to the start time for the next demographic
          * event, and use its change_state method to update the
          * state of the simulation.
          */
-        event = self->next_demographic_event;
+        event = &self->demographic_events[self->next_demographic_event];
         tsk_bug_assert(event->change_state != NULL);
         ret = event->change_state(self, event);
         if (ret != 0) {
             goto out;
         }
-        self->next_demographic_event = event->next;
+        self->next_demographic_event++;
     }
 out:
     return ret;
 }
 
-int
-msp_reset(msp_t *self)
+/* Seeds the per-population random generators used when the DTWF runs on
+ * more than one thread from the main generator, allocating them first if
+ * necessary. This is done at each reset so that each replicate depends
+ * only on the state of the main generator when it starts. */
+static int MSP_WARN_UNUSED
+msp_reset_dtwf_rngs(msp_t *self)
 {
     int ret = 0;
-    size_t N = self->num_populations;
-    population_id_t population_id;
-    population_t *pop, *initial_pop;
+    uint32_t j;
 
-    memcpy(&self->model, &self->initial_model, sizeof(self->model));
-    if (self->pedigree != NULL) {
-        ret = msp_reset_pedigree(self);
-        if (ret != 0) {
+    if (self->dtwf_rngs == NULL) {
+        self->dtwf_rngs = calloc(self->num_populations, sizeof(*self->dtwf_rngs));
+        if (self->dtwf_rngs == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
             goto out;
         }
     }
-    ret = msp_reset_memory_state(self);
-    if (ret != 0) {
-        goto out;
-    }
+    for (j = 0; j < self->num_populations; j++) {
+        if (self->dtwf_rngs[j] == NULL) {
+            self->dtwf_rngs[j] = gsl_rng_alloc(self->rng->type);
+            if (self->dtwf_rngs[j] == NULL) {
+                ret = MSP_ERR_NO_MEMORY;
+                goto out;
+            }
+        }
+        gsl_rng_set(self->dtwf_rngs[j], gsl_rng_get(self->rng));
+    }
+out:
+    return ret;
+}
+
+int
+msp_reset(msp_t *self)
+{
+    int ret = 0;
+    size_t N = self->num_populations;
+    population_id_t population_id;
+    population_t *pop, *initial_pop;
+
+    memcpy(&self->model, &self->initial_model, sizeof(self->model));
+    msp_free_sweep_state(self);
+    if (self->pedigree != NULL) {
+        ret = msp_reset_pedigree(self);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    ret = msp_reset_memory_state(self);
+    if (ret != 0) {
+        goto out;
+    }
     /* Set up the initial segments and algorithm state */
     self->time = self->start_time;
     for (population_id = 0; population_id < (population_id_t) N; population_id++) {
@@ -3628,7 +4503,7 @@ msp_reset(msp_t *self)
         goto out;
     }
 
-    self->next_demographic_event = self->demographic_events_head;
+    self->next_demographic_event = 0;
     memcpy(
         self->migration_matrix, self->initial_migration_matrix, N * N * sizeof(double));
     self->next_sampling_event = 0;
@@ -3639,6 +4514,12 @@ msp_reset(msp_t *self)
     self->num_trapped_re_events = 0;
     self->num_multiple_re_events = 0;
     memset(self->num_migration_events, 0, N * N * sizeof(size_t));
+    if (self->dtwf_num_threads > 1) {
+        ret = msp_reset_dtwf_rngs(self);
+        if (ret != 0) {
+            goto out;
+        }
+    }
     self->state = MSP_STATE_INITIALISED;
 out:
     return ret;
@@ -3906,30 +4787,33 @@ msp_get_total_gc_left(msp_t *self)
     return total;
 }
 
+/* Returns the lineage with the specified index in the ordering of all
+ * lineages with this label by population, using the ancestor count index
+ * to find the population. */
 static segment_t *
 msp_find_gc_left_individual(msp_t *self, label_id_t label, double value)
 {
-    size_t j, num_ancestors, individual_index;
+    size_t j, individual_index;
+    fenwick_t *counts = &self->ancestor_count_index[label];
     avl_tree_t *ancestors;
     avl_node_t *node;
-    segment_t *ind;
 
     double mean_gc_rate = rate_map_get_total_mass(&self->gc_map) / self->sequence_length;
     individual_index = (size_t) floor(value / (mean_gc_rate * self->gc_tract_length));
-    for (j = 0; j < self->num_populations; j++) {
-        num_ancestors = msp_get_num_population_ancestors(self, (tsk_id_t) j);
-        if (individual_index < num_ancestors) {
-            ancestors = &self->populations[j].ancestors[label];
-            /* Choose the correct individual */
-            node = avl_at(ancestors, (unsigned int) individual_index);
-            assert(node != NULL);
-            ind = (segment_t *) node->item;
-            return ind;
-        } else {
-            individual_index -= num_ancestors;
-        }
+    if (individual_index >= (size_t) fenwick_get_total(counts)) {
+        return NULL;
     }
-    return NULL;
+    /* The first population whose cumulative count exceeds the index */
+    j = fenwick_find(counts, (double) individual_index + 1);
+    tsk_bug_assert(j >= 1 && j <= self->num_populations);
+    if (j > 1) {
+        individual_index -= (size_t) fenwick_get_cumulative_sum(counts, j - 1);
+    }
+    ancestors = &self->populations[j - 1].ancestors[label];
+    /* Choose the correct individual */
+    node = avl_at(ancestors, (unsigned int) individual_index);
+    assert(node != NULL);
+    return (segment_t *) node->item;
 }
 
 static double
@@ -3968,24 +4852,15 @@ msp_gene_conversion_left_event(msp_t *self, label_id_t label)
     double h = gsl_rng_uniform(self->rng) * gc_left_total;
     double tl, bp;
     segment_t *y, *x, *alpha;
-    int num_resamplings = 0;
 
     y = msp_find_gc_left_individual(self, label, h);
     assert(y != NULL);
 
-    /* generate tract length */
-    do {
-        tl = gsl_ran_exponential(self->rng, self->gc_tract_length);
-        if (self->discrete_genome) {
-            /* We want the tract length to be at least 1 */
-            tl = ceil(tl);
-        }
-        if (num_resamplings == 10) {
-            ret = MSP_ERR_TRACTLEN_RESAMPLE_OVERFLOW;
-            goto out;
-        }
-        num_resamplings++;
-    } while (tl <= 0);
+    tl = msp_generate_gc_tract_length(self);
+    if (tl <= 0) {
+        ret = MSP_ERR_TRACTLEN_RESAMPLE_OVERFLOW;
+        goto out;
+    }
     tsk_bug_assert(tl > 0);
 
     bp = y->left + tl;
@@ -4157,7 +5032,7 @@ msp_run_coalescent(msp_t *self, double max_time, unsigned long max_events)
 
         t_wait = GSL_MIN(mig_t_wait,
             GSL_MIN(gc_t_wait, GSL_MIN(gc_left_t_wait, GSL_MIN(re_t_wait, ca_t_wait))));
-        if (self->next_demographic_event == NULL
+        if (self->next_demographic_event == self->num_demographic_events
             && self->next_sampling_event == self->num_sampling_events
             && t_wait == DBL_MAX) {
             ret = MSP_ERR_INFINITE_WAITING_TIME;
@@ -4170,8 +5045,9 @@ msp_run_coalescent(msp_t *self, double max_time, unsigned long max_events)
             sampling_event_time = self->sampling_events[self->next_sampling_event].time;
         }
         demographic_event_time = DBL_MAX;
-        if (self->next_demographic_event != NULL) {
-            demographic_event_time = self->next_demographic_event->time;
+        if (self->next_demographic_event < self->num_demographic_events) {
+            demographic_event_time
+                = self->demographic_events[self->next_demographic_event].time;
         }
         /* The simulation state is can only changed from this point on. If
          * any of the events would cause the time to be >= max_time, we exit
@@ -4262,25 +5138,574 @@ out:
     return ret;
 }
 
+/* Returns the recombination mass within which the first breakpoint drawn by
+ * msp_dtwf_generate_breakpoint must fall to recombine the lineage headed
+ * by x. */
+static double
+msp_dtwf_get_recombination_mass(msp_t *self, segment_t *x)
+{
+    double left_bound, mass;
+    segment_t *tail;
+
+    left_bound = self->discrete_genome ? x->left + 1 : x->left;
+    for (tail = x; tail->next != NULL; tail = tail->next)
+        ;
+    mass = rate_map_position_to_mass(&self->recomb_map, tail->right)
+           - rate_map_position_to_mass(&self->recomb_map, left_bound);
+    return GSL_MAX(mass, 0);
+}
+
+/* Generates the first breakpoint for the lineage headed by x, conditional
+ * on the lineage recombining. */
+static double
+msp_dtwf_generate_conditional_breakpoint(msp_t *self, gsl_rng *rng, segment_t *x)
+{
+    double left_bound, mass, mass_to_next_recomb, breakpoint;
+
+    mass = msp_dtwf_get_recombination_mass(self, x);
+    tsk_bug_assert(mass > 0);
+    left_bound = self->discrete_genome ? x->left + 1 : x->left;
+    /* Exponential truncated to (0, mass) */
+    mass_to_next_recomb = -log1p(gsl_rng_uniform_pos(rng) * expm1(-mass));
+    breakpoint
+        = rate_map_shift_by_mass(&self->recomb_map, left_bound, mass_to_next_recomb);
+    return self->discrete_genome ? floor(breakpoint) : breakpoint;
+}
+
+/* Draws the transmission of the lineage starting at x to its parents
+ * from the specified generator, so that it can later be carried out by
+ * msp_dtwf_recombine. The breakpoints are appended to those already in
+ * the plan. If conditional is true the first breakpoint is drawn
+ * conditional on the lineage recombining. Does not modify the simulation
+ * state, and so may be called concurrently for different lineages. */
+static int MSP_WARN_UNUSED
+msp_dtwf_plan_recombination(msp_t *self, segment_t *x, gsl_rng *rng,
+    bool conditional, recomb_plan_t *plan)
+{
+    int ret = 0;
+    double k, right;
+    double *tmp;
+    const segment_t *tail = x;
+
+    if (rate_map_get_total_mass(&self->recomb_map) == 0) {
+        plan->first_parent = (int) gsl_rng_uniform_int(rng, 2);
+        goto out;
+    }
+    while (tail->next != NULL) {
+        tail = tail->next;
+    }
+    right = tail->right;
+    if (conditional) {
+        k = msp_dtwf_generate_conditional_breakpoint(self, rng, x);
+    } else {
+        k = msp_dtwf_draw_breakpoint(self, rng, x->left);
+    }
+    plan->first_parent = (int) gsl_rng_uniform_int(rng, 2);
+    /* Breakpoints at or beyond the end of the lineage are never used */
+    while (k < right) {
+        if (plan->num_breakpoints == plan->max_breakpoints) {
+            plan->max_breakpoints = GSL_MAX(2 * plan->max_breakpoints, 16);
+            tmp = realloc(
+                plan->breakpoints, plan->max_breakpoints * sizeof(*plan->breakpoints));
+            if (tmp == NULL) {
+                ret = MSP_ERR_NO_MEMORY;
+                goto out;
+            }
+            plan->breakpoints = tmp;
+        }
+        plan->breakpoints[plan->num_breakpoints] = k;
+        plan->num_breakpoints++;
+        k = msp_dtwf_draw_breakpoint(self, rng, k);
+    }
+out:
+    return ret;
+}
+
+/* The segments that a pedigree individual inherited from one parent are
+ * merged into a lineage, which is then passed on to the chromosomes of
+ * that parent. The merge is recorded in the buffer of the thread that
+ * did the work, starting at the recorded offsets. */
+typedef struct {
+    tsk_id_t parent;
+    avl_tree_t *segments;
+    unsigned long int seed;
+    int ret;
+    size_t thread;
+    bool coalescence;
+    double l_min;
+    double r_max;
+    segment_t *lineage;
+    segment_t *chromosome[2];
+    size_t num_re_events;
+    size_t first_edge;
+    size_t num_edges;
+    size_t first_update;
+    size_t num_updates;
+    size_t first_freed_segment;
+    size_t num_freed_segments;
+    size_t first_freed_node;
+    size_t num_freed_nodes;
+} pedigree_transmission_t;
+
+/* Per-thread state for msp_pedigree_climb_generations. Recombination
+ * allocates its segments from the local heap of the merge buffer. */
+typedef struct {
+    gsl_rng *rng;
+    merge_buffer_t merge;
+    avl_tree_t queue;
+    recomb_plan_t plan;
+    recomb_buffer_t buffer;
+} pedigree_workspace_t;
+
+static int MSP_WARN_UNUSED
+pedigree_workspace_init(pedigree_workspace_t *self, size_t block_size)
+{
+    int ret = 0;
+
+    memset(self, 0, sizeof(*self));
+    self->rng = gsl_rng_alloc(gsl_rng_taus2);
+    if (self->rng == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    ret = merge_buffer_init(&self->merge, block_size);
+    if (ret != 0) {
+        goto out;
+    }
+    avl_init_tree(&self->queue, cmp_segment_queue, NULL);
+    self->buffer.heap = &self->merge.segment_heap;
+out:
+    return ret;
+}
+
+static void
+pedigree_workspace_free(pedigree_workspace_t *self)
+{
+    if (self->rng != NULL) {
+        gsl_rng_free(self->rng);
+    }
+    merge_buffer_free(&self->merge);
+    msp_safe_free(self->plan.breakpoints);
+    recomb_buffer_free(&self->buffer);
+}
+
+/* Merges the segments of a transmission into a single lineage with
+ * msp_merge_segments, without modifying any state that is shared with
+ * other transmissions. As the transmissions in a generation share no
+ * lineages, whether an interval reaches its MRCA does not depend on the
+ * order in which they are committed. */
+static int MSP_WARN_UNUSED
+msp_pedigree_merge_transmission(
+    msp_t *self, pedigree_workspace_t *ws, pedigree_transmission_t *tr)
+{
+    int ret = 0;
+    avl_node_t *node, *next;
+    merge_buffer_t *buffer = &ws->merge;
+
+    if (avl_count(tr->segments) > buffer->max_merging) {
+        msp_safe_free(buffer->merging);
+        buffer->max_merging = avl_count(tr->segments);
+        buffer->merging = malloc(buffer->max_merging * sizeof(*buffer->merging));
+        if (buffer->merging == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+    }
+    /* Move the segments into the local queue */
+    for (node = tr->segments->head; node != NULL; node = next) {
+        next = node->next;
+        avl_unlink_node(tr->segments, node);
+        ret = msp_merge_free_avl_node(self, buffer, node);
+        if (ret != 0) {
+            goto out;
+        }
+        ret = msp_merge_queue_insert(self, buffer, &ws->queue, (segment_t *) node->item);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    ret = msp_merge_segments(self, &ws->queue, buffer->merging, 0, 0, tr->parent,
+        buffer, &tr->lineage);
+    if (ret != 0) {
+        goto out;
+    }
+    tr->coalescence = buffer->coalescence;
+    tr->l_min = buffer->l_min;
+    tr->r_max = buffer->r_max;
+out:
+    return ret;
+}
+
+/* Merges the segments of a transmission and passes the resulting lineage
+ * on to the chromosomes of the parent. Breakpoints are drawn from the
+ * thread's generator, seeded for the transmission. */
+static int MSP_WARN_UNUSED
+msp_pedigree_run_transmission(
+    msp_t *self, pedigree_workspace_t *ws, pedigree_transmission_t *tr)
+{
+    int ret = 0;
+
+    tr->first_edge = ws->merge.num_edges;
+    tr->first_update = ws->merge.num_updates;
+    tr->first_freed_segment = ws->merge.num_freed_segments;
+    tr->first_freed_node = ws->merge.num_freed_nodes;
+    tr->chromosome[0] = NULL;
+    tr->chromosome[1] = NULL;
+
+    ret = msp_pedigree_merge_transmission(self, ws, tr);
+    if (ret != 0) {
+        goto out;
+    }
+    if (tr->lineage != NULL && tr->parent != TSK_NULL) {
+        gsl_rng_set(ws->rng, tr->seed);
+        ws->plan.num_breakpoints = 0;
+        ret = msp_dtwf_plan_recombination(self, tr->lineage, ws->rng, false, &ws->plan);
+        if (ret != 0) {
+            goto out;
+        }
+        if (ws->plan.num_breakpoints > 0) {
+            ret = msp_dtwf_recombine(self, tr->lineage, 0, &ws->plan, &ws->buffer,
+                &tr->chromosome[0], &tr->chromosome[1]);
+            if (ret != 0) {
+                goto out;
+            }
+        } else {
+            tr->chromosome[ws->plan.first_parent] = tr->lineage;
+        }
+    }
+    tr->num_re_events = ws->buffer.num_re_events;
+    ws->buffer.num_re_events = 0;
+out:
+    tr->num_edges = ws->merge.num_edges - tr->first_edge;
+    tr->num_updates = ws->merge.num_updates - tr->first_update;
+    tr->num_freed_segments = ws->merge.num_freed_segments - tr->first_freed_segment;
+    tr->num_freed_nodes = ws->merge.num_freed_nodes - tr->first_freed_node;
+    return ret;
+}
+
+static int MSP_WARN_UNUSED
+msp_apply_overlap_update(msp_t *self, const overlap_update_t *update)
+{
+    int ret = 0;
+    avl_node_t *node;
+    node_mapping_t *nm, search;
+
+    search.position = update->left;
+    if (avl_search(&self->overlap_counts, &search) == NULL) {
+        ret = msp_copy_overlap_count(self, update->left);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    search.position = update->r_max;
+    if (avl_search(&self->overlap_counts, &search) == NULL) {
+        ret = msp_copy_overlap_count(self, update->r_max);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    search.position = update->left;
+    node = avl_search(&self->overlap_counts, &search);
+    tsk_bug_assert(node != NULL);
+    nm = (node_mapping_t *) node->item;
+    while (nm->position < update->right) {
+        if (update->mrca) {
+            tsk_bug_assert(nm->value == update->num_lineages);
+            nm->value = 0;
+        } else {
+            tsk_bug_assert(nm->value > update->num_lineages);
+            nm->value -= update->num_lineages - 1;
+        }
+        node = node->next;
+        tsk_bug_assert(node != NULL);
+        nm = (node_mapping_t *) node->item;
+    }
+out:
+    return ret;
+}
+
+/* Moves the segments of the lineage starting at *head that came from the
+ * thread-local heap into the main heap, assigns the merge node v to the
+ * segments that are waiting for it and sets the recombination masses. */
+static int MSP_WARN_UNUSED
+msp_pedigree_commit_lineage(
+    msp_t *self, pedigree_workspace_t *ws, segment_t **head, tsk_id_t v)
+{
+    int ret = 0;
+    segment_t *x, *y;
+
+    for (x = *head; x != NULL; x = x->next) {
+        if (x->value == TSK_NULL) {
+            tsk_bug_assert(v != TSK_NULL);
+            x->value = v;
+        }
+        if (x->id == 0) {
+            y = msp_alloc_segment(self, x->left, x->right, x->value, x->population,
+                x->label, x->prev, x->next);
+            if (y == NULL) {
+                ret = MSP_ERR_NO_MEMORY;
+                goto out;
+            }
+            if (x->prev == NULL) {
+                *head = y;
+            } else {
+                x->prev->next = y;
+            }
+            if (x->next != NULL) {
+                x->next->prev = y;
+            }
+            object_heap_free_object(&ws->merge.segment_heap, x);
+            x = y;
+        }
+        msp_set_segment_mass(self, x);
+    }
+out:
+    return ret;
+}
+
+/* Applies the buffered changes of a transmission to the simulation state
+ * and passes the lineage on to the parent. */
+static int MSP_WARN_UNUSED
+msp_pedigree_commit_transmission(
+    msp_t *self, pedigree_workspace_t *ws, pedigree_transmission_t *tr)
+{
+    int ret = 0;
+    size_t j;
+    tsk_id_t v = TSK_NULL;
+    const pending_edge_t *edge;
+
+    if (tr->coalescence || self->store_full_arg) {
+        ret = msp_store_node(self, tr->coalescence ? 0 : MSP_NODE_IS_CA_EVENT,
+            self->time, 0, tr->parent);
+        if (ret != 0) {
+            goto out;
+        }
+        v = (tsk_id_t) msp_get_num_nodes(self) - 1;
+    }
+    for (j = 0; j < tr->num_updates; j++) {
+        ret = msp_apply_overlap_update(self, ws->merge.updates + tr->first_update + j);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    for (j = 0; j < tr->num_edges; j++) {
+        edge = ws->merge.edges + tr->first_edge + j;
+        ret = msp_store_edge(self, edge->left, edge->right, v, edge->child);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    for (j = 0; j < tr->num_freed_nodes; j++) {
+        msp_free_avl_node(self, ws->merge.freed_nodes[tr->first_freed_node + j]);
+    }
+    for (j = 0; j < tr->num_freed_segments; j++) {
+        msp_free_segment(self, ws->merge.freed_segments[tr->first_freed_segment + j]);
+    }
+    if (tr->parent == TSK_NULL) {
+        if (tr->lineage != NULL) {
+            ret = msp_pedigree_commit_lineage(self, ws, &tr->lineage, v);
+            if (ret != 0) {
+                goto out;
+            }
+            ret = msp_insert_individual(self, tr->lineage);
+            if (ret != 0) {
+                goto out;
+            }
+        }
+    } else {
+        for (j = 0; j < self->ploidy; j++) {
+            if (tr->chromosome[j] == NULL) {
+                continue;
+            }
+            ret = msp_pedigree_commit_lineage(self, ws, &tr->chromosome[j], v);
+            if (ret != 0) {
+                goto out;
+            }
+            ret = msp_pedigree_add_individual_segment(
+                self, tr->parent, tr->chromosome[j], j);
+            if (ret != 0) {
+                goto out;
+            }
+        }
+        if (tr->lineage != NULL && !self->pedigree->queued[tr->parent]) {
+            ret = msp_pedigree_push_ind(self, tr->parent);
+            if (ret != 0) {
+                goto out;
+            }
+        }
+    }
+    if (tr->coalescence) {
+        ret = msp_conditional_compress_overlap_counts(self, tr->l_min, tr->r_max);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    self->num_re_events += tr->num_re_events;
+out:
+    return ret;
+}
+
+/* Climbs the pedigree one generation at a time, for use when
+ * pedigree_num_threads > 1. As parents are strictly older than their
+ * children, none of the individuals queued at the current time can
+ * receive material from the others, and so their transmissions to their
+ * parents can be carried out in parallel. Each thread works on its own
+ * heaps and buffers, and the buffered changes are then committed
+ * serially, in queue order, which is where segments are added to the
+ * parents that siblings share. The merges use msp_merge_segments, as
+ * msp_merge_ancestors does, recording their changes in a merge_buffer_t.
+ * Each transmission draws from a generator seeded for it from the main
+ * one, so that the output depends only on the seed and not on the number
+ * of threads or on scheduling; this is a Tausworthe generator, whose small
+ * state makes seeding it cheap. These draws differ from those of the serial
+ * climb, so that the output for a given seed with one thread differs from
+ * that with several, and the default single-threaded output is unchanged. */
+static int MSP_WARN_UNUSED
+msp_pedigree_climb_generations(msp_t *self)
+{
+    int ret = 0;
+    int j, num_transmissions;
+    size_t i, max_transmissions, num_inds, max_inds;
+    double t;
+    tsk_id_t ind, parent;
+    tsk_id_t *inds = NULL;
+    pedigree_t *pedigree = self->pedigree;
+    pedigree_transmission_t *transmissions = NULL;
+    pedigree_transmission_t *tr;
+    pedigree_workspace_t *workspaces = NULL;
+    avl_tree_t *segments;
+    const size_t num_workspaces = self->pedigree_num_threads;
+
+    max_transmissions = 0;
+    max_inds = 0;
+    workspaces = calloc(num_workspaces, sizeof(*workspaces));
+    if (workspaces == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    for (i = 0; i < num_workspaces; i++) {
+        ret = pedigree_workspace_init(&workspaces[i], self->segment_block_size);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+
+    while (msp_pedigree_get_num_queued(self) > 0) {
+        t = msp_pedigree_get_next_time(self);
+        tsk_bug_assert(t >= self->time);
+        self->time = t;
+        num_transmissions = 0;
+        num_inds = 0;
+        while (msp_pedigree_get_num_queued(self) > 0
+               && msp_pedigree_get_next_time(self) == t) {
+            ret = msp_pedigree_pop_ind(self, &ind);
+            if (ret != 0) {
+                goto out;
+            }
+            tsk_bug_assert(pedigree->segments[ind] != NULL);
+            ret = msp_expand_array((void **) &inds, &max_inds, num_inds, sizeof(*inds));
+            if (ret != 0) {
+                goto out;
+            }
+            inds[num_inds] = ind;
+            num_inds++;
+            for (i = 0; i < self->ploidy; i++) {
+                parent = pedigree->parents[(size_t) ind * self->ploidy + i];
+                if (parent != TSK_NULL && t >= pedigree->time[parent]) {
+                    ret = MSP_ERR_TIME_TRAVEL;
+                    goto out;
+                }
+                segments = pedigree->segments[ind] + i;
+                if (avl_count(segments) == 0) {
+                    continue;
+                }
+                ret = msp_expand_array((void **) &transmissions, &max_transmissions,
+                    (size_t) num_transmissions, sizeof(*transmissions));
+                if (ret != 0) {
+                    goto out;
+                }
+                tr = &transmissions[num_transmissions];
+                memset(tr, 0, sizeof(*tr));
+                tr->parent = parent;
+                tr->segments = segments;
+                if (parent != TSK_NULL) {
+                    tr->seed = gsl_rng_get(self->rng);
+                }
+                num_transmissions++;
+            }
+        }
+        for (i = 0; i < num_workspaces; i++) {
+            merge_buffer_clear(&workspaces[i].merge);
+        }
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads((int) num_workspaces) schedule(dynamic, 16)
+#endif
+        for (j = 0; j < num_transmissions; j++) {
+            int thread = 0;
+            pedigree_transmission_t *trans = &transmissions[j];
+#ifdef _OPENMP
+            thread = omp_get_thread_num();
+#endif
+            trans->thread = (size_t) thread;
+            trans->ret = msp_pedigree_run_transmission(self, &workspaces[thread], trans);
+        }
+
+        for (j = 0; j < num_transmissions; j++) {
+            if (transmissions[j].ret != 0) {
+                ret = transmissions[j].ret;
+                goto out;
+            }
+        }
+        /* All of these individuals' material has now moved on */
+        for (i = 0; i < num_inds; i++) {
+            msp_pedigree_free_segments(self, inds[i]);
+        }
+        for (j = 0; j < num_transmissions; j++) {
+            tr = &transmissions[j];
+            ret = msp_pedigree_commit_transmission(self, &workspaces[tr->thread], tr);
+            if (ret != 0) {
+                goto out;
+            }
+        }
+    }
+out:
+    if (workspaces != NULL) {
+        for (i = 0; i < num_workspaces; i++) {
+            pedigree_workspace_free(&workspaces[i]);
+        }
+        free(workspaces);
+    }
+    msp_safe_free(transmissions);
+    msp_safe_free(inds);
+    return ret;
+}
+
 static int MSP_WARN_UNUSED
 msp_pedigree_climb(msp_t *self)
 {
     int ret, ix;
     size_t i, j;
-    tsk_id_t parent_id;
-    individual_t *ind = NULL;
-    individual_t *parent = NULL;
+    tsk_id_t ind, parent;
+    pedigree_t *pedigree = self->pedigree;
     segment_t *merged_segment = NULL;
     segment_t *u[2]; // Will need to update for different ploidy
     avl_tree_t *segments = NULL;
 
     tsk_bug_assert(self->num_populations == 1);
-    tsk_bug_assert(avl_count(&self->pedigree->ind_heap) > 0);
+    tsk_bug_assert(msp_pedigree_get_num_queued(self) > 0);
     tsk_bug_assert(self->pedigree->state == MSP_PED_STATE_UNCLIMBED);
 
     self->pedigree->state = MSP_PED_STATE_CLIMBING;
 
-    while (avl_count(&self->pedigree->ind_heap) > 0) {
+    if (self->pedigree_num_threads > 1) {
+        /* Empties the queue, so that the serial loop below does nothing */
+        ret = msp_pedigree_climb_generations(self);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    while (msp_pedigree_get_num_queued(self) > 0) {
         /* NOTE: We don't yet support early termination - need to properly
          handle moving segments back into population (or possibly keep them
          there in the first place) before we can handle that */
@@ -4288,16 +5713,17 @@ msp_pedigree_climb(msp_t *self)
         if (ret != 0) {
             goto out;
         }
-        tsk_bug_assert(ind->time >= self->time);
-        self->time = ind->time;
+        tsk_bug_assert(pedigree->time[ind] >= self->time);
+        tsk_bug_assert(pedigree->segments[ind] != NULL);
+        self->time = pedigree->time[ind];
 
         for (i = 0; i < self->ploidy; i++) {
-            parent = ind->parents[i];
-            if (parent != NULL && ind->time >= parent->time) {
+            parent = pedigree->parents[(size_t) ind * self->ploidy + i];
+            if (parent != TSK_NULL && pedigree->time[ind] >= pedigree->time[parent]) {
                 ret = MSP_ERR_TIME_TRAVEL;
                 goto out;
             }
-            segments = ind->segments + i;
+            segments = pedigree->segments[ind] + i;
 
             /* This parent may not have contributed any ancestral material
              * to the samples */
@@ -4305,14 +5731,9 @@ msp_pedigree_climb(msp_t *self)
                 continue;
             }
 
-            parent_id = TSK_NULL;
-            if (parent != NULL) {
-                parent_id = parent->id;
-            }
-
             /* Merge segments inherited from this ind and recombine */
             // TODO: Make sure population gets properly set when more than one
-            ret = msp_merge_ancestors(self, segments, 0, 0, &merged_segment, parent_id);
+            ret = msp_merge_ancestors(self, segments, 0, 0, &merged_segment, parent);
             if (ret != 0) {
                 goto out;
             }
@@ -4325,7 +5746,7 @@ msp_pedigree_climb(msp_t *self)
 
             /* If parent is NULL, we are at a pedigree founder and we add the
              * lineage back to its original population */
-            if (parent == NULL) {
+            if (parent == TSK_NULL) {
                 ret = msp_insert_individual(self, merged_segment);
                 if (ret != 0) {
                     goto out;
@@ -4335,7 +5756,9 @@ msp_pedigree_climb(msp_t *self)
 
             /* Recombine and climb to segments to the parents */
             if (rate_map_get_total_mass(&self->recomb_map) > 0) {
-                ret = msp_dtwf_recombine(self, merged_segment, &u[0], &u[1]);
+                ret = msp_dtwf_recombine(self, merged_segment,
+                    msp_dtwf_generate_breakpoint(self, merged_segment->left), NULL, NULL,
+                    &u[0], &u[1]);
                 if (ret != 0) {
                     goto out;
                 }
@@ -4355,19 +5778,20 @@ msp_pedigree_climb(msp_t *self)
                     goto out;
                 }
             }
-            if (parent->queued == false) {
+            if (!pedigree->queued[parent]) {
                 ret = msp_pedigree_push_ind(self, parent);
                 if (ret != 0) {
                     goto out;
                 }
             }
         }
-        ind->merged = true;
+        /* All of this individual's material has now moved on */
+        msp_pedigree_free_segments(self, ind);
     }
     self->pedigree->state = MSP_PED_STATE_CLIMB_COMPLETE;
 
-    if (self->next_demographic_event != NULL
-        && self->next_demographic_event->time <= self->time) {
+    if (self->next_demographic_event < self->num_demographic_events
+        && self->demographic_events[self->next_demographic_event].time <= self->time) {
         /* We can't have demographic events happening during the
          * pedigree sim */
         ret = MSP_ERR_UNSUPPORTED_OPERATION;
@@ -4378,28 +5802,523 @@ out:
     return ret;
 }
 
-/* List structure for collecting segments by parent */
+/* Generation skipping for the DTWF.
+ *
+ * A generation is "quiet" if no lineage migrates, the lineages within each
+ * population all choose distinct parents and no lineage has a breakpoint
+ * within its ancestral material. Quiet generations leave the state of the
+ * simulation unchanged, so while the model parameters are constant we can
+ * skip a run of them exactly by drawing its length from a geometric
+ * distribution and then simulating the next generation conditional on it
+ * not being quiet. To condition, we choose the first source of events in
+ * the order (migration, coalescence, recombination) and then by population.
+ * Sources before it are forced to be quiet, it is forced to produce at least
+ * one event, and everything after it is simulated as usual.
+ */
+typedef struct {
+    int type;
+    population_id_t population;
+    /* For recombination, the index of the first recombining lineage within
+     * the population. */
+    size_t lineage;
+} dtwf_condition_t;
+
+/* Draws the number of lineages migrating from population j into each of the
+ * other populations conditional on there being at least one migrant. The
+ * index of the first migrant follows a truncated geometric distribution,
+ * and the lineages after it migrate independently. */
+static void
+msp_dtwf_conditional_migration(msp_t *self, uint32_t j, unsigned int num_lineages,
+    const double *mig_prob, unsigned int *n)
+{
+    uint32_t k, dest;
+    unsigned int first = 0;
+    double m = 1 - mig_prob[j];
+    double u;
+
+    tsk_bug_assert(num_lineages > 0 && m > 0);
+    if (m < 1) {
+        u = gsl_rng_uniform(self->rng);
+        first = (unsigned int) floor(
+            log1p(u * expm1(num_lineages * log1p(-m))) / log1p(-m));
+        first = GSL_MIN(first, num_lineages - 1);
+    }
+    gsl_ran_multinomial(
+        self->rng, self->num_populations, num_lineages - first - 1, mig_prob, n);
+
+    u = gsl_rng_uniform(self->rng) * m;
+    dest = j;
+    for (k = 0; k < self->num_populations; k++) {
+        if (k != j && mig_prob[k] > 0) {
+            dest = k;
+            if (u < mig_prob[k]) {
+                break;
+            }
+            u -= mig_prob[k];
+        }
+    }
+    tsk_bug_assert(dest != j);
+    n[dest]++;
+}
+
+/* Computes the log probabilities that each population is quiet in the next
+ * generation with respect to migration, coalescence and recombination,
+ * storing them in log_quiet[j], log_quiet[P + j] and log_quiet[2P + j]
+ * for P populations. If the population sizes are not constant, or the
+ * next generation would raise an error, skippable is set to false. */
+static void
+msp_dtwf_get_log_quiet_probabilities(msp_t *self, double *log_quiet, bool *skippable)
+{
+    uint32_t j, k, i, n, P;
+    double N, mig_sum;
+    population_t *pop;
+    avl_node_t *a;
+    label_id_t label = 0;
+
+    P = self->num_populations;
+    *skippable = true;
+    for (j = 0; j < P; j++) {
+        pop = &self->populations[j];
+        n = avl_count(&pop->ancestors[label]);
+        log_quiet[j] = 0;
+        log_quiet[P + j] = 0;
+        log_quiet[2 * P + j] = 0;
+        if (n == 0) {
+            continue;
+        }
+        N = round(get_population_size(pop, self->time));
+        mig_sum = 0;
+        for (k = 0; k < P; k++) {
+            mig_sum += self->migration_matrix[j * P + k];
+        }
+        if (pop->growth_rate != 0 || N == 0 || mig_sum > 1) {
+            *skippable = false;
+            break;
+        }
+        log_quiet[j] = n * log1p(-mig_sum);
+        for (i = 1; i < n; i++) {
+            if (i >= N) {
+                log_quiet[P + j] = -INFINITY;
+                break;
+            }
+            log_quiet[P + j] += log1p(-i / N);
+        }
+        if (rate_map_get_total_mass(&self->recomb_map) > 0) {
+            for (a = pop->ancestors[label].head; a != NULL; a = a->next) {
+                log_quiet[2 * P + j]
+                    -= msp_dtwf_get_recombination_mass(self, (segment_t *) a->item);
+            }
+        }
+    }
+}
+
+/* Skips over the quiet generations before the next eventful one, and sets
+ * the condition that must be applied to the next generation. */
+static int MSP_WARN_UNUSED
+msp_dtwf_skip_quiet_generations(
+    msp_t *self, double max_time, double *log_quiet, dtwf_condition_t *condition)
+{
+    int ret = 0;
+    uint32_t P = self->num_populations;
+    uint32_t c, chosen;
+    size_t l;
+    bool skippable;
+    double limit, max_skip, num_quiet, log_p, prefix, u, w, mass;
+    avl_node_t *a;
+    label_id_t label = 0;
+
+    condition->type = MSP_DTWF_EVENT_ANY;
+    /* The model parameters are constant for generations before the next
+     * demographic event. Samples are added at the end of the first
+     * generation at or after their time, which must therefore be run. */
+    limit = max_time;
+    if (self->next_demographic_event < self->num_demographic_events) {
+        limit = GSL_MIN(
+            limit, self->demographic_events[self->next_demographic_event].time);
+    }
+    if (self->next_sampling_event < self->num_sampling_events) {
+        limit = GSL_MIN(limit, self->sampling_events[self->next_sampling_event].time);
+    }
+    max_skip = ceil(limit - self->time) - 1;
+    if (max_skip < 1) {
+        goto out;
+    }
+    msp_dtwf_get_log_quiet_probabilities(self, log_quiet, &skippable);
+    if (!skippable) {
+        goto out;
+    }
+    log_p = 0;
+    for (c = 0; c < 3 * P; c++) {
+        log_p += log_quiet[c];
+    }
+    if (log_p == -INFINITY) {
+        goto out;
+    }
+    num_quiet = max_skip;
+    if (log_p < 0) {
+        num_quiet = floor(log(gsl_rng_uniform_pos(self->rng)) / log_p);
+    }
+    if (num_quiet >= max_skip) {
+        /* All generations up to the limit are quiet, and the next generation
+         * is unconditioned. */
+        self->time += max_skip;
+        goto out;
+    }
+    self->time += num_quiet;
+
+    /* Choose the first source of events */
+    u = gsl_rng_uniform(self->rng) * -expm1(log_p);
+    prefix = 0;
+    chosen = 3 * P;
+    for (c = 0; c < 3 * P; c++) {
+        w = exp(prefix) * -expm1(log_quiet[c]);
+        if (w > 0) {
+            chosen = c;
+            if (u < w) {
+                break;
+            }
+            u -= w;
+        }
+        prefix += log_quiet[c];
+    }
+    tsk_bug_assert(chosen < 3 * P);
+    condition->type = MSP_DTWF_EVENT_MIGRATION + (int) (chosen / P);
+    condition->population = (population_id_t)(chosen % P);
+    if (condition->type == MSP_DTWF_EVENT_RECOMBINATION) {
+        /* Choose the first recombining lineage in the same way */
+        u = gsl_rng_uniform(self->rng) * -expm1(log_quiet[chosen]);
+        prefix = 0;
+        l = 0;
+        condition->lineage = 0;
+        for (a = self->populations[condition->population].ancestors[label].head;
+             a != NULL; a = a->next) {
+            mass = msp_dtwf_get_recombination_mass(self, (segment_t *) a->item);
+            w = exp(prefix) * -expm1(-mass);
+            if (w > 0) {
+                condition->lineage = l;
+                if (u < w) {
+                    break;
+                }
+                u -= w;
+            }
+            prefix -= mass;
+            l++;
+        }
+    }
+out:
+    return ret;
+}
+
+/* List structure for collecting segments by parent. Each element also
+ * records the transmission of the lineage to its parent: the range of its
+ * breakpoints within the population's plan and the resulting lineages on
+ * the two parental chromosomes. */
 typedef struct _segment_list_t {
     avl_node_t *node;
+    uint32_t parent;
+    int first_parent;
+    size_t first_breakpoint;
+    size_t num_breakpoints;
+    segment_t *chromosome[2];
     struct _segment_list_t *next;
 } segment_list_t;
 
-/* Performs a single generation under the Wright Fisher model */
+/* The parents chosen by the lineages of a population in one DTWF generation.
+ * Lineages sharing a parent are linked into a family, and the families are
+ * stored in the order of their parents. The breakpoints of all lineages
+ * are stored consecutively in the plan, and when running on more than one
+ * thread the segments needed to carry them out are reserved in the
+ * buffer. */
+typedef struct {
+    uint32_t N;
+    size_t num_lineages;
+    segment_list_t *lineages;
+    segment_list_t **families;
+    size_t num_families;
+    size_t num_ca_events;
+    recomb_plan_t plan;
+    recomb_buffer_t buffer;
+    int ret;
+} dtwf_parents_t;
+
+static int
+cmp_family(const void *a, const void *b)
+{
+    const segment_list_t *ia = *(segment_list_t *const *) a;
+    const segment_list_t *ib = *(segment_list_t *const *) b;
+    return (ia->parent > ib->parent) - (ia->parent < ib->parent);
+}
+
+/* Chooses a parent for each lineage in population j. This does not modify
+ * the simulation state, so populations can be processed concurrently
+ * given independent random generators and scratch arrays. The scratch
+ * array must have at least N elements, all NULL, and is left in this
+ * state on return. */
+static void
+msp_dtwf_choose_parents(msp_t *self, uint32_t j, gsl_rng *rng,
+    const dtwf_condition_t *condition, segment_list_t **parents,
+    dtwf_parents_t *result)
+{
+    uint32_t k, p;
+    size_t i;
+    bool distinct_parents, force_collision;
+    double log_distinct;
+    const uint32_t N = result->N;
+    segment_list_t *s;
+    avl_node_t *a;
+    label_id_t label = 0;
+
+    distinct_parents = condition->type == MSP_DTWF_EVENT_RECOMBINATION
+                       || (condition->type == MSP_DTWF_EVENT_COALESCENCE
+                              && (population_id_t) j < condition->population);
+    force_collision = condition->type == MSP_DTWF_EVENT_COALESCENCE
+                      && (population_id_t) j == condition->population;
+    /* The log probability that the remaining lineages choose distinct
+     * parents, given that the previous ones did. */
+    log_distinct = 0;
+    if (force_collision) {
+        for (i = 1; i < result->num_lineages; i++) {
+            log_distinct += log1p(-(double) i / N);
+        }
+    }
+
+    result->num_ca_events = 0;
+    i = 0;
+    for (a = self->populations[j].ancestors[label].head; a != NULL; a = a->next) {
+        s = result->lineages + i;
+        if (force_collision
+            && gsl_rng_uniform(rng) * -expm1(log_distinct) < (double) i / N) {
+            /* Choose the parent of a previous lineage */
+            k = (uint32_t) gsl_rng_uniform_int(rng, i);
+            p = result->lineages[k].parent;
+            force_collision = false;
+        } else if (distinct_parents || force_collision) {
+            do {
+                p = (uint32_t) gsl_rng_uniform_int(rng, N);
+            } while (parents[p] != NULL);
+            log_distinct -= log1p(-(double) i / N);
+        } else {
+            p = (uint32_t) gsl_rng_uniform_int(rng, N);
+        }
+        i++;
+        if (parents[p] != NULL) {
+            result->num_ca_events++;
+        }
+        s->next = parents[p];
+        s->node = a;
+        s->parent = p;
+        parents[p] = s;
+    }
+
+    /* Collect the families, clearing the scratch array as we go */
+    result->num_families = 0;
+    for (i = 0; i < result->num_lineages; i++) {
+        p = result->lineages[i].parent;
+        if (parents[p] != NULL) {
+            result->families[result->num_families] = parents[p];
+            result->num_families++;
+            parents[p] = NULL;
+        }
+    }
+    qsort(result->families, result->num_families, sizeof(*result->families),
+        cmp_family);
+}
+
+/* Draws the transmissions of the lineages in population j to their
+ * parents, appending the breakpoints to the population's plan. Like
+ * msp_dtwf_choose_parents, this does not modify the simulation state. */
 static int MSP_WARN_UNUSED
-msp_dtwf_generation(msp_t *self)
+msp_dtwf_plan_transmissions(msp_t *self, uint32_t j, gsl_rng *rng,
+    const dtwf_condition_t *condition, dtwf_parents_t *result)
+{
+    int ret = 0;
+    size_t f, i;
+    bool quiet_lineage, conditional;
+    segment_list_t *s;
+    const bool recombination = rate_map_get_total_mass(&self->recomb_map) > 0;
+    const bool condition_recomb = condition->type == MSP_DTWF_EVENT_RECOMBINATION;
+
+    result->plan.num_breakpoints = 0;
+    for (f = 0; f < result->num_families; f++) {
+        for (s = result->families[f]; s != NULL; s = s->next) {
+            i = (size_t)(s - result->lineages);
+            /* Lineages before the first recombining one do not recombine */
+            quiet_lineage = condition_recomb
+                            && ((population_id_t) j < condition->population
+                                   || ((population_id_t) j == condition->population
+                                          && i < condition->lineage));
+            conditional = condition_recomb
+                          && (population_id_t) j == condition->population
+                          && i == condition->lineage;
+            s->first_breakpoint = result->plan.num_breakpoints;
+            // TODO Should this be the recombination rate going foward from x.left?
+            if (recombination && !quiet_lineage) {
+                ret = msp_dtwf_plan_recombination(self, (segment_t *) s->node->item,
+                    rng, conditional, &result->plan);
+                if (ret != 0) {
+                    goto out;
+                }
+            } else {
+                result->plan.first_parent = (int) gsl_rng_uniform_int(rng, 2);
+            }
+            s->first_parent = result->plan.first_parent;
+            s->num_breakpoints = result->plan.num_breakpoints - s->first_breakpoint;
+        }
+    }
+out:
+    return ret;
+}
+
+/* Carries out the planned transmission of lineage s in a population. New
+ * segments are taken from the buffer, or from the main heap if it is NULL. */
+static int MSP_WARN_UNUSED
+msp_dtwf_transmit_lineage(
+    msp_t *self, dtwf_parents_t *result, segment_list_t *s, recomb_buffer_t *buffer)
+{
+    int ret = 0;
+    segment_t *x = (segment_t *) s->node->item;
+    recomb_plan_t plan;
+
+    s->chromosome[0] = NULL;
+    s->chromosome[1] = NULL;
+    if (s->num_breakpoints == 0) {
+        s->chromosome[s->first_parent] = x;
+        goto out;
+    }
+    plan.first_parent = s->first_parent;
+    plan.breakpoints = result->plan.breakpoints + s->first_breakpoint;
+    plan.num_breakpoints = s->num_breakpoints;
+    plan.max_breakpoints = 0;
+    ret = msp_dtwf_recombine(
+        self, x, 0, &plan, buffer, &s->chromosome[0], &s->chromosome[1]);
+out:
+    return ret;
+}
+
+/* Carries out the planned transmissions of the lineages in a population,
+ * taking new segments from the population's buffer. Only the segments of
+ * the population's lineages are modified. */
+static int MSP_WARN_UNUSED
+msp_dtwf_transmit(msp_t *self, dtwf_parents_t *result)
+{
+    int ret = 0;
+    size_t i;
+
+    for (i = 0; i < result->num_lineages; i++) {
+        ret = msp_dtwf_transmit_lineage(
+            self, result, result->lineages + i, &result->buffer);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+out:
+    return ret;
+}
+
+/* Chooses the parents for all populations and, when running on more than
+ * one thread, transmits the lineages to them. Each population then draws
+ * from its own random generator, so that the output depends only on the
+ * seed and not on the number of threads or on scheduling. The work for
+ * each population is done in parallel, apart from reserving segments from
+ * the main heap and updating the recombination mass index, which are done
+ * serially in population order so that segment IDs are reproducible.
+ *
+ * On a single thread all draws are made from the main generator in the
+ * same order as when each population is processed in turn, and the
+ * lineages are transmitted as their families are merged, so that the
+ * output is the same as that of the serial algorithm. The scratch array
+ * holds max_N elements for each thread. */
+static int MSP_WARN_UNUSED
+msp_dtwf_transmit_all(msp_t *self, const dtwf_condition_t *condition,
+    dtwf_parents_t *pop_parents, segment_list_t **scratch, uint32_t max_N)
+{
+    int ret = 0;
+    int j;
+    const int num_populations = (int) self->num_populations;
+    const bool threaded = self->dtwf_num_threads > 1;
+    /* Only support single structured coalescent label for now. */
+    label_id_t label = 0;
+
+    if (threaded && self->dtwf_rngs == NULL) {
+        /* The number of threads was set after the simulator was reset */
+        ret = msp_reset_dtwf_rngs(self);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(                                                   \
+        (int) GSL_MIN(self->dtwf_num_threads, self->num_populations)) schedule(dynamic)
+#endif
+    for (j = 0; j < num_populations; j++) {
+        int thread = 0;
+        gsl_rng *rng = threaded ? self->dtwf_rngs[j] : self->rng;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+#endif
+        if (pop_parents[j].num_lineages > 0) {
+            msp_dtwf_choose_parents(self, (uint32_t) j, rng, condition,
+                scratch + (size_t) thread * max_N, &pop_parents[j]);
+            pop_parents[j].ret = msp_dtwf_plan_transmissions(
+                self, (uint32_t) j, rng, condition, &pop_parents[j]);
+        }
+    }
+    for (j = 0; j < num_populations; j++) {
+        if (pop_parents[j].ret != 0) {
+            ret = pop_parents[j].ret;
+            goto out;
+        }
+    }
+    if (!threaded) {
+        goto out;
+    }
+    for (j = 0; j < num_populations; j++) {
+        ret = msp_reserve_recombinations(
+            self, &pop_parents[j].buffer, pop_parents[j].plan.num_breakpoints, label);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(                                                   \
+        (int) GSL_MIN(self->dtwf_num_threads, self->num_populations)) schedule(dynamic)
+#endif
+    for (j = 0; j < num_populations; j++) {
+        if (pop_parents[j].num_lineages > 0) {
+            pop_parents[j].ret = msp_dtwf_transmit(self, &pop_parents[j]);
+        }
+    }
+    for (j = 0; j < num_populations; j++) {
+        if (pop_parents[j].ret != 0) {
+            ret = pop_parents[j].ret;
+            goto out;
+        }
+        msp_commit_recombinations(self, &pop_parents[j].buffer);
+    }
+out:
+    return ret;
+}
+
+/* Performs a single generation under the Wright Fisher model, subject to
+ * the specified condition. When running on more than one thread, the
+ * lineages in all populations are first transmitted to their parents in
+ * parallel. The families are then merged serially in population order,
+ * because all populations share the node table, the edge buffer and the
+ * overlap counts used to detect the MRCA. */
+static int MSP_WARN_UNUSED
+msp_dtwf_generation(msp_t *self, const dtwf_condition_t *condition)
 {
     int ret = 0;
-    int ix;
     unsigned int segments_to_merge;
-    uint32_t N, i, j, k, p;
-    size_t segment_mem_offset;
+    uint32_t N, max_N, i, j;
+    size_t f, offset, num_scratch;
     population_t *pop;
     segment_t *x, *ind1, *ind2;
-    segment_t *u[2];
-    segment_list_t **parents = NULL;
+    dtwf_parents_t *pop_parents = NULL;
+    segment_list_t **scratch = NULL;
     segment_list_t *segment_mem = NULL;
+    segment_list_t **family_mem = NULL;
     segment_list_t *s;
-    avl_node_t *a, *node;
     avl_tree_t Q[2];
     /* Only support single structured coalescent label for now. */
     label_id_t label = 0;
@@ -4408,10 +6327,19 @@ msp_dtwf_generation(msp_t *self)
         avl_init_tree(&Q[i], cmp_segment_queue, NULL);
     }
 
+    pop_parents = calloc(self->num_populations, sizeof(*pop_parents));
+    segment_mem = malloc(msp_get_num_ancestors(self) * sizeof(*segment_mem));
+    family_mem = malloc(msp_get_num_ancestors(self) * sizeof(*family_mem));
+    if (pop_parents == NULL || segment_mem == NULL || family_mem == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    offset = 0;
+    max_N = 0;
     for (j = 0; j < self->num_populations; j++) {
-
         pop = &self->populations[j];
-        if (avl_count(&pop->ancestors[label]) == 0) {
+        pop_parents[j].num_lineages = avl_count(&pop->ancestors[label]);
+        if (pop_parents[j].num_lineages == 0) {
             continue;
         }
         /* For the DTWF, N for each population is the reference population size
@@ -4424,58 +6352,49 @@ msp_dtwf_generation(msp_t *self)
             ret = MSP_ERR_DTWF_ZERO_POPULATION_SIZE;
             goto out;
         }
+        pop_parents[j].N = N;
+        pop_parents[j].lineages = segment_mem + offset;
+        pop_parents[j].families = family_mem + offset;
+        offset += pop_parents[j].num_lineages;
+        max_N = GSL_MAX(max_N, N);
+    }
 
-        // Allocate memory for linked list of offspring per parent
-        parents = calloc(N, sizeof(segment_list_t *));
-        segment_mem = malloc(msp_get_num_ancestors(self) * sizeof(segment_list_t));
-        if (parents == NULL || segment_mem == NULL) {
-            ret = MSP_ERR_NO_MEMORY;
-            goto out;
-        }
-        // Iterate through ancestors and draw parents
-        segment_mem_offset = 0;
-        for (a = pop->ancestors[label].head; a != NULL; a = a->next) {
-            s = segment_mem + segment_mem_offset;
-            segment_mem_offset++;
-            p = (uint32_t) gsl_rng_uniform_int(self->rng, N);
-            if (parents[p] != NULL) {
-                self->num_ca_events++;
-            }
-            s->next = parents[p];
-            s->node = a;
-            parents[p] = s;
-        }
+    // Allocate memory for linked list of offspring per parent
+    num_scratch = GSL_MIN(self->dtwf_num_threads, self->num_populations);
+    scratch = calloc(num_scratch * (size_t) max_N, sizeof(*scratch));
+    if (scratch == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    ret = msp_dtwf_transmit_all(self, condition, pop_parents, scratch, max_N);
+    if (ret != 0) {
+        goto out;
+    }
 
-        // Iterate through offspring of parent k, adding to avl_tree
-        for (k = 0; k < N; k++) {
-            for (s = parents[k]; s != NULL; s = s->next) {
-                node = s->node;
-                x = (segment_t *) node->item;
-                // Recombine ancestor
-                // TODO Should this be the recombination rate going foward from x.left?
-                if (rate_map_get_total_mass(&self->recomb_map) > 0) {
-                    ret = msp_dtwf_recombine(self, x, &u[0], &u[1]);
+    for (j = 0; j < self->num_populations; j++) {
+        self->num_ca_events += pop_parents[j].num_ca_events;
+        // Iterate through offspring of each parent, adding to avl_tree
+        for (f = 0; f < pop_parents[j].num_families; f++) {
+            for (s = pop_parents[j].families[f]; s != NULL; s = s->next) {
+                x = (segment_t *) s->node->item;
+                if (self->dtwf_num_threads == 1) {
+                    ret = msp_dtwf_transmit_lineage(self, &pop_parents[j], s, NULL);
                     if (ret != 0) {
                         goto out;
                     }
-                    for (i = 0; i < 2; i++) {
-                        if (u[i] != NULL && u[i] != x) {
-                            ret = msp_insert_individual(self, u[i]);
-                            if (ret != 0) {
-                                goto out;
-                            }
+                }
+                for (i = 0; i < 2; i++) {
+                    if (s->chromosome[i] != NULL && s->chromosome[i] != x) {
+                        ret = msp_insert_individual(self, s->chromosome[i]);
+                        if (ret != 0) {
+                            goto out;
                         }
                     }
-                } else {
-                    ix = (int) gsl_rng_uniform_int(self->rng, 2);
-                    u[0] = NULL;
-                    u[1] = NULL;
-                    u[ix] = x;
                 }
                 // Add to AVLTree for each parental chromosome
                 for (i = 0; i < 2; i++) {
-                    if (u[i] != NULL) {
-                        ret = msp_priority_queue_insert(self, &Q[i], u[i]);
+                    if (s->chromosome[i] != NULL) {
+                        ret = msp_priority_queue_insert(self, &Q[i], s->chromosome[i]);
                         if (ret != 0) {
                             goto out;
                         }
@@ -4504,61 +6423,60 @@ msp_dtwf_generation(msp_t *self)
                 }
             }
         }
-        free(parents);
-        free(segment_mem);
-        segment_mem = NULL;
-        parents = NULL;
     }
 out:
-    msp_safe_free(parents);
+    if (pop_parents != NULL) {
+        for (j = 0; j < self->num_populations; j++) {
+            msp_safe_free(pop_parents[j].plan.breakpoints);
+            recomb_buffer_free(&pop_parents[j].buffer);
+        }
+    }
+    msp_safe_free(pop_parents);
+    msp_safe_free(scratch);
     msp_safe_free(segment_mem);
+    msp_safe_free(family_mem);
     return ret;
 }
 
-static int MSP_WARN_UNUSED
-msp_store_simultaneous_migration_events(
-    msp_t *self, avl_tree_t *nodes, population_id_t source_pop, label_id_t label)
+/* Removes num_migrants lineages chosen uniformly at random from the
+ * source population, appending their AVL nodes to the specified buffer.
+ * The nodes are unlinked but not freed, so that they can be spliced
+ * directly into the destination population once all populations have
+ * chosen their migrants. */
+static void
+msp_dtwf_choose_migrants(
+    msp_t *self, avl_tree_t *source, uint32_t num_migrants, avl_node_t **migrants)
 {
-    int ret = 0;
     uint32_t j;
+    unsigned int index;
     avl_node_t *node;
-    avl_tree_t *source;
-
-    source = &self->populations[source_pop].ancestors[label];
-
-    // Choose node to migrate
-    j = (uint32_t) gsl_rng_uniform_int(self->rng, avl_count(source));
-    node = avl_at(source, j);
-    tsk_bug_assert(node != NULL);
-
-    avl_unlink_node(source, node);
-    node = avl_insert_node(nodes, node);
-    tsk_bug_assert(node != NULL);
 
-    return ret;
+    for (j = 0; j < num_migrants; j++) {
+        index = (unsigned int) gsl_rng_uniform_int(self->rng, avl_count(source));
+        node = avl_at(source, index);
+        tsk_bug_assert(node != NULL);
+        msp_unlink_ancestor(self, source, node);
+        migrants[j] = node;
+    }
 }
 
+/* Moves the individual in the specified unlinked AVL node into dest_pop,
+ * reusing the node and the individual's segments. */
 static int MSP_WARN_UNUSED
-msp_simultaneous_migration_event(
-    msp_t *self, avl_tree_t *nodes, population_id_t source_pop, population_id_t dest_pop)
+msp_dtwf_splice_migrant(msp_t *self, avl_node_t *node, population_id_t dest_pop)
 {
     int ret = 0;
-    avl_node_t *node;
+    segment_t *ind = (segment_t *) node->item;
     size_t index;
-    label_id_t label = 0; /* For now only support label 0 */
 
-    index = ((size_t) source_pop) * self->num_populations + (size_t) dest_pop;
+    index = ((size_t) ind->population) * self->num_populations + (size_t) dest_pop;
     self->num_migration_events[index]++;
-
-    // Iterate through nodes in tree and move to new pop
-    // -- removed from "nodes" in msp_move_individual()
-    while (avl_count(nodes) > 0) {
-        node = nodes->head;
-        ret = msp_move_individual(self, node, nodes, dest_pop, label);
-        if (ret != 0) {
-            goto out;
-        }
+    ret = msp_migrate_segments(self, ind, dest_pop);
+    if (ret != 0) {
+        goto out;
     }
+    node = msp_link_ancestor(self, node);
+    tsk_bug_assert(node != NULL);
 out:
     return ret;
 }
@@ -4578,19 +6496,25 @@ msp_run_dtwf(msp_t *self, double max_time, unsigned long max_events)
 {
     int ret = 0;
     unsigned long events = 0;
-    int mig_source_pop, mig_dest_pop;
     sampling_event_t *se;
     uint32_t j, k, i, N;
+    size_t l, num_ancestors, num_migrants;
+    size_t max_migrants = 0;
     unsigned int *n = NULL;
     double *mig_tmp = NULL;
+    double *log_quiet = NULL;
     double sum, cur_time;
-    avl_tree_t *node_trees = NULL;
-    avl_tree_t *nodes;
+    avl_node_t **migrants = NULL;
+    population_id_t *migrant_dest = NULL;
+    avl_tree_t *source;
+    dtwf_condition_t condition;
     /* Only support a single structured coalescent label at the moment */
     label_id_t label = 0;
 
-    tsk_bug_assert(self->recomb_mass_index == NULL);
-    tsk_bug_assert(self->gc_mass_index == NULL);
+    if (self->model.type == MSP_MODEL_DTWF) {
+        tsk_bug_assert(self->recomb_mass_index == NULL);
+        tsk_bug_assert(self->gc_mass_index == NULL);
+    }
     if (rate_map_get_total_mass(&self->gc_map) != 0.0) {
         /* Could be, we just haven't implemented it */
         ret = MSP_ERR_DTWF_GC_NOT_SUPPORTED;
@@ -4603,7 +6527,8 @@ msp_run_dtwf(msp_t *self, double max_time, unsigned long max_events)
 
     n = malloc(self->num_populations * sizeof(int));
     mig_tmp = malloc(self->num_populations * sizeof(double));
-    if (n == NULL || mig_tmp == NULL) {
+    log_quiet = malloc(3 * self->num_populations * sizeof(double));
+    if (n == NULL || mig_tmp == NULL || log_quiet == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
@@ -4614,6 +6539,13 @@ msp_run_dtwf(msp_t *self, double max_time, unsigned long max_events)
             break;
         }
         events++;
+        condition.type = MSP_DTWF_EVENT_ANY;
+        if (self->dtwf_generation_skipping) {
+            ret = msp_dtwf_skip_quiet_generations(self, max_time, log_quiet, &condition);
+            if (ret != 0) {
+                goto out;
+            }
+        }
         if (self->time + 1 >= max_time) {
             ret = MSP_EXIT_MAX_TIME;
             goto out;
@@ -4621,16 +6553,24 @@ msp_run_dtwf(msp_t *self, double max_time, unsigned long max_events)
         self->time++;
 
         /* Following SLiM, we perform migrations prior to selecting
-         * parents for the current generation */
-        node_trees
-            = malloc(self->num_populations * self->num_populations * sizeof(avl_tree_t));
-        if (node_trees == NULL) {
-            ret = MSP_ERR_NO_MEMORY;
-            goto out;
+         * parents for the current generation. The number of migrants
+         * from each population to each destination is a single
+         * multinomial draw; the chosen lineages are all removed before
+         * any are spliced into their destinations, so that a lineage
+         * migrates at most once per generation. */
+        num_ancestors = msp_get_num_ancestors(self);
+        if (num_ancestors > max_migrants) {
+            max_migrants = num_ancestors;
+            msp_safe_free(migrants);
+            msp_safe_free(migrant_dest);
+            migrants = malloc(max_migrants * sizeof(*migrants));
+            migrant_dest = malloc(max_migrants * sizeof(*migrant_dest));
+            if (migrants == NULL || migrant_dest == NULL) {
+                ret = MSP_ERR_NO_MEMORY;
+                goto out;
+            }
         }
-
-        mig_source_pop = 0;
-        mig_dest_pop = 0;
+        num_migrants = 0;
         for (j = 0; j < self->num_populations; j++) {
             // For proper sampling, we need to calculate the proportion
             // of non-migrants as well
@@ -4647,62 +6587,56 @@ msp_run_dtwf(msp_t *self, double max_time, unsigned long max_events)
                 ret = MSP_ERR_DTWF_MIGRATION_MATRIX_NOT_STOCHASTIC;
                 goto out;
             }
-
+            source = &self->populations[j].ancestors[label];
+            N = avl_count(source);
+            if (sum == 0 || N == 0) {
+                continue;
+            }
             mig_tmp[j] = 1 - sum;
-            N = avl_count(&self->populations[j].ancestors[label]);
-            gsl_ran_multinomial(self->rng, self->num_populations, N, mig_tmp, n);
+            if (condition.type == MSP_DTWF_EVENT_ANY
+                || (condition.type == MSP_DTWF_EVENT_MIGRATION
+                       && (population_id_t) j > condition.population)) {
+                gsl_ran_multinomial(self->rng, self->num_populations, N, mig_tmp, n);
+            } else if (condition.type == MSP_DTWF_EVENT_MIGRATION
+                       && (population_id_t) j == condition.population) {
+                msp_dtwf_conditional_migration(self, j, N, mig_tmp, n);
+            } else {
+                continue;
+            }
 
+            /* m[j, k] is the rate at which migrants move from
+             * population k to j forwards in time. Backwards
+             * in time, we move the individual from from
+             * population j into population k.
+             */
             for (k = 0; k < self->num_populations; k++) {
-                if (k == j) {
+                if (k == j || n[k] == 0) {
                     continue;
                 }
-                // Initialize an avl tree for this pair of populations
-                nodes = &node_trees[j * self->num_populations + k];
-                avl_init_tree(nodes, cmp_individual, NULL);
-
-                /* m[j, k] is the rate at which migrants move from
-                 * population k to j forwards in time. Backwards
-                 * in time, we move the individual from from
-                 * population j into population k.
-                 */
-                mig_source_pop = (population_id_t) j;
-                mig_dest_pop = (population_id_t) k;
-
+                msp_dtwf_choose_migrants(self, source, n[k], migrants + num_migrants);
                 for (i = 0; i < n[k]; i++) {
-                    ret = msp_store_simultaneous_migration_events(
-                        self, nodes, mig_source_pop, label);
-                    if (ret != 0) {
-                        goto out;
-                    }
+                    migrant_dest[num_migrants + i] = (population_id_t) k;
                 }
+                num_migrants += n[k];
             }
         }
-        for (j = 0; j < self->num_populations; j++) {
-            for (k = 0; k < self->num_populations; k++) {
-                if (k == j) {
-                    continue;
-                }
-                nodes = &node_trees[j * self->num_populations + k];
-                mig_source_pop = (population_id_t) j;
-                mig_dest_pop = (population_id_t) k;
-                ret = msp_simultaneous_migration_event(
-                    self, nodes, mig_source_pop, mig_dest_pop);
-                if (ret != 0) {
-                    goto out;
-                }
+        for (l = 0; l < num_migrants; l++) {
+            ret = msp_dtwf_splice_migrant(self, migrants[l], migrant_dest[l]);
+            if (ret != 0) {
+                goto out;
             }
         }
-        free(node_trees);
-        node_trees = NULL;
 
         /* Demographic events set the simulation time to the time of the event.
          * In the DTWF, this would prevent more than one event occurring per
          * generation, and throw off the time between generations. We avoid
          * this by saving the current time and returning to it. */
         cur_time = self->time;
-        while (self->next_demographic_event != NULL
-               && self->next_demographic_event->time <= cur_time) {
-            if (self->next_demographic_event->time >= max_time) {
+        while (self->next_demographic_event < self->num_demographic_events
+               && self->demographic_events[self->next_demographic_event].time
+                      <= cur_time) {
+            if (self->demographic_events[self->next_demographic_event].time
+                >= max_time) {
                 ret = MSP_EXIT_MAX_TIME;
                 goto out;
             }
@@ -4712,7 +6646,7 @@ msp_run_dtwf(msp_t *self, double max_time, unsigned long max_events)
             }
         }
         self->time = cur_time;
-        ret = msp_dtwf_generation(self);
+        ret = msp_dtwf_generation(self, &condition);
         if (ret != 0) {
             goto out;
         }
@@ -4730,9 +6664,65 @@ msp_run_dtwf(msp_t *self, double max_time, unsigned long max_events)
         }
     }
 out:
-    msp_safe_free(node_trees);
+    msp_safe_free(migrants);
+    msp_safe_free(migrant_dest);
     msp_safe_free(n);
     msp_safe_free(mig_tmp);
+    msp_safe_free(log_quiet);
+    return ret;
+}
+
+/* Returns true if the DTWF hybrid should switch to the coalescent: the
+ * simulation must have run for at least the specified duration, and the
+ * number of lineages in each population must be no more than
+ * max_lineage_ratio times its size. */
+static bool
+msp_dtwf_hybrid_switch_ready(msp_t *self)
+{
+    bool ret;
+    uint32_t j, n;
+    population_t *pop;
+    const dtwf_hybrid_t *params = &self->model.params.dtwf_hybrid;
+    label_id_t label = 0;
+
+    ret = self->time - self->start_time >= params->duration;
+    for (j = 0; j < self->num_populations && ret; j++) {
+        pop = &self->populations[j];
+        n = avl_count(&pop->ancestors[label]);
+        if (n > params->max_lineage_ratio * get_population_size(pop, self->time)) {
+            ret = false;
+        }
+    }
+    return ret;
+}
+
+/* Runs the DTWF one generation at a time until the switching criterion
+ * holds, and then continues under the standard coalescent. The mass indexes
+ * are kept up to date during the DTWF phase, so there is no need to rebuild
+ * them as msp_set_simulation_model would do.
+ */
+static int MSP_WARN_UNUSED
+msp_run_dtwf_hybrid(msp_t *self, double max_time, unsigned long max_events)
+{
+    int ret = 0;
+    unsigned long events = 0;
+
+    while (!msp_dtwf_hybrid_switch_ready(self)) {
+        if (events == max_events) {
+            ret = MSP_EXIT_MAX_EVENTS;
+            goto out;
+        }
+        events++;
+        ret = msp_run_dtwf(self, max_time, 1);
+        if (ret != MSP_EXIT_MAX_EVENTS) {
+            goto out;
+        }
+    }
+    /* The common ancestor event functions are already set to the standard
+     * coalescent by msp_set_simulation_model */
+    self->model.type = MSP_MODEL_HUDSON;
+    ret = msp_run_coalescent(self, max_time, max_events - events);
+out:
     return ret;
 }
 
@@ -4854,63 +6844,313 @@ out:
     return ret;
 }
 
-static int
-msp_run_sweep(msp_t *self)
+/* Returns the integrated hazard of all events in a sweep up to the
+ * specified trajectory step, given the coefficients for the current
+ * numbers of lineages. Coefficients of zero are skipped so that they do
+ * not contribute to the hazard if the cumulative rate is infinite. */
+static double
+msp_sweep_get_hazard(const double *cum_coal_b, const double *cum_coal_B,
+    const double *time, double coal_b, double coal_B, double rec_rate, size_t step)
+{
+    double hazard = rec_rate * (time[step] - time[0]);
+
+    if (coal_b != 0) {
+        hazard += coal_b * cum_coal_b[step];
+    }
+    if (coal_B != 0) {
+        hazard += coal_B * cum_coal_B[step];
+    }
+    return hazard;
+}
+
+/* Returns the first trajectory step s >= start at which the hazard
+ * accumulated since step start - 1 is at least the specified value, or
+ * num_steps if there is no such step. The integrated hazard is
+ * non-decreasing in s, so we can binary search for it. */
+static size_t
+msp_sweep_find_event_step(const double *cum_coal_b, const double *cum_coal_B,
+    const double *time, double coal_b, double coal_B, double rec_rate, size_t start,
+    size_t num_steps, double hazard)
+{
+    size_t lo = start;
+    size_t hi = num_steps;
+    size_t mid;
+    double base = msp_sweep_get_hazard(
+        cum_coal_b, cum_coal_B, time, coal_b, coal_B, rec_rate, start - 1);
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (msp_sweep_get_hazard(
+                cum_coal_b, cum_coal_B, time, coal_b, coal_B, rec_rate, mid)
+                - base
+            >= hazard) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+static bool
+msp_sweep_trajectory_bank_is_current(msp_t *self)
+{
+    const sweep_trajectory_bank_t *bank = self->sweep_trajectory_bank;
+    const genic_selection_trajectory_t *params
+        = &self->model.params.sweep.trajectory_params.genic_selection_trajectory;
+
+    return bank->num_trajectories == self->sweep_trajectory_bank_size
+           && bank->params.start_frequency == params->start_frequency
+           && bank->params.end_frequency == params->end_frequency
+           && bank->params.alpha == params->alpha && bank->params.dt == params->dt;
+}
+
+static int MSP_WARN_UNUSED
+msp_alloc_sweep_trajectory_bank(msp_t *self)
 {
     int ret = 0;
-    simulation_model_t *model = &self->model;
-    size_t curr_step = 0;
-    size_t num_steps;
+    sweep_t *sweep = &self->model.params.sweep;
+    sweep_trajectory_bank_t *bank = NULL;
+    size_t j, k, num_steps;
+    size_t total_steps = 0;
+    size_t max_steps = 0;
+    double *time = NULL;
     double *allele_frequency = NULL;
+    void *tmp;
+
+    tsk_bug_assert(self->sweep_trajectory_bank == NULL);
+    tsk_bug_assert(self->sweep_trajectory_bank_size > 0);
+
+    bank = calloc(1, sizeof(*bank));
+    if (bank == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    self->sweep_trajectory_bank = bank;
+    bank->params = sweep->trajectory_params.genic_selection_trajectory;
+    bank->num_trajectories = self->sweep_trajectory_bank_size;
+    bank->offset = malloc((bank->num_trajectories + 1) * sizeof(*bank->offset));
+    if (bank->offset == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    bank->offset[0] = 0;
+    for (j = 0; j < bank->num_trajectories; j++) {
+        ret = sweep->generate_trajectory(
+            sweep, self, &num_steps, &time, &allele_frequency);
+        if (ret != 0) {
+            goto out;
+        }
+        if (total_steps + num_steps > max_steps) {
+            max_steps = GSL_MAX(2 * max_steps, total_steps + num_steps);
+            tmp = realloc(bank->time, max_steps * sizeof(*bank->time));
+            if (tmp == NULL) {
+                ret = MSP_ERR_NO_MEMORY;
+                goto out;
+            }
+            bank->time = tmp;
+            tmp = realloc(
+                bank->allele_frequency, max_steps * sizeof(*bank->allele_frequency));
+            if (tmp == NULL) {
+                ret = MSP_ERR_NO_MEMORY;
+                goto out;
+            }
+            bank->allele_frequency = tmp;
+        }
+        for (k = 0; k < num_steps; k++) {
+            bank->time[total_steps + k] = time[k] - time[0];
+            bank->allele_frequency[total_steps + k] = allele_frequency[k];
+        }
+        total_steps += num_steps;
+        bank->offset[j + 1] = total_steps;
+        msp_safe_free(time);
+        msp_safe_free(allele_frequency);
+    }
+    /* Trim the buffers, as the bank is kept for the life of the simulator */
+    tmp = realloc(bank->time, total_steps * sizeof(*bank->time));
+    if (tmp != NULL) {
+        bank->time = tmp;
+    }
+    tmp = realloc(bank->allele_frequency, total_steps * sizeof(*bank->allele_frequency));
+    if (tmp != NULL) {
+        bank->allele_frequency = tmp;
+    }
+out:
+    msp_safe_free(time);
+    msp_safe_free(allele_frequency);
+    if (ret != 0) {
+        msp_free_sweep_trajectory_bank(self);
+    }
+    return ret;
+}
+
+/* Returns the trajectory for a sweep starting at the current time, either
+ * newly generated or drawn uniformly from the trajectory bank. The caller
+ * is responsible for freeing the returned arrays. */
+static int MSP_WARN_UNUSED
+msp_sweep_get_trajectory(
+    msp_t *self, size_t *ret_num_steps, double **ret_time, double **ret_allele_frequency)
+{
+    int ret = 0;
+    sweep_t *sweep = &self->model.params.sweep;
+    sweep_trajectory_bank_t *bank;
+    size_t j, k, start, num_steps;
     double *time = NULL;
-    double sweep_locus = model->params.sweep.position;
-    double sweep_dt;
-    size_t j = 0;
-    double recomb_mass;
-    unsigned long events = 0;
-    label_id_t label;
-    double rec_rates[] = { 0.0, 0.0 };
-    double sweep_pop_sizes[] = { 0.0, 0.0 };
-    double event_prob, event_rand, tmp_rand, e_sum, pop_size;
-    double p_coal_b, p_coal_B, total_rate, sweep_pop_tot_rate;
-    double p_rec_b, p_rec_B;
-    bool sweep_over;
+    double *allele_frequency = NULL;
+
+    if (self->sweep_trajectory_bank_size == 0) {
+        ret = sweep->generate_trajectory(
+            sweep, self, ret_num_steps, ret_time, ret_allele_frequency);
+        goto out;
+    }
+    if (self->sweep_trajectory_bank != NULL
+        && !msp_sweep_trajectory_bank_is_current(self)) {
+        msp_free_sweep_trajectory_bank(self);
+    }
+    if (self->sweep_trajectory_bank == NULL) {
+        ret = msp_alloc_sweep_trajectory_bank(self);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    bank = self->sweep_trajectory_bank;
+    j = (size_t) gsl_rng_uniform_int(self->rng, bank->num_trajectories);
+    start = bank->offset[j];
+    num_steps = bank->offset[j + 1] - start;
+    time = malloc(num_steps * sizeof(*time));
+    allele_frequency = malloc(num_steps * sizeof(*allele_frequency));
+    if (time == NULL || allele_frequency == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    for (k = 0; k < num_steps; k++) {
+        time[k] = self->time + bank->time[start + k];
+    }
+    memcpy(allele_frequency, bank->allele_frequency + start,
+        num_steps * sizeof(*allele_frequency));
+    *ret_num_steps = num_steps;
+    *ret_time = time;
+    *ret_allele_frequency = allele_frequency;
+    time = NULL;
+    allele_frequency = NULL;
+out:
+    msp_safe_free(time);
+    msp_safe_free(allele_frequency);
+    return ret;
+}
+
+/* Starts a sweep at the current time, by getting the trajectory and
+ * moving lineages into the beneficial background. */
+static int MSP_WARN_UNUSED
+msp_sweep_start(msp_t *self)
+{
+    int ret = 0;
+    sweep_state_t *state = &self->sweep_state;
+    size_t j, num_steps;
+    double *time, *allele_frequency, *cum_coal_b, *cum_coal_B;
+    double sweep_dt, pop_size;
+
+    tsk_bug_assert(!msp_sweep_in_progress(self));
 
     if (rate_map_get_total_mass(&self->gc_map) != 0.0) {
         /* Could be, we just haven't implemented it */
         ret = MSP_ERR_SWEEPS_GC_NOT_SUPPORTED;
         goto out;
     }
-
-    /* Keep the compiler happy */
-    sweep_pop_tot_rate = 0;
-    p_coal_b = 0;
-    p_coal_B = 0;
-    p_rec_b = 0;
-    p_rec_B = 0;
-    /* JK: I've removed the time and event limits on this function to simplify
-     * things as function is currently 'non-rentrant'; we can't stop in the middle
-     * of the sweep and pick it up again from where we left off later. This is
-     * different to all the other model runners. Probably the simplest thing to
-     * do here is to make the trajectory times absolute wrt to the simulation, and
-     * to then increment curr_step accordingly. We can then probably reason about
-     * when the call msp_sweep_initialise and msp_sweep_finalise
-     * depending on the value of curr_step, and hopefully reintroduce the max_time
-     * and max_steps parameters. */
-
-    ret = model->params.sweep.generate_trajectory(
-        &model->params.sweep, self, &num_steps, &time, &allele_frequency);
+    ret = msp_sweep_get_trajectory(
+        self, &state->num_steps, &state->time, &state->allele_frequency);
     if (ret != 0) {
         goto out;
     }
+    num_steps = state->num_steps;
+    time = state->time;
+    allele_frequency = state->allele_frequency;
+
+    /* The rate of coalescence in each background at step j is the number of
+     * pairs of lineages in it times a factor depending only on the trajectory
+     * and population size, and the rate of recombination is proportional to
+     * the time step. We store the cumulative sums of the factors so that the
+     * integrated hazard between events can be found for any numbers of
+     * lineages without walking through the trajectory. */
+    state->cum_coal_b = malloc(num_steps * sizeof(*state->cum_coal_b));
+    state->cum_coal_B = malloc(num_steps * sizeof(*state->cum_coal_B));
+    if (state->cum_coal_b == NULL || state->cum_coal_B == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    cum_coal_b = state->cum_coal_b;
+    cum_coal_B = state->cum_coal_B;
+    cum_coal_b[0] = 0;
+    cum_coal_B[0] = 0;
+    for (j = 1; j < num_steps; j++) {
+        sweep_dt = time[j] - time[j - 1];
+        /* using pop sizes grabbed from get_population_size */
+        pop_size = get_population_size(&self->populations[0], time[j]);
+        cum_coal_b[j] = cum_coal_b[j - 1]
+                        + sweep_dt / ((1.0 - allele_frequency[j]) * pop_size);
+        cum_coal_B[j] = cum_coal_B[j - 1] + sweep_dt / (allele_frequency[j] * pop_size);
+    }
+    state->curr_step = 1;
+
     ret = msp_sweep_initialise(self, allele_frequency[0]);
+out:
     if (ret != 0) {
-        goto out;
+        msp_free_sweep_state(self);
     }
+    return ret;
+}
+
+/* Ends the sweep in progress, moving all lineages back to label 0. */
+static int MSP_WARN_UNUSED
+msp_sweep_end(msp_t *self)
+{
+    int ret = msp_sweep_finalise(self);
+
+    msp_free_sweep_state(self);
+    return ret;
+}
+
+/* Runs the sweep until it completes, the sample coalesces, or the
+ * maximum time or number of events is reached. In the latter cases the
+ * sweep is left in progress, and is resumed at the same point in the
+ * trajectory by the next call. */
+static int
+msp_run_sweep(msp_t *self, double max_time, unsigned long max_events)
+{
+    int ret = 0;
+    simulation_model_t *model = &self->model;
+    sweep_state_t *state = &self->sweep_state;
+    size_t step;
+    double sweep_locus = model->params.sweep.position;
+    double sweep_dt;
+    size_t j = 0;
+    double recomb_mass;
+    unsigned long events = 0;
+    label_id_t label;
+    double rec_rates[] = { 0.0, 0.0 };
+    double sweep_pop_sizes[] = { 0.0, 0.0 };
+    double hazard, tmp_rand, e_sum;
+    double coal_b, coal_B;
+    double p_coal_b, p_coal_B, sweep_pop_tot_rate;
+    double p_rec_b, p_rec_B;
+    const double *time, *allele_frequency, *cum_coal_b, *cum_coal_B;
 
-    curr_step = 1;
+    if (!msp_sweep_in_progress(self)) {
+        ret = msp_sweep_start(self);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    time = state->time;
+    allele_frequency = state->allele_frequency;
+    cum_coal_b = state->cum_coal_b;
+    cum_coal_B = state->cum_coal_B;
 
-    while (msp_get_num_ancestors(self) > 0 && curr_step < num_steps) {
+    while (msp_get_num_ancestors(self) > 0 && state->curr_step < state->num_steps) {
+        if (events == max_events) {
+            ret = MSP_EXIT_MAX_EVENTS;
+            goto out;
+        }
         events++;
         /* Set pop sizes & rec_rates */
         for (j = 0; j < self->num_labels; j++) {
@@ -4921,44 +7161,50 @@ msp_run_sweep(msp_t *self)
             sweep_pop_sizes[j] = avl_count(&self->populations[0].ancestors[label]);
             rec_rates[j] = recomb_mass;
         }
-
-        event_prob = 1.0;
-        event_rand = gsl_rng_uniform(self->rng);
-        sweep_over = false;
-        while (event_prob > event_rand && curr_step < num_steps && !sweep_over) {
-            sweep_dt = time[curr_step] - time[curr_step - 1];
-            /* using pop sizes grabbed from get_population_size */
-            pop_size = get_population_size(&self->populations[0], time[curr_step]);
-
-            p_coal_B = 0;
-            if (avl_count(&self->populations[0].ancestors[1]) > 1) {
-                p_coal_B = ((sweep_pop_sizes[1] * (sweep_pop_sizes[1] - 1)))
-                           / allele_frequency[curr_step] * sweep_dt / pop_size;
-            }
-            p_coal_b = 0;
-            if (avl_count(&self->populations[0].ancestors[0]) > 1) {
-                p_coal_b = ((sweep_pop_sizes[0] * (sweep_pop_sizes[0] - 1)))
-                           / (1.0 - allele_frequency[curr_step]) * sweep_dt / pop_size;
-            }
-            p_rec_b = rec_rates[0] * sweep_dt;
-            p_rec_B = rec_rates[1] * sweep_dt;
-            sweep_pop_tot_rate = p_coal_b + p_coal_B + p_rec_b + p_rec_B;
-            /* doing this to build in generality if we want >1 pop */
-
-            total_rate = sweep_pop_tot_rate;
-            event_prob *= 1.0 - total_rate;
-            curr_step++;
-
-            sweep_over = total_rate == 0;
-        }
-        if (sweep_over) {
+        coal_b = 0;
+        if (sweep_pop_sizes[0] > 1) {
+            coal_b = sweep_pop_sizes[0] * (sweep_pop_sizes[0] - 1);
+        }
+        coal_B = 0;
+        if (sweep_pop_sizes[1] > 1) {
+            coal_B = sweep_pop_sizes[1] * (sweep_pop_sizes[1] - 1);
+        }
+        step = state->num_steps;
+        if (coal_b != 0 || coal_B != 0 || rec_rates[0] != 0 || rec_rates[1] != 0) {
+            hazard = gsl_ran_exponential(self->rng, 1.0);
+            step = msp_sweep_find_event_step(cum_coal_b, cum_coal_B, time, coal_b,
+                coal_B, rec_rates[0] + rec_rates[1], state->curr_step,
+                state->num_steps, hazard);
+        }
+        if (step == state->num_steps && time[step - 1] < max_time) {
+            /* No more events happen during the sweep, which lasts until
+             * the end of the trajectory. */
+            state->curr_step = state->num_steps;
+            self->time = time[state->num_steps - 1];
             break;
         }
+        if (step == state->num_steps || time[step] >= max_time) {
+            /* No events happen before max_time. As the waiting time is
+             * memoryless, we resume from the step containing max_time. */
+            while (time[state->curr_step] < max_time) {
+                state->curr_step++;
+            }
+            ret = MSP_EXIT_MAX_TIME;
+            goto out;
+        }
+        state->curr_step = step + 1;
+
+        sweep_dt = time[step] - time[step - 1];
+        p_coal_b = coal_b * (cum_coal_b[step] - cum_coal_b[step - 1]);
+        p_coal_B = coal_B * (cum_coal_B[step] - cum_coal_B[step - 1]);
+        p_rec_b = rec_rates[0] * sweep_dt;
+        p_rec_B = rec_rates[1] * sweep_dt;
+        sweep_pop_tot_rate = p_coal_b + p_coal_B + p_rec_b + p_rec_B;
 
         tmp_rand = gsl_rng_uniform(self->rng);
 
         e_sum = p_coal_b;
-        self->time = time[curr_step - 1];
+        self->time = time[step];
         if (tmp_rand < e_sum / sweep_pop_tot_rate) {
             /* coalescent in b background */
             ret = self->common_ancestor_event(self, 0, 0);
@@ -4972,11 +7218,11 @@ msp_run_sweep(msp_t *self)
                 if (tmp_rand < e_sum / sweep_pop_tot_rate) {
                     /* recomb in b background */
                     ret = msp_sweep_recombination_event(
-                        self, 0, sweep_locus, (1.0 - allele_frequency[curr_step - 1]));
+                        self, 0, sweep_locus, (1.0 - allele_frequency[step]));
                 } else {
                     /* recomb in B background */
                     ret = msp_sweep_recombination_event(
-                        self, 1, sweep_locus, allele_frequency[curr_step - 1]);
+                        self, 1, sweep_locus, allele_frequency[step]);
                 }
             }
         }
@@ -4988,8 +7234,8 @@ msp_run_sweep(msp_t *self)
     /* Check if any demographic events should have happened during the
      * event and raise an error if so. This is to keep computing population
      * sizes simple */
-    if (self->next_demographic_event != NULL
-        && self->next_demographic_event->time <= self->time) {
+    if (self->next_demographic_event < self->num_demographic_events
+        && self->demographic_events[self->next_demographic_event].time <= self->time) {
         ret = MSP_ERR_EVENTS_DURING_SWEEP;
         goto out;
     }
@@ -5000,13 +7246,8 @@ msp_run_sweep(msp_t *self)
         ret = MSP_ERR_EVENTS_DURING_SWEEP;
         goto out;
     }
-    ret = msp_sweep_finalise(self);
-    if (ret != 0) {
-        goto out;
-    }
+    ret = msp_sweep_end(self);
 out:
-    msp_safe_free(time);
-    msp_safe_free(allele_frequency);
     return ret;
 }
 
@@ -5044,6 +7285,8 @@ msp_run(msp_t *self, double max_time, unsigned long max_events)
         ret = 0;
     } else if (self->model.type == MSP_MODEL_DTWF) {
         ret = msp_run_dtwf(self, max_time, max_events);
+    } else if (self->model.type == MSP_MODEL_DTWF_HYBRID) {
+        ret = msp_run_dtwf_hybrid(self, max_time, max_events);
     } else if (self->model.type == MSP_MODEL_WF_PED) {
         if (self->pedigree == NULL || self->pedigree->state != MSP_PED_STATE_UNCLIMBED) {
             ret = MSP_ERR_BAD_STATE;
@@ -5062,8 +7305,7 @@ msp_run(msp_t *self, double max_time, unsigned long max_events)
             goto out;
         }
     } else if (self->model.type == MSP_MODEL_SWEEP) {
-        /* FIXME making sweep atomic for now as it's non-rentrant */
-        ret = msp_run_sweep(self);
+        ret = msp_run_sweep(self, max_time, max_events);
     } else {
         ret = msp_run_coalescent(self, max_time, max_events);
     }
@@ -5205,8 +7447,8 @@ msp_debug_demography(msp_t *self, double *end_time)
         ret = MSP_ERR_BAD_STATE;
         goto out;
     }
-    if (!first_call && self->next_demographic_event != NULL) {
-        de = self->next_demographic_event;
+    if (!first_call && self->next_demographic_event < self->num_demographic_events) {
+        de = &self->demographic_events[self->next_demographic_event];
 
         /* Add in historical samples more recent than next demographic event */
         while (self->next_sampling_event < self->num_sampling_events
@@ -5224,8 +7466,8 @@ msp_debug_demography(msp_t *self, double *end_time)
             goto out;
         }
     }
-    if (self->next_demographic_event != NULL) {
-        t = self->next_demographic_event->time;
+    if (self->next_demographic_event < self->num_demographic_events) {
+        t = self->demographic_events[self->next_demographic_event].time;
     }
     *end_time = t;
 out:
@@ -5286,6 +7528,9 @@ msp_get_model_name(msp_t *self)
         case MSP_MODEL_DTWF:
             ret = "dtwf";
             break;
+        case MSP_MODEL_DTWF_HYBRID:
+            ret = "dtwf_hybrid";
+            break;
         case MSP_MODEL_WF_PED:
             ret = "wf_ped";
             break;
@@ -5335,9 +7580,16 @@ msp_get_num_ancestors(msp_t *self)
 {
     size_t n = 0;
     tsk_id_t j;
+    uint32_t label;
 
-    for (j = 0; j < (tsk_id_t) self->num_populations; j++) {
-        n += msp_get_num_population_ancestors(self, j);
+    if (self->ancestor_count_index != NULL) {
+        for (label = 0; label < self->num_labels; label++) {
+            n += (size_t) fenwick_get_total(&self->ancestor_count_index[label]);
+        }
+    } else {
+        for (j = 0; j < (tsk_id_t) self->num_populations; j++) {
+            n += msp_get_num_population_ancestors(self, j);
+        }
     }
     return n;
 }
@@ -5459,33 +7711,35 @@ msp_add_demographic_event(msp_t *self, double time, demographic_event_t **event)
 {
     int ret = MSP_ERR_GENERIC;
     demographic_event_t *ret_event = NULL;
+    demographic_event_t *tmp;
+    size_t max_events;
 
     if (time < 0) {
         ret = MSP_ERR_BAD_PARAM_VALUE;
         goto out;
     }
-
-    if (self->demographic_events_tail != NULL) {
-        if (time < self->demographic_events_tail->time) {
-            ret = MSP_ERR_UNSORTED_DEMOGRAPHIC_EVENTS;
+    if (self->num_demographic_events > 0
+        && time < self->demographic_events[self->num_demographic_events - 1].time) {
+        ret = MSP_ERR_UNSORTED_DEMOGRAPHIC_EVENTS;
+        goto out;
+    }
+    /* Events are stored in one contiguous array that grows geometrically,
+     * so that adding large numbers of events stays cheap. Any event
+     * pointers handed out previously are invalidated by a realloc. */
+    if (self->num_demographic_events == self->max_demographic_events) {
+        max_events = GSL_MAX(64, 2 * self->max_demographic_events);
+        tmp = realloc(self->demographic_events, max_events * sizeof(*tmp));
+        if (tmp == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
             goto out;
         }
+        self->demographic_events = tmp;
+        self->max_demographic_events = max_events;
     }
-    ret_event = calloc(1, sizeof(demographic_event_t));
-    if (ret_event == NULL) {
-        ret = MSP_ERR_NO_MEMORY;
-        goto out;
-    }
+    ret_event = &self->demographic_events[self->num_demographic_events];
+    memset(ret_event, 0, sizeof(*ret_event));
     ret_event->time = time;
-    /* now insert this event at the end of the chain. */
-    if (self->demographic_events_head == NULL) {
-        self->demographic_events_head = ret_event;
-        self->demographic_events_tail = ret_event;
-    } else {
-        tsk_bug_assert(self->demographic_events_tail != NULL);
-        self->demographic_events_tail->next = ret_event;
-        self->demographic_events_tail = ret_event;
-    }
+    self->num_demographic_events++;
     *event = ret_event;
     ret = 0;
 out:
@@ -5713,28 +7967,65 @@ msp_mass_migration(msp_t *self, demographic_event_t *event)
     double p = event->params.mass_migration.proportion;
     population_id_t N = (population_id_t) self->num_populations;
     avl_node_t *node, *next;
-    avl_tree_t *pop;
+    avl_tree_t *pop, *dest_pop, tmp;
+    fenwick_t *count_index;
     label_id_t label = 0; /* For now only support label 0 */
+    size_t n, k, num_seen;
 
     /* This should have been caught on adding the event */
-    if (source < 0 || source > N || dest < 0 || dest > N) {
+    if (source < 0 || source >= N || dest < 0 || dest >= N || source == dest) {
         ret = MSP_ERR_ASSERTION_FAILED;
         goto out;
     }
+    pop = &self->populations[source].ancestors[label];
+    dest_pop = &self->populations[dest].ancestors[label];
+    count_index = &self->ancestor_count_index[label];
     /*
-     * Move lineages from source to dest with probability p.
+     * Each lineage moves independently with probability p, so the number
+     * of lineages that move is binomial. Splits in species trees move all
+     * lineages (p = 1), which we special case so that no random numbers
+     * are used.
      */
-    pop = &self->populations[source].ancestors[label];
-    node = pop->head;
-    while (node != NULL) {
-        next = node->next;
-        if (gsl_rng_uniform(self->rng) < p) {
-            ret = msp_move_individual(self, node, pop, dest, label);
+    n = avl_count(pop);
+    if (p >= 1) {
+        k = n;
+    } else {
+        k = gsl_ran_binomial(self->rng, p, (unsigned int) n);
+    }
+    if (k == n && avl_count(dest_pop) == 0) {
+        /* All lineages move to an empty population, so we can take the
+         * source's ancestor set as a whole. */
+        tmp = *dest_pop;
+        *dest_pop = *pop;
+        *pop = tmp;
+        fenwick_increment(count_index, (size_t) source + 1, -(double) n);
+        fenwick_increment(count_index, (size_t) dest + 1, (double) n);
+        for (node = dest_pop->head; node != NULL; node = node->next) {
+            ret = msp_migrate_segments(self, (segment_t *) node->item, dest);
             if (ret != 0) {
                 goto out;
             }
         }
-        node = next;
+    } else {
+        /* Choose a uniformly random subset of k of the n lineages in one
+         * pass by selection sampling, reusing the AVL nodes as they move. */
+        num_seen = 0;
+        node = pop->head;
+        while (node != NULL && k > 0) {
+            next = node->next;
+            if ((double) (n - num_seen) * gsl_rng_uniform(self->rng) < (double) k) {
+                msp_unlink_ancestor(self, pop, node);
+                ret = msp_migrate_segments(self, (segment_t *) node->item, dest);
+                if (ret != 0) {
+                    goto out;
+                }
+                node = msp_link_ancestor(self, node);
+                tsk_bug_assert(node != NULL);
+                k--;
+            }
+            num_seen++;
+            node = next;
+        }
     }
 out:
     return ret;
@@ -5804,7 +8095,8 @@ msp_simple_bottleneck(msp_t *self, demographic_event_t *event)
         ret = MSP_ERR_ASSERTION_FAILED;
         goto out;
     }
-    if (self->model.type == MSP_MODEL_DTWF) {
+    if (self->model.type == MSP_MODEL_DTWF
+        || self->model.type == MSP_MODEL_DTWF_HYBRID) {
         ret = MSP_ERR_DTWF_UNSUPPORTED_BOTTLENECK;
         goto out;
     }
@@ -5819,7 +8111,7 @@ msp_simple_bottleneck(msp_t *self, demographic_event_t *event)
         next = node->next;
         if (gsl_rng_uniform(self->rng) < p) {
             u = (segment_t *) node->item;
-            avl_unlink_node(pop, node);
+            msp_unlink_ancestor(self, pop, node);
             msp_free_avl_node(self, node);
             q_node = msp_alloc_avl_node(self);
             if (q_node == NULL) {
@@ -5879,6 +8171,35 @@ out:
  * equivalent to what would happen in time T2.
  */
 
+/* Makes sure the bottleneck scratch space can hold n lineages: 4n ids
+ * for the lineage, parent and group arrays and n AVL node pointers. */
+static int MSP_WARN_UNUSED
+msp_reserve_bottleneck_scratch(msp_t *self, size_t n)
+{
+    int ret = 0;
+    tsk_id_t *ids;
+    avl_node_t **nodes;
+    size_t max_lineages = GSL_MAX(n, 2 * self->max_bottleneck_lineages);
+
+    if (n > self->max_bottleneck_lineages) {
+        ids = realloc(self->bottleneck_ids, 4 * max_lineages * sizeof(*ids));
+        if (ids == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        self->bottleneck_ids = ids;
+        nodes = realloc(self->bottleneck_nodes, max_lineages * sizeof(*nodes));
+        if (nodes == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        self->bottleneck_nodes = nodes;
+        self->max_bottleneck_lineages = max_lineages;
+    }
+out:
+    return ret;
+}
+
 static int
 msp_instantaneous_bottleneck(msp_t *self, demographic_event_t *event)
 {
@@ -5886,16 +8207,13 @@ msp_instantaneous_bottleneck(msp_t *self, demographic_event_t *event)
     population_id_t population_id = event->params.instantaneous_bottleneck.population;
     double T2 = event->params.instantaneous_bottleneck.strength;
     population_id_t N = (population_id_t) self->num_populations;
-    tsk_id_t *lineages = NULL;
-    tsk_id_t *pi = NULL;
-    avl_node_t **avl_nodes = NULL;
-    avl_tree_t *sets = NULL;
-    tsk_id_t u, parent;
+    tsk_id_t *lineages, *pi, *group_start;
+    avl_node_t **group_nodes;
+    tsk_id_t u, parent, root;
     uint32_t j, k, n, num_roots;
     double rate, t;
-    avl_tree_t *pop;
-    avl_node_t *node, *set_node;
-    segment_t *individual;
+    avl_tree_t *pop, Q;
+    avl_node_t *node;
     label_id_t label = 0; /* For now only support label 0 */
 
     /* This should have been caught on adding the event */
@@ -5903,31 +8221,30 @@ msp_instantaneous_bottleneck(msp_t *self, demographic_event_t *event)
         ret = MSP_ERR_ASSERTION_FAILED;
         goto out;
     }
-    if (self->model.type == MSP_MODEL_DTWF) {
+    if (self->model.type == MSP_MODEL_DTWF
+        || self->model.type == MSP_MODEL_DTWF_HYBRID) {
         ret = MSP_ERR_DTWF_UNSUPPORTED_BOTTLENECK;
         goto out;
     }
     pop = &self->populations[population_id].ancestors[label];
     n = avl_count(pop);
-    lineages = malloc(n * sizeof(tsk_id_t));
-    avl_nodes = malloc(n * sizeof(avl_node_t *));
-    pi = malloc(2 * n * sizeof(tsk_id_t));
-    sets = malloc(2 * n * sizeof(avl_tree_t));
-    if (lineages == NULL || avl_nodes == NULL || pi == NULL || sets == NULL) {
-        ret = MSP_ERR_NO_MEMORY;
+    if (n == 0) {
+        goto out;
+    }
+    ret = msp_reserve_bottleneck_scratch(self, n);
+    if (ret != 0) {
         goto out;
     }
+    lineages = self->bottleneck_ids;
+    pi = lineages + n;
+    group_start = pi + 2 * n;
+    group_nodes = self->bottleneck_nodes;
     for (u = 0; u < (tsk_id_t) n; u++) {
         lineages[u] = u;
     }
     for (u = 0; u < (tsk_id_t)(2 * n); u++) {
         pi[u] = TSK_NULL;
     }
-    j = 0;
-    for (node = pop->head; node != NULL; node = node->next) {
-        avl_nodes[j] = node;
-        j++;
-    }
 
     /* Now we implement the Kingman coalescent for these lineages until we have
      * exceeded T2. This is based on the algorithm from Hudson 1990.
@@ -5956,175 +8273,707 @@ msp_instantaneous_bottleneck(msp_t *self, demographic_event_t *event)
         parent++;
     }
     num_roots = j + 1;
+
+    /* Point every node directly at its root. Parents always have larger
+     * ids than their children, so visiting the nodes in decreasing order
+     * compresses each path in a single step. Afterwards pi[u] is the root
+     * for u, or TSK_NULL if u is a root itself. */
+    for (u = parent - 1; u >= 0; u--) {
+        if (pi[u] != TSK_NULL && pi[pi[u]] != TSK_NULL) {
+            pi[u] = pi[pi[u]];
+        }
+    }
+
+    /* Group the lineages by their root with a counting sort on the root
+     * ids n, ..., parent - 1. Lineages with no parent have not been
+     * affected, and we leave them alone. */
+    for (u = 0; u <= parent - (tsk_id_t) n; u++) {
+        group_start[u] = 0;
+    }
+    for (j = 0; j < n; j++) {
+        if (pi[j] != TSK_NULL) {
+            group_start[pi[j] - (tsk_id_t) n + 1]++;
+        }
+    }
+    for (u = 1; u <= parent - (tsk_id_t) n; u++) {
+        group_start[u] += group_start[u - 1];
+    }
+    /* group_start[root] is used as the insertion cursor for each group,
+     * so that afterwards the group for root is in the range
+     * [group_start[root - 1], group_start[root]). */
+    j = 0;
+    for (node = pop->head; node != NULL; node = node->next) {
+        if (pi[j] != TSK_NULL) {
+            root = pi[j] - (tsk_id_t) n;
+            group_nodes[group_start[root]] = node;
+            group_start[root]++;
+        }
+        j++;
+    }
+
+    /* Merge each group, reusing the lineages' AVL nodes in the queue */
     for (j = 0; j < num_roots; j++) {
         if (lineages[j] >= (tsk_id_t) n) {
-            avl_init_tree(&sets[lineages[j]], cmp_segment_queue, NULL);
+            root = lineages[j] - (tsk_id_t) n;
+            avl_init_tree(&Q, cmp_segment_queue, NULL);
+            for (u = root == 0 ? 0 : group_start[root - 1]; u < group_start[root];
+                 u++) {
+                node = group_nodes[u];
+                msp_unlink_ancestor(self, pop, node);
+                avl_init_node(node, node->item);
+                node = avl_insert_node(&Q, node);
+                tsk_bug_assert(node != NULL);
+            }
+            ret = msp_merge_ancestors(self, &Q, population_id, label, NULL, TSK_NULL);
+            if (ret != 0) {
+                goto out;
+            }
+        }
+    }
+out:
+    return ret;
+}
+
+static void
+msp_print_instantaneous_bottleneck(
+    msp_t *MSP_UNUSED(self), demographic_event_t *event, FILE *out)
+{
+    fprintf(out, "%f\tinstantaneous_bottleneck: %d T2 = %f\n", event->time,
+        (int) event->params.instantaneous_bottleneck.population,
+        event->params.instantaneous_bottleneck.strength);
+}
+
+/* Add an instantaneous bottleneck event. Time and strength are measured in generations
+ */
+int MSP_WARN_UNUSED
+msp_add_instantaneous_bottleneck(
+    msp_t *self, double time, int population_id, double strength)
+{
+    int ret = 0;
+    demographic_event_t *de;
+    int N = (int) self->num_populations;
+
+    if (population_id < 0 || population_id >= N) {
+        ret = MSP_ERR_POPULATION_OUT_OF_BOUNDS;
+        goto out;
+    }
+    if (strength < 0.0) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    ret = msp_add_demographic_event(self, time, &de);
+    if (ret != 0) {
+        goto out;
+    }
+    de->params.instantaneous_bottleneck.population = population_id;
+    de->params.instantaneous_bottleneck.strength = strength;
+    de->change_state = msp_instantaneous_bottleneck;
+    de->print_state = msp_print_instantaneous_bottleneck;
+    ret = 0;
+out:
+    return ret;
+}
+
+/* Add a census event at a specified time (given in generations). A census
+ * node is added for each segment of every lineage, or for each lineage if
+ * per_lineage is set. All the census nodes and edges are written to the
+ * tables in one batch. */
+static int
+msp_census_event(msp_t *self, demographic_event_t *event)
+{
+    int ret = 0;
+    bool per_lineage = event->params.census_event.per_lineage;
+    const double *node_time = self->tables->nodes.time;
+    avl_node_t *node;
+    segment_t *seg;
+    tsk_id_t i, j, u;
+    tsk_size_t k, num_nodes, num_edges, num_lineage_edges, lineage_start;
+    tsk_flags_t *flags = NULL;
+    double *time = NULL;
+    tsk_id_t *population = NULL;
+    tsk_edge_t *edges = NULL;
+    double *left = NULL;
+    double *right = NULL;
+    tsk_id_t *parent = NULL;
+    tsk_id_t *child = NULL;
+
+    ret = msp_flush_edges(self);
+    if (ret != 0) {
+        goto out;
+    }
+    num_nodes = 0;
+    num_edges = 0;
+    for (i = 0; i < (int) self->num_populations; i++) {
+        for (j = 0; j < (int) self->num_labels; j++) {
+            for (node = self->populations[i].ancestors[j].head; node != NULL;
+                 node = node->next) {
+                for (seg = (segment_t *) node->item; seg != NULL; seg = seg->next) {
+                    if (node_time[seg->value] >= event->time) {
+                        ret = MSP_ERR_TIME_TRAVEL;
+                        goto out;
+                    }
+                    num_edges++;
+                }
+                num_nodes++;
+            }
+        }
+    }
+    if (!per_lineage) {
+        num_nodes = num_edges;
+    }
+    if (num_edges == 0) {
+        goto out;
+    }
+    flags = malloc(num_nodes * sizeof(*flags));
+    time = malloc(num_nodes * sizeof(*time));
+    population = malloc(num_nodes * sizeof(*population));
+    edges = malloc(num_edges * sizeof(*edges));
+    left = malloc(num_edges * sizeof(*left));
+    right = malloc(num_edges * sizeof(*right));
+    parent = malloc(num_edges * sizeof(*parent));
+    child = malloc(num_edges * sizeof(*child));
+    if (flags == NULL || time == NULL || population == NULL || edges == NULL
+        || left == NULL || right == NULL || parent == NULL || child == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+
+    u = (tsk_id_t) self->tables->nodes.num_rows;
+    num_nodes = 0;
+    num_edges = 0;
+    for (i = 0; i < (int) self->num_populations; i++) {
+        for (j = 0; j < (int) self->num_labels; j++) {
+            for (node = self->populations[i].ancestors[j].head; node != NULL;
+                 node = node->next) {
+                lineage_start = num_edges;
+                for (seg = (segment_t *) node->item; seg != NULL; seg = seg->next) {
+                    if (!per_lineage || seg->prev == NULL) {
+                        flags[num_nodes] = MSP_NODE_IS_CEN_EVENT;
+                        time[num_nodes] = event->time;
+                        population[num_nodes] = i;
+                        num_nodes++;
+                    }
+                    edges[num_edges].left = seg->left;
+                    edges[num_edges].right = seg->right;
+                    edges[num_edges].parent = u;
+                    edges[num_edges].child = seg->value;
+                    edges[num_edges].metadata = NULL;
+                    edges[num_edges].metadata_length = 0;
+                    num_edges++;
+                    seg->value = u;
+                    if (!per_lineage) {
+                        u++;
+                    }
+                }
+                if (per_lineage) {
+                    /* Edges for the lineage's node must be sorted by child
+                     * and adjacent edges with the same child merged. */
+                    ret = tsk_squash_edges(edges + lineage_start,
+                        num_edges - lineage_start, &num_lineage_edges);
+                    if (ret != 0) {
+                        ret = msp_set_tsk_error(ret);
+                        goto out;
+                    }
+                    num_edges = lineage_start + num_lineage_edges;
+                    u++;
+                }
+            }
+        }
+    }
+    for (k = 0; k < num_edges; k++) {
+        left[k] = edges[k].left;
+        right[k] = edges[k].right;
+        parent[k] = edges[k].parent;
+        child[k] = edges[k].child;
+    }
+    ret = tsk_node_table_append_columns(
+        &self->tables->nodes, num_nodes, flags, time, population, NULL, NULL, NULL);
+    if (ret != 0) {
+        ret = msp_set_tsk_error(ret);
+        goto out;
+    }
+    ret = tsk_edge_table_append_columns(
+        &self->tables->edges, num_edges, left, right, parent, child, NULL, NULL);
+    if (ret != 0) {
+        ret = msp_set_tsk_error(ret);
+        goto out;
+    }
+out:
+    msp_safe_free(flags);
+    msp_safe_free(time);
+    msp_safe_free(population);
+    msp_safe_free(edges);
+    msp_safe_free(left);
+    msp_safe_free(right);
+    msp_safe_free(parent);
+    msp_safe_free(child);
+    return ret;
+}
+
+static void
+msp_print_census_event(msp_t *MSP_UNUSED(self), demographic_event_t *event, FILE *out)
+{
+    fprintf(out, "%f\tcensus_event: per_lineage = %d\n", event->time,
+        event->params.census_event.per_lineage);
+}
+
+int MSP_WARN_UNUSED
+msp_add_census_event(msp_t *self, double time, bool per_lineage)
+{
+    int ret = 0;
+    demographic_event_t *de;
+
+    ret = msp_add_demographic_event(self, time, &de);
+    if (ret != 0) {
+        goto out;
+    }
+
+    de->params.census_event.per_lineage = per_lineage;
+    de->change_state = msp_census_event;
+    de->print_state = msp_print_census_event;
+    ret = 0;
+
+out:
+    return ret;
+}
+
+/*
+ * Numerical calculations for the demography debugger. These walk through
+ * the epochs of the model using msp_debug_demography, and so must be run
+ * on a freshly initialised simulator. Within each interval between steps
+ * the population sizes are taken to be constant, and the state is advanced
+ * by computing the action of the matrix exponential of the generator
+ * directly, using a Taylor series over enough substeps that each substep
+ * is well conditioned. The generator is only ever applied to n x n
+ * matrices, so we never form the n^2 x n^2 generator for pairs of
+ * lineages explicitly.
+ */
+
+#define MSP_DEBUG_MAX_TAYLOR_TERMS 64
+
+typedef struct {
+    size_t num_populations;
+    int num_threads;
+    /* The migration generator Q = M - diag(rowsums(M)) */
+    double *Q;
+    /* The per-population coalescence rates, or NULL if we are following
+     * single lineages */
+    double *coalescence_rate;
+    /* The norm bound for the generator */
+    double norm;
+} debug_generator_t;
+
+static void
+debug_generator_free(debug_generator_t *self)
+{
+    msp_safe_free(self->Q);
+    msp_safe_free(self->coalescence_rate);
+}
+
+static int MSP_WARN_UNUSED
+debug_generator_alloc(
+    debug_generator_t *self, size_t num_populations, bool pairs, int num_threads)
+{
+    int ret = 0;
+
+    memset(self, 0, sizeof(*self));
+    if (num_threads < 1) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    self->num_populations = num_populations;
+    self->num_threads = num_threads;
+    self->Q = calloc(num_populations * num_populations, sizeof(*self->Q));
+    if (self->Q == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    if (pairs) {
+        self->coalescence_rate
+            = calloc(num_populations, sizeof(*self->coalescence_rate));
+        if (self->coalescence_rate == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+    }
+out:
+    return ret;
+}
+
+/* Updates the generator to the state of the simulator at time t. */
+static int MSP_WARN_UNUSED
+msp_debug_generator_update(
+    msp_t *self, debug_generator_t *gen, double t, double min_pop_size)
+{
+    int ret = 0;
+    size_t n = gen->num_populations;
+    size_t j, k;
+    double row_sum, row_norm, size, max_rate;
+    double *col_norm = gen->coalescence_rate;
+
+    gen->norm = 0;
+    for (j = 0; j < n; j++) {
+        row_sum = 0;
+        for (k = 0; k < n; k++) {
+            gen->Q[j * n + k] = self->migration_matrix[j * n + k];
+            row_sum += self->migration_matrix[j * n + k];
+        }
+        gen->Q[j * n + j] -= row_sum;
+        row_norm = 0;
+        for (k = 0; k < n; k++) {
+            row_norm += fabs(gen->Q[j * n + k]);
+        }
+        gen->norm = GSL_MAX(gen->norm, row_norm);
+    }
+    if (gen->coalescence_rate != NULL) {
+        /* Pairs of lineages migrate on both sides, so the generator's norm
+         * is bounded by twice the larger of the row and column norms of Q,
+         * plus the largest coalescence rate. We use coalescence_rate to
+         * hold the column norms until the rates are computed. */
+        memset(col_norm, 0, n * sizeof(*col_norm));
+        for (j = 0; j < n; j++) {
+            for (k = 0; k < n; k++) {
+                col_norm[k] += fabs(gen->Q[j * n + k]);
+            }
+        }
+        for (k = 0; k < n; k++) {
+            gen->norm = GSL_MAX(gen->norm, col_norm[k]);
+        }
+        gen->norm *= 2;
+        max_rate = 0;
+        for (j = 0; j < n; j++) {
+            ret = msp_compute_population_size(self, j, t, &size);
+            if (ret != 0) {
+                goto out;
+            }
+            gen->coalescence_rate[j] = 1.0 / (2 * GSL_MAX(min_pop_size, size));
+            max_rate = GSL_MAX(max_rate, gen->coalescence_rate[j]);
+        }
+        gen->norm += max_rate;
+    }
+out:
+    return ret;
+}
+
+/* Sets Y to the generator applied to X. For single lineages this is XQ,
+ * and for pairs of lineages (where X[x, y] is the probability that the
+ * pair are in populations x and y) it is Q^T X + X Q, less the rate of
+ * coalescence on the diagonal. */
+static void
+debug_generator_apply(debug_generator_t *self, const double *X, double *Y)
+{
+    const size_t n = self->num_populations;
+    const double *Q = self->Q;
+    const double *coalescence_rate = self->coalescence_rate;
+    int i;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(self->num_threads) schedule(static)
+#endif
+    for (i = 0; i < (int) n; i++) {
+        size_t row = (size_t) i;
+        size_t j, k;
+        double sum;
+
+        for (j = 0; j < n; j++) {
+            sum = 0;
+            for (k = 0; k < n; k++) {
+                sum += X[row * n + k] * Q[k * n + j];
+            }
+            if (coalescence_rate != NULL) {
+                for (k = 0; k < n; k++) {
+                    sum += Q[k * n + row] * X[k * n + j];
+                }
+                if (j == row) {
+                    sum -= coalescence_rate[row] * X[row * n + row];
+                }
+            }
+            Y[row * n + j] = sum;
         }
     }
-
-    /* Assign each lineage to the set corresponding to a given root.
-     * For any root < n, this lineages has not been affected, so we
-     * leave it alone.
-     */
-    for (j = 0; j < n; j++) {
-        u = (tsk_id_t) j;
-        while (pi[u] != TSK_NULL) {
-            u = pi[u];
-        }
-        if (u >= (tsk_id_t) n) {
-            /* Remove this node from the population, and add it into the
-             * set for the root at u */
-            individual = (segment_t *) avl_nodes[j]->item;
-            avl_unlink_node(pop, avl_nodes[j]);
-            msp_free_avl_node(self, avl_nodes[j]);
-            set_node = msp_alloc_avl_node(self);
-            if (set_node == NULL) {
-                ret = MSP_ERR_NO_MEMORY;
-                goto out;
+}
+
+/* Replaces X with X exp(dt G), where G is the generator. The work array
+ * must have space for 2n^2 values. */
+static int MSP_WARN_UNUSED
+debug_generator_propagate(debug_generator_t *self, double dt, double *X, double *work)
+{
+    int ret = 0;
+    const size_t N2 = self->num_populations * self->num_populations;
+    double *term = work;
+    double *next = work + N2;
+    double *tmp;
+    double h, bound, term_norm, X_norm;
+    size_t s, num_substeps, j;
+    unsigned int k;
+
+    bound = ceil(self->norm * dt);
+    if (!isfinite(bound) || bound > (double) UINT32_MAX) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    num_substeps = (size_t) GSL_MAX(1, bound);
+    h = dt / (double) num_substeps;
+    for (s = 0; s < num_substeps; s++) {
+        memcpy(term, X, N2 * sizeof(*X));
+        for (k = 1; k <= MSP_DEBUG_MAX_TAYLOR_TERMS; k++) {
+            debug_generator_apply(self, term, next);
+            term_norm = 0;
+            X_norm = 0;
+            for (j = 0; j < N2; j++) {
+                next[j] *= h / k;
+                X[j] += next[j];
+                term_norm = GSL_MAX(term_norm, fabs(next[j]));
+                X_norm = GSL_MAX(X_norm, fabs(X[j]));
             }
-            avl_init_node(set_node, individual);
-            set_node = avl_insert_node(&sets[u], set_node);
-            tsk_bug_assert(set_node != NULL);
-        }
-    }
-    for (j = 0; j < num_roots; j++) {
-        if (lineages[j] >= (tsk_id_t) n) {
-            ret = msp_merge_ancestors(
-                self, &sets[lineages[j]], population_id, label, NULL, TSK_NULL);
-            if (ret != 0) {
-                goto out;
+            tmp = term;
+            term = next;
+            next = tmp;
+            if (term_norm <= DBL_EPSILON * X_norm) {
+                break;
             }
         }
     }
 out:
-    if (lineages != NULL) {
-        free(lineages);
-    }
-    if (pi != NULL) {
-        free(pi);
-    }
-    if (sets != NULL) {
-        free(sets);
-    }
-    if (avl_nodes != NULL) {
-        free(avl_nodes);
-    }
     return ret;
 }
 
-static void
-msp_print_instantaneous_bottleneck(
-    msp_t *MSP_UNUSED(self), demographic_event_t *event, FILE *out)
+/* Applies the demographic events at the end of the current epoch and moves
+ * on to the next epoch. If X is not NULL, mass migrations are applied to it:
+ * to the columns for single lineages and to both rows and columns for pairs
+ * of lineages. */
+static int MSP_WARN_UNUSED
+msp_debug_next_epoch(msp_t *self, double *X, bool pairs, double *epoch_end)
 {
-    fprintf(out, "%f\tinstantaneous_bottleneck: %d T2 = %f\n", event->time,
-        (int) event->params.instantaneous_bottleneck.population,
-        event->params.instantaneous_bottleneck.strength);
+    int ret = 0;
+    size_t n = self->num_populations;
+    size_t j, k, source, dest;
+    double p;
+    demographic_event_t *de;
+
+    for (k = self->next_demographic_event; X != NULL && k < self->num_demographic_events;
+         k++) {
+        de = &self->demographic_events[k];
+        if (de->time != *epoch_end) {
+            break;
+        }
+        if (de->change_state == msp_mass_migration) {
+            source = (size_t) de->params.mass_migration.source;
+            dest = (size_t) de->params.mass_migration.destination;
+            p = de->params.mass_migration.proportion;
+            for (j = 0; j < n; j++) {
+                X[j * n + dest] += p * X[j * n + source];
+                X[j * n + source] *= 1 - p;
+            }
+            if (pairs) {
+                for (j = 0; j < n; j++) {
+                    X[dest * n + j] += p * X[source * n + j];
+                    X[source * n + j] *= 1 - p;
+                }
+            }
+        }
+    }
+    ret = msp_debug_demography(self, epoch_end);
+    return ret;
 }
 
-/* Add an instantaneous bottleneck event. Time and strength are measured in generations
- */
-int MSP_WARN_UNUSED
-msp_add_instantaneous_bottleneck(
-    msp_t *self, double time, int population_id, double strength)
+static int MSP_WARN_UNUSED
+msp_debug_check_steps(msp_t *self, size_t num_steps, const double *steps)
 {
     int ret = 0;
-    demographic_event_t *de;
-    int N = (int) self->num_populations;
+    size_t j;
 
-    if (population_id < 0 || population_id >= N) {
-        ret = MSP_ERR_POPULATION_OUT_OF_BOUNDS;
-        goto out;
-    }
-    if (strength < 0.0) {
-        ret = MSP_ERR_BAD_PARAM_VALUE;
+    if (self->state != MSP_STATE_INITIALISED) {
+        ret = MSP_ERR_BAD_STATE;
         goto out;
     }
-    ret = msp_add_demographic_event(self, time, &de);
-    if (ret != 0) {
-        goto out;
+    for (j = 0; j < num_steps; j++) {
+        if (!isfinite(steps[j]) || steps[j] < 0 || (j > 0 && steps[j] <= steps[j - 1])) {
+            ret = MSP_ERR_BAD_PARAM_VALUE;
+            goto out;
+        }
     }
-    de->params.instantaneous_bottleneck.population = population_id;
-    de->params.instantaneous_bottleneck.strength = strength;
-    de->change_state = msp_instantaneous_bottleneck;
-    de->print_state = msp_print_instantaneous_bottleneck;
-    ret = 0;
 out:
     return ret;
 }
 
-/* Add a census event at a specified time (given in generations). */
-static int
-msp_census_event(msp_t *self, demographic_event_t *event)
+/* Computes the mean coalescence rate of the uncoalesced pairs of lineages
+ * and the probability that a random pair of lineages from the sample
+ * configuration has not coalesced at each of the specified steps. */
+int MSP_WARN_UNUSED
+msp_debug_coalescence_rates(msp_t *self, size_t num_steps, const double *steps,
+    const double *num_samples, double min_pop_size, int num_threads,
+    double *coalescence_rate, double *uncoalesced)
 {
     int ret = 0;
-    avl_tree_t *ancestors;
-    avl_node_t *node;
-    segment_t *seg;
-    tsk_id_t i, j;
-    tsk_id_t u;
-
-    for (i = 0; i < (int) self->num_populations; i++) {
-        for (j = 0; j < (int) self->num_labels; j++) {
-
-            // Get segment from an ancestor in a population.
-            ancestors = &self->populations[i].ancestors[j];
-            node = ancestors->head;
-
-            while (node != NULL) {
-                seg = (segment_t *) node->item;
+    size_t n = self->num_populations;
+    size_t j, x, y;
+    double t, t_next, epoch_end, total, rate;
+    double *V = NULL;
+    double *work = NULL;
+    debug_generator_t gen;
+
+    ret = debug_generator_alloc(&gen, n, true, num_threads);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_debug_check_steps(self, num_steps, steps);
+    if (ret != 0) {
+        goto out;
+    }
+    V = malloc(n * n * sizeof(*V));
+    work = malloc(2 * n * n * sizeof(*work));
+    if (V == NULL || work == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    total = 0;
+    for (x = 0; x < n; x++) {
+        for (y = 0; y < n; y++) {
+            V[x * n + y] = num_samples[x] * (num_samples[y] - (x == y));
+            total += V[x * n + y];
+        }
+    }
+    if (!(total > 0)) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    for (j = 0; j < n * n; j++) {
+        V[j] /= total;
+    }
 
-                while (seg != NULL) {
-                    // Add an edge to the edge table.
-                    ret = msp_flush_edges(self);
-                    if (ret != 0) {
-                        goto out;
-                    }
-                    ret = tsk_node_table_add_row(&self->tables->nodes,
-                        MSP_NODE_IS_CEN_EVENT, event->time, i, TSK_NULL, NULL, 0);
-                    if (ret < 0) {
-                        goto out;
-                    }
-                    u = (tsk_id_t) ret;
-                    // Add an edge joining the segment to the new node.
-                    ret = msp_store_edge(self, seg->left, seg->right, u, seg->value);
-                    if (ret != 0) {
-                        goto out;
-                    }
-                    // Modify segment node id.
-                    seg->value = u;
-                    seg = seg->next;
+    ret = msp_debug_demography(self, &epoch_end);
+    if (ret != 0) {
+        goto out;
+    }
+    t = 0;
+    j = 0;
+    while (j < num_steps) {
+        while (t == epoch_end) {
+            ret = msp_debug_next_epoch(self, V, true, &epoch_end);
+            if (ret != 0) {
+                goto out;
+            }
+        }
+        ret = msp_debug_generator_update(self, &gen, t, min_pop_size);
+        if (ret != 0) {
+            goto out;
+        }
+        if (steps[j] == t) {
+            total = 0;
+            rate = 0;
+            for (x = 0; x < n; x++) {
+                for (y = 0; y < n; y++) {
+                    total += V[x * n + y];
                 }
-                node = node->next;
+                rate += V[x * n + x] * gen.coalescence_rate[x];
+            }
+            uncoalesced[j] = total;
+            coalescence_rate[j] = total > 0 ? rate / total : GSL_NAN;
+            j++;
+            if (j == num_steps) {
+                break;
             }
         }
+        t_next = GSL_MIN(steps[j], epoch_end);
+        ret = debug_generator_propagate(&gen, t_next - t, V, work);
+        if (ret != 0) {
+            goto out;
+        }
+        t = t_next;
     }
-    ret = 0;
 out:
+    debug_generator_free(&gen);
+    msp_safe_free(V);
+    msp_safe_free(work);
     return ret;
 }
 
-static void
-msp_print_census_event(msp_t *MSP_UNUSED(self), demographic_event_t *event, FILE *out)
-{
-    fprintf(out, "%f\tcensus_event:\n", event->time);
-}
-
+/* Computes the probability that a lineage sampled in population a at
+ * sample_time is in population b at each of the steps, before any mass
+ * migrations at that time. The probabilities for step j are stored
+ * in the n x n matrix starting at probabilities[j * n * n]. Steps more
+ * recent than sample_time have probability zero. */
 int MSP_WARN_UNUSED
-msp_add_census_event(msp_t *self, double time)
+msp_debug_lineage_probabilities(msp_t *self, size_t num_steps, const double *steps,
+    double sample_time, int num_threads, double *probabilities)
 {
     int ret = 0;
-    demographic_event_t *de;
+    size_t n = self->num_populations;
+    size_t j;
+    double t, t_next, epoch_end;
+    double *P = NULL;
+    double *work = NULL;
+    debug_generator_t gen;
 
-    ret = msp_add_demographic_event(self, time, &de);
+    ret = debug_generator_alloc(&gen, n, false, num_threads);
     if (ret != 0) {
         goto out;
     }
+    ret = msp_debug_check_steps(self, num_steps, steps);
+    if (ret != 0) {
+        goto out;
+    }
+    if (!isfinite(sample_time) || sample_time < 0) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    P = calloc(n * n, sizeof(*P));
+    work = malloc(2 * n * n * sizeof(*work));
+    if (P == NULL || work == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    memset(probabilities, 0, num_steps * n * n * sizeof(*probabilities));
+    for (j = 0; j < n; j++) {
+        P[j * n + j] = 1;
+    }
 
-    de->change_state = msp_census_event;
-    de->print_state = msp_print_census_event;
-    ret = 0;
-
+    /* Skip the epochs before the sample time. */
+    ret = msp_debug_demography(self, &epoch_end);
+    if (ret != 0) {
+        goto out;
+    }
+    while (epoch_end <= sample_time) {
+        ret = msp_debug_next_epoch(self, NULL, false, &epoch_end);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    j = 0;
+    while (j < num_steps && steps[j] < sample_time) {
+        j++;
+    }
+    t = sample_time;
+    while (j < num_steps) {
+        if (steps[j] == t) {
+            memcpy(probabilities + j * n * n, P, n * n * sizeof(*P));
+            j++;
+            if (j == num_steps) {
+                break;
+            }
+        }
+        while (t == epoch_end) {
+            ret = msp_debug_next_epoch(self, P, false, &epoch_end);
+            if (ret != 0) {
+                goto out;
+            }
+        }
+        ret = msp_debug_generator_update(self, &gen, t, 0);
+        if (ret != 0) {
+            goto out;
+        }
+        t_next = GSL_MIN(steps[j], epoch_end);
+        ret = debug_generator_propagate(&gen, t_next - t, P, work);
+        if (ret != 0) {
+            goto out;
+        }
+        t = t_next;
+    }
 out:
+    debug_generator_free(&gen);
+    msp_safe_free(P);
+    msp_safe_free(work);
     return ret;
 }
 
@@ -6169,12 +9018,12 @@ msp_std_common_ancestor_event(
     x_node = avl_at(ancestors, j);
     tsk_bug_assert(x_node != NULL);
     x = (segment_t *) x_node->item;
-    avl_unlink_node(ancestors, x_node);
+    msp_unlink_ancestor(self, ancestors, x_node);
     j = (uint32_t) gsl_rng_uniform_int(self->rng, n - 1);
     y_node = avl_at(ancestors, j);
     tsk_bug_assert(y_node != NULL);
     y = (segment_t *) y_node->item;
-    avl_unlink_node(ancestors, y_node);
+    msp_unlink_ancestor(self, ancestors, y_node);
 
     /* For SMC and SMC' models we reject some events to get the required
      * distribution. */
@@ -6182,10 +9031,10 @@ msp_std_common_ancestor_event(
         self->num_rejected_ca_events++;
         /* insert x and y back into the population */
         tsk_bug_assert(x_node->item == x);
-        node = avl_insert_node(ancestors, x_node);
+        node = msp_link_ancestor(self, x_node);
         tsk_bug_assert(node != NULL);
         tsk_bug_assert(y_node->item == y);
-        node = avl_insert_node(ancestors, y_node);
+        node = msp_link_ancestor(self, y_node);
         tsk_bug_assert(node != NULL);
     } else {
         self->num_ca_events++;
@@ -6301,12 +9150,12 @@ msp_dirac_common_ancestor_event(msp_t *self, population_id_t pop_id, label_id_t
             x_node = avl_at(ancestors, j);
             tsk_bug_assert(x_node != NULL);
             x = (segment_t *) x_node->item;
-            avl_unlink_node(ancestors, x_node);
+            msp_unlink_ancestor(self, ancestors, x_node);
             j = (uint32_t) gsl_rng_uniform_int(self->rng, n - 1);
             y_node = avl_at(ancestors, j);
             tsk_bug_assert(y_node != NULL);
             y = (segment_t *) y_node->item;
-            avl_unlink_node(ancestors, y_node);
+            msp_unlink_ancestor(self, ancestors, y_node);
             self->num_ca_events++;
             msp_free_avl_node(self, x_node);
             msp_free_avl_node(self, y_node);
@@ -6455,7 +9304,7 @@ msp_multi_merger_common_ancestor_event(
                 tsk_bug_assert(node != NULL);
 
                 u = (segment_t *) node->item;
-                avl_unlink_node(ancestors, node);
+                msp_unlink_ancestor(self, ancestors, node);
                 msp_free_avl_node(self, node);
 
                 q_node = msp_alloc_avl_node(self);
@@ -6665,10 +9514,18 @@ msp_set_simulation_model(msp_t *self, int model)
     if (model != MSP_MODEL_HUDSON && model != MSP_MODEL_SMC
         && model != MSP_MODEL_SMC_PRIME && model != MSP_MODEL_DIRAC
         && model != MSP_MODEL_BETA && model != MSP_MODEL_DTWF
-        && model != MSP_MODEL_WF_PED && model != MSP_MODEL_SWEEP) {
+        && model != MSP_MODEL_WF_PED && model != MSP_MODEL_SWEEP
+        && model != MSP_MODEL_DTWF_HYBRID) {
         ret = MSP_ERR_BAD_MODEL;
         goto out;
     }
+    if (msp_sweep_in_progress(self)) {
+        /* The sweep was stopped early by a model change */
+        ret = msp_sweep_end(self);
+        if (ret != 0) {
+            goto out;
+        }
+    }
     if (self->model.free != NULL) {
         self->model.free(&self->model);
     }
@@ -6711,6 +9568,199 @@ msp_set_simulation_model_dtwf(msp_t *self)
     return msp_set_simulation_model(self, MSP_MODEL_DTWF);
 }
 
+int
+msp_set_simulation_model_dtwf_hybrid(
+    msp_t *self, double duration, double max_lineage_ratio)
+{
+    int ret = 0;
+
+    if (duration < 0 || max_lineage_ratio < 0) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    ret = msp_set_simulation_model(self, MSP_MODEL_DTWF_HYBRID);
+    if (ret != 0) {
+        goto out;
+    }
+    self->model.params.dtwf_hybrid.duration = duration;
+    self->model.params.dtwf_hybrid.max_lineage_ratio = max_lineage_ratio;
+out:
+    return ret;
+}
+
+/* Maps the specified file read-only into memory. Where mmap isn't
+ * available we read the whole file into a buffer instead. */
+static int MSP_WARN_UNUSED
+msp_map_file(const char *filename, void **data, size_t *size)
+{
+    int ret = 0;
+#ifdef _WIN32
+    long file_size;
+    FILE *file = fopen(filename, "rb");
+
+    *data = NULL;
+    *size = 0;
+    if (file == NULL || fseek(file, 0, SEEK_END) != 0) {
+        ret = MSP_ERR_IO;
+        goto out;
+    }
+    file_size = ftell(file);
+    if (file_size < 0 || fseek(file, 0, SEEK_SET) != 0) {
+        ret = MSP_ERR_IO;
+        goto out;
+    }
+    *size = (size_t) file_size;
+    *data = malloc(*size + 1);
+    if (*data == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    if (fread(*data, 1, *size, file) != *size) {
+        ret = MSP_ERR_IO;
+        goto out;
+    }
+out:
+    if (file != NULL) {
+        fclose(file);
+    }
+#else
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+
+    *data = NULL;
+    *size = 0;
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        ret = MSP_ERR_IO;
+        goto out;
+    }
+    *size = (size_t) st.st_size;
+    if (*size > 0) {
+        *data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (*data == MAP_FAILED) {
+            *data = NULL;
+            ret = MSP_ERR_IO;
+            goto out;
+        }
+    }
+out:
+    if (fd != -1) {
+        close(fd);
+    }
+#endif
+    return ret;
+}
+
+static void
+msp_unmap_file(void *data, size_t size)
+{
+#ifdef _WIN32
+    (void) size;
+    msp_safe_free(data);
+#else
+    if (data != NULL) {
+        munmap(data, size);
+    }
+#endif
+}
+
+static size_t
+msp_pedigree_file_align(size_t offset)
+{
+    return (offset + 7) & ~((size_t) 7);
+}
+
+/* Sets the pedigree from a binary columnar pedigree file (see
+ * MSP_PEDIGREE_FILE_MAGIC). The file is memory mapped and validated in a
+ * single pass over the columns, which are then copied directly into the
+ * pedigree. The input tables must contain one individual per row of the
+ * file, and the sample nodes. */
+int
+msp_set_simulation_model_wf_ped_file(msp_t *self, const char *filename)
+{
+    int ret;
+    void *data = NULL;
+    size_t size = 0;
+    size_t j, k, n, ploidy, parents_offset, time_offset, is_sample_offset, end;
+    const char *bytes;
+    uint32_t version, file_ploidy;
+    uint64_t num_individuals;
+    const tsk_id_t *parents;
+    const double *time;
+    const tsk_flags_t *is_sample;
+    tsk_id_t parent;
+
+    if (self->ploidy != 2) {
+        ret = MSP_ERR_BAD_PLOIDY;
+        goto out;
+    }
+    ret = msp_map_file(filename, &data, &size);
+    if (ret != 0) {
+        goto out;
+    }
+    bytes = (const char *) data;
+    if (size < MSP_PEDIGREE_FILE_HEADER_SIZE
+        || memcmp(bytes, MSP_PEDIGREE_FILE_MAGIC, 8) != 0) {
+        ret = MSP_ERR_BAD_PEDIGREE_FILE;
+        goto out;
+    }
+    memcpy(&version, bytes + 8, sizeof(version));
+    memcpy(&file_ploidy, bytes + 12, sizeof(file_ploidy));
+    memcpy(&num_individuals, bytes + 16, sizeof(num_individuals));
+    if (version != MSP_PEDIGREE_FILE_VERSION || file_ploidy != self->ploidy
+        || num_individuals == 0
+        || num_individuals != (uint64_t) self->tables->individuals.num_rows) {
+        ret = MSP_ERR_BAD_PEDIGREE_FILE;
+        goto out;
+    }
+    n = (size_t) num_individuals;
+    ploidy = self->ploidy;
+    /* The individual column holds external IDs, which we don't need */
+    parents_offset
+        = msp_pedigree_file_align(MSP_PEDIGREE_FILE_HEADER_SIZE + n * sizeof(tsk_id_t));
+    time_offset
+        = msp_pedigree_file_align(parents_offset + n * ploidy * sizeof(tsk_id_t));
+    is_sample_offset = msp_pedigree_file_align(time_offset + n * sizeof(double));
+    end = is_sample_offset + n * sizeof(tsk_flags_t);
+    if (end > size) {
+        ret = MSP_ERR_BAD_PEDIGREE_FILE;
+        goto out;
+    }
+    parents = (const tsk_id_t *) (const void *) (bytes + parents_offset);
+    time = (const double *) (const void *) (bytes + time_offset);
+    is_sample = (const tsk_flags_t *) (const void *) (bytes + is_sample_offset);
+
+    for (j = 0; j < n; j++) {
+        if (!isfinite(time[j]) || is_sample[j] > 1) {
+            ret = MSP_ERR_BAD_PEDIGREE_FILE;
+            goto out;
+        }
+        for (k = 0; k < ploidy; k++) {
+            parent = parents[j * ploidy + k];
+            if (parent < TSK_NULL || parent >= (tsk_id_t) n) {
+                ret = msp_set_tsk_error(TSK_ERR_INDIVIDUAL_OUT_OF_BOUNDS);
+                goto out;
+            }
+            if (parent != TSK_NULL && time[parent] <= time[j]) {
+                ret = MSP_ERR_TIME_TRAVEL;
+                goto out;
+            }
+        }
+    }
+
+    ret = msp_alloc_pedigree(self, n, ploidy);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_set_pedigree(self, parents, time, is_sample);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = msp_set_simulation_model(self, MSP_MODEL_WF_PED);
+out:
+    msp_unmap_file(data, size);
+    return ret;
+}
+
 int
 msp_set_simulation_model_wf_ped(msp_t *self)
 {
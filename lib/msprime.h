@@ -40,6 +40,7 @@
 #define MSP_MODEL_DTWF 5
 #define MSP_MODEL_SWEEP 6
 #define MSP_MODEL_WF_PED 7
+#define MSP_MODEL_DTWF_HYBRID 8
 
 /* Exit codes from msp_run to distinguish different reasons for exiting
  * before coalescence. */
@@ -93,36 +94,48 @@ typedef struct {
     tsk_id_t *potential_destinations;
 } population_t;
 
-/* Note: we might want to make a distinction here between "individual"
- * and "pedigree individual". We might want to have a more generic
- * individual type at some point which just consists of an array of
- * ploidy segment pointers (one head for each strand). This struct
- * is quite specialised for the purpose of running the pedigree
- * simulation. */
-typedef struct individual_t_t {
-    tsk_id_t id;
-    /* Note: probably simpler to make parents a list of tsk_id_ts,
-     * save a bit of pointer fiddling */
-    struct individual_t_t **parents;
-    avl_tree_t *segments;
-    int sex;
-    double time;
-    bool queued;
-    // For debugging, to ensure we only merge once.
-    bool merged;
-} individual_t;
-
+/* The pedigree is stored in columnar form: individual j has time time[j]
+ * and parents parents[j * ploidy + k], which are TSK_NULL for founders.
+ * Most individuals in a deep pedigree never receive ancestral material,
+ * so the per-individual segment sets are allocated from segment_set_heap
+ * when material first arrives and returned once the individual has been
+ * merged; segments[j] is NULL otherwise. */
 typedef struct {
-    individual_t *inds;
     size_t num_inds;
-    /* JK We don't need the samples any more, as we can derive this
-     * from the tables. */
-    individual_t **samples;
+    tsk_id_t *parents;
+    double *time;
+    avl_tree_t **segments;
+    object_heap_t segment_set_heap;
+    bool *queued;
+    tsk_id_t *samples;
     size_t num_samples;
     avl_tree_t ind_heap;
+    /* When all times are integers the individual queue is a FIFO bucket
+     * per generation, bucket j holding individuals with time
+     * min_time + j and linked through next_queued. Otherwise we fall
+     * back to ind_heap. */
+    bool use_buckets;
+    double min_time;
+    size_t num_buckets;
+    size_t current_bucket;
+    size_t num_queued;
+    tsk_id_t *next_queued;
+    tsk_id_t *bucket_head;
+    tsk_id_t *bucket_tail;
     int state;
 } pedigree_t;
 
+/* Binary columnar pedigree files, as read by
+ * msp_set_simulation_model_wf_ped_file. The file starts with the 8 byte
+ * magic, followed by the uint32 version and ploidy and the uint64 number
+ * of individuals, all in native byte order. The individual (int32),
+ * parents (int32, ploidy per individual), time (float64) and is_sample
+ * (uint32) columns follow in that order, each starting at a multiple of
+ * 8 bytes from the start of the file. */
+#define MSP_PEDIGREE_FILE_MAGIC "MSPPED01"
+#define MSP_PEDIGREE_FILE_VERSION 1
+#define MSP_PEDIGREE_FILE_HEADER_SIZE 24
+
 typedef struct {
     double time;
     tsk_id_t sample;
@@ -141,6 +154,11 @@ typedef struct {
     double c;
 } dirac_coalescent_t;
 
+typedef struct {
+    double duration;
+    double max_lineage_ratio;
+} dtwf_hybrid_t;
+
 /* Forward declaration */
 struct _msp_t;
 
@@ -163,11 +181,38 @@ typedef struct _sweep_t {
     void (*print_state)(struct _sweep_t *self, FILE *out);
 } sweep_t;
 
+/* A bank of sweep trajectories generated in advance, from which each
+ * sweep draws one at random instead of generating its own. Trajectory j
+ * occupies entries offset[j] to offset[j + 1] - 1 of the time and
+ * allele_frequency arrays, with times relative to the start of the
+ * sweep. The bank is kept across msp_reset and regenerated only if the
+ * trajectory parameters change. */
+typedef struct {
+    genic_selection_trajectory_t params;
+    size_t num_trajectories;
+    size_t *offset;
+    double *time;
+    double *allele_frequency;
+} sweep_trajectory_bank_t;
+
+/* The state of the sweep in progress, so that it can be stopped and
+ * resumed across calls to msp_run. Times are absolute; see msp_run_sweep
+ * for the cumulative coalescence factors. */
+typedef struct {
+    size_t num_steps;
+    size_t curr_step;
+    double *time;
+    double *allele_frequency;
+    double *cum_coal_b;
+    double *cum_coal_B;
+} sweep_state_t;
+
 typedef struct _simulation_model_t {
     int type;
     union {
         beta_coalescent_t beta_coalescent;
         dirac_coalescent_t dirac_coalescent;
+        dtwf_hybrid_t dtwf_hybrid;
         sweep_t sweep;
     } params;
     /* If the model allocates memory this function should be non-null. */
@@ -185,6 +230,10 @@ typedef struct _msp_t {
     simulation_model_t model;
     bool store_migrations;
     bool store_full_arg;
+    bool dtwf_generation_skipping;
+    size_t dtwf_num_threads;
+    size_t pedigree_num_threads;
+    size_t sweep_trajectory_bank_size;
     double sequence_length;
     bool discrete_genome;
     rate_map_t recomb_map;
@@ -219,10 +268,11 @@ typedef struct _msp_t {
     sampling_event_t *sampling_events;
     size_t num_sampling_events;
     size_t next_sampling_event;
-    /* Demographic events */
-    struct demographic_event_t_t *demographic_events_head;
-    struct demographic_event_t_t *demographic_events_tail;
-    struct demographic_event_t_t *next_demographic_event;
+    /* Demographic events, stored contiguously in time order. */
+    struct demographic_event_t_t *demographic_events;
+    size_t num_demographic_events;
+    size_t max_demographic_events;
+    size_t next_demographic_event;
     /* algorithm state */
     int state;
     double time;
@@ -231,14 +281,24 @@ typedef struct _msp_t {
     avl_tree_t non_empty_populations;
     avl_tree_t breakpoints;
     avl_tree_t overlap_counts;
-    /* We keep an independent Fenwick tree for each label */
+    sweep_state_t sweep_state;
+    /* We keep an independent Fenwick tree for each label, all indexed by
+     * segment id. A segment's mass is stored only in the tree for its
+     * label, so that changing label just moves the mass between trees. */
     fenwick_t *recomb_mass_index;
     fenwick_t *gc_mass_index;
+    /* The number of lineages in each population, with a tree for each
+     * label, so that we can count and choose lineages across populations
+     * without visiting them all */
+    fenwick_t *ancestor_count_index;
+    /* Per-population random generators for the DTWF on more than one thread */
+    gsl_rng **dtwf_rngs;
+    sweep_trajectory_bank_t *sweep_trajectory_bank;
     /* memory management */
     object_heap_t avl_node_heap;
     object_heap_t node_mapping_heap;
-    /* We keep an independent segment heap for each label */
-    object_heap_t *segment_heap;
+    /* Segments of all labels share a single heap and id space */
+    object_heap_t segment_heap;
     /* The tables used to store the simulation state */
     tsk_table_collection_t *tables;
     tsk_bookmark_t input_position;
@@ -246,6 +306,11 @@ typedef struct _msp_t {
     tsk_edge_t *buffered_edges;
     tsk_size_t num_buffered_edges;
     tsk_size_t max_buffered_edges;
+    /* Scratch space for instantaneous bottlenecks, grown as needed and
+     * reused between events */
+    tsk_id_t *bottleneck_ids;
+    avl_node_t **bottleneck_nodes;
+    size_t max_bottleneck_lineages;
     /* Methods for getting the waiting time until the next common ancestor
      * event and the event are defined by the simulation model */
     double (*get_common_ancestor_waiting_time)(
@@ -282,6 +347,10 @@ typedef struct {
     double strength;
 } instantaneous_bottleneck_t;
 
+typedef struct {
+    bool per_lineage;
+} census_event_t;
+
 typedef struct demographic_event_t_t {
     double time;
     int (*change_state)(msp_t *, struct demographic_event_t_t *);
@@ -292,8 +361,8 @@ typedef struct demographic_event_t_t {
         mass_migration_t mass_migration;
         migration_rate_change_t migration_rate_change;
         population_parameters_change_t population_parameters_change;
+        census_event_t census_event;
     } params;
-    struct demographic_event_t_t *next;
 } demographic_event_t;
 
 /* The site_t and mutation_t are similar the equivalent tsk_ types,
@@ -304,6 +373,9 @@ typedef struct mutation_t {
     tsk_id_t node;
     char *derived_state;
     tsk_size_t derived_state_length;
+    /* The index of the derived state in the mutation model's alleles,
+     * or TSK_NULL if this is not known. */
+    tsk_id_t allele;
     char *metadata;
     tsk_size_t metadata_length;
     double time;
@@ -317,6 +389,7 @@ typedef struct {
     double position;
     char *ancestral_state;
     tsk_size_t ancestral_state_length;
+    tsk_id_t allele;
     char *metadata;
     tsk_size_t metadata_length;
     mutation_t *mutations;
@@ -324,24 +397,68 @@ typedef struct {
     bool new;
 } site_t;
 
+/* A new mutation that has been placed on an edge, but not yet assigned
+ * to a site. */
+typedef struct {
+    double position;
+    double time;
+    tsk_id_t node;
+    tsk_id_t edge;
+} placed_mutation_t;
+
+/* The new mutations placed in the genome interval [left, right), using
+ * a random generator seeded with the specified value. The chunk's alleles
+ * are chosen with the same generator. */
+typedef struct {
+    double left;
+    double right;
+    unsigned long int seed;
+    gsl_rng *rng;
+    /* The edges that overlap the chunk, in table order */
+    const tsk_id_t *edges;
+    size_t num_edges;
+    size_t first_site;
+    placed_mutation_t *mutations;
+    size_t num_mutations;
+    size_t max_mutations;
+    int ret;
+} mutgen_chunk_t;
+
 typedef struct {
     size_t num_alleles;
     char **alleles;
     tsk_size_t *allele_length;
     double *root_distribution;
     double *transition_matrix;
+    /* Alias tables for each row of the transition matrix, followed by
+     * the table for the root distribution. */
+    double *alias_threshold;
+    size_t *alias_index;
 } mutation_matrix_t;
 
+/* Append-only storage for the alleles and metadata generated by mutation
+ * models. Values are written once, in order, into large chunks that never
+ * move, so that consecutive values are adjacent in memory. */
+typedef struct {
+    size_t chunk_size;
+    size_t num_chunks;
+    char **chunks;
+    char *head;
+    size_t head_size;
+    size_t head_used;
+} allele_arena_t;
+
 typedef struct {
     int32_t mutation_type_id; // following SLiM's MutationMetadataRec
     int64_t next_mutation_id; // following SLiM's slim_mutationid_t
-    tsk_blkalloc_t allocator;
+    allele_arena_t alleles;
+    allele_arena_t metadata;
 } slim_mutator_t;
 
 typedef struct {
     uint64_t start_allele;
     uint64_t next_allele;
-    tsk_blkalloc_t allocator;
+    allele_arena_t alleles;
 } infinite_alleles_t;
 
 typedef struct _mutation_model_t {
@@ -357,8 +474,11 @@ typedef struct _mutation_model_t {
         struct _mutation_model_t *model, gsl_rng *rng, site_t *site);
     int (*transition)(struct _mutation_model_t *model, gsl_rng *rng,
         const char *parent_allele, tsk_size_t parent_allele_length,
-        const char *parent_metadata, tsk_size_t parent_metadata_length,
-        mutation_t *mutation);
+        tsk_id_t parent_allele_index, const char *parent_metadata,
+        tsk_size_t parent_metadata_length, mutation_t *mutation);
+    /* True if the model has no state that changes as alleles are chosen,
+     * so that it can be called concurrently with different generators. */
+    bool thread_safe;
 } mutation_model_t;
 
 typedef struct {
@@ -368,7 +488,19 @@ typedef struct {
     double end_time;
     size_t block_size;
     rate_map_t rate_map;
-    avl_tree_t sites;
+    size_t num_chunks;
+    size_t num_threads;
+    mutgen_chunk_t *chunks;
+    tsk_id_t *chunk_edges;
+    size_t max_chunk_edges;
+    site_t *sites;
+    size_t num_sites;
+    size_t max_sites;
+    placed_mutation_t *placed_mutations;
+    size_t num_placed_mutations;
+    size_t max_placed_mutations;
+    mutation_t *new_mutations;
+    size_t max_new_mutations;
     tsk_blkalloc_t allocator;
     mutation_model_t *model;
 } mutgen_t;
@@ -378,7 +510,10 @@ int msp_set_simulation_model_hudson(msp_t *self);
 int msp_set_simulation_model_smc(msp_t *self);
 int msp_set_simulation_model_smc_prime(msp_t *self);
 int msp_set_simulation_model_dtwf(msp_t *self);
+int msp_set_simulation_model_dtwf_hybrid(
+    msp_t *self, double duration, double max_lineage_ratio);
 int msp_set_simulation_model_wf_ped(msp_t *self);
+int msp_set_simulation_model_wf_ped_file(msp_t *self, const char *filename);
 int msp_set_simulation_model_dirac(msp_t *self, double psi, double c);
 int msp_set_simulation_model_beta(msp_t *self, double alpha, double truncation_point);
 int msp_set_simulation_model_sweep_genic_selection(msp_t *self, double position,
@@ -387,6 +522,10 @@ int msp_set_simulation_model_sweep_genic_selection(msp_t *self, double position,
 int msp_set_start_time(msp_t *self, double start_time);
 int msp_set_store_migrations(msp_t *self, bool store_migrations);
 int msp_set_store_full_arg(msp_t *self, bool store_full_arg);
+int msp_set_dtwf_generation_skipping(msp_t *self, bool dtwf_generation_skipping);
+int msp_set_dtwf_num_threads(msp_t *self, size_t num_threads);
+int msp_set_pedigree_num_threads(msp_t *self, size_t num_threads);
+int msp_set_sweep_trajectory_bank_size(msp_t *self, size_t size);
 int msp_set_ploidy(msp_t *self, int ploidy);
 int msp_set_recombination_map(msp_t *self, size_t size, double *position, double *rate);
 int msp_set_recombination_rate(msp_t *self, double rate);
@@ -413,11 +552,16 @@ int msp_add_simple_bottleneck(
     msp_t *self, double time, int population_id, double intensity);
 int msp_add_instantaneous_bottleneck(
     msp_t *self, double time, int population_id, double strength);
-int msp_add_census_event(msp_t *self, double time);
+int msp_add_census_event(msp_t *self, double time, bool per_lineage);
 
 int msp_initialise(msp_t *self);
 int msp_run(msp_t *self, double max_time, unsigned long max_events);
 int msp_debug_demography(msp_t *self, double *end_time);
+int msp_debug_coalescence_rates(msp_t *self, size_t num_steps, const double *steps,
+    const double *num_samples, double min_pop_size, int num_threads,
+    double *coalescence_rate, double *uncoalesced);
+int msp_debug_lineage_probabilities(msp_t *self, size_t num_steps, const double *steps,
+    double sample_time, int num_threads, double *probabilities);
 int msp_finalise_tables(msp_t *self);
 int msp_reset(msp_t *self);
 int msp_print_state(msp_t *self, FILE *out);
@@ -472,6 +616,8 @@ int mutgen_alloc(mutgen_t *self, gsl_rng *rng, tsk_table_collection_t *tables,
 int mutgen_set_time_interval(mutgen_t *self, double start_time, double end_time);
 int mutgen_set_rate(mutgen_t *self, double rate);
 int mutgen_set_rate_map(mutgen_t *self, size_t size, double *position, double *rate);
+int mutgen_set_num_chunks(mutgen_t *self, size_t num_chunks);
+int mutgen_set_num_threads(mutgen_t *self, size_t num_threads);
 int mutgen_free(mutgen_t *self);
 int mutgen_generate(mutgen_t *self, int flags);
 void mutgen_print_state(mutgen_t *self, FILE *out);
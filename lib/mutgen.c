@@ -25,6 +25,10 @@
 
 #include "msprime.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 static int
 cmp_site(const void *a, const void *b)
 {
@@ -116,6 +120,67 @@ out:
     return ret;
 }
 
+/**************************
+ * Allele arena */
+
+static void
+allele_arena_init(allele_arena_t *self, size_t chunk_size)
+{
+    memset(self, 0, sizeof(*self));
+    self->chunk_size = chunk_size;
+}
+
+static void
+allele_arena_free(allele_arena_t *self)
+{
+    size_t j;
+
+    for (j = 0; j < self->num_chunks; j++) {
+        msp_safe_free(self->chunks[j]);
+    }
+    msp_safe_free(self->chunks);
+}
+
+/* Returns a pointer to at least size free bytes at the end of the arena,
+ * or NULL if we run out of memory. Values larger than the chunk size get a
+ * chunk of their own. The space is not used until allele_arena_commit is
+ * called, so we can reserve an upper bound and commit the actual length. */
+static char *
+allele_arena_reserve(allele_arena_t *self, size_t size)
+{
+    char *chunk = NULL;
+    char **chunks;
+    size_t chunk_size;
+
+    if (self->head != NULL && self->head_used + size <= self->head_size) {
+        return self->head + self->head_used;
+    }
+    chunk_size = GSL_MAX(self->chunk_size, size);
+    chunks = realloc(self->chunks, (self->num_chunks + 1) * sizeof(*chunks));
+    if (chunks == NULL) {
+        goto out;
+    }
+    self->chunks = chunks;
+    chunk = malloc(chunk_size);
+    if (chunk == NULL) {
+        goto out;
+    }
+    self->chunks[self->num_chunks] = chunk;
+    self->num_chunks++;
+    self->head = chunk;
+    self->head_size = chunk_size;
+    self->head_used = 0;
+out:
+    return chunk;
+}
+
+static void
+allele_arena_commit(allele_arena_t *self, size_t size)
+{
+    tsk_bug_assert(self->head_used + size <= self->head_size);
+    self->head_used += size;
+}
+
 /**************************
  * Mutation matrix model */
 
@@ -202,11 +267,14 @@ mutation_matrix_choose_root_state(mutation_model_t *self, gsl_rng *rng, site_t *
 {
     int ret = 0;
     mutation_matrix_t params = self->params.mutation_matrix;
-    double u = gsl_ran_flat(rng, 0.0, 1.0);
-    size_t j = probability_list_select(u, params.num_alleles, params.root_distribution);
-    tsk_bug_assert(j < params.num_alleles);
+    size_t n = params.num_alleles;
+    double u = gsl_ran_flat(rng, 0.0, (double) n);
+    size_t j = alias_table_select(
+        u, n, params.alias_threshold + n * n, params.alias_index + n * n);
+    tsk_bug_assert(j < n);
     site->ancestral_state = params.alleles[j];
     site->ancestral_state_length = params.allele_length[j];
+    site->allele = (tsk_id_t) j;
     return ret;
 }
 
@@ -216,29 +284,38 @@ mutation_matrix_choose_root_state(mutation_model_t *self, gsl_rng *rng, site_t *
 static int
 mutation_matrix_transition(mutation_model_t *self, gsl_rng *rng,
     const char *parent_allele, tsk_size_t parent_allele_length,
-    const char *MSP_UNUSED(parent_metadata),
+    tsk_id_t parent_allele_index, const char *MSP_UNUSED(parent_metadata),
     tsk_size_t MSP_UNUSED(parent_metadata_length), mutation_t *mutation)
 {
     int ret = 0;
     mutation_matrix_t params = self->params.mutation_matrix;
-    double u = gsl_ran_flat(rng, 0.0, 1.0);
-    double *probs;
+    size_t n = params.num_alleles;
+    double u;
+    size_t row;
     tsk_id_t j, pi;
 
-    pi = mutation_matrix_allele_index(&params, parent_allele, parent_allele_length);
+    /* Only alleles that came from the tables need to be looked up */
+    pi = parent_allele_index;
+    if (pi < 0) {
+        pi = mutation_matrix_allele_index(&params, parent_allele, parent_allele_length);
+    }
     if (pi < 0) {
         /* only error if we are actually trying to mutate an unknown allele */
         ret = MSP_ERR_UNKNOWN_ALLELE;
         goto out;
     }
-    probs = params.transition_matrix + (tsk_size_t) pi * params.num_alleles;
-    j = (tsk_id_t) probability_list_select(u, params.num_alleles, probs);
+    tsk_bug_assert((size_t) pi < n);
+    row = (size_t) pi * n;
+    u = gsl_ran_flat(rng, 0.0, (double) n);
+    j = (tsk_id_t) alias_table_select(
+        u, n, params.alias_threshold + row, params.alias_index + row);
     ret = 1;
     if (j != pi) {
         /* Only return 0 in the case where we perform an actual transition */
         ret = 0;
         mutation->derived_state = params.alleles[j];
         mutation->derived_state_length = params.allele_length[j];
+        mutation->allele = j;
     }
 out:
     return ret;
@@ -259,6 +336,8 @@ mutation_matrix_free(mutation_model_t *self)
     msp_safe_free(params.allele_length);
     msp_safe_free(params.root_distribution);
     msp_safe_free(params.transition_matrix);
+    msp_safe_free(params.alias_threshold);
+    msp_safe_free(params.alias_index);
     return 0;
 }
 
@@ -352,12 +431,14 @@ slim_mutator_choose_root_state(
 static int
 slim_mutator_transition(mutation_model_t *self, gsl_rng *MSP_UNUSED(rng),
     const char *parent_allele, tsk_size_t parent_allele_length,
-    const char *parent_metadata, tsk_size_t parent_metadata_length, mutation_t *mutation)
+    tsk_id_t MSP_UNUSED(parent_allele_index), const char *parent_metadata,
+    tsk_size_t parent_metadata_length, mutation_t *mutation)
 {
     int ret = 0;
     slim_mutator_t *params = &self->params.slim_mutator;
     char *buff = NULL;
     int len;
+    size_t metadata_length;
     /* The maximum number of digits for a signed 64 bit integer (including
      * the leading "-") */
     const size_t max_digits = 20;
@@ -368,7 +449,7 @@ slim_mutator_transition(mutation_model_t *self, gsl_rng *MSP_UNUSED(rng),
     const char *sep = parent_allele_length == 0 ? "" : ",";
 
     /* Append to derived_state */
-    buff = tsk_blkalloc_get(&params->allocator, alloc_size);
+    buff = allele_arena_reserve(&params->alleles, alloc_size);
     if (buff == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
@@ -387,22 +468,23 @@ slim_mutator_transition(mutation_model_t *self, gsl_rng *MSP_UNUSED(rng),
         goto out;
     }
     params->next_mutation_id++;
+    allele_arena_commit(&params->alleles, (size_t) len);
     mutation->derived_state = buff;
     mutation->derived_state_length = (tsk_size_t) len;
 
     /* Append to metadata */
-    buff = tsk_blkalloc_get(
-        &params->allocator, parent_metadata_length + SLIM_MUTATION_METADATA_SIZE);
+    metadata_length = parent_metadata_length + SLIM_MUTATION_METADATA_SIZE;
+    buff = allele_arena_reserve(&params->metadata, metadata_length);
     if (buff == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
     memcpy(buff, parent_metadata, parent_metadata_length);
     copy_slim_mutation_metadata(params, buff + parent_metadata_length);
+    allele_arena_commit(&params->metadata, metadata_length);
 
     mutation->metadata = buff;
-    mutation->metadata_length
-        = (tsk_size_t)(parent_metadata_length + SLIM_MUTATION_METADATA_SIZE);
+    mutation->metadata_length = (tsk_size_t) metadata_length;
 out:
     return ret;
 }
@@ -410,8 +492,9 @@ out:
 static int
 slim_mutator_free(mutation_model_t *self)
 {
-    slim_mutator_t params = self->params.slim_mutator;
-    tsk_blkalloc_free(&params.allocator);
+    slim_mutator_t *params = &self->params.slim_mutator;
+    allele_arena_free(&params->alleles);
+    allele_arena_free(&params->metadata);
     return 0;
 }
 
@@ -437,12 +520,18 @@ infinite_alleles_make_allele(
 {
     int ret = 0;
     infinite_alleles_t *params = &self->params.infinite_alleles;
-    char tmp_buff[MAX_UINT_BUFF_SIZE];
     char *buff = NULL;
     int num_digits;
     tsk_size_t len;
 
-    num_digits = snprintf(tmp_buff, MAX_UINT_BUFF_SIZE, "%" PRIu64, params->next_allele);
+    /* Format the allele directly into the arena; the NULL terminator is
+     * overwritten by the next allele. */
+    buff = allele_arena_reserve(&params->alleles, MAX_UINT_BUFF_SIZE);
+    if (buff == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    num_digits = snprintf(buff, MAX_UINT_BUFF_SIZE, "%" PRIu64, params->next_allele);
     if (num_digits < 0) {
         /* Technically this can happen. Returning TSK_ERR_IO should result
          * in Python code checking errno. */
@@ -451,13 +540,7 @@ infinite_alleles_make_allele(
     }
     len = (tsk_size_t) num_digits;
     tsk_bug_assert(len < MAX_UINT_BUFF_SIZE);
-
-    buff = tsk_blkalloc_get(&params->allocator, len);
-    if (buff == NULL) {
-        ret = MSP_ERR_NO_MEMORY;
-        goto out;
-    }
-    memcpy(buff, tmp_buff, len);
+    allele_arena_commit(&params->alleles, len);
     params->next_allele++;
     *dest = buff;
     *dest_length = len;
@@ -476,7 +559,7 @@ infinite_alleles_choose_root_state(
 static int
 infinite_alleles_transition(mutation_model_t *self, gsl_rng *MSP_UNUSED(rng),
     const char *MSP_UNUSED(parent_allele), tsk_size_t MSP_UNUSED(parent_allele_length),
-    const char *MSP_UNUSED(parent_metadata),
+    tsk_id_t MSP_UNUSED(parent_allele_index), const char *MSP_UNUSED(parent_metadata),
     tsk_size_t MSP_UNUSED(parent_metadata_length), mutation_t *mutation)
 {
     return infinite_alleles_make_allele(
@@ -486,8 +569,8 @@ infinite_alleles_transition(mutation_model_t *self, gsl_rng *MSP_UNUSED(rng),
 static int
 infinite_alleles_free(mutation_model_t *self)
 {
-    infinite_alleles_t params = self->params.infinite_alleles;
-    tsk_blkalloc_free(&params.allocator);
+    infinite_alleles_t *params = &self->params.infinite_alleles;
+    allele_arena_free(&params->alleles);
     return 0;
 }
 
@@ -531,8 +614,13 @@ matrix_mutation_model_alloc(mutation_model_t *self, size_t num_alleles, char **a
     params->root_distribution = malloc(num_alleles * sizeof(*params->root_distribution));
     params->transition_matrix
         = malloc(num_alleles * num_alleles * sizeof(*params->transition_matrix));
+    params->alias_threshold = malloc(
+        (num_alleles + 1) * num_alleles * sizeof(*params->alias_threshold));
+    params->alias_index
+        = malloc((num_alleles + 1) * num_alleles * sizeof(*params->alias_index));
     if (params->alleles == NULL || params->allele_length == NULL
-        || params->root_distribution == NULL || params->transition_matrix == NULL) {
+        || params->root_distribution == NULL || params->transition_matrix == NULL
+        || params->alias_threshold == NULL || params->alias_index == NULL) {
         ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
@@ -540,6 +628,16 @@ matrix_mutation_model_alloc(mutation_model_t *self, size_t num_alleles, char **a
         num_alleles * sizeof(*root_distribution));
     memcpy(params->transition_matrix, transition_matrix,
         num_alleles * num_alleles * sizeof(*transition_matrix));
+    /* Precompute the alias tables so that each draw takes constant time */
+    for (i = 0; i <= num_alleles; i++) {
+        ret = alias_table_init(num_alleles,
+            i < num_alleles ? transition_matrix + i * num_alleles : root_distribution,
+            params->alias_threshold + i * num_alleles,
+            params->alias_index + i * num_alleles);
+        if (ret != 0) {
+            goto out;
+        }
+    }
     ret = mutation_matrix_copy_alleles(params, alleles, allele_lengths);
     if (ret != 0) {
         goto out;
@@ -548,6 +646,7 @@ matrix_mutation_model_alloc(mutation_model_t *self, size_t num_alleles, char **a
     self->transition = &mutation_matrix_transition;
     self->print_state = &mutation_matrix_print_state;
     self->free = &mutation_matrix_free;
+    self->thread_safe = true;
 out:
     return ret;
 }
@@ -566,19 +665,15 @@ slim_mutation_model_alloc(mutation_model_t *self, int32_t mutation_type_id,
     self->print_state = &slim_mutator_print_state;
     self->free = &slim_mutator_free;
     if (block_size == 0) {
-        /* 8K is a good default, but we need to have the
-         * block_size argument here because the size of the allocations
-         * we need to make are in principle unbounded since SLiM
-         * copies the entire parent state for every mutation as it
-         * goes down along the tree.
+        /* 8K is a good default. The size of the allocations we need to
+         * make are in principle unbounded since SLiM copies the entire
+         * parent state for every mutation as it goes down along the tree,
+         * but the arena gives any larger values a chunk of their own.
          */
         block_size = 8192;
     }
-    ret = tsk_blkalloc_init(&params->allocator, block_size);
-    if (ret != 0) {
-        ret = msp_set_tsk_error(ret);
-        goto out;
-    }
+    allele_arena_init(&params->alleles, block_size);
+    allele_arena_init(&params->metadata, block_size);
     params->mutation_type_id = mutation_type_id;
     params->next_mutation_id = next_mutation_id;
 
@@ -594,7 +689,6 @@ int MSP_WARN_UNUSED
 infinite_alleles_mutation_model_alloc(
     mutation_model_t *self, uint64_t start_allele, tsk_flags_t MSP_UNUSED(options))
 {
-    int ret = 0;
     infinite_alleles_t *params = &self->params.infinite_alleles;
 
     memset(self, 0, sizeof(*self));
@@ -603,15 +697,10 @@ infinite_alleles_mutation_model_alloc(
     self->transition = &infinite_alleles_transition;
     self->print_state = &infinite_alleles_print_state;
     self->free = &infinite_alleles_free;
-    ret = tsk_blkalloc_init(&params->allocator, 8192);
-    if (ret != 0) {
-        ret = msp_set_tsk_error(ret);
-        goto out;
-    }
+    allele_arena_init(&params->alleles, 8192);
     params->start_allele = start_allele;
     params->next_allele = start_allele;
-out:
-    return ret;
+    return 0;
 }
 
 int
@@ -632,10 +721,11 @@ mutation_model_choose_root_state(mutation_model_t *self, gsl_rng *rng, site_t *s
 static int MSP_WARN_UNUSED
 mutation_model_transition(mutation_model_t *self, gsl_rng *rng,
     const char *parent_allele, tsk_size_t parent_allele_length,
-    const char *parent_metadata, tsk_size_t parent_metadata_length, mutation_t *mutation)
+    tsk_id_t parent_allele_index, const char *parent_metadata,
+    tsk_size_t parent_metadata_length, mutation_t *mutation)
 {
     return self->transition(self, rng, parent_allele, parent_allele_length,
-        parent_metadata, parent_metadata_length, mutation);
+        parent_allele_index, parent_metadata, parent_metadata_length, mutation);
 }
 
 void
@@ -689,13 +779,16 @@ matrix_mutation_model_factory(mutation_model_t *self, int model)
 static void
 mutgen_check_state(mutgen_t *self)
 {
-    size_t j;
-    avl_node_t *a;
+    size_t j, k;
     site_t *s;
     mutation_t *m;
 
-    for (a = self->sites.head; a != NULL; a = a->next) {
-        s = (site_t *) a->item;
+    tsk_bug_assert(self->num_sites <= self->max_sites);
+    for (k = 0; k < self->num_sites; k++) {
+        s = &self->sites[k];
+        if (k > 0) {
+            tsk_bug_assert(self->sites[k - 1].position < s->position);
+        }
         m = s->mutations;
         for (j = 0; j < s->mutations_length; j++) {
             tsk_bug_assert(m != NULL);
@@ -713,7 +806,7 @@ mutgen_check_state(mutgen_t *self)
 void
 mutgen_print_state(mutgen_t *self, FILE *out)
 {
-    avl_node_t *a;
+    size_t j;
     site_t *s;
     mutation_t *m;
     tsk_id_t parent_id;
@@ -723,12 +816,16 @@ mutgen_print_state(mutgen_t *self, FILE *out)
     rate_map_print_state(&self->rate_map, out);
     fprintf(out, "\tstart_time = %f\n", self->start_time);
     fprintf(out, "\tend_time = %f\n", self->end_time);
+    fprintf(out, "\tnum_chunks = %d\n", (int) self->num_chunks);
+    fprintf(out, "\tnum_threads = %d\n", (int) self->num_threads);
     fprintf(out, "\tmodel:\n");
     mutation_model_print_state(self->model, out);
+    fprintf(out, "\tnum_placed_mutations = %d\n", (int) self->num_placed_mutations);
+    fprintf(out, "\tnum_sites = %d\n", (int) self->num_sites);
     tsk_blkalloc_print_state(&self->allocator, out);
 
-    for (a = self->sites.head; a != NULL; a = a->next) {
-        s = (site_t *) a->item;
+    for (j = 0; j < self->num_sites; j++) {
+        s = &self->sites[j];
         fprintf(out, "site:\t%f\t'%.*s'\t'%.*s'\t(%d)\t%d\n", s->position,
             (int) s->ancestral_state_length, s->ancestral_state,
             (int) s->metadata_length, s->metadata, s->new, (int) s->mutations_length);
@@ -760,25 +857,52 @@ mutgen_alloc(mutgen_t *self, gsl_rng *rng, tsk_table_collection_t *tables,
     self->start_time = -DBL_MAX;
     self->end_time = DBL_MAX;
     self->block_size = block_size;
+    self->num_threads = 1;
 
     if (tables->sequence_length <= 0) {
         ret = MSP_ERR_BAD_PARAM_VALUE;
         goto out;
     }
-    avl_init_tree(&self->sites, cmp_site, NULL);
     ret = mutgen_set_rate(self, 0);
     if (ret != 0) {
         goto out;
     }
+    ret = mutgen_set_num_chunks(self, 1);
+    if (ret != 0) {
+        goto out;
+    }
 out:
     return ret;
 }
 
+static void
+mutgen_free_chunks(mutgen_t *self)
+{
+    size_t j;
+
+    if (self->chunks != NULL) {
+        for (j = 0; j < self->num_chunks; j++) {
+            msp_safe_free(self->chunks[j].mutations);
+            if (self->chunks[j].rng != NULL) {
+                gsl_rng_free(self->chunks[j].rng);
+            }
+        }
+        free(self->chunks);
+        self->chunks = NULL;
+    }
+    self->num_chunks = 0;
+}
+
 int
 mutgen_free(mutgen_t *self)
 {
+    mutgen_free_chunks(self);
+    msp_safe_free(self->chunk_edges);
     tsk_blkalloc_free(&self->allocator);
     rate_map_free(&self->rate_map);
+    msp_safe_free(self->sites);
+    msp_safe_free(self->placed_mutations);
+    msp_safe_free(self->new_mutations);
     return 0;
 }
 
@@ -816,6 +940,44 @@ out:
     return ret;
 }
 
+/* Sets the number of equal-length chunks of the genome in which mutations
+ * are placed independently. Each chunk has its own random generator, so
+ * that the chunks can be placed, and for thread safe mutation models have
+ * their alleles chosen, in parallel. */
+int MSP_WARN_UNUSED
+mutgen_set_num_chunks(mutgen_t *self, size_t num_chunks)
+{
+    int ret = 0;
+
+    if (num_chunks < 1) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    mutgen_free_chunks(self);
+    self->chunks = calloc(num_chunks, sizeof(*self->chunks));
+    if (self->chunks == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    self->num_chunks = num_chunks;
+out:
+    return ret;
+}
+
+int MSP_WARN_UNUSED
+mutgen_set_num_threads(mutgen_t *self, size_t num_threads)
+{
+    int ret = 0;
+
+    if (num_threads < 1) {
+        ret = MSP_ERR_BAD_PARAM_VALUE;
+        goto out;
+    }
+    self->num_threads = num_threads;
+out:
+    return ret;
+}
+
 /* Short-cut for mutgen_set_recombination_map can be used in testing. */
 int
 mutgen_set_rate(mutgen_t *self, double rate)
@@ -859,29 +1021,20 @@ out:
 }
 
 static int MSP_WARN_UNUSED
-mutgen_add_new_site(mutgen_t *self, double position, site_t **new_site)
+mutgen_reserve_sites(mutgen_t *self, size_t num_sites)
 {
     int ret = 0;
-    avl_node_t *avl_node;
-    site_t *site;
-
-    avl_node = tsk_blkalloc_get(&self->allocator, sizeof(*avl_node));
-    site = tsk_blkalloc_get(&self->allocator, sizeof(*site));
-    if (site == NULL || avl_node == NULL) {
-        ret = MSP_ERR_NO_MEMORY;
-        goto out;
-    }
-    memset(site, 0, sizeof(*site));
-    site->position = position;
-    site->new = true;
+    site_t *p;
 
-    avl_init_node(avl_node, site);
-    avl_node = avl_insert_node(&self->sites, avl_node);
-    if (avl_node == NULL) {
-        ret = MSP_ERR_DUPLICATE_SITE_POSITION;
-        goto out;
+    if (num_sites > self->max_sites) {
+        p = realloc(self->sites, num_sites * sizeof(*p));
+        if (p == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        self->sites = p;
+        self->max_sites = num_sites;
     }
-    *new_site = site;
 out:
     return ret;
 }
@@ -894,10 +1047,14 @@ mutgen_add_existing_site(mutgen_t *self, double position, char *ancestral_state,
     int ret = 0;
     site_t *site;
 
-    ret = mutgen_add_new_site(self, position, &site);
-    if (ret != 0) {
-        goto out;
-    }
+    /* Space for the existing sites is reserved in advance, so that the
+     * site pointers remain valid while we add their mutations. */
+    tsk_bug_assert(self->num_sites < self->max_sites);
+    site = &self->sites[self->num_sites];
+    self->num_sites++;
+    memset(site, 0, sizeof(*site));
+    site->position = position;
+    site->allele = TSK_NULL;
     site->new = false;
 
     /* We need to copy the ancestral state and metadata  */
@@ -916,49 +1073,25 @@ out:
     return ret;
 }
 
-static int
-mutgen_add_mutation(
-    mutgen_t *self, site_t *site, tsk_id_t node, double time, mutation_t **new_mutation)
-{
-    int ret = 0;
-
-    mutation_t *mutation = tsk_blkalloc_get(&self->allocator, sizeof(*mutation));
-    if (mutation == NULL) {
-        ret = MSP_ERR_NO_MEMORY;
-        goto out;
-    }
-    memset(mutation, 0, sizeof(*mutation));
-    mutation->node = node;
-    mutation->time = time;
-    mutation->parent = NULL;
-    mutation->new = true;
-    insert_mutation(site, mutation);
-    *new_mutation = mutation;
-out:
-    return ret;
-}
-
-static int MSP_WARN_UNUSED
-mutgen_add_new_mutation(mutgen_t *self, site_t *site, tsk_id_t node, double time)
-{
-    mutation_t *not_used;
-    return mutgen_add_mutation(self, site, node, time, &not_used);
-}
-
 static int MSP_WARN_UNUSED
 mutgen_add_existing_mutation(mutgen_t *self, site_t *site, tsk_id_t id, tsk_id_t node,
     double time, char *derived_state, tsk_size_t derived_state_length, char *metadata,
     tsk_size_t metadata_length)
 {
     int ret = 0;
-    mutation_t *mutation;
+    mutation_t *mutation = tsk_blkalloc_get(&self->allocator, sizeof(*mutation));
 
-    ret = mutgen_add_mutation(self, site, node, time, &mutation);
-    if (ret != 0) {
+    if (mutation == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
+    memset(mutation, 0, sizeof(*mutation));
     mutation->id = id;
+    mutation->node = node;
+    mutation->time = time;
+    mutation->allele = TSK_NULL;
     mutation->new = false;
+    insert_mutation(site, mutation);
 
     /* Need to copy the derived state and metadata */
     ret = copy_string(&self->allocator, derived_state, derived_state_length,
@@ -987,7 +1120,12 @@ mutgen_initialise_sites(mutgen_t *self, bool check_kept_times)
     const double end_time = self->end_time;
     char *state, *metadata;
     tsk_size_t j, length, metadata_length;
+    size_t k;
 
+    ret = mutgen_reserve_sites(self, sites->num_rows);
+    if (ret != 0) {
+        goto out;
+    }
     j = 0;
     for (site_id = 0; site_id < (tsk_id_t) sites->num_rows; site_id++) {
         state = sites->ancestral_state + sites->ancestral_state_offset[site_id];
@@ -1030,64 +1168,247 @@ mutgen_initialise_sites(mutgen_t *self, bool check_kept_times)
             j++;
         }
     }
-
+    /* The site table is not required to be sorted */
+    qsort(self->sites, self->num_sites, sizeof(*self->sites), cmp_site);
+    for (k = 1; k < self->num_sites; k++) {
+        if (self->sites[k - 1].position == self->sites[k].position) {
+            ret = MSP_ERR_DUPLICATE_SITE_POSITION;
+            goto out;
+        }
+    }
 out:
     return ret;
 }
 
+/* A ragged column being filled in row by row. Values that are adjacent in
+ * memory, such as those written in order to an allele_arena_t, are
+ * gathered into a run and copied with a single memcpy. */
+typedef struct {
+    char *data;
+    tsk_size_t *offset;
+    const char *run;
+    tsk_size_t run_length;
+} ragged_column_t;
+
+/* Copies the pending run into the column, which is filled up to end. */
+static void
+ragged_column_flush(ragged_column_t *self, tsk_size_t end)
+{
+    if (self->run_length > 0) {
+        memcpy(self->data + end - self->run_length, self->run, self->run_length);
+    }
+    self->run_length = 0;
+}
+
+/* Appends the value for the specified row, whose offsets are filled in up
+ * to this row. ragged_column_flush must be called after the last row. */
+static void
+ragged_column_append(
+    ragged_column_t *self, tsk_id_t row, const char *value, tsk_size_t length)
+{
+    tsk_size_t end = self->offset[row];
+
+    if (length > 0) {
+        if (self->run_length == 0 || self->run + self->run_length != value) {
+            ragged_column_flush(self, end);
+            self->run = value;
+        }
+        self->run_length += length;
+    }
+    self->offset[row + 1] = end + length;
+}
+
+/* Writes the kept sites and mutations to the tables in one batch. The
+ * columns are staged in temporary buffers, which the tables then copy. */
 static int MSP_WARN_UNUSED
 mutgen_populate_tables(mutgen_t *self)
 {
     int ret = 0;
-    tsk_site_table_t *sites = &self->tables->sites;
-    tsk_mutation_table_t *mutations = &self->tables->mutations;
-    tsk_id_t site_id, mutation_id, parent_id;
-    avl_node_t *a;
+    tsk_size_t num_sites, num_mutations, site_mutations;
+    tsk_size_t ancestral_state_length, site_metadata_length;
+    tsk_size_t derived_state_length, mutation_metadata_length;
+    tsk_id_t site_id, mutation_id;
     site_t *site;
     mutation_t *m;
-    size_t num_mutations;
-
-    site_id = 0;
-    for (a = self->sites.head; a != NULL; a = a->next) {
-        site = (site_t *) a->item;
-        num_mutations = 0;
+    size_t j;
+    double *position = NULL;
+    tsk_id_t *mutation_site = NULL;
+    tsk_id_t *node = NULL;
+    tsk_id_t *parent = NULL;
+    double *time = NULL;
+    ragged_column_t ancestral_state, site_metadata, derived_state, mutation_metadata;
+
+    memset(&ancestral_state, 0, sizeof(ancestral_state));
+    memset(&site_metadata, 0, sizeof(site_metadata));
+    memset(&derived_state, 0, sizeof(derived_state));
+    memset(&mutation_metadata, 0, sizeof(mutation_metadata));
+
+    /* Count the rows and the lengths of the ragged columns, and assign the
+     * output IDs of the kept mutations. */
+    num_sites = 0;
+    num_mutations = 0;
+    ancestral_state_length = 0;
+    site_metadata_length = 0;
+    derived_state_length = 0;
+    mutation_metadata_length = 0;
+    for (j = 0; j < self->num_sites; j++) {
+        site = &self->sites[j];
+        site_mutations = 0;
         for (m = site->mutations; m != NULL; m = m->next) {
             if (m->keep) {
-                if (m->parent == NULL) {
-                    parent_id = TSK_NULL;
-                } else {
-                    parent_id = m->parent->id;
-                    tsk_bug_assert(parent_id != TSK_NULL);
-                }
-                mutation_id = tsk_mutation_table_add_row(mutations, site_id, m->node,
-                    parent_id, m->time, m->derived_state, m->derived_state_length,
-                    m->metadata, m->metadata_length);
-                if (mutation_id < 0) {
-                    ret = msp_set_tsk_error(mutation_id);
-                    goto out;
-                }
-                tsk_bug_assert(mutation_id > parent_id);
-                m->id = mutation_id;
+                m->id = (tsk_id_t) num_mutations;
                 num_mutations++;
+                site_mutations++;
+                derived_state_length += m->derived_state_length;
+                mutation_metadata_length += m->metadata_length;
             }
         }
         /* Omit any new sites that have no mutations */
-        if ((!site->new) || num_mutations > 0) {
-            ret = tsk_site_table_add_row(sites, site->position, site->ancestral_state,
-                site->ancestral_state_length, site->metadata, site->metadata_length);
-            if (ret < 0) {
-                goto out;
+        if ((!site->new) || site_mutations > 0) {
+            num_sites++;
+            ancestral_state_length += site->ancestral_state_length;
+            site_metadata_length += site->metadata_length;
+        }
+    }
+    if (num_sites == 0) {
+        goto out;
+    }
+
+    /* Add one to the lengths of the ragged columns so that we never malloc 0 */
+    position = malloc(num_sites * sizeof(*position));
+    ancestral_state.data = malloc(ancestral_state_length + 1);
+    ancestral_state.offset = malloc((num_sites + 1) * sizeof(tsk_size_t));
+    site_metadata.data = malloc(site_metadata_length + 1);
+    site_metadata.offset = malloc((num_sites + 1) * sizeof(tsk_size_t));
+    mutation_site = malloc((num_mutations + 1) * sizeof(*mutation_site));
+    node = malloc((num_mutations + 1) * sizeof(*node));
+    parent = malloc((num_mutations + 1) * sizeof(*parent));
+    time = malloc((num_mutations + 1) * sizeof(*time));
+    derived_state.data = malloc(derived_state_length + 1);
+    derived_state.offset = malloc((num_mutations + 1) * sizeof(tsk_size_t));
+    mutation_metadata.data = malloc(mutation_metadata_length + 1);
+    mutation_metadata.offset = malloc((num_mutations + 1) * sizeof(tsk_size_t));
+    if (position == NULL || ancestral_state.data == NULL
+        || ancestral_state.offset == NULL || site_metadata.data == NULL
+        || site_metadata.offset == NULL || mutation_site == NULL || node == NULL
+        || parent == NULL || time == NULL || derived_state.data == NULL
+        || derived_state.offset == NULL || mutation_metadata.data == NULL
+        || mutation_metadata.offset == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+
+    site_id = 0;
+    mutation_id = 0;
+    ancestral_state.offset[0] = 0;
+    site_metadata.offset[0] = 0;
+    derived_state.offset[0] = 0;
+    mutation_metadata.offset[0] = 0;
+    for (j = 0; j < self->num_sites; j++) {
+        site = &self->sites[j];
+        site_mutations = 0;
+        for (m = site->mutations; m != NULL; m = m->next) {
+            if (m->keep) {
+                tsk_bug_assert(m->id == mutation_id);
+                mutation_site[mutation_id] = site_id;
+                node[mutation_id] = m->node;
+                parent[mutation_id] = TSK_NULL;
+                if (m->parent != NULL) {
+                    parent[mutation_id] = m->parent->id;
+                    tsk_bug_assert(m->parent->keep);
+                    tsk_bug_assert(mutation_id > m->parent->id);
+                }
+                time[mutation_id] = m->time;
+                ragged_column_append(&derived_state, mutation_id, m->derived_state,
+                    m->derived_state_length);
+                ragged_column_append(
+                    &mutation_metadata, mutation_id, m->metadata, m->metadata_length);
+                mutation_id++;
+                site_mutations++;
             }
+        }
+        if ((!site->new) || site_mutations > 0) {
+            position[site_id] = site->position;
+            ragged_column_append(&ancestral_state, site_id, site->ancestral_state,
+                site->ancestral_state_length);
+            ragged_column_append(
+                &site_metadata, site_id, site->metadata, site->metadata_length);
             site_id++;
         }
     }
-    ret = 0;
+    tsk_bug_assert(site_id == (tsk_id_t) num_sites);
+    tsk_bug_assert(mutation_id == (tsk_id_t) num_mutations);
+    ragged_column_flush(&ancestral_state, ancestral_state_length);
+    ragged_column_flush(&site_metadata, site_metadata_length);
+    ragged_column_flush(&derived_state, derived_state_length);
+    ragged_column_flush(&mutation_metadata, mutation_metadata_length);
+
+    ret = tsk_site_table_append_columns(&self->tables->sites, num_sites, position,
+        ancestral_state.data, ancestral_state.offset, site_metadata.data,
+        site_metadata.offset);
+    if (ret != 0) {
+        ret = msp_set_tsk_error(ret);
+        goto out;
+    }
+    ret = tsk_mutation_table_append_columns(&self->tables->mutations, num_mutations,
+        mutation_site, node, parent, time, derived_state.data, derived_state.offset,
+        mutation_metadata.data, mutation_metadata.offset);
+    if (ret != 0) {
+        ret = msp_set_tsk_error(ret);
+        goto out;
+    }
+out:
+    msp_safe_free(position);
+    msp_safe_free(ancestral_state.data);
+    msp_safe_free(ancestral_state.offset);
+    msp_safe_free(site_metadata.data);
+    msp_safe_free(site_metadata.offset);
+    msp_safe_free(mutation_site);
+    msp_safe_free(node);
+    msp_safe_free(parent);
+    msp_safe_free(time);
+    msp_safe_free(derived_state.data);
+    msp_safe_free(derived_state.offset);
+    msp_safe_free(mutation_metadata.data);
+    msp_safe_free(mutation_metadata.offset);
+    return ret;
+}
+
+static int MSP_WARN_UNUSED
+mutgen_chunk_add_mutation(
+    mutgen_chunk_t *chunk, double position, double time, tsk_id_t node, tsk_id_t edge)
+{
+    int ret = 0;
+    size_t max_size;
+    placed_mutation_t *p;
+
+    if (chunk->num_mutations == chunk->max_mutations) {
+        max_size = GSL_MAX(1024, 2 * chunk->max_mutations);
+        p = realloc(chunk->mutations, max_size * sizeof(*p));
+        if (p == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        chunk->mutations = p;
+        chunk->max_mutations = max_size;
+    }
+    p = &chunk->mutations[chunk->num_mutations];
+    p->position = position;
+    p->time = time;
+    p->node = node;
+    p->edge = edge;
+    chunk->num_mutations++;
 out:
     return ret;
 }
 
+/* Places new mutations on the parts of the edges that overlap the chunk.
+ * Since mutations occur independently on disjoint intervals, splitting an
+ * edge at chunk boundaries doesn't change the distribution. This is called
+ * concurrently for different chunks, and so must only read the shared state. */
 static int MSP_WARN_UNUSED
-mutgen_place_mutations(mutgen_t *self, bool discrete_sites)
+mutgen_place_mutations(
+    mutgen_t *self, mutgen_chunk_t *chunk, gsl_rng *rng, bool discrete_sites)
 {
     /* The mutation model for discrete sites is that there is
      * a unit of "mutation mass" on each integer, so that
@@ -1098,7 +1419,8 @@ mutgen_place_mutations(mutgen_t *self, bool discrete_sites)
     const double *map_position = self->rate_map.position;
     const double *map_rate = self->rate_map.rate;
     size_t branch_mutations, map_index;
-    size_t j, k;
+    size_t e, k;
+    tsk_id_t j;
     const tsk_node_table_t nodes = self->tables->nodes;
     const tsk_edge_table_t edges = self->tables->edges;
     const double start_time = self->start_time;
@@ -1107,13 +1429,12 @@ mutgen_place_mutations(mutgen_t *self, bool discrete_sites)
     double time, mu, position;
     double branch_start, branch_end, branch_length;
     tsk_id_t parent, child;
-    avl_node_t *avl_node;
-    site_t *site;
-    site_t search;
 
-    for (j = 0; j < edges.num_rows; j++) {
-        left = edges.left[j];
-        edge_right = edges.right[j];
+    for (e = 0; e < chunk->num_edges; e++) {
+        j = chunk->edges[e];
+        left = GSL_MAX(edges.left[j], chunk->left);
+        edge_right = GSL_MIN(edges.right[j], chunk->right);
+        tsk_bug_assert(left < edge_right);
         parent = edges.parent[j];
         child = edges.child[j];
         tsk_bug_assert(child >= 0 && child < (tsk_id_t) nodes.num_rows);
@@ -1128,38 +1449,21 @@ mutgen_place_mutations(mutgen_t *self, bool discrete_sites)
             site_left = discrete_sites ? ceil(left) : left;
             site_right = discrete_sites ? ceil(right) : right;
             mu = branch_length * (site_right - site_left) * map_rate[map_index];
-            branch_mutations = gsl_ran_poisson(self->rng, mu);
+            branch_mutations = gsl_ran_poisson(rng, mu);
             for (k = 0; k < branch_mutations; k++) {
-                /* Rejection sample positions until we get one we haven't seen before,
-                 * unless we are doing discrete sites. Note that in principle this
-                 * could lead to an infinite loop here, but in practise we'd need to
-                 * use up all of the doubles before it could happen and so we'd
-                 * certainly run out of memory first. */
-                do {
-                    position = gsl_ran_flat(self->rng, site_left, site_right);
-                    if (discrete_sites) {
-                        position = floor(position);
-                    }
-                    search.position = position;
-                    avl_node = avl_search(&self->sites, &search);
-                } while (avl_node != NULL && !discrete_sites);
-
-                time = gsl_ran_flat(self->rng, branch_start, branch_end);
+                position = gsl_ran_flat(rng, site_left, site_right);
+                if (discrete_sites) {
+                    position = floor(position);
+                }
+                time = gsl_ran_flat(rng, branch_start, branch_end);
                 tsk_bug_assert(site_left <= position && position < site_right);
                 tsk_bug_assert(branch_start <= time && time < branch_end);
-                if (avl_node != NULL) {
-                    site = (site_t *) avl_node->item;
-                } else {
-                    ret = mutgen_add_new_site(self, position, &site);
-                    if (ret != 0) {
-                        goto out;
-                    }
-                }
-                ret = mutgen_add_new_mutation(self, site, child, time);
+                ret = mutgen_chunk_add_mutation(chunk, position, time, child, j);
                 if (ret != 0) {
                     goto out;
                 }
             }
+            left = right;
             map_index++;
         }
     }
@@ -1167,50 +1471,679 @@ out:
     return ret;
 }
 
+static uint64_t
+position_sort_key(double position)
+{
+    uint64_t key;
+
+    /* Positions are non-negative, so the IEEE 754 bit patterns sort in the
+     * same order as the values when interpreted as unsigned integers. */
+    tsk_bug_assert(position >= 0);
+    memcpy(&key, &position, sizeof(key));
+    return key;
+}
+
+/* Stable LSD radix sort of the placed mutations by position, one byte of
+ * the key at a time. Passes in which every key has the same digit are
+ * skipped, which is common for the high-order bytes. */
 static int MSP_WARN_UNUSED
-mutgen_choose_alleles(mutgen_t *self, tsk_id_t *parent, mutation_t **bottom_mutation,
-    tsk_size_t num_nodes, site_t *site)
+sort_placed_mutations(placed_mutation_t *mutations, size_t num_mutations)
 {
     int ret = 0;
-    const char *pa, *pm;
-    tsk_size_t palen, pmlen;
-    mutation_t *mut, *parent_mut;
-    tsk_id_t u;
-
-    ret = sort_mutations(site);
-    if (ret != 0) {
+    size_t count[8][256];
+    size_t j, digit, offset, tmp_count;
+    unsigned int pass, shift;
+    uint64_t key;
+    placed_mutation_t *buffer = NULL;
+    placed_mutation_t *src, *dest, *tmp;
+
+    if (num_mutations < 2) {
         goto out;
     }
-    if (site->new) {
-        tsk_bug_assert(site->ancestral_state == NULL);
-        ret = mutation_model_choose_root_state(self->model, self->rng, site);
-        if (ret != 0) {
-            goto out;
+    buffer = malloc(num_mutations * sizeof(*buffer));
+    if (buffer == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    memset(count, 0, sizeof(count));
+    for (j = 0; j < num_mutations; j++) {
+        key = position_sort_key(mutations[j].position);
+        for (pass = 0; pass < 8; pass++) {
+            count[pass][(size_t) ((key >> (8 * pass)) & 0xff)]++;
         }
     }
-
-    /* Create a mapping from mutations to nodes in bottom_mutation. If we see
-     * more than one mutation at a node, the previously seen one must be the
-     * parent of the current one since we assume they are in order. */
-    for (mut = site->mutations; mut != NULL; mut = mut->next) {
-        u = mut->node;
-        tsk_bug_assert((tsk_size_t) u < num_nodes);
-        while (u != TSK_NULL && bottom_mutation[u] == NULL) {
-            u = parent[u];
+    src = mutations;
+    dest = buffer;
+    for (pass = 0; pass < 8; pass++) {
+        shift = 8 * pass;
+        key = position_sort_key(src[0].position);
+        if (count[pass][(size_t) ((key >> shift) & 0xff)] == num_mutations) {
+            continue;
         }
-        if (u == TSK_NULL) {
-            pa = site->ancestral_state;
-            palen = site->ancestral_state_length;
-            pm = site->metadata;
-            pmlen = site->metadata_length;
-            tsk_bug_assert(mut->parent == NULL);
-        } else {
-            parent_mut = bottom_mutation[u];
-            mut->parent = parent_mut;
+        offset = 0;
+        for (digit = 0; digit < 256; digit++) {
+            tmp_count = count[pass][digit];
+            count[pass][digit] = offset;
+            offset += tmp_count;
+        }
+        for (j = 0; j < num_mutations; j++) {
+            key = position_sort_key(src[j].position);
+            digit = (size_t) ((key >> shift) & 0xff);
+            dest[count[pass][digit]] = src[j];
+            count[pass][digit]++;
+        }
+        tmp = src;
+        src = dest;
+        dest = tmp;
+    }
+    if (src != mutations) {
+        memcpy(mutations, src, num_mutations * sizeof(*mutations));
+    }
+out:
+    msp_safe_free(buffer);
+    return ret;
+}
+
+/* Sorts the chunk's mutations by position. For continuous genomes every new
+ * mutation must be at a distinct position that is not used by any existing
+ * site, and so we resample the positions of any mutations that collide and
+ * sort again until there are no collisions. These are very rare, so this
+ * almost always takes a single pass. Note that in principle this could lead
+ * to an infinite loop, but in practise we'd need to use up all of the doubles
+ * before it could happen and so we'd certainly run out of memory first. */
+static int MSP_WARN_UNUSED
+mutgen_sort_placed_mutations(
+    mutgen_t *self, mutgen_chunk_t *chunk, gsl_rng *rng, bool discrete_sites)
+{
+    int ret = 0;
+    placed_mutation_t *placed = chunk->mutations;
+    const size_t num_placed = chunk->num_mutations;
+    const site_t *sites = self->sites;
+    const size_t num_sites = self->num_sites;
+    const double *edge_left = self->tables->edges.left;
+    const double *edge_right = self->tables->edges.right;
+    const double *map_position = self->rate_map.position;
+    size_t j, k, map_index, num_collisions;
+    double position, left, right;
+
+    do {
+        ret = sort_placed_mutations(placed, num_placed);
+        if (ret != 0 || discrete_sites) {
+            goto out;
+        }
+        num_collisions = 0;
+        k = 0;
+        while (k < num_sites && sites[k].position < chunk->left) {
+            k++;
+        }
+        for (j = 0; j < num_placed; j++) {
+            position = placed[j].position;
+            while (k < num_sites && sites[k].position < position) {
+                k++;
+            }
+            if ((j > 0 && placed[j - 1].position == position)
+                || (k < num_sites && sites[k].position == position)) {
+                map_index = rate_map_get_index(&self->rate_map, position);
+                left = GSL_MAX(edge_left[placed[j].edge], map_position[map_index]);
+                left = GSL_MAX(left, chunk->left);
+                right = GSL_MIN(edge_right[placed[j].edge], map_position[map_index + 1]);
+                right = GSL_MIN(right, chunk->right);
+                placed[j].position = gsl_ran_flat(rng, left, right);
+                num_collisions++;
+            }
+        }
+    } while (num_collisions > 0);
+out:
+    return ret;
+}
+
+static int MSP_WARN_UNUSED
+mutgen_place_chunk_mutations(
+    mutgen_t *self, mutgen_chunk_t *chunk, gsl_rng *rng, bool discrete_sites)
+{
+    int ret = 0;
+
+    chunk->num_mutations = 0;
+    ret = mutgen_place_mutations(self, chunk, rng, discrete_sites);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = mutgen_sort_placed_mutations(self, chunk, rng, discrete_sites);
+out:
+    return ret;
+}
+
+/* Returns the index of the chunk that contains the specified position. */
+static size_t
+mutgen_find_chunk(const mutgen_t *self, double position)
+{
+    const size_t num_chunks = self->num_chunks;
+    const mutgen_chunk_t *chunks = self->chunks;
+    size_t k = (size_t) (position / self->tables->sequence_length * (double) num_chunks);
+
+    k = GSL_MIN(k, num_chunks - 1);
+    while (k > 0 && chunks[k - 1].right > position) {
+        k--;
+    }
+    while (k < num_chunks - 1 && chunks[k].right <= position) {
+        k++;
+    }
+    return k;
+}
+
+/* Finds the edges that overlap each chunk, keeping them in table order, so
+ * that each chunk only needs to look at its own edges. */
+static int MSP_WARN_UNUSED
+mutgen_bucket_edges(mutgen_t *self)
+{
+    int ret = 0;
+    const tsk_edge_table_t edges = self->tables->edges;
+    const size_t num_chunks = self->num_chunks;
+    mutgen_chunk_t *chunks = self->chunks;
+    size_t *offset = NULL;
+    size_t j, k, total;
+    tsk_id_t *p;
+
+    offset = malloc(num_chunks * sizeof(*offset));
+    if (offset == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    for (k = 0; k < num_chunks; k++) {
+        chunks[k].num_edges = 0;
+    }
+    for (j = 0; j < edges.num_rows; j++) {
+        k = mutgen_find_chunk(self, edges.left[j]);
+        while (k < num_chunks && chunks[k].left < edges.right[j]) {
+            chunks[k].num_edges++;
+            k++;
+        }
+    }
+    total = 0;
+    for (k = 0; k < num_chunks; k++) {
+        offset[k] = total;
+        total += chunks[k].num_edges;
+    }
+    if (total > self->max_chunk_edges) {
+        p = realloc(self->chunk_edges, total * sizeof(*p));
+        if (p == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        self->chunk_edges = p;
+        self->max_chunk_edges = total;
+    }
+    for (j = 0; j < edges.num_rows; j++) {
+        k = mutgen_find_chunk(self, edges.left[j]);
+        while (k < num_chunks && chunks[k].left < edges.right[j]) {
+            self->chunk_edges[offset[k]] = (tsk_id_t) j;
+            offset[k]++;
+            k++;
+        }
+    }
+    total = 0;
+    for (k = 0; k < num_chunks; k++) {
+        chunks[k].edges = self->chunk_edges + total;
+        total += chunks[k].num_edges;
+    }
+out:
+    msp_safe_free(offset);
+    return ret;
+}
+
+/* Places the new mutations in each chunk of the genome, and concatenates
+ * them in order so that they are sorted by position. With a single chunk
+ * the main random generator is used directly. Otherwise, each chunk is
+ * given its own generator seeded from the main one, so that the output
+ * depends only on the seed and the number of chunks, and not on the number
+ * of threads or on scheduling. */
+static int MSP_WARN_UNUSED
+mutgen_place_chunks(mutgen_t *self, bool discrete_sites)
+{
+    int ret = 0;
+    int j;
+    size_t k, num_placed, max_placed;
+    const size_t num_chunks = self->num_chunks;
+    const double sequence_length = self->tables->sequence_length;
+    mutgen_chunk_t *chunk;
+    placed_mutation_t *p;
+
+    for (k = 0; k < num_chunks; k++) {
+        chunk = &self->chunks[k];
+        chunk->left = sequence_length * (double) k / (double) num_chunks;
+        chunk->right = sequence_length * (double) (k + 1) / (double) num_chunks;
+        chunk->ret = 0;
+    }
+    self->chunks[num_chunks - 1].right = sequence_length;
+    ret = mutgen_bucket_edges(self);
+    if (ret != 0) {
+        goto out;
+    }
+
+    if (num_chunks == 1) {
+        chunk = self->chunks;
+        ret = mutgen_place_chunk_mutations(self, chunk, self->rng, discrete_sites);
+        if (ret != 0) {
+            goto out;
+        }
+        /* Swap the buffers rather than copying */
+        p = self->placed_mutations;
+        max_placed = self->max_placed_mutations;
+        self->placed_mutations = chunk->mutations;
+        self->max_placed_mutations = chunk->max_mutations;
+        self->num_placed_mutations = chunk->num_mutations;
+        chunk->mutations = p;
+        chunk->max_mutations = max_placed;
+        chunk->num_mutations = 0;
+        goto out;
+    }
+
+    for (k = 0; k < num_chunks; k++) {
+        chunk = &self->chunks[k];
+        if (chunk->rng == NULL) {
+            chunk->rng = gsl_rng_alloc(self->rng->type);
+            if (chunk->rng == NULL) {
+                ret = MSP_ERR_NO_MEMORY;
+                goto out;
+            }
+        }
+        chunk->seed = gsl_rng_get(self->rng);
+        gsl_rng_set(chunk->rng, chunk->seed);
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads((int) GSL_MIN(self->num_threads, num_chunks)) \
+    schedule(dynamic)
+#endif
+    for (j = 0; j < (int) num_chunks; j++) {
+        mutgen_chunk_t *chunk_j = &self->chunks[j];
+        chunk_j->ret = mutgen_place_chunk_mutations(
+            self, chunk_j, chunk_j->rng, discrete_sites);
+    }
+
+    num_placed = 0;
+    for (k = 0; k < num_chunks; k++) {
+        if (self->chunks[k].ret != 0) {
+            ret = self->chunks[k].ret;
+            goto out;
+        }
+        num_placed += self->chunks[k].num_mutations;
+    }
+    if (num_placed > self->max_placed_mutations) {
+        p = realloc(self->placed_mutations, num_placed * sizeof(*p));
+        if (p == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        self->placed_mutations = p;
+        self->max_placed_mutations = num_placed;
+    }
+    num_placed = 0;
+    for (k = 0; k < num_chunks; k++) {
+        chunk = &self->chunks[k];
+        if (chunk->num_mutations > 0) {
+            memcpy(self->placed_mutations + num_placed, chunk->mutations,
+                chunk->num_mutations * sizeof(*chunk->mutations));
+        }
+        num_placed += chunk->num_mutations;
+    }
+    self->num_placed_mutations = num_placed;
+out:
+    return ret;
+}
+
+/* Merges the sorted placed mutations into the sorted array of existing
+ * sites, creating a new site for each distinct position that is not
+ * already present. The merge works backwards from the end of the array
+ * so that existing sites can be moved into place without a copy. */
+static int MSP_WARN_UNUSED
+mutgen_merge_sites(mutgen_t *self)
+{
+    int ret = 0;
+    const placed_mutation_t *placed = self->placed_mutations;
+    const size_t num_placed = self->num_placed_mutations;
+    const size_t num_existing_sites = self->num_sites;
+    size_t j, k, dest, num_new_sites;
+    double position;
+    site_t *sites;
+    mutation_t *mutation;
+
+    num_new_sites = 0;
+    k = 0;
+    for (j = 0; j < num_placed; j++) {
+        position = placed[j].position;
+        if (j > 0 && placed[j - 1].position == position) {
+            continue;
+        }
+        while (k < num_existing_sites && self->sites[k].position < position) {
+            k++;
+        }
+        if (k == num_existing_sites || self->sites[k].position != position) {
+            num_new_sites++;
+        }
+    }
+    ret = mutgen_reserve_sites(self, num_existing_sites + num_new_sites);
+    if (ret != 0) {
+        goto out;
+    }
+    if (num_placed > self->max_new_mutations) {
+        msp_safe_free(self->new_mutations);
+        self->max_new_mutations = 0;
+        self->new_mutations = malloc(num_placed * sizeof(*self->new_mutations));
+        if (self->new_mutations == NULL) {
+            ret = MSP_ERR_NO_MEMORY;
+            goto out;
+        }
+        self->max_new_mutations = num_placed;
+    }
+
+    sites = self->sites;
+    j = num_placed;
+    k = num_existing_sites;
+    dest = num_existing_sites + num_new_sites;
+    while (j > 0) {
+        position = placed[j - 1].position;
+        dest--;
+        if (k > 0 && sites[k - 1].position > position) {
+            k--;
+            sites[dest] = sites[k];
+            continue;
+        }
+        if (k > 0 && sites[k - 1].position == position) {
+            k--;
+            sites[dest] = sites[k];
+        } else {
+            memset(&sites[dest], 0, sizeof(*sites));
+            sites[dest].position = position;
+            sites[dest].allele = TSK_NULL;
+            sites[dest].new = true;
+        }
+        while (j > 0 && placed[j - 1].position == position) {
+            j--;
+            mutation = &self->new_mutations[j];
+            memset(mutation, 0, sizeof(*mutation));
+            mutation->node = placed[j].node;
+            mutation->time = placed[j].time;
+            mutation->allele = TSK_NULL;
+            mutation->new = true;
+            insert_mutation(&sites[dest], mutation);
+        }
+    }
+    tsk_bug_assert(dest == k);
+    self->num_sites = num_existing_sites + num_new_sites;
+out:
+    return ret;
+}
+
+/* Preorder indexes for the nodes in the current tree, which let us find the
+ * ancestral mutations at a site without walking up the tree from each
+ * mutation. Node u is an ancestor of v (or v itself) if and only if
+ * enter[u] <= enter[v] < leave[u]. */
+typedef struct {
+    tsk_size_t num_nodes;
+    tsk_size_t *enter;
+    tsk_size_t *leave;
+    tsk_size_t *child_offset;
+    tsk_id_t *children;
+    tsk_id_t *order;
+    bool valid;
+    /* The number of steps taken walking up the current tree */
+    size_t walk_length;
+} euler_tour_t;
+
+typedef struct {
+    tsk_size_t enter;
+    size_t index;
+    mutation_t *mutation;
+} tour_mutation_t;
+
+static int
+cmp_tour_mutation(const void *a, const void *b)
+{
+    const tour_mutation_t *ia = (const tour_mutation_t *) a;
+    const tour_mutation_t *ib = (const tour_mutation_t *) b;
+    int ret = (ia->enter > ib->enter) - (ia->enter < ib->enter);
+    if (ret == 0) {
+        ret = (ia->index > ib->index) - (ia->index < ib->index);
+    }
+    return ret;
+}
+
+static int MSP_WARN_UNUSED
+euler_tour_alloc(euler_tour_t *self, tsk_size_t num_nodes)
+{
+    int ret = 0;
+
+    memset(self, 0, sizeof(*self));
+    self->num_nodes = num_nodes;
+    self->enter = malloc(num_nodes * sizeof(*self->enter));
+    self->leave = malloc(num_nodes * sizeof(*self->leave));
+    self->child_offset = malloc((num_nodes + 1) * sizeof(*self->child_offset));
+    self->children = malloc(num_nodes * sizeof(*self->children));
+    self->order = malloc(num_nodes * sizeof(*self->order));
+    if (self->enter == NULL || self->leave == NULL || self->child_offset == NULL
+        || self->children == NULL || self->order == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+out:
+    return ret;
+}
+
+static void
+euler_tour_free(euler_tour_t *self)
+{
+    msp_safe_free(self->enter);
+    msp_safe_free(self->leave);
+    msp_safe_free(self->child_offset);
+    msp_safe_free(self->children);
+    msp_safe_free(self->order);
+}
+
+/* Computes the preorder indexes of all nodes in the tree defined by the
+ * parent array in O(num_nodes) time. */
+static void
+euler_tour_build(euler_tour_t *self, const tsk_id_t *parent)
+{
+    const tsk_size_t N = self->num_nodes;
+    tsk_size_t *enter = self->enter;
+    tsk_size_t *leave = self->leave;
+    tsk_size_t *child_offset = self->child_offset;
+    tsk_id_t *children = self->children;
+    tsk_id_t *order = self->order;
+    tsk_size_t j, k, num_visited, stack_top;
+    tsk_id_t u, v;
+
+    /* Build the lists of children, using leave as scratch space */
+    memset(child_offset, 0, (N + 1) * sizeof(*child_offset));
+    for (j = 0; j < N; j++) {
+        if (parent[j] != TSK_NULL) {
+            child_offset[parent[j] + 1]++;
+        }
+    }
+    for (j = 0; j < N; j++) {
+        child_offset[j + 1] += child_offset[j];
+        leave[j] = child_offset[j];
+    }
+    for (j = 0; j < N; j++) {
+        u = parent[j];
+        if (u != TSK_NULL) {
+            children[leave[u]] = (tsk_id_t) j;
+            leave[u]++;
+        }
+    }
+
+    /* Visit the nodes in preorder from each root. The stack grows down from
+     * the end of the order array, and never overlaps the visited nodes. */
+    num_visited = 0;
+    for (j = 0; j < N; j++) {
+        if (parent[j] != TSK_NULL) {
+            continue;
+        }
+        stack_top = N - 1;
+        order[stack_top] = (tsk_id_t) j;
+        while (stack_top < N) {
+            u = order[stack_top];
+            stack_top++;
+            enter[u] = num_visited;
+            order[num_visited] = u;
+            num_visited++;
+            for (k = child_offset[u]; k < child_offset[u + 1]; k++) {
+                stack_top--;
+                order[stack_top] = children[k];
+            }
+        }
+    }
+    tsk_bug_assert(num_visited == N);
+
+    /* Subtree sizes, in reverse preorder */
+    for (j = 0; j < N; j++) {
+        leave[j] = 1;
+    }
+    for (j = N; j > 0; j--) {
+        v = order[j - 1];
+        u = parent[v];
+        if (u != TSK_NULL) {
+            leave[u] += leave[v];
+        }
+    }
+    for (j = 0; j < N; j++) {
+        leave[j] += enter[j];
+    }
+    self->valid = true;
+}
+
+/* Sets the parent of each of the site's mutations to the closest mutation
+ * above it in the tree (or on the same node) that comes before it in the
+ * site's list, regardless of whether these are kept. The mutations are
+ * sorted by the preorder index of their nodes and swept with a stack that
+ * holds the mutations on the path from the current node to the root, so
+ * this takes O(m log m) time for m mutations. */
+static int MSP_WARN_UNUSED
+euler_tour_set_ancestral_mutations(euler_tour_t *self, site_t *site)
+{
+    int ret = 0;
+    const size_t num_mutations = site->mutations_length;
+    tour_mutation_t *tour_mutations = NULL;
+    tour_mutation_t *stack, *x;
+    size_t j, k, stack_top;
+    tsk_size_t enter;
+    mutation_t *mut;
+
+    tour_mutations = malloc(2 * num_mutations * sizeof(*tour_mutations));
+    if (tour_mutations == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    stack = tour_mutations + num_mutations;
+    j = 0;
+    for (mut = site->mutations; mut != NULL; mut = mut->next) {
+        tour_mutations[j].enter = self->enter[mut->node];
+        tour_mutations[j].index = j;
+        tour_mutations[j].mutation = mut;
+        j++;
+    }
+    tsk_bug_assert(j == num_mutations);
+    qsort(tour_mutations, num_mutations, sizeof(*tour_mutations), cmp_tour_mutation);
+
+    stack_top = 0;
+    for (j = 0; j < num_mutations; j++) {
+        x = &tour_mutations[j];
+        enter = x->enter;
+        while (stack_top > 0
+               && self->leave[stack[stack_top - 1].mutation->node] <= enter) {
+            stack_top--;
+        }
+        /* Skip over any mutations above that come later in the list */
+        k = stack_top;
+        while (k > 0 && stack[k - 1].index > x->index) {
+            k--;
+        }
+        x->mutation->parent = k == 0 ? NULL : stack[k - 1].mutation;
+        stack[stack_top] = *x;
+        stack_top++;
+    }
+out:
+    msp_safe_free(tour_mutations);
+    return ret;
+}
+
+/* Finds the closest kept mutation above the specified one by walking up
+ * the tree until we find a node in bottom_mutation. */
+static mutation_t *
+mutgen_walk_to_parent_mutation(mutation_t *mut, const tsk_id_t *parent,
+    mutation_t **bottom_mutation, euler_tour_t *tour)
+{
+    tsk_id_t u = mut->node;
+
+    while (u != TSK_NULL && bottom_mutation[u] == NULL) {
+        u = parent[u];
+        tour->walk_length++;
+    }
+    return u == TSK_NULL ? NULL : bottom_mutation[u];
+}
+
+static int MSP_WARN_UNUSED
+mutgen_choose_alleles(mutgen_t *self, gsl_rng *rng, tsk_id_t *parent,
+    mutation_t **bottom_mutation, tsk_size_t num_nodes, site_t *site, euler_tour_t *tour)
+{
+    int ret = 0;
+    const char *pa, *pm;
+    tsk_size_t palen, pmlen;
+    tsk_id_t pai;
+    mutation_t *mut, *parent_mut;
+    bool use_tour = false;
+
+    ret = sort_mutations(site);
+    if (ret != 0) {
+        goto out;
+    }
+    if (site->new) {
+        tsk_bug_assert(site->ancestral_state == NULL);
+        ret = mutation_model_choose_root_state(self->model, rng, site);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    if (tour->valid && site->mutations_length > 1) {
+        ret = euler_tour_set_ancestral_mutations(tour, site);
+        if (ret != 0) {
+            goto out;
+        }
+        use_tour = true;
+    }
+
+    /* Create a mapping from mutations to nodes in bottom_mutation. If we see
+     * more than one mutation at a node, the previously seen one must be the
+     * parent of the current one since we assume they are in order. */
+    for (mut = site->mutations; mut != NULL; mut = mut->next) {
+        tsk_bug_assert((tsk_size_t) mut->node < num_nodes);
+        if (use_tour) {
+            /* The closest mutation above is the parent if it is kept, and
+             * otherwise we fall back to walking up the tree. */
+            parent_mut = mut->parent;
+            if (parent_mut != NULL && !parent_mut->keep) {
+                parent_mut = mutgen_walk_to_parent_mutation(
+                    mut, parent, bottom_mutation, tour);
+            }
+        } else {
+            tsk_bug_assert(mut->parent == NULL);
+            parent_mut = mutgen_walk_to_parent_mutation(
+                mut, parent, bottom_mutation, tour);
+        }
+        mut->parent = parent_mut;
+        if (parent_mut == NULL) {
+            pa = site->ancestral_state;
+            palen = site->ancestral_state_length;
+            pai = site->allele;
+            pm = site->metadata;
+            pmlen = site->metadata_length;
+        } else {
             assert(mut->time <= parent_mut->time);
             if (mut->new) {
                 pa = parent_mut->derived_state;
                 palen = parent_mut->derived_state_length;
+                pai = parent_mut->allele;
                 pm = parent_mut->metadata;
                 pmlen = parent_mut->metadata_length;
             }
@@ -1219,7 +2152,7 @@ mutgen_choose_alleles(mutgen_t *self, tsk_id_t *parent, mutation_t **bottom_muta
         if (mut->new) {
             tsk_bug_assert(mut->derived_state == NULL);
             ret = mutation_model_transition(
-                self->model, self->rng, pa, palen, pm, pmlen, mut);
+                self->model, rng, pa, palen, pai, pm, pmlen, mut);
             if (ret < 0) {
                 goto out;
             }
@@ -1242,81 +2175,226 @@ out:
     return ret;
 }
 
+/* The per-thread state used to choose alleles along the trees of a chunk. */
+typedef struct {
+    tsk_id_t *parent;
+    mutation_t **bottom_mutation;
+    euler_tour_t tour;
+} tree_workspace_t;
+
 static int MSP_WARN_UNUSED
-mutgen_apply_mutations(mutgen_t *self)
+tree_workspace_alloc(tree_workspace_t *self, tsk_size_t num_nodes)
 {
     int ret = 0;
-    const tsk_id_t *I, *O;
-    const tsk_edge_table_t edges = self->tables->edges;
-    const tsk_node_table_t nodes = self->tables->nodes;
-    const tsk_id_t M = (tsk_id_t) edges.num_rows;
-    tsk_id_t tj, tk;
-    tsk_id_t *parent = NULL;
-    mutation_t **bottom_mutation = NULL;
-    double left, right;
-    const double sequence_length = self->tables->sequence_length;
-    avl_node_t *avl_node;
-    site_t *site;
 
-    parent = malloc(nodes.num_rows * sizeof(*parent));
-    bottom_mutation = malloc(nodes.num_rows * sizeof(*bottom_mutation));
-    if (parent == NULL || bottom_mutation == NULL) {
-        ret = TSK_ERR_NO_MEMORY;
+    memset(self, 0, sizeof(*self));
+    self->parent = malloc(num_nodes * sizeof(*self->parent));
+    self->bottom_mutation = malloc(num_nodes * sizeof(*self->bottom_mutation));
+    if (self->parent == NULL || self->bottom_mutation == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
         goto out;
     }
-    memset(parent, 0xff, nodes.num_rows * sizeof(*parent));
-    memset(bottom_mutation, 0, nodes.num_rows * sizeof(*bottom_mutation));
+    memset(self->parent, 0xff, num_nodes * sizeof(*self->parent));
+    memset(self->bottom_mutation, 0, num_nodes * sizeof(*self->bottom_mutation));
+out:
+    return ret;
+}
 
-    if (!tsk_table_collection_has_index(self->tables, 0)) {
-        ret = tsk_table_collection_build_index(self->tables, 0);
-        if (ret != 0) {
-            goto out;
+static void
+tree_workspace_free(tree_workspace_t *self)
+{
+    msp_safe_free(self->parent);
+    msp_safe_free(self->bottom_mutation);
+    euler_tour_free(&self->tour);
+}
+
+/* Returns the first index j such that value[index[j]] > x, where the values
+ * are sorted in the order given by the index. */
+static tsk_id_t
+edge_index_upper_bound(const tsk_id_t *index, const double *value, tsk_id_t n, double x)
+{
+    tsk_id_t lo = 0;
+    tsk_id_t hi = n;
+    tsk_id_t mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (value[index[mid]] <= x) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
+    return lo;
+}
 
-    I = self->tables->indexes.edge_insertion_order;
-    O = self->tables->indexes.edge_removal_order;
-    tj = 0;
-    tk = 0;
-    left = 0;
-    avl_node = self->sites.head;
-    while (tj < M || left < sequence_length) {
-        while (tk < M && edges.right[O[tk]] == left) {
-            parent[edges.child[O[tk]]] = TSK_NULL;
-            tk++;
-        }
-        while (tj < M && edges.left[I[tj]] == left) {
-            parent[edges.child[I[tj]]] = edges.parent[I[tj]];
-            tj++;
+/* Chooses the alleles for the sites in each tree of the chunk. The tree at
+ * the left end of the chunk is built from the chunk's edges, and we then
+ * move along the trees using the edge indexes. Parent mutations are found
+ * by walking up the tree from each mutation, unless this becomes expensive:
+ * once the length of the walks in the current tree reaches the number of
+ * nodes, we compute its Euler tour and use that for any remaining sites
+ * with more than one mutation. The result is the same either way. */
+static int MSP_WARN_UNUSED
+mutgen_apply_chunk_mutations(
+    mutgen_t *self, mutgen_chunk_t *chunk, gsl_rng *rng, tree_workspace_t *workspace)
+{
+    int ret = 0;
+    const tsk_id_t *I = self->tables->indexes.edge_insertion_order;
+    const tsk_id_t *O = self->tables->indexes.edge_removal_order;
+    const tsk_edge_table_t edges = self->tables->edges;
+    const tsk_size_t num_nodes = self->tables->nodes.num_rows;
+    const tsk_id_t M = (tsk_id_t) edges.num_rows;
+    tsk_id_t *parent = workspace->parent;
+    euler_tour_t *tour = &workspace->tour;
+    tsk_id_t tj, tk, e;
+    double left, right;
+    size_t j, site_index;
+    site_t *site;
+
+    left = chunk->left;
+    for (j = 0; j < chunk->num_edges; j++) {
+        e = chunk->edges[j];
+        if (edges.left[e] <= left) {
+            parent[edges.child[e]] = edges.parent[e];
         }
-        right = sequence_length;
+    }
+    tj = edge_index_upper_bound(I, edges.left, M, left);
+    tk = edge_index_upper_bound(O, edges.right, M, left);
+    site_index = chunk->first_site;
+    while (left < chunk->right) {
+        right = chunk->right;
         if (tj < M) {
             right = TSK_MIN(right, edges.left[I[tj]]);
         }
         if (tk < M) {
             right = TSK_MIN(right, edges.right[O[tk]]);
         }
+        tour->valid = false;
+        tour->walk_length = 0;
 
         /* Tree is now ready. We look at each site on this tree in turn */
-        while (avl_node != NULL) {
-            site = (site_t *) avl_node->item;
+        while (site_index < self->num_sites) {
+            site = &self->sites[site_index];
             if (site->position >= right) {
                 break;
             }
-            ret = mutgen_choose_alleles(
-                self, parent, bottom_mutation, nodes.num_rows, site);
+            if (!tour->valid && site->mutations_length > 1
+                && tour->walk_length >= num_nodes) {
+                if (tour->enter == NULL) {
+                    ret = euler_tour_alloc(tour, num_nodes);
+                    if (ret != 0) {
+                        goto out;
+                    }
+                }
+                euler_tour_build(tour, parent);
+            }
+            ret = mutgen_choose_alleles(self, rng, parent, workspace->bottom_mutation,
+                num_nodes, site, tour);
             if (ret != 0) {
                 goto out;
             }
-            avl_node = avl_node->next;
+            site_index++;
         }
         /* Move on to the next tree */
         left = right;
+        if (left < chunk->right) {
+            while (tk < M && edges.right[O[tk]] == left) {
+                parent[edges.child[O[tk]]] = TSK_NULL;
+                tk++;
+            }
+            while (tj < M && edges.left[I[tj]] == left) {
+                parent[edges.child[I[tj]]] = edges.parent[I[tj]];
+                tj++;
+            }
+        }
+    }
+out:
+    /* Leave the parent array empty for the next chunk */
+    for (j = 0; j < chunk->num_edges; j++) {
+        parent[edges.child[chunk->edges[j]]] = TSK_NULL;
+    }
+    return ret;
+}
+
+/* Chooses the alleles for the sites in each chunk, using the chunk's
+ * random generator. Thread safe models choose the alleles for different
+ * chunks in parallel; otherwise the chunks are processed in order. Either
+ * way the output depends only on the seed and the number of chunks. With
+ * a single chunk the main random generator is used. */
+static int MSP_WARN_UNUSED
+mutgen_apply_mutations(mutgen_t *self)
+{
+    int ret = 0;
+    int j;
+    size_t k, site_index;
+    const size_t num_chunks = self->num_chunks;
+    size_t num_workspaces = 1;
+    tree_workspace_t *workspaces = NULL;
+
+    if (self->model->thread_safe) {
+        num_workspaces = GSL_MIN(self->num_threads, num_chunks);
+    }
+    if (!tsk_table_collection_has_index(self->tables, 0)) {
+        ret = tsk_table_collection_build_index(self->tables, 0);
+        if (ret != 0) {
+            ret = msp_set_tsk_error(ret);
+            goto out;
+        }
+    }
+    site_index = 0;
+    for (k = 0; k < num_chunks; k++) {
+        while (site_index < self->num_sites
+               && self->sites[site_index].position < self->chunks[k].left) {
+            site_index++;
+        }
+        self->chunks[k].first_site = site_index;
+        self->chunks[k].ret = 0;
+    }
+    workspaces = calloc(num_workspaces, sizeof(*workspaces));
+    if (workspaces == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    for (k = 0; k < num_workspaces; k++) {
+        ret = tree_workspace_alloc(&workspaces[k], self->tables->nodes.num_rows);
+        if (ret != 0) {
+            goto out;
+        }
     }
 
+    if (num_chunks == 1) {
+        ret = mutgen_apply_chunk_mutations(
+            self, self->chunks, self->rng, &workspaces[0]);
+        goto out;
+    }
+    /* With one workspace the chunks are processed in order by a single
+     * thread, which models that are not thread safe rely on. */
+#ifdef _OPENMP
+#pragma omp parallel for num_threads((int) num_workspaces) schedule(dynamic)
+#endif
+    for (j = 0; j < (int) num_chunks; j++) {
+        int thread = 0;
+        mutgen_chunk_t *chunk_j = &self->chunks[j];
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+#endif
+        chunk_j->ret = mutgen_apply_chunk_mutations(
+            self, chunk_j, chunk_j->rng, &workspaces[thread]);
+    }
+    for (k = 0; k < num_chunks; k++) {
+        if (self->chunks[k].ret != 0) {
+            ret = self->chunks[k].ret;
+            goto out;
+        }
+    }
 out:
-    msp_safe_free(parent);
-    msp_safe_free(bottom_mutation);
+    if (workspaces != NULL) {
+        for (k = 0; k < num_workspaces; k++) {
+            tree_workspace_free(&workspaces[k]);
+        }
+        free(workspaces);
+    }
     return ret;
 }
 
@@ -1327,7 +2405,8 @@ mutgen_generate(mutgen_t *self, int flags)
     bool discrete_sites = flags & MSP_DISCRETE_SITES;
     bool kept_mutations_before_end_time = flags & MSP_KEPT_MUTATIONS_BEFORE_END_TIME;
 
-    avl_clear_tree(&self->sites);
+    self->num_sites = 0;
+    self->num_placed_mutations = 0;
 
     ret = mutgen_init_allocator(self);
     if (ret != 0) {
@@ -1354,7 +2433,11 @@ mutgen_generate(mutgen_t *self, int flags)
     if (ret != 0) {
         goto out;
     }
-    ret = mutgen_place_mutations(self, discrete_sites);
+    ret = mutgen_place_chunks(self, discrete_sites);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = mutgen_merge_sites(self);
     if (ret != 0) {
         goto out;
     }
@@ -182,6 +182,65 @@ test_single_locus_many_populations(void)
     tsk_table_collection_free(&tables);
 }
 
+static void
+test_mass_migration_proportions(void)
+{
+    int ret;
+    msp_t msp;
+    gsl_rng *rng = safe_rng_alloc();
+    sample_t *samples = malloc(20 * sizeof(sample_t));
+    uint32_t n = 20;
+    tsk_table_collection_t tables;
+    size_t j, num_ancestors;
+
+    CU_ASSERT_FATAL(samples != NULL);
+    memset(samples, 0, n * sizeof(sample_t));
+    ret = build_sim(&msp, &tables, rng, 100, 3, samples, n);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    for (j = 0; j < 3; j++) {
+        ret = msp_set_population_configuration(&msp, (int) j, 100, 0);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+    }
+    CU_ASSERT_EQUAL_FATAL(msp_set_recombination_rate(&msp, 0.01), 0);
+    CU_ASSERT_EQUAL_FATAL(msp_set_store_migrations(&msp, true), 0);
+    CU_ASSERT_EQUAL_FATAL(msp_set_store_full_arg(&msp, true), 0);
+    /* Move a random subset, then everything into an empty population and
+     * then everything into a non-empty population. */
+    CU_ASSERT_EQUAL_FATAL(msp_add_mass_migration(&msp, 0.1, 0, 1, 0.5), 0);
+    CU_ASSERT_EQUAL_FATAL(msp_add_mass_migration(&msp, 0.2, 0, 2, 1.0), 0);
+    CU_ASSERT_EQUAL_FATAL(msp_add_mass_migration(&msp, 0.3, 1, 2, 1.0), 0);
+    CU_ASSERT_EQUAL_FATAL(msp_add_mass_migration(&msp, 0.4, 2, 0, 0.0), 0);
+    ret = msp_initialise(&msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+    ret = msp_run(&msp, 0.25, ULONG_MAX);
+    CU_ASSERT_EQUAL_FATAL(ret, MSP_EXIT_MAX_TIME);
+    msp_verify(&msp, 0);
+    CU_ASSERT_EQUAL(msp_get_num_population_ancestors(&msp, 0), 0);
+
+    ret = msp_run(&msp, 0.45, ULONG_MAX);
+    CU_ASSERT_EQUAL_FATAL(ret, MSP_EXIT_MAX_TIME);
+    msp_verify(&msp, 0);
+    num_ancestors = msp_get_num_ancestors(&msp);
+    CU_ASSERT_EQUAL(msp_get_num_population_ancestors(&msp, 2), num_ancestors);
+    CU_ASSERT_TRUE(num_ancestors > 0);
+
+    ret = msp_run(&msp, DBL_MAX, ULONG_MAX);
+    CU_ASSERT_EQUAL(ret, 0);
+    msp_verify(&msp, 0);
+    CU_ASSERT_TRUE(msp_get_num_migrations(&msp) > 0);
+    for (j = 0; j < msp.tables->migrations.num_rows; j++) {
+        CU_ASSERT_NOT_EQUAL(
+            msp.tables->migrations.source[j], msp.tables->migrations.dest[j]);
+    }
+
+    ret = msp_free(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    gsl_rng_free(rng);
+    free(samples);
+    tsk_table_collection_free(&tables);
+}
+
 static void
 test_single_locus_labels(void)
 {
@@ -788,6 +847,77 @@ test_dtwf_multi_locus_simulation(void)
     tsk_table_collection_free(&tables);
 }
 
+static void
+test_dtwf_dense_migration(void)
+{
+    int ret;
+    uint32_t j, k;
+    uint32_t n = 30;
+    uint32_t num_pops = 6;
+    size_t total_migration_events;
+    size_t *migration_events = malloc(num_pops * num_pops * sizeof(size_t));
+    double *migration_matrix = malloc(num_pops * num_pops * sizeof(double));
+    sample_t *samples = malloc(n * sizeof(sample_t));
+    tsk_table_collection_t tables;
+    msp_t msp;
+    gsl_rng *rng = safe_rng_alloc();
+
+    CU_ASSERT_FATAL(
+        migration_events != NULL && migration_matrix != NULL && samples != NULL);
+    for (j = 0; j < n; j++) {
+        samples[j].time = 0;
+        samples[j].population = (population_id_t)(j % num_pops);
+    }
+    for (j = 0; j < num_pops; j++) {
+        for (k = 0; k < num_pops; k++) {
+            migration_matrix[j * num_pops + k] = j == k ? 0 : 0.1;
+        }
+    }
+    gsl_rng_set(rng, 5);
+    ret = build_sim(&msp, &tables, rng, 10, num_pops, samples, n);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_set_simulation_model_dtwf(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_EQUAL_FATAL(msp_set_recombination_rate(&msp, 0.05), 0);
+    for (j = 0; j < num_pops; j++) {
+        ret = msp_set_population_configuration(&msp, (int) j, 20, 0);
+        CU_ASSERT_EQUAL(ret, 0);
+    }
+    ret = msp_set_migration_matrix(&msp, num_pops * num_pops, migration_matrix);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_store_migrations(&msp, true);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_initialise(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+
+    while ((ret = msp_run(&msp, DBL_MAX, 1)) > 0) {
+        msp_verify(&msp, 0);
+    }
+    CU_ASSERT_EQUAL(ret, 0);
+    msp_verify(&msp, 0);
+
+    ret = msp_get_num_migration_events(&msp, migration_events);
+    CU_ASSERT_EQUAL(ret, 0);
+    total_migration_events = 0;
+    for (j = 0; j < num_pops; j++) {
+        CU_ASSERT_EQUAL(migration_events[j * num_pops + j], 0);
+        for (k = 0; k < num_pops; k++) {
+            total_migration_events += migration_events[j * num_pops + k];
+        }
+    }
+    /* Each migrating lineage records at least one migration */
+    CU_ASSERT_TRUE(total_migration_events > 0);
+    CU_ASSERT_TRUE(tables.migrations.num_rows >= total_migration_events);
+
+    ret = msp_free(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    gsl_rng_free(rng);
+    tsk_table_collection_free(&tables);
+    free(migration_events);
+    free(migration_matrix);
+    free(samples);
+}
+
 static void
 test_dtwf_deterministic(void)
 {
@@ -976,6 +1106,121 @@ test_dtwf_events_between_generations(void)
     tsk_table_collection_free(&tables);
 }
 
+static void
+test_dtwf_generation_skipping(void)
+{
+    int ret, j;
+    uint32_t n = 10;
+    sample_t *samples = malloc(n * sizeof(sample_t));
+    double migration_matrix[] = { 0, 1e-5, 1e-5, 0 };
+    tsk_node_table_t *nodes;
+    msp_t msp;
+    gsl_rng *rng = safe_rng_alloc();
+    tsk_table_collection_t tables;
+
+    CU_ASSERT_FATAL(samples != NULL);
+    for (j = 0; j < n; j++) {
+        samples[j].time = j == n - 1 ? 500.5 : 0;
+        samples[j].population = j % 2;
+    }
+    gsl_rng_set(rng, 42);
+    ret = build_sim(&msp, &tables, rng, 100, 2, samples, n);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_simulation_model_dtwf(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_dtwf_generation_skipping(&msp, true);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_recombination_rate(&msp, 1e-6);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_population_configuration(&msp, 0, 10000, 0);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_population_configuration(&msp, 1, 10000, 0);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_migration_matrix(&msp, 4, migration_matrix);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_add_population_parameters_change(&msp, 1000, -1, 100, 0);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_initialise(&msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    msp_print_state(&msp, _devnull);
+
+    /* Quiet generations must not skip past the demographic event */
+    ret = msp_run(&msp, 999, ULONG_MAX);
+    CU_ASSERT_EQUAL(ret, MSP_EXIT_MAX_TIME);
+    CU_ASSERT_EQUAL(msp.time, 999);
+    CU_ASSERT_EQUAL(msp.populations[0].initial_size, 10000);
+    msp_verify(&msp, 0);
+
+    while ((ret = msp_run(&msp, DBL_MAX, 1)) > 0) {
+        msp_verify(&msp, 0);
+        CU_ASSERT_EQUAL_FATAL(msp.time, floor(msp.time));
+    }
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_EQUAL(msp.populations[0].initial_size, 100);
+    msp_verify(&msp, 0);
+    nodes = &msp.tables->nodes;
+    CU_ASSERT_EQUAL(nodes->time[n - 1], 500.5);
+    for (j = n; j < (int) nodes->num_rows; j++) {
+        CU_ASSERT_EQUAL(nodes->time[j], floor(nodes->time[j]));
+    }
+    ret = msp_finalise_tables(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+
+    ret = msp_free(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    gsl_rng_free(rng);
+    free(samples);
+    tsk_table_collection_free(&tables);
+}
+
+static void
+test_dtwf_generation_skipping_sample_time(void)
+{
+    int ret, j;
+    sample_t samples[] = { { 0, 0.0 }, { 1, 10.0 } };
+    /* Every lineage in population 1 migrates to population 0 */
+    double migration_matrix[] = { 0, 0, 1, 0 };
+    tsk_migration_table_t *migrations;
+    msp_t msp;
+    gsl_rng *rng = safe_rng_alloc();
+    tsk_table_collection_t tables;
+
+    for (j = 0; j < 2; j++) {
+        gsl_rng_set(rng, 5);
+        ret = build_sim(&msp, &tables, rng, 100, 2, samples, 2);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_set_simulation_model_dtwf(&msp);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_set_dtwf_generation_skipping(&msp, j);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_set_store_migrations(&msp, true);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_set_population_configuration(&msp, 0, 1000, 0);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_set_population_configuration(&msp, 1, 1000, 0);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_set_migration_matrix(&msp, 4, migration_matrix);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_initialise(&msp);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+        /* The sample is added at the end of generation 10, and so
+         * migrates in generation 11 whether or not we skip. */
+        ret = msp_run(&msp, 20, ULONG_MAX);
+        CU_ASSERT_EQUAL(ret, MSP_EXIT_MAX_TIME);
+        msp_verify(&msp, 0);
+        migrations = &msp.tables->migrations;
+        CU_ASSERT_EQUAL_FATAL(migrations->num_rows, 1);
+        CU_ASSERT_EQUAL(migrations->node[0], 1);
+        CU_ASSERT_EQUAL(migrations->time[0], 11);
+
+        ret = msp_free(&msp);
+        CU_ASSERT_EQUAL(ret, 0);
+        tsk_table_collection_free(&tables);
+    }
+    gsl_rng_free(rng);
+}
+
 static void
 test_dtwf_unsupported_bottleneck(void)
 {
@@ -1249,6 +1494,263 @@ test_pedigree_multi_locus_simulation(void)
     tsk_table_collection_free(&tables);
 }
 
+static void
+test_pedigree_queue(void)
+{
+    int ret;
+    int j, k;
+    int num_coalescent_events;
+    int num_children;
+    tsk_table_collection_t tables;
+    int num_inds = 14;
+    int ploidy = 2;
+    int n = 8;
+    /* 4 samples, 4 parents, 4 grandparents and 2 founders */
+    tsk_id_t parents[28] = { 4, 5, 4, 5, 6, 7, 6, 7, 8, 9, 10, 11, 8, 10, 9, 11, 12,
+        13, 12, 13, 12, 13, 12, 13, -1, -1, -1, -1 };
+    double time[14] = { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3 };
+    tsk_flags_t is_sample[14] = { 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    double scale[] = { 1, 0.5, 2.25 };
+    bool use_buckets[] = { true, false, false };
+    double scaled_time[14];
+    msp_t msp;
+    gsl_rng *rng = safe_rng_alloc();
+
+    for (k = 0; k < 3; k++) {
+        for (j = 0; j < num_inds; j++) {
+            scaled_time[j] = time[j] * scale[k];
+        }
+        ret = build_pedigree_sim(
+            &msp, &tables, rng, 1, ploidy, num_inds, parents, scaled_time, is_sample);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        CU_ASSERT_EQUAL(msp.pedigree->use_buckets, use_buckets[k]);
+        ret = msp_initialise(&msp);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        msp_print_state(&msp, _devnull);
+        ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
+        CU_ASSERT_EQUAL(ret, 0);
+        msp_verify(&msp, 0);
+        CU_ASSERT_EQUAL(msp.time, scaled_time[num_inds - 1]);
+        /* Segment sets are returned to the pool once individuals are merged */
+        CU_ASSERT_EQUAL(
+            object_heap_get_num_allocated(&msp.pedigree->segment_set_heap), 0);
+        for (j = 0; j < num_inds; j++) {
+            CU_ASSERT_EQUAL(msp.pedigree->segments[j], NULL);
+        }
+        ret = msp_set_simulation_model_dtwf(&msp);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
+        CU_ASSERT_EQUAL(ret, 0);
+        msp_verify(&msp, 0);
+
+        num_coalescent_events = 0;
+        for (j = 0; j < (int) msp.tables->nodes.num_rows; j++) {
+            num_children = get_num_children((size_t) j, &msp.tables->edges);
+            if (num_children > 0) {
+                num_coalescent_events += num_children - 1;
+            }
+        }
+        CU_ASSERT_EQUAL(num_coalescent_events, n - 1);
+        ret = msp_free(&msp);
+        CU_ASSERT_EQUAL(ret, 0);
+        tsk_table_collection_free(&tables);
+    }
+    gsl_rng_free(rng);
+}
+
+static void
+verify_pedigree_threads(bool store_full_arg)
+{
+    int ret, j;
+    tsk_table_collection_t tables[4];
+    int num_inds = 14;
+    int ploidy = 2;
+    tsk_id_t parents[28] = { 4, 5, 4, 5, 6, 7, 6, 7, 8, 9, 10, 11, 8, 10, 9, 11, 12,
+        13, 12, 13, 12, 13, 12, 13, -1, -1, -1, -1 };
+    double time[14] = { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3 };
+    tsk_flags_t is_sample[14] = { 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    size_t num_threads[] = { 1, 2, 2, 8 };
+    msp_t msp;
+    gsl_rng *rng = safe_rng_alloc();
+
+    for (j = 0; j < 4; j++) {
+        gsl_rng_set(rng, 5678);
+        ret = build_pedigree_sim(
+            &msp, &tables[j], rng, 100, ploidy, num_inds, parents, time, is_sample);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        CU_ASSERT_EQUAL(
+            msp_set_pedigree_num_threads(&msp, 0), MSP_ERR_BAD_PARAM_VALUE);
+        ret = msp_set_pedigree_num_threads(&msp, num_threads[j]);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_set_recombination_rate(&msp, 0.05);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_set_store_full_arg(&msp, store_full_arg);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_initialise(&msp);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        msp_print_state(&msp, _devnull);
+        ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
+        CU_ASSERT_EQUAL(ret, 0);
+        msp_verify(&msp, 0);
+        CU_ASSERT_EQUAL(msp.time, 3);
+        CU_ASSERT_EQUAL(
+            object_heap_get_num_allocated(&msp.pedigree->segment_set_heap), 0);
+        ret = msp_set_simulation_model_dtwf(&msp);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
+        CU_ASSERT_EQUAL(ret, 0);
+        msp_verify(&msp, 0);
+        ret = msp_finalise_tables(&msp);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_free(&msp);
+        CU_ASSERT_EQUAL(ret, 0);
+    }
+    /* Output depends only on whether threads are used, not how many: a
+     * single thread climbs the pedigree serially, drawing breakpoints from
+     * the main generator, while several threads draw from generators
+     * seeded for each transmission. */
+    CU_ASSERT_FALSE(tsk_edge_table_equals(&tables[0].edges, &tables[1].edges, 0));
+    for (j = 2; j < 4; j++) {
+        CU_ASSERT_TRUE(tsk_node_table_equals(&tables[1].nodes, &tables[j].nodes, 0));
+        CU_ASSERT_TRUE(tsk_edge_table_equals(&tables[1].edges, &tables[j].edges, 0));
+    }
+
+    gsl_rng_free(rng);
+    for (j = 0; j < 4; j++) {
+        tsk_table_collection_free(&tables[j]);
+    }
+}
+
+static void
+test_pedigree_threads(void)
+{
+    verify_pedigree_threads(false);
+}
+
+static void
+test_pedigree_threads_full_arg(void)
+{
+    verify_pedigree_threads(true);
+}
+
+static void
+write_pedigree_file(const char *filename, const char *magic, size_t num_inds,
+    tsk_id_t *parents, double *time, tsk_flags_t *is_sample, size_t truncate)
+{
+    FILE *f = fopen(filename, "wb");
+    char buffer[1024];
+    uint32_t version = MSP_PEDIGREE_FILE_VERSION;
+    uint32_t ploidy = 2;
+    uint64_t n = num_inds;
+    size_t j, offset;
+    tsk_id_t individual;
+
+    CU_ASSERT_FATAL(f != NULL);
+    memset(buffer, 0, sizeof(buffer));
+    memcpy(buffer, magic, 8);
+    memcpy(buffer + 8, &version, sizeof(version));
+    memcpy(buffer + 12, &ploidy, sizeof(ploidy));
+    memcpy(buffer + 16, &n, sizeof(n));
+    offset = MSP_PEDIGREE_FILE_HEADER_SIZE;
+    for (j = 0; j < num_inds; j++) {
+        individual = (tsk_id_t) j + 1;
+        memcpy(buffer + offset + j * sizeof(tsk_id_t), &individual, sizeof(tsk_id_t));
+    }
+    offset = (offset + num_inds * sizeof(tsk_id_t) + 7) & ~((size_t) 7);
+    memcpy(buffer + offset, parents, num_inds * ploidy * sizeof(tsk_id_t));
+    offset = (offset + num_inds * ploidy * sizeof(tsk_id_t) + 7) & ~((size_t) 7);
+    memcpy(buffer + offset, time, num_inds * sizeof(double));
+    offset = (offset + num_inds * sizeof(double) + 7) & ~((size_t) 7);
+    memcpy(buffer + offset, is_sample, num_inds * sizeof(tsk_flags_t));
+    offset += num_inds * sizeof(tsk_flags_t);
+    CU_ASSERT_FATAL(offset <= sizeof(buffer));
+    CU_ASSERT_FATAL(fwrite(buffer, 1, offset - truncate, f) == offset - truncate);
+    fclose(f);
+}
+
+static void
+test_pedigree_file(void)
+{
+    int ret;
+    size_t num_inds = 4;
+    size_t ploidy = 2;
+    tsk_id_t parents[8] = { 2, 3, 2, 3, -1, -1, -1, -1 };
+    double time[4] = { 0, 0, 1, 1 };
+    tsk_flags_t is_sample[4] = { 1, 1, 0, 0 };
+    tsk_table_collection_t tables[2];
+    msp_t msp;
+    gsl_rng *rng = safe_rng_alloc();
+
+    write_pedigree_file(
+        _tmp_file_name, MSP_PEDIGREE_FILE_MAGIC, num_inds, parents, time, is_sample, 0);
+
+    /* The pedigree from the file matches the one encoded in the tables */
+    gsl_rng_set(rng, 2);
+    ret = build_pedigree_sim(
+        &msp, &tables[0], rng, 100, ploidy, num_inds, parents, time, is_sample);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_set_recombination_rate(&msp, 0.1);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_initialise(&msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_finalise_tables(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    msp_free(&msp);
+
+    gsl_rng_set(rng, 2);
+    ret = build_pedigree_sim(
+        &msp, &tables[1], rng, 100, ploidy, num_inds, parents, time, is_sample);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_set_simulation_model_wf_ped_file(&msp, _tmp_file_name);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_set_recombination_rate(&msp, 0.1);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_initialise(&msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    msp_print_state(&msp, _devnull);
+    ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
+    CU_ASSERT_EQUAL(ret, 0);
+    msp_verify(&msp, 0);
+    ret = msp_finalise_tables(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_TRUE(tsk_node_table_equals(&tables[0].nodes, &tables[1].nodes, 0));
+    CU_ASSERT_TRUE(tsk_edge_table_equals(&tables[0].edges, &tables[1].edges, 0));
+
+    CU_ASSERT_EQUAL(
+        msp_set_simulation_model_wf_ped_file(&msp, "/does/not/exist"), MSP_ERR_IO);
+    write_pedigree_file(
+        _tmp_file_name, "XXXXXXXX", num_inds, parents, time, is_sample, 0);
+    CU_ASSERT_EQUAL(msp_set_simulation_model_wf_ped_file(&msp, _tmp_file_name),
+        MSP_ERR_BAD_PEDIGREE_FILE);
+    write_pedigree_file(
+        _tmp_file_name, MSP_PEDIGREE_FILE_MAGIC, num_inds, parents, time, is_sample, 1);
+    CU_ASSERT_EQUAL(msp_set_simulation_model_wf_ped_file(&msp, _tmp_file_name),
+        MSP_ERR_BAD_PEDIGREE_FILE);
+    write_pedigree_file(
+        _tmp_file_name, MSP_PEDIGREE_FILE_MAGIC, 3, parents, time, is_sample, 0);
+    CU_ASSERT_EQUAL(msp_set_simulation_model_wf_ped_file(&msp, _tmp_file_name),
+        MSP_ERR_BAD_PEDIGREE_FILE);
+    time[2] = 0;
+    write_pedigree_file(
+        _tmp_file_name, MSP_PEDIGREE_FILE_MAGIC, num_inds, parents, time, is_sample, 0);
+    CU_ASSERT_EQUAL(msp_set_simulation_model_wf_ped_file(&msp, _tmp_file_name),
+        MSP_ERR_TIME_TRAVEL);
+    time[2] = 1;
+    parents[0] = 4;
+    write_pedigree_file(
+        _tmp_file_name, MSP_PEDIGREE_FILE_MAGIC, num_inds, parents, time, is_sample, 0);
+    CU_ASSERT_EQUAL(msp_set_simulation_model_wf_ped_file(&msp, _tmp_file_name),
+        msp_set_tsk_error(TSK_ERR_INDIVIDUAL_OUT_OF_BOUNDS));
+    parents[0] = 2;
+
+    msp_free(&msp);
+    tsk_table_collection_free(&tables[0]);
+    tsk_table_collection_free(&tables[1]);
+    gsl_rng_free(rng);
+}
+
 static void
 test_pedigree_errors(void)
 {
@@ -1280,52 +1782,237 @@ test_pedigree_errors(void)
     tsk_table_collection_free(&tables);
     msp_free(&msp);
 
-    /* Any demographic events during the pedigree sim are errors */
-    ret = build_pedigree_sim(
-        &msp, &tables, rng, 100, ploidy, num_inds, parents, time, is_sample);
-    CU_ASSERT_EQUAL_FATAL(ret, 0);
-    ret = msp_add_population_parameters_change(&msp, 0.5, 0, 1, 0);
-    CU_ASSERT_EQUAL_FATAL(ret, 0);
-    ret = msp_initialise(&msp);
-    CU_ASSERT_EQUAL_FATAL(ret, 0);
-    ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
-    CU_ASSERT_EQUAL_FATAL(ret, MSP_ERR_UNSUPPORTED_OPERATION);
-    tsk_table_collection_free(&tables);
-    msp_free(&msp);
+    /* Any demographic events during the pedigree sim are errors */
+    ret = build_pedigree_sim(
+        &msp, &tables, rng, 100, ploidy, num_inds, parents, time, is_sample);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_add_population_parameters_change(&msp, 0.5, 0, 1, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_initialise(&msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
+    CU_ASSERT_EQUAL_FATAL(ret, MSP_ERR_UNSUPPORTED_OPERATION);
+    tsk_table_collection_free(&tables);
+    msp_free(&msp);
+
+    time[0] = 1;
+    time[1] = 1;
+    ret = build_pedigree_sim(
+        &msp, &tables, rng, 100, ploidy, num_inds, parents, time, is_sample);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_initialise(&msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_TIME_TRAVEL);
+    tsk_table_collection_free(&tables);
+    msp_free(&msp);
+    time[0] = 0;
+    time[1] = 0;
+
+    parents[0] = -2;
+    ret = build_pedigree_sim(
+        &msp, &tables, rng, 100, ploidy, num_inds, parents, time, is_sample);
+    CU_ASSERT_EQUAL_FATAL(ret, TSK_ERR_INDIVIDUAL_OUT_OF_BOUNDS);
+    ret = msp_initialise(&msp);
+    tsk_table_collection_free(&tables);
+    msp_free(&msp);
+
+    parents[0] = 100;
+    ret = build_pedigree_sim(
+        &msp, &tables, rng, 100, ploidy, num_inds, parents, time, is_sample);
+    CU_ASSERT_EQUAL_FATAL(ret, TSK_ERR_INDIVIDUAL_OUT_OF_BOUNDS);
+    ret = msp_initialise(&msp);
+    tsk_table_collection_free(&tables);
+    msp_free(&msp);
+
+    /* TODO lots more tests when we update the pedigree simulation. */
+
+    gsl_rng_free(rng);
+}
+
+/* Builds a four-population DTWF simulation with recombination and
+ * migration, run on the specified number of threads. */
+static void
+build_dtwf_threads_sim(
+    msp_t *msp, tsk_table_collection_t *tables, gsl_rng *rng, size_t num_threads)
+{
+    int ret, j, k;
+    uint32_t n = 40;
+    uint32_t num_pops = 4;
+    sample_t samples[40];
+    double migration_matrix[16];
+
+    for (j = 0; j < (int) n; j++) {
+        samples[j].time = 0;
+        samples[j].population = j % (int) num_pops;
+    }
+    for (j = 0; j < (int) num_pops; j++) {
+        for (k = 0; k < (int) num_pops; k++) {
+            migration_matrix[j * (int) num_pops + k] = j == k ? 0 : 0.01;
+        }
+    }
+    ret = build_sim(msp, tables, rng, 10, num_pops, samples, n);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_set_simulation_model_dtwf(msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_EQUAL(msp_set_dtwf_num_threads(msp, 0), MSP_ERR_BAD_PARAM_VALUE);
+    ret = msp_set_dtwf_num_threads(msp, num_threads);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_recombination_rate(msp, 0.01);
+    CU_ASSERT_EQUAL(ret, 0);
+    for (k = 0; k < (int) num_pops; k++) {
+        ret = msp_set_population_configuration(msp, k, 50, 0);
+        CU_ASSERT_EQUAL(ret, 0);
+    }
+    ret = msp_set_migration_matrix(msp, num_pops * num_pops, migration_matrix);
+    CU_ASSERT_EQUAL(ret, 0);
+}
+
+static void
+test_dtwf_threads(void)
+{
+    int ret, j;
+    size_t num_threads[] = { 1, 2, 3, 8 };
+    msp_t msp;
+    gsl_rng *rng = safe_rng_alloc();
+    tsk_table_collection_t tables[4];
+
+    for (j = 0; j < 4; j++) {
+        gsl_rng_set(rng, 1234);
+        build_dtwf_threads_sim(&msp, &tables[j], rng, num_threads[j]);
+        ret = msp_initialise(&msp);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        msp_print_state(&msp, _devnull);
+        ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
+        CU_ASSERT_EQUAL(ret, 0);
+        msp_verify(&msp, 0);
+        ret = msp_finalise_tables(&msp);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_free(&msp);
+        CU_ASSERT_EQUAL(ret, 0);
+    }
+    /* A single thread runs the serial algorithm on the main generator;
+     * otherwise output does not depend on the number of threads. */
+    for (j = 2; j < 4; j++) {
+        CU_ASSERT_TRUE(tsk_node_table_equals(&tables[1].nodes, &tables[j].nodes, 0));
+        CU_ASSERT_TRUE(tsk_edge_table_equals(&tables[1].edges, &tables[j].edges, 0));
+    }
+
+    gsl_rng_free(rng);
+    for (j = 0; j < 4; j++) {
+        tsk_table_collection_free(&tables[j]);
+    }
+}
+
+static void
+test_dtwf_threads_replicates(void)
+{
+    int ret, j, k;
+    size_t num_threads[] = { 1, 3 };
+    msp_t msp, fresh_msp;
+    gsl_rng *rng = safe_rng_alloc();
+    gsl_rng *fresh_rng = safe_rng_alloc();
+    tsk_table_collection_t tables, fresh_tables;
+
+    for (j = 0; j < 2; j++) {
+        gsl_rng_set(rng, 42);
+        build_dtwf_threads_sim(&msp, &tables, rng, num_threads[j]);
+        for (k = 0; k < 3; k++) {
+            /* Each replicate must match a fresh run started from the state of
+             * the main generator at the start of the replicate. */
+            gsl_rng_memcpy(fresh_rng, rng);
+            ret = k == 0 ? msp_initialise(&msp) : msp_reset(&msp);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+            ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
+            CU_ASSERT_EQUAL(ret, 0);
+            ret = msp_finalise_tables(&msp);
+            CU_ASSERT_EQUAL(ret, 0);
+
+            build_dtwf_threads_sim(&fresh_msp, &fresh_tables, fresh_rng, num_threads[j]);
+            ret = msp_initialise(&fresh_msp);
+            CU_ASSERT_EQUAL_FATAL(ret, 0);
+            ret = msp_run(&fresh_msp, DBL_MAX, UINT32_MAX);
+            CU_ASSERT_EQUAL(ret, 0);
+            ret = msp_finalise_tables(&fresh_msp);
+            CU_ASSERT_EQUAL(ret, 0);
+            CU_ASSERT_TRUE(tsk_node_table_equals(&tables.nodes, &fresh_tables.nodes, 0));
+            CU_ASSERT_TRUE(tsk_edge_table_equals(&tables.edges, &fresh_tables.edges, 0));
+            ret = msp_free(&fresh_msp);
+            CU_ASSERT_EQUAL(ret, 0);
+            tsk_table_collection_free(&fresh_tables);
+        }
+        ret = msp_free(&msp);
+        CU_ASSERT_EQUAL(ret, 0);
+        tsk_table_collection_free(&tables);
+    }
+    gsl_rng_free(rng);
+    gsl_rng_free(fresh_rng);
+}
 
-    time[0] = 1;
-    time[1] = 1;
-    ret = build_pedigree_sim(
-        &msp, &tables, rng, 100, ploidy, num_inds, parents, time, is_sample);
-    CU_ASSERT_EQUAL_FATAL(ret, 0);
-    ret = msp_initialise(&msp);
-    CU_ASSERT_EQUAL_FATAL(ret, 0);
-    ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
-    CU_ASSERT_EQUAL(ret, MSP_ERR_TIME_TRAVEL);
-    tsk_table_collection_free(&tables);
-    msp_free(&msp);
-    time[0] = 0;
-    time[1] = 0;
+static void
+test_dtwf_hybrid(void)
+{
+    int ret;
+    uint32_t n = 20;
+    fenwick_t *recomb_mass_index;
+    tsk_table_collection_t tables;
+    msp_t msp;
+    gsl_rng *rng = safe_rng_alloc();
 
-    parents[0] = -2;
-    ret = build_pedigree_sim(
-        &msp, &tables, rng, 100, ploidy, num_inds, parents, time, is_sample);
-    CU_ASSERT_EQUAL_FATAL(ret, TSK_ERR_INDIVIDUAL_OUT_OF_BOUNDS);
+    gsl_rng_set(rng, 5);
+    ret = build_sim(&msp, &tables, rng, 10, 1, NULL, n);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_recombination_rate(&msp, 0.001);
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_EQUAL(
+        msp_set_simulation_model_dtwf_hybrid(&msp, -1, 0), MSP_ERR_BAD_PARAM_VALUE);
+    CU_ASSERT_EQUAL(
+        msp_set_simulation_model_dtwf_hybrid(&msp, 0, -1), MSP_ERR_BAD_PARAM_VALUE);
+    ret = msp_set_simulation_model_dtwf_hybrid(&msp, 5, 0.1);
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_STRING_EQUAL(msp_get_model_name(&msp), "dtwf_hybrid");
+    ret = msp_set_population_configuration(&msp, 0, 100, 0);
+    CU_ASSERT_EQUAL(ret, 0);
     ret = msp_initialise(&msp);
-    tsk_table_collection_free(&tables);
-    msp_free(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    msp_print_state(&msp, _devnull);
+    recomb_mass_index = msp.recomb_mass_index;
+    CU_ASSERT_FATAL(recomb_mass_index != NULL);
 
-    parents[0] = 100;
-    ret = build_pedigree_sim(
-        &msp, &tables, rng, 100, ploidy, num_inds, parents, time, is_sample);
-    CU_ASSERT_EQUAL_FATAL(ret, TSK_ERR_INDIVIDUAL_OUT_OF_BOUNDS);
-    ret = msp_initialise(&msp);
-    tsk_table_collection_free(&tables);
-    msp_free(&msp);
+    /* The DTWF runs generation by generation for the first 5 generations */
+    ret = msp_run(&msp, DBL_MAX, 5);
+    CU_ASSERT_EQUAL(ret, MSP_EXIT_MAX_EVENTS);
+    CU_ASSERT_EQUAL(msp.time, 5);
+    msp_verify(&msp, 0);
 
-    /* TODO lots more tests when we update the pedigree simulation. */
+    /* Once there are no more than 10 lineages we switch to the coalescent */
+    while ((ret = msp_run(&msp, DBL_MAX, 1)) == MSP_EXIT_MAX_EVENTS) {
+        msp_verify(&msp, 0);
+        if (msp_get_model(&msp)->type == MSP_MODEL_DTWF_HYBRID) {
+            CU_ASSERT_EQUAL_FATAL(msp.time, floor(msp.time));
+        } else {
+            CU_ASSERT_EQUAL(msp_get_model(&msp)->type, MSP_MODEL_HUDSON);
+        }
+    }
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_EQUAL(msp_get_model(&msp)->type, MSP_MODEL_HUDSON);
+    CU_ASSERT_EQUAL(msp.recomb_mass_index, recomb_mass_index);
+    msp_verify(&msp, 0);
+    ret = msp_finalise_tables(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
 
+    /* Resetting goes back to the hybrid model */
+    ret = msp_reset(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_EQUAL(msp_get_model(&msp)->type, MSP_MODEL_DTWF_HYBRID);
+    ret = msp_run(&msp, DBL_MAX, ULONG_MAX);
+    CU_ASSERT_EQUAL(ret, 0);
+    msp_verify(&msp, 0);
+
+    ret = msp_free(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
     gsl_rng_free(rng);
+    tsk_table_collection_free(&tables);
 }
 
 static void
@@ -1545,7 +2232,7 @@ test_gc_single_locus(void)
 static void
 test_gc_tract_lengths(void)
 {
-    double tract_lengths[] = { 1.0, 1.3333, 5, 10 };
+    double tract_lengths[] = { 1e-6, 0.01, 1.0, 1.3333, 5, 10 };
     size_t j;
 
     for (j = 0; j < sizeof(tract_lengths) / sizeof(double); j++) {
@@ -1561,6 +2248,55 @@ test_gc_zero_recombination(void)
     run_gc_simulation(10, 1.0, 1, 0.0, false);
 }
 
+static void
+test_gc_many_populations(void)
+{
+    int ret;
+    uint32_t j, k;
+    uint32_t n = 20;
+    uint32_t num_pops = 8;
+    sample_t *samples = malloc(n * sizeof(sample_t));
+    double *migration_matrix = calloc(num_pops * num_pops, sizeof(double));
+    tsk_table_collection_t tables;
+    msp_t msp;
+    gsl_rng *rng = safe_rng_alloc();
+
+    CU_ASSERT_FATAL(samples != NULL && migration_matrix != NULL);
+    /* Leave some populations empty so that the count index has gaps */
+    for (j = 0; j < n; j++) {
+        samples[j].time = 0;
+        samples[j].population = (population_id_t)((2 * j) % num_pops);
+    }
+    for (j = 0; j < num_pops; j++) {
+        for (k = 0; k < num_pops; k++) {
+            migration_matrix[j * num_pops + k] = j == k ? 0 : 0.5;
+        }
+    }
+    ret = build_sim(&msp, &tables, rng, 20, num_pops, samples, n);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_EQUAL_FATAL(msp_set_gene_conversion_rate(&msp, 1), 0);
+    CU_ASSERT_EQUAL_FATAL(msp_set_gene_conversion_tract_length(&msp, 3), 0);
+    ret = msp_set_migration_matrix(&msp, num_pops * num_pops, migration_matrix);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_initialise(&msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_EQUAL(msp_get_num_ancestors(&msp), n);
+
+    while ((ret = msp_run(&msp, DBL_MAX, 1)) == MSP_EXIT_MAX_EVENTS) {
+        msp_verify(&msp, 0);
+    }
+    CU_ASSERT_EQUAL(ret, 0);
+    msp_verify(&msp, 0);
+    CU_ASSERT_EQUAL(msp_get_num_ancestors(&msp), 0);
+    CU_ASSERT_TRUE(msp_get_num_gene_conversion_events(&msp) > 0);
+
+    msp_free(&msp);
+    tsk_table_collection_free(&tables);
+    gsl_rng_free(rng);
+    free(samples);
+    free(migration_matrix);
+}
+
 static void
 test_gc_rates(void)
 {
@@ -1983,9 +2719,10 @@ test_demographic_events(void)
         CU_ASSERT_EQUAL_FATAL(msp_add_simple_bottleneck(&msp, 10, -1, 0),
             MSP_ERR_POPULATION_OUT_OF_BOUNDS);
 
-        CU_ASSERT_EQUAL(msp_add_census_event(&msp, -0.5), MSP_ERR_BAD_PARAM_VALUE);
+        CU_ASSERT_EQUAL(
+            msp_add_census_event(&msp, -0.5, false), MSP_ERR_BAD_PARAM_VALUE);
 
-        ret = msp_add_census_event(&msp, 0.05);
+        ret = msp_add_census_event(&msp, 0.05, false);
         CU_ASSERT_EQUAL(ret, 0);
         ret = msp_add_mass_migration(&msp, 0.1, 0, 1, 0.5);
         CU_ASSERT_EQUAL(ret, 0);
@@ -2080,6 +2817,97 @@ test_demographic_events(void)
     gsl_rng_free(rng);
 }
 
+static void
+test_debug_demography_calculations(void)
+{
+    int ret;
+    msp_t msp;
+    gsl_rng *rng = safe_rng_alloc();
+    sample_t samples[] = { { 0, 0.0 }, { 1, 0.0 } };
+    double migration_matrix[] = { 0, 0.1, 0.1, 0 };
+    double steps[] = { 0, 1, 2.5, 5, 6 };
+    double num_samples[] = { 2, 0 };
+    double rates[5], uncoalesced[5], probabilities[5 * 4];
+    double p;
+    tsk_table_collection_t tables;
+    size_t j;
+    int num_threads;
+
+    for (num_threads = 1; num_threads <= 2; num_threads++) {
+        ret = build_sim(&msp, &tables, rng, 1, 2, samples, 2);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        CU_ASSERT_EQUAL_FATAL(msp_set_population_configuration(&msp, 0, 2, 0), 0);
+        CU_ASSERT_EQUAL_FATAL(msp_set_population_configuration(&msp, 1, 2, 0), 0);
+        CU_ASSERT_EQUAL_FATAL(msp_set_migration_matrix(&msp, 4, migration_matrix), 0);
+        CU_ASSERT_EQUAL_FATAL(msp_add_mass_migration(&msp, 5, 1, 0, 1.0), 0);
+        ret = msp_debug_lineage_probabilities(&msp, 5, steps, 0, 1, probabilities);
+        CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_STATE);
+        ret = msp_initialise(&msp);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        ret = msp_debug_lineage_probabilities(
+            &msp, 5, steps, 0, num_threads, probabilities);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        for (j = 0; j < 5; j++) {
+            CU_ASSERT_DOUBLE_EQUAL(
+                probabilities[4 * j] + probabilities[4 * j + 1], 1, 1e-12);
+            CU_ASSERT_DOUBLE_EQUAL(
+                probabilities[4 * j + 2] + probabilities[4 * j + 3], 1, 1e-12);
+            if (steps[j] <= 5) {
+                /* Probabilities are reported before the mass migration */
+                p = (1 + exp(-0.2 * steps[j])) / 2;
+                CU_ASSERT_DOUBLE_EQUAL(probabilities[4 * j], p, 1e-12);
+                CU_ASSERT_DOUBLE_EQUAL(probabilities[4 * j + 3], p, 1e-12);
+            }
+        }
+        /* We've walked through the epochs, so can't do it again */
+        ret = msp_debug_lineage_probabilities(
+            &msp, 5, steps, 0, num_threads, probabilities);
+        CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_STATE);
+        ret = msp_free(&msp);
+        CU_ASSERT_EQUAL(ret, 0);
+        tsk_table_collection_free(&tables);
+
+        /* Without migration, pairs sampled in population 0 coalesce at rate
+         * 1 / (2 N) */
+        ret = build_sim(&msp, &tables, rng, 1, 2, samples, 2);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        CU_ASSERT_EQUAL_FATAL(msp_set_population_configuration(&msp, 0, 2, 0), 0);
+        CU_ASSERT_EQUAL_FATAL(msp_set_population_configuration(&msp, 1, 2, 0), 0);
+        ret = msp_initialise(&msp);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        ret = msp_debug_coalescence_rates(
+            &msp, 5, steps, num_samples, 1, num_threads, rates, uncoalesced);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        for (j = 0; j < 5; j++) {
+            CU_ASSERT_DOUBLE_EQUAL(rates[j], 0.25, 1e-12);
+            CU_ASSERT_DOUBLE_EQUAL(uncoalesced[j], exp(-0.25 * steps[j]), 1e-12);
+        }
+        ret = msp_free(&msp);
+        CU_ASSERT_EQUAL(ret, 0);
+        tsk_table_collection_free(&tables);
+
+        /* Bad parameters */
+        ret = build_sim(&msp, &tables, rng, 1, 2, samples, 2);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        ret = msp_initialise(&msp);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        steps[1] = 0;
+        ret = msp_debug_coalescence_rates(
+            &msp, 5, steps, num_samples, 1, num_threads, rates, uncoalesced);
+        CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_PARAM_VALUE);
+        steps[1] = 1;
+        ret = msp_debug_coalescence_rates(
+            &msp, 5, steps, num_samples, 1, 0, rates, uncoalesced);
+        CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_PARAM_VALUE);
+        ret = msp_debug_lineage_probabilities(&msp, 5, steps, -1, 1, probabilities);
+        CU_ASSERT_EQUAL(ret, MSP_ERR_BAD_PARAM_VALUE);
+        ret = msp_free(&msp);
+        CU_ASSERT_EQUAL(ret, 0);
+        tsk_table_collection_free(&tables);
+    }
+    gsl_rng_free(rng);
+}
+
 static void
 test_demographic_events_start_time(void)
 {
@@ -2126,22 +2954,79 @@ test_demographic_events_start_time(void)
 }
 
 static void
-test_census_event(void)
+test_many_demographic_events(void)
+{
+    int ret;
+    uint32_t j, n = 10;
+    size_t num_events = 1000;
+    double t;
+    msp_t msp;
+    gsl_rng *rng = safe_rng_alloc();
+    tsk_table_collection_t tables;
+
+    ret = build_sim(&msp, &tables, rng, 10, 1, NULL, n);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_recombination_rate(&msp, 1);
+    CU_ASSERT_EQUAL(ret, 0);
+    for (j = 0; j < num_events; j++) {
+        ret = msp_add_population_parameters_change(
+            &msp, 0.01 * (j + 1), 0, 1 + (j % 7), GSL_NAN);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+    }
+    CU_ASSERT_EQUAL(msp.num_demographic_events, num_events);
+    CU_ASSERT_TRUE(msp.max_demographic_events >= num_events);
+    ret = msp_add_population_parameters_change(&msp, 0, 0, 1, GSL_NAN);
+    CU_ASSERT_EQUAL(ret, MSP_ERR_UNSORTED_DEMOGRAPHIC_EVENTS);
+    CU_ASSERT_EQUAL(msp.num_demographic_events, num_events);
+    ret = msp_initialise(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+
+    for (j = 0; j < 2; j++) {
+        ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
+        CU_ASSERT_EQUAL(ret, 0);
+        CU_ASSERT_TRUE(msp.next_demographic_event > 0);
+        msp_verify(&msp, 0);
+        ret = msp_reset(&msp);
+        CU_ASSERT_EQUAL(ret, 0);
+        CU_ASSERT_EQUAL(msp.next_demographic_event, 0);
+    }
+
+    /* The debugger visits each event time in turn */
+    ret = msp_debug_demography(&msp, &t);
+    CU_ASSERT_EQUAL(ret, 0);
+    for (j = 0; j < num_events; j++) {
+        CU_ASSERT_DOUBLE_EQUAL(t, 0.01 * (j + 1), 1e-12);
+        ret = msp_debug_demography(&msp, &t);
+        CU_ASSERT_EQUAL(ret, 0);
+        CU_ASSERT_EQUAL(msp.populations[0].initial_size, 1 + (j % 7));
+    }
+    CU_ASSERT_TRUE(gsl_isinf(t));
+    CU_ASSERT_EQUAL(msp.next_demographic_event, num_events);
+
+    ret = msp_free(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    tsk_table_collection_free(&tables);
+    gsl_rng_free(rng);
+}
+
+static int
+run_census_simulation(bool per_lineage)
 {
     int ret;
     uint32_t n = 10;
     msp_t msp;
     gsl_rng *rng = safe_rng_alloc();
     tsk_table_collection_t tables;
+    tsk_treeseq_t ts;
     int num_census_nodes = 0;
-    int i;
+    tsk_size_t i;
 
     ret = build_sim(&msp, &tables, rng, 2, 1, NULL, n);
     CU_ASSERT_EQUAL(ret, 0);
     ret = msp_set_recombination_rate(&msp, 1);
 
     /* Add a census event in at 0.5 generations. */
-    ret = msp_add_census_event(&msp, 0.5);
+    ret = msp_add_census_event(&msp, 0.5, per_lineage);
     CU_ASSERT_EQUAL(ret, 0);
     ret = msp_initialise(&msp);
     CU_ASSERT_EQUAL(ret, 0);
@@ -2151,18 +3036,37 @@ test_census_event(void)
     msp_verify(&msp, 0);
     msp_print_state(&msp, _devnull);
 
-    /* Check there is more than 1 node at the census time. */
     for (i = 0; i < tables.nodes.num_rows; i++) {
         if (tables.nodes.time[i] == 0.5) {
+            CU_ASSERT_EQUAL(tables.nodes.flags[i], MSP_NODE_IS_CEN_EVENT);
             num_census_nodes++;
         }
     }
-    CU_ASSERT_TRUE(num_census_nodes > 1);
-
     ret = msp_free(&msp);
     CU_ASSERT_EQUAL(ret, 0);
+
+    /* Make sure we can build a tree sequence out of the result */
+    ret = tsk_treeseq_init(&ts, &tables, TSK_BUILD_INDEXES);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    tsk_treeseq_free(&ts);
+
     gsl_rng_free(rng);
     tsk_table_collection_free(&tables);
+    return num_census_nodes;
+}
+
+static void
+test_census_event(void)
+{
+    int num_segment_nodes = run_census_simulation(false);
+    int num_lineage_nodes = run_census_simulation(true);
+
+    /* Check there is more than 1 node at the census time. */
+    CU_ASSERT_TRUE(num_segment_nodes > 1);
+    CU_ASSERT_TRUE(num_lineage_nodes > 1);
+    /* The census doesn't use any random numbers, so both simulations
+     * have the same lineages at the census time. */
+    CU_ASSERT_TRUE(num_lineage_nodes <= num_segment_nodes);
 }
 
 static void
@@ -2446,6 +3350,61 @@ test_large_bottleneck_simulation(void)
     tsk_table_collection_free(&tables);
 }
 
+static void
+test_large_instantaneous_bottleneck_simulation(void)
+{
+    int ret;
+    uint32_t j;
+    uint32_t n = 1000;
+    long seed = 10;
+    msp_t msp;
+    gsl_rng *rng = safe_rng_alloc();
+    uint32_t num_bottlenecks = 10;
+    double time[num_bottlenecks];
+    double strength[num_bottlenecks];
+    tsk_table_collection_t tables;
+
+    for (j = 0; j < num_bottlenecks; j++) {
+        time[j] = 0.1 + j * 0.01;
+        strength[j] = 0.001 * (j + 1);
+    }
+    /* The last bottleneck coalesces everything */
+    strength[num_bottlenecks - 1] = 1000;
+
+    gsl_rng_set(rng, seed);
+    ret = build_sim(&msp, &tables, rng, 10, 2, NULL, n);
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_EQUAL_FATAL(msp_set_recombination_rate(&msp, 1), 0);
+    for (j = 0; j < num_bottlenecks; j++) {
+        /* Population 1 has no lineages, so these bottlenecks are no-ops there */
+        ret = msp_add_instantaneous_bottleneck(&msp, time[j], (int) j % 2, 0.001);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_add_instantaneous_bottleneck(&msp, time[j], 0, strength[j]);
+        CU_ASSERT_EQUAL(ret, 0);
+    }
+    ret = msp_initialise(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+
+    for (j = 0; j < num_bottlenecks - 1; j++) {
+        ret = msp_run(&msp, time[j] + 1e-6, ULONG_MAX);
+        CU_ASSERT_EQUAL(ret, MSP_EXIT_MAX_TIME);
+        CU_ASSERT_FALSE(msp_is_completed(&msp));
+        CU_ASSERT_EQUAL(msp_get_num_population_ancestors(&msp, 1), 0);
+        msp_verify(&msp, 0);
+    }
+    CU_ASSERT_TRUE(msp.max_bottleneck_lineages >= n);
+    ret = msp_run(&msp, DBL_MAX, ULONG_MAX);
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT_TRUE(msp_is_completed(&msp));
+    CU_ASSERT_EQUAL(msp.time, time[num_bottlenecks - 1]);
+    msp_verify(&msp, 0);
+
+    ret = msp_free(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    gsl_rng_free(rng);
+    tsk_table_collection_free(&tables);
+}
+
 static void
 verify_simulate_from(int model, rate_map_t *recomb_map,
     tsk_table_collection_t *from_tables, size_t num_replicates)
@@ -2918,6 +3877,7 @@ main(int argc, char **argv)
         { "test_single_locus_simulation", test_single_locus_simulation },
         { "test_single_locus_two_populations", test_single_locus_two_populations },
         { "test_single_locus_many_populations", test_single_locus_many_populations },
+        { "test_mass_migration_proportions", test_mass_migration_proportions },
         { "test_single_locus_labels", test_single_locus_labels },
         { "test_single_locus_historical_sample", test_single_locus_historical_sample },
         { "test_single_locus_all_historical", test_single_locus_all_historical },
@@ -2933,11 +3893,18 @@ main(int argc, char **argv)
 
         { "test_dtwf_single_locus_simulation", test_dtwf_single_locus_simulation },
         { "test_dtwf_multi_locus_simulation", test_dtwf_multi_locus_simulation },
+        { "test_dtwf_dense_migration", test_dtwf_dense_migration },
         { "test_dtwf_deterministic", test_dtwf_deterministic },
         { "test_dtwf_simultaneous_historical_samples",
             test_dtwf_simultaneous_historical_samples },
         { "test_dtwf_low_recombination", test_dtwf_low_recombination },
         { "test_dtwf_events_between_generations", test_dtwf_events_between_generations },
+        { "test_dtwf_generation_skipping", test_dtwf_generation_skipping },
+        { "test_dtwf_generation_skipping_sample_time",
+            test_dtwf_generation_skipping_sample_time },
+        { "test_dtwf_threads", test_dtwf_threads },
+        { "test_dtwf_threads_replicates", test_dtwf_threads_replicates },
+        { "test_dtwf_hybrid", test_dtwf_hybrid },
         { "test_dtwf_unsupported_bottleneck", test_dtwf_unsupported_bottleneck },
         { "test_dtwf_zero_pop_size", test_dtwf_zero_pop_size },
         { "test_dtwf_migration_matrix_not_stochastic",
@@ -2947,6 +3914,10 @@ main(int argc, char **argv)
         { "test_pedigree_single_locus_simulation",
             test_pedigree_single_locus_simulation },
         { "test_pedigree_multi_locus_simulation", test_pedigree_multi_locus_simulation },
+        { "test_pedigree_queue", test_pedigree_queue },
+        { "test_pedigree_threads", test_pedigree_threads },
+        { "test_pedigree_threads_full_arg", test_pedigree_threads_full_arg },
+        { "test_pedigree_file", test_pedigree_file },
         { "test_pedigree_errors", test_pedigree_errors },
 
         { "test_mixed_hudson_dtwf", test_mixed_hudson_dtwf },
@@ -2956,6 +3927,7 @@ main(int argc, char **argv)
         { "test_gc_tract_lengths", test_gc_tract_lengths },
         { "test_gc_zero_recombination", test_gc_zero_recombination },
         { "test_gc_rates", test_gc_rates },
+        { "test_gc_many_populations", test_gc_many_populations },
 
         { "test_multiple_mergers_simulation", test_multiple_mergers_simulation },
         { "test_multiple_mergers_growth_rate", test_multiple_mergers_growth_rate },
@@ -2964,13 +3936,17 @@ main(int argc, char **argv)
 
         { "test_simulator_getters_setters", test_simulator_getters_setters },
         { "test_demographic_events", test_demographic_events },
+        { "test_debug_demography_calculations", test_debug_demography_calculations },
         { "test_demographic_events_start_time", test_demographic_events_start_time },
+        { "test_many_demographic_events", test_many_demographic_events },
         { "test_census_event", test_census_event },
         { "test_time_travel_error", test_time_travel_error },
         { "test_floating_point_extremes", test_floating_point_extremes },
         { "test_simulation_replicates", test_simulation_replicates },
         { "test_bottleneck_simulation", test_bottleneck_simulation },
         { "test_large_bottleneck_simulation", test_large_bottleneck_simulation },
+        { "test_large_instantaneous_bottleneck_simulation",
+            test_large_instantaneous_bottleneck_simulation },
 
         { "test_simulate_from_single_locus", test_simulate_from_single_locus },
         { "test_simulate_from_single_locus_replicates",
@@ -117,6 +117,69 @@ test_probability_list_select(void)
     }
 }
 
+static void
+verify_alias_table(size_t num_probs, double *probs)
+{
+    int ret;
+    double *threshold = malloc(num_probs * sizeof(*threshold));
+    size_t *alias = malloc(num_probs * sizeof(*alias));
+    double *implied = calloc(num_probs, sizeof(*implied));
+    double u;
+    size_t j;
+
+    CU_ASSERT_FATAL(threshold != NULL && alias != NULL && implied != NULL);
+    ret = alias_table_init(num_probs, probs, threshold, alias);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    for (j = 0; j < num_probs; j++) {
+        CU_ASSERT_FATAL(alias[j] < num_probs);
+        CU_ASSERT(threshold[j] >= 0.0 && threshold[j] <= 1.0);
+        implied[j] += threshold[j] / (double) num_probs;
+        implied[alias[j]] += (1.0 - threshold[j]) / (double) num_probs;
+        /* Each column selects its own value below the threshold */
+        u = (double) j;
+        if (threshold[j] > 0) {
+            CU_ASSERT_EQUAL(j, alias_table_select(u, num_probs, threshold, alias));
+        }
+        if (threshold[j] < 0.5) {
+            u += 0.75;
+            CU_ASSERT_EQUAL(
+                alias[j], alias_table_select(u, num_probs, threshold, alias));
+        }
+    }
+    for (j = 0; j < num_probs; j++) {
+        CU_ASSERT_DOUBLE_EQUAL(implied[j], probs[j], 1e-12);
+        if (probs[j] == 0) {
+            CU_ASSERT_EQUAL(implied[j], 0);
+        }
+    }
+    /* Out of range values are clamped to the last column */
+    CU_ASSERT_TRUE(
+        alias_table_select((double) num_probs, num_probs, threshold, alias) < num_probs);
+    free(threshold);
+    free(alias);
+    free(implied);
+}
+
+static void
+test_alias_table(void)
+{
+    double p1[] = { 1.0 };
+    double p2[] = { 0.5, 0.5 };
+    double p3[] = { 0.0, 1.0 };
+    double p4[] = { 0.1, 0.2, 0.3, 0.4 };
+    double p5[] = { 0.0, 0.0, 1.0, 0.0 };
+    double p6[] = { 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1 };
+    double p7[] = { 0.0, 1.0 / 3.0, 0.0, 1.0 / 3.0, 1.0 / 3.0 };
+
+    verify_alias_table(1, p1);
+    verify_alias_table(2, p2);
+    verify_alias_table(2, p3);
+    verify_alias_table(4, p4);
+    verify_alias_table(4, p5);
+    verify_alias_table(10, p6);
+    verify_alias_table(5, p7);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -124,6 +187,7 @@ main(int argc, char **argv)
         { "test_strerror", test_strerror },
         { "test_strerror_tskit", test_strerror_tskit },
         { "test_probability_list_select", test_probability_list_select },
+        { "test_alias_table", test_alias_table },
         CU_TEST_INFO_NULL,
     };
 
@@ -806,6 +806,238 @@ test_single_tree_mutgen_many_mutations(void)
     gsl_rng_free(rng);
 }
 
+static void
+test_single_tree_mutgen_many_sites(void)
+{
+    int ret = 0;
+    int j, k;
+    int flags[] = { MSP_KEEP_SITES, 0, MSP_DISCRETE_SITES };
+    mutgen_t mutgen;
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+    tsk_table_collection_t tables;
+    mutation_model_t mut_model;
+    double pos[] = { 0, 50, 75, 100 };
+    double rate[] = { 0, 10, 1 };
+    double *position;
+
+    CU_ASSERT_FATAL(rng != NULL);
+    ret = matrix_mutation_model_factory(&mut_model, ALPHABET_NUCLEOTIDE);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = tsk_table_collection_init(&tables, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    insert_single_tree(&tables, ALPHABET_NUCLEOTIDE);
+    /* Stretch the tree over a longer genome so we have lots of integer sites */
+    tables.sequence_length = 100;
+    for (j = 0; j < (int) tables.edges.num_rows; j++) {
+        tables.edges.right[j] = 100;
+    }
+
+    for (k = 0; k < 3; k++) {
+        ret = mutgen_alloc(&mutgen, rng, &tables, &mut_model, 0);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        ret = mutgen_set_rate_map(&mutgen, 3, pos, rate);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        ret = mutgen_generate(&mutgen, flags[k]);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        mutgen_print_state(&mutgen, _devnull);
+        ret = tsk_table_collection_check_integrity(&tables, 0);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        CU_ASSERT_TRUE(tables.sites.num_rows > 40);
+
+        /* Sites must be sorted and unique, with none where the rate is zero
+         * apart from the kept site at 0.1. */
+        position = tables.sites.position;
+        for (j = 0; j < (int) tables.sites.num_rows; j++) {
+            if (flags[k] == MSP_KEEP_SITES && j == 0) {
+                CU_ASSERT_EQUAL(position[j], 0.1);
+            } else {
+                CU_ASSERT_TRUE(position[j] >= 50);
+            }
+            if (j > 0) {
+                CU_ASSERT_TRUE(position[j - 1] < position[j]);
+            }
+            if (flags[k] == MSP_DISCRETE_SITES) {
+                CU_ASSERT_EQUAL(position[j], floor(position[j]));
+            }
+        }
+        for (j = 0; j < (int) tables.mutations.num_rows; j++) {
+            CU_ASSERT_TRUE(tables.mutations.parent[j] < j);
+            if (j > 0) {
+                CU_ASSERT_TRUE(tables.mutations.site[j - 1] <= tables.mutations.site[j]);
+            }
+        }
+        if (flags[k] != MSP_DISCRETE_SITES) {
+            /* Every new site on a continuous genome has a single mutation */
+            CU_ASSERT_EQUAL(tables.mutations.num_rows, tables.sites.num_rows);
+        }
+        mutgen_free(&mutgen);
+    }
+
+    mutation_model_free(&mut_model);
+    tsk_table_collection_free(&tables);
+    gsl_rng_free(rng);
+}
+
+static void
+test_single_tree_mutgen_chunks(void)
+{
+    int ret = 0;
+    int j, k, flags;
+    size_t num_chunks[] = { 1, 2, 7 };
+    size_t num_threads[] = { 1, 2, 4 };
+    mutgen_t mutgen;
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+    tsk_table_collection_t tables, copy;
+    mutation_model_t mut_model;
+
+    CU_ASSERT_FATAL(rng != NULL);
+    ret = matrix_mutation_model_factory(&mut_model, ALPHABET_NUCLEOTIDE);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = tsk_table_collection_init(&tables, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    insert_single_tree(&tables, ALPHABET_NUCLEOTIDE);
+    tables.sequence_length = 100;
+    for (j = 0; j < (int) tables.edges.num_rows; j++) {
+        tables.edges.right[j] = 100;
+    }
+
+    ret = mutgen_alloc(&mutgen, rng, &tables, &mut_model, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_EQUAL(mutgen.num_chunks, 1);
+    CU_ASSERT_EQUAL(mutgen.num_threads, 1);
+    CU_ASSERT_EQUAL(mutgen_set_num_chunks(&mutgen, 0), MSP_ERR_BAD_PARAM_VALUE);
+    CU_ASSERT_EQUAL(mutgen_set_num_threads(&mutgen, 0), MSP_ERR_BAD_PARAM_VALUE);
+    mutgen_free(&mutgen);
+
+    for (flags = 0; flags <= MSP_DISCRETE_SITES; flags += MSP_DISCRETE_SITES) {
+        for (j = 0; j < 3; j++) {
+            for (k = 0; k < 3; k++) {
+                gsl_rng_set(rng, 42);
+                ret = mutgen_alloc(&mutgen, rng, &tables, &mut_model, 0);
+                CU_ASSERT_EQUAL_FATAL(ret, 0);
+                ret = mutgen_set_rate(&mutgen, 0.5);
+                CU_ASSERT_EQUAL_FATAL(ret, 0);
+                ret = mutgen_set_num_chunks(&mutgen, num_chunks[j]);
+                CU_ASSERT_EQUAL_FATAL(ret, 0);
+                ret = mutgen_set_num_threads(&mutgen, num_threads[k]);
+                CU_ASSERT_EQUAL_FATAL(ret, 0);
+                ret = mutgen_generate(&mutgen, flags);
+                CU_ASSERT_EQUAL_FATAL(ret, 0);
+                mutgen_print_state(&mutgen, _devnull);
+                CU_ASSERT_TRUE(tables.sites.num_rows > 0);
+                ret = tsk_table_collection_check_integrity(&tables, 0);
+                CU_ASSERT_EQUAL_FATAL(ret, 0);
+                if (k == 0) {
+                    ret = tsk_table_collection_copy(&tables, &copy, 0);
+                    CU_ASSERT_EQUAL_FATAL(ret, 0);
+                } else {
+                    /* The output doesn't depend on the number of threads */
+                    CU_ASSERT_TRUE(tsk_table_collection_equals(&tables, &copy, 0));
+                }
+                mutgen_free(&mutgen);
+            }
+            tsk_table_collection_free(&copy);
+        }
+    }
+
+    mutation_model_free(&mut_model);
+    tsk_table_collection_free(&tables);
+    gsl_rng_free(rng);
+}
+
+static void
+test_caterpillar_tree_mutgen_parents(void)
+{
+    int ret = 0;
+    mutgen_t mutgen;
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+    tsk_table_collection_t tables;
+    mutation_model_t mut_model;
+    size_t lengths[] = { 1, 1 };
+    const char *binary_alleles[] = { "0", "1" };
+    double root_distribution[] = { 0.5, 0.5 };
+    double transition_matrix[] = { 0.5, 0.5, 0.5, 0.5 };
+    const int n = 30;
+    tsk_id_t j, k, u, expected_parent;
+    tsk_id_t *parent;
+    tsk_id_t *node, *site;
+
+    CU_ASSERT_FATAL(rng != NULL);
+    ret = matrix_mutation_model_alloc(&mut_model, 2,
+        (char **) (uintptr_t *) binary_alleles, lengths, root_distribution,
+        transition_matrix);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = tsk_table_collection_init(&tables, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+    /* A caterpillar tree, in which leaf j + 1 joins the tree at time j */
+    tables.sequence_length = 10;
+    for (j = 0; j < n; j++) {
+        ret = tsk_node_table_add_row(
+            &tables.nodes, TSK_NODE_IS_SAMPLE, 0, 0, TSK_NULL, NULL, 0);
+        CU_ASSERT_EQUAL_FATAL(ret, j);
+    }
+    for (j = 1; j < n; j++) {
+        ret = tsk_node_table_add_row(&tables.nodes, 0, j, 0, TSK_NULL, NULL, 0);
+        CU_ASSERT_EQUAL_FATAL(ret, n + j - 1);
+        u = j == 1 ? 0 : n + j - 2;
+        ret = tsk_edge_table_add_row(&tables.edges, 0, 10, n + j - 1, u, NULL, 0);
+        CU_ASSERT_FATAL(ret >= 0);
+        ret = tsk_edge_table_add_row(&tables.edges, 0, 10, n + j - 1, j, NULL, 0);
+        CU_ASSERT_FATAL(ret >= 0);
+    }
+    ret = tsk_population_table_add_row(&tables.populations, NULL, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = tsk_table_collection_sort(&tables, NULL, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    parent = malloc(tables.nodes.num_rows * sizeof(*parent));
+    CU_ASSERT_FATAL(parent != NULL);
+    memset(parent, 0xff, tables.nodes.num_rows * sizeof(*parent));
+    for (j = 0; j < (tsk_id_t) tables.edges.num_rows; j++) {
+        parent[tables.edges.child[j]] = tables.edges.parent[j];
+    }
+
+    ret = mutgen_alloc(&mutgen, rng, &tables, &mut_model, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = mutgen_set_rate(&mutgen, 1);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    /* Many mutations on a deep tree, so that parent mutations are found
+     * using the Euler tour once walking up the tree gets too expensive. */
+    ret = mutgen_generate(&mutgen, MSP_DISCRETE_SITES);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_EQUAL(tables.sites.num_rows, 10);
+    CU_ASSERT_TRUE(tables.mutations.num_rows > 100);
+    ret = tsk_table_collection_check_integrity(&tables, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+    /* The parent of each mutation must be the last mutation before it at the
+     * same site on the closest node above it. */
+    node = tables.mutations.node;
+    site = tables.mutations.site;
+    for (j = 0; j < (tsk_id_t) tables.mutations.num_rows; j++) {
+        expected_parent = TSK_NULL;
+        for (u = node[j]; u != TSK_NULL && expected_parent == TSK_NULL; u = parent[u]) {
+            for (k = j - 1; k >= 0 && site[k] == site[j]; k--) {
+                if (node[k] == u) {
+                    expected_parent = k;
+                    break;
+                }
+            }
+        }
+        CU_ASSERT_EQUAL(tables.mutations.parent[j], expected_parent);
+        if (expected_parent != TSK_NULL) {
+            CU_ASSERT_TRUE(tables.mutations.time[expected_parent]
+                           >= tables.mutations.time[j]);
+        }
+    }
+    mutgen_free(&mutgen);
+
+    free(parent);
+    mutation_model_free(&mut_model);
+    tsk_table_collection_free(&tables);
+    gsl_rng_free(rng);
+}
+
 static int
 cmp_int64(const void *a, const void *b)
 {
@@ -967,6 +1199,48 @@ test_mutgen_slim_mutations(void)
     gsl_rng_free(rng);
 }
 
+static void
+test_mutgen_slim_mutations_small_block_size(void)
+{
+    int ret = 0;
+    tsk_size_t j, max_len;
+    mutgen_t mutgen;
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+    tsk_table_collection_t tables;
+    mutation_model_t mut_model;
+
+    CU_ASSERT_FATAL(rng != NULL);
+    /* Values longer than the block size get a chunk of their own */
+    ret = slim_mutation_model_alloc(&mut_model, 0, 0, 16);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+    ret = tsk_table_collection_init(&tables, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    insert_single_tree(&tables, -1);
+
+    ret = mutgen_alloc(&mutgen, rng, &tables, &mut_model, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = mutgen_set_rate(&mutgen, 10);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = mutgen_generate(&mutgen, MSP_DISCRETE_SITES);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_TRUE(tables.mutations.num_rows > 0);
+
+    max_len = 0;
+    for (j = 0; j < tables.mutations.num_rows; j++) {
+        max_len = TSK_MAX(max_len, tables.mutations.metadata_offset[j + 1]
+                                       - tables.mutations.metadata_offset[j]);
+    }
+    CU_ASSERT_TRUE(max_len > 16);
+    ret = tsk_table_collection_check_integrity(&tables, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+    mutgen_free(&mutgen);
+    mutation_model_free(&mut_model);
+    tsk_table_collection_free(&tables);
+    gsl_rng_free(rng);
+}
+
 static void
 test_mutgen_slim_mutation_large_values(void)
 {
@@ -1286,7 +1560,12 @@ main(int argc, char **argv)
             test_single_tree_mutgen_do_nothing_mutations },
         { "test_single_tree_mutgen_many_mutations",
             test_single_tree_mutgen_many_mutations },
+        { "test_single_tree_mutgen_many_sites", test_single_tree_mutgen_many_sites },
+        { "test_single_tree_mutgen_chunks", test_single_tree_mutgen_chunks },
+        { "test_caterpillar_tree_mutgen_parents", test_caterpillar_tree_mutgen_parents },
         { "test_mutgen_slim_mutations", test_mutgen_slim_mutations },
+        { "test_mutgen_slim_mutations_small_block_size",
+            test_mutgen_slim_mutations_small_block_size },
         { "test_mutgen_slim_mutation_large_values",
             test_mutgen_slim_mutation_large_values },
         { "test_mutgen_infinite_alleles", test_mutgen_infinite_alleles },
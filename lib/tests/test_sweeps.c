@@ -236,6 +236,235 @@ test_sweep_genic_selection_recomb(void)
     verify_sweep_genic_selection(100, -1.0);
 }
 
+static void
+test_sweep_genic_selection_small_dt(void)
+{
+    int ret;
+    uint32_t n = 4;
+    msp_t msp;
+    gsl_rng *rng = safe_rng_alloc();
+    tsk_table_collection_t tables;
+
+    /* The trajectory has ~10^5 steps, almost all of them without events */
+    ret = build_sim(&msp, &tables, rng, 10, 1, NULL, n);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_EQUAL_FATAL(msp_set_recombination_rate(&msp, 0.1), 0);
+    ret = msp_set_num_labels(&msp, 2);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_simulation_model_sweep_genic_selection(&msp, 5, 0.1, 0.9, 10, 1e-6);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_initialise(&msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
+    CU_ASSERT_TRUE(ret >= 0);
+    msp_verify(&msp, 0);
+    ret = msp_set_simulation_model_hudson(&msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
+    CU_ASSERT_EQUAL(ret, 0);
+    msp_verify(&msp, 0);
+    ret = msp_finalise_tables(&msp);
+    CU_ASSERT_EQUAL(ret, 0);
+    CU_ASSERT(tables.edges.num_rows > 0);
+
+    msp_free(&msp);
+    tsk_table_collection_free(&tables);
+    gsl_rng_free(rng);
+}
+
+static void
+test_sweep_trajectory_bank(void)
+{
+    int ret, j;
+    uint32_t n = 6;
+    msp_t msp;
+    gsl_rng *rng = safe_rng_alloc();
+    tsk_table_collection_t tables;
+    sweep_trajectory_bank_t *bank;
+    size_t k;
+
+    ret = build_sim(&msp, &tables, rng, 10, 1, NULL, n);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_EQUAL_FATAL(msp_set_recombination_rate(&msp, 0.1), 0);
+    ret = msp_set_num_labels(&msp, 2);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_simulation_model_sweep_genic_selection(&msp, 5, 0.1, 0.9, 0.1, 0.01);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_set_sweep_trajectory_bank_size(&msp, 4);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_initialise(&msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_EQUAL(msp.sweep_trajectory_bank, NULL);
+
+    bank = NULL;
+    for (j = 0; j < 3; j++) {
+        ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
+        CU_ASSERT_TRUE(ret >= 0);
+        msp_verify(&msp, 0);
+        msp_print_state(&msp, _devnull);
+        CU_ASSERT_FATAL(msp.sweep_trajectory_bank != NULL);
+        /* The bank is generated once and kept across replicates */
+        if (bank != NULL) {
+            CU_ASSERT_EQUAL(msp.sweep_trajectory_bank, bank);
+        }
+        bank = msp.sweep_trajectory_bank;
+        CU_ASSERT_EQUAL(bank->num_trajectories, 4);
+        CU_ASSERT_EQUAL(bank->offset[0], 0);
+        for (k = 0; k < bank->num_trajectories; k++) {
+            CU_ASSERT_TRUE(bank->offset[k + 1] > bank->offset[k] + 1);
+            CU_ASSERT_EQUAL(bank->time[bank->offset[k]], 0);
+            CU_ASSERT_EQUAL(bank->allele_frequency[bank->offset[k]], 0.9);
+            CU_ASSERT_EQUAL(bank->allele_frequency[bank->offset[k + 1] - 1], 0.1);
+        }
+        ret = msp_reset(&msp);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+    }
+
+    /* Changing the size discards the bank */
+    ret = msp_set_sweep_trajectory_bank_size(&msp, 2);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_EQUAL(msp.sweep_trajectory_bank, NULL);
+    ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
+    CU_ASSERT_TRUE(ret >= 0);
+    msp_verify(&msp, 0);
+    CU_ASSERT_FATAL(msp.sweep_trajectory_bank != NULL);
+    CU_ASSERT_EQUAL(msp.sweep_trajectory_bank->num_trajectories, 2);
+
+    msp_free(&msp);
+    tsk_table_collection_free(&tables);
+    gsl_rng_free(rng);
+}
+
+static void
+test_sweep_genic_selection_resume(void)
+{
+    int ret, j;
+    uint32_t n = 10;
+    msp_t msp;
+    gsl_rng *rng = safe_rng_alloc();
+    tsk_table_collection_t tables[2];
+    size_t last_step;
+    double max_time;
+
+    for (j = 0; j < 2; j++) {
+        gsl_rng_set(rng, 42);
+        ret = build_sim(&msp, &tables[j], rng, 10, 1, NULL, n);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        CU_ASSERT_EQUAL_FATAL(msp_set_recombination_rate(&msp, 0.1), 0);
+        ret = msp_set_num_labels(&msp, 2);
+        CU_ASSERT_EQUAL(ret, 0);
+        ret = msp_set_simulation_model_sweep_genic_selection(
+            &msp, 5, 0.1, 0.9, 0.1, 0.001);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        ret = msp_initialise(&msp);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        if (j == 0) {
+            ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
+        } else {
+            /* Stopping after every event gives the same result */
+            last_step = 0;
+            while ((ret = msp_run(&msp, DBL_MAX, 1)) == MSP_EXIT_MAX_EVENTS) {
+                CU_ASSERT_FATAL(msp.sweep_state.time != NULL);
+                CU_ASSERT_TRUE(msp.sweep_state.curr_step >= last_step);
+                last_step = msp.sweep_state.curr_step;
+                msp_verify(&msp, 0);
+            }
+        }
+        CU_ASSERT_TRUE(ret >= 0);
+        CU_ASSERT_EQUAL(msp.sweep_state.time, NULL);
+        CU_ASSERT_EQUAL(avl_count(&msp.populations[0].ancestors[1]), 0);
+        ret = msp_finalise_tables(&msp);
+        CU_ASSERT_EQUAL(ret, 0);
+        msp_free(&msp);
+    }
+    CU_ASSERT_TRUE(tsk_node_table_equals(&tables[0].nodes, &tables[1].nodes, 0));
+    CU_ASSERT_TRUE(tsk_edge_table_equals(&tables[0].edges, &tables[1].edges, 0));
+    tsk_table_collection_free(&tables[0]);
+    tsk_table_collection_free(&tables[1]);
+
+    /* Stop at a series of times, then change model during the sweep */
+    ret = build_sim(&msp, &tables[0], rng, 10, 1, NULL, n);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_EQUAL_FATAL(msp_set_recombination_rate(&msp, 0.1), 0);
+    ret = msp_set_num_labels(&msp, 2);
+    CU_ASSERT_EQUAL(ret, 0);
+    ret = msp_set_simulation_model_sweep_genic_selection(&msp, 5, 0.1, 0.9, 0.1, 0.001);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = msp_initialise(&msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    for (max_time = 0.01; max_time < 0.05; max_time += 0.01) {
+        ret = msp_run(&msp, max_time, UINT32_MAX);
+        CU_ASSERT_EQUAL_FATAL(ret, MSP_EXIT_MAX_TIME);
+        CU_ASSERT_EQUAL(msp.time, max_time);
+        CU_ASSERT_FATAL(msp.sweep_state.time != NULL);
+        CU_ASSERT_TRUE(
+            msp.sweep_state.time[msp.sweep_state.curr_step - 1] < max_time);
+        CU_ASSERT_TRUE(msp.sweep_state.time[msp.sweep_state.curr_step] >= max_time);
+        msp_print_state(&msp, _devnull);
+        msp_verify(&msp, 0);
+    }
+    ret = msp_set_simulation_model_hudson(&msp);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_EQUAL(msp.sweep_state.time, NULL);
+    CU_ASSERT_EQUAL(avl_count(&msp.populations[0].ancestors[1]), 0);
+    ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
+    CU_ASSERT_EQUAL(ret, 0);
+    msp_verify(&msp, 0);
+
+    msp_free(&msp);
+    tsk_table_collection_free(&tables[0]);
+    gsl_rng_free(rng);
+}
+
+static void
+test_sweep_genic_selection_runs_to_end(void)
+{
+    int ret;
+    uint32_t n = 2;
+    unsigned long seed;
+    msp_t msp;
+    gsl_rng *rng = safe_rng_alloc();
+    tsk_table_collection_t tables;
+    double dt = 0.001;
+    double end_time;
+    int num_completed = 0;
+
+    for (seed = 1; seed < 20; seed++) {
+        gsl_rng_set(rng, seed);
+        ret = build_sim(&msp, &tables, rng, 10, 1, NULL, n);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        ret = msp_set_num_labels(&msp, 2);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        ret = msp_set_simulation_model_sweep_genic_selection(
+            &msp, 5, 0.1, 0.9, 1000, dt);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+        ret = msp_initialise(&msp);
+        CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+        /* Stop before the first step to find the end of the trajectory */
+        ret = msp_run(&msp, dt / 2, UINT32_MAX);
+        CU_ASSERT_EQUAL_FATAL(ret, MSP_EXIT_MAX_TIME);
+        CU_ASSERT_FATAL(msp.sweep_state.time != NULL);
+        end_time = msp.sweep_state.time[msp.sweep_state.num_steps - 1];
+        CU_ASSERT_TRUE(end_time > 0);
+
+        ret = msp_run(&msp, DBL_MAX, UINT32_MAX);
+        CU_ASSERT_TRUE(ret >= 0);
+        CU_ASSERT_EQUAL(msp.sweep_state.time, NULL);
+        if (msp_get_num_ancestors(&msp) > 0) {
+            /* The sweep lasts until the end of the trajectory even if
+             * no events happen in its final steps. */
+            CU_ASSERT_TRUE(msp_get_time(&msp) >= end_time);
+            num_completed++;
+        }
+        msp_verify(&msp, 0);
+        msp_free(&msp);
+        tsk_table_collection_free(&tables);
+    }
+    CU_ASSERT_TRUE(num_completed > 0);
+    gsl_rng_free(rng);
+}
+
 static void
 test_sweep_genic_selection_gc(void)
 {
@@ -391,6 +620,11 @@ main(int argc, char **argv)
         { "test_sweep_genic_selection_single_locus",
             test_sweep_genic_selection_single_locus },
         { "test_sweep_genic_selection_recomb", test_sweep_genic_selection_recomb },
+        { "test_sweep_genic_selection_small_dt", test_sweep_genic_selection_small_dt },
+        { "test_sweep_genic_selection_resume", test_sweep_genic_selection_resume },
+        { "test_sweep_genic_selection_runs_to_end",
+            test_sweep_genic_selection_runs_to_end },
+        { "test_sweep_trajectory_bank", test_sweep_trajectory_bank },
         { "test_sweep_genic_selection_gc", test_sweep_genic_selection_gc },
         { "test_sweep_genic_selection_time_change",
             test_sweep_genic_selection_time_change },
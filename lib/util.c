@@ -224,13 +224,13 @@ msp_strerror_internal(int err)
             break;
         case MSP_ERR_BREAKPOINT_RESAMPLE_OVERFLOW:
             ret = "An unlikely numerical error occured computing recombination "
-                  "breakpoints (resample overflow). Please check your "
+                  "breakpoints (no valid breakpoint position). Please check your "
                   "parameters, and if they make sense help us fix the problem "
                   "by opening an issue on GitHub.";
             break;
         case MSP_ERR_TRACTLEN_RESAMPLE_OVERFLOW:
-            ret = "An unlikely numerical error occured computing gene conversion"
-                  "tract lengths (resample overflow). Please check your "
+            ret = "An unlikely numerical error occured computing gene conversion "
+                  "tract lengths (non-positive tract length). Please check your "
                   "parameters, and if they make sense help us fix the problem "
                   "by opening an issue on GitHub.";
             break;
@@ -268,6 +268,13 @@ msp_strerror_internal(int err)
         case MSP_ERR_DTWF_DIPLOID_ONLY:
             ret = "The DTWF model only supports ploidy = 2";
             break;
+        case MSP_ERR_IO:
+            ret = "Error opening or reading file.";
+            break;
+        case MSP_ERR_BAD_PEDIGREE_FILE:
+            ret = "Malformed pedigree file, or the number of individuals or the "
+                  "ploidy does not match the simulation.";
+            break;
         default:
             ret = "Error occurred generating error string. Please file a bug "
                   "report!";
@@ -366,6 +373,94 @@ probability_list_select(double u, size_t num_probs, double const *probs)
     return (num_probs > 0 ? positive_interval_select(u, num_probs - 1, probs) : 0);
 }
 
+/* Builds a Walker alias table for the specified probabilities, which must sum
+ * to one, using Vose's method. A value can then be drawn in constant time
+ * with alias_table_select. Probabilities of zero are never selected.
+ */
+int MSP_WARN_UNUSED
+alias_table_init(
+    size_t num_probs, double const *probs, double *threshold, size_t *alias)
+{
+    int ret = 0;
+    double *scaled = malloc(num_probs * sizeof(*scaled));
+    size_t *small = malloc(num_probs * sizeof(*small));
+    size_t *large = malloc(num_probs * sizeof(*large));
+    size_t num_small = 0;
+    size_t num_large = 0;
+    size_t j, s, l, max_index;
+
+    if (scaled == NULL || small == NULL || large == NULL) {
+        ret = MSP_ERR_NO_MEMORY;
+        goto out;
+    }
+    max_index = 0;
+    for (j = 0; j < num_probs; j++) {
+        scaled[j] = probs[j] * (double) num_probs;
+        alias[j] = j;
+        if (probs[j] > probs[max_index]) {
+            max_index = j;
+        }
+        if (scaled[j] < 1.0) {
+            small[num_small] = j;
+            num_small++;
+        } else {
+            large[num_large] = j;
+            num_large++;
+        }
+    }
+    while (num_small > 0 && num_large > 0) {
+        num_small--;
+        s = small[num_small];
+        num_large--;
+        l = large[num_large];
+        threshold[s] = scaled[s];
+        alias[s] = l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+        if (scaled[l] < 1.0) {
+            small[num_small] = l;
+            num_small++;
+        } else {
+            large[num_large] = l;
+            num_large++;
+        }
+    }
+    /* Anything left over is only there because of rounding error, so should
+     * have a threshold of one; zero probabilities must still never be chosen. */
+    while (num_large > 0) {
+        num_large--;
+        threshold[large[num_large]] = 1.0;
+    }
+    while (num_small > 0) {
+        num_small--;
+        s = small[num_small];
+        threshold[s] = 1.0;
+        if (probs[s] <= 0) {
+            threshold[s] = 0.0;
+            alias[s] = max_index;
+        }
+    }
+out:
+    msp_safe_free(scaled);
+    msp_safe_free(small);
+    msp_safe_free(large);
+    return ret;
+}
+
+/* Returns the value chosen from an alias table by the random variate `u`,
+ * which must be uniform on [0, num_probs).
+ */
+size_t
+alias_table_select(
+    double u, size_t num_probs, double const *threshold, size_t const *alias)
+{
+    size_t k = (size_t) u;
+
+    if (k >= num_probs) {
+        k = num_probs - 1;
+    }
+    return u - (double) k < threshold[k] ? k : alias[k];
+}
+
 /* binary search functions */
 
 /* This function follows standard semantics of:
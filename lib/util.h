@@ -113,6 +113,8 @@
 #define MSP_ERR_BAD_ANCIENT_SAMPLE_NODE                             -69
 #define MSP_ERR_UNKNOWN_TIME_NOT_SUPPORTED                          -70
 #define MSP_ERR_DTWF_DIPLOID_ONLY                                   -71
+#define MSP_ERR_IO                                                  -72
+#define MSP_ERR_BAD_PEDIGREE_FILE                                   -73
 
 /* clang-format on */
 /* This bit is 0 for any errors originating from tskit */
@@ -128,6 +130,10 @@ void __msp_safe_free(void **ptr);
 bool doubles_almost_equal(double a, double b, double eps);
 
 size_t probability_list_select(double u, size_t num_probs, double const *probs);
+int alias_table_init(
+    size_t num_probs, double const *probs, double *threshold, size_t *alias);
+size_t alias_table_select(
+    double u, size_t num_probs, double const *threshold, size_t const *alias);
 
 /* binary search functions */
 
@@ -151,6 +151,59 @@ out:
     return ret;
 }
 
+/*
+ * Retrieves the value with the specified key from the specified dictionary
+ * as a one dimensional array of the specified type and length. If the key
+ * is missing and required is false, *ret_array is set to NULL. A new
+ * reference is returned in *ret_array, so the caller must DECREF it.
+ */
+static int
+get_dict_column(PyObject *dict, const char *key_str, int type, bool required,
+        npy_intp length, PyArrayObject **ret_array)
+{
+    int ret = -1;
+    PyObject *value;
+    PyArrayObject *array = NULL;
+
+    *ret_array = NULL;
+    value = PyDict_GetItemString(dict, key_str);
+    if (value == NULL) {
+        if (required) {
+            PyErr_Format(PyExc_ValueError, "'%s' not specified", key_str);
+            goto out;
+        }
+        ret = 0;
+        goto out;
+    }
+    array = (PyArrayObject *) PyArray_FROMANY(value, type, 1, 1, NPY_ARRAY_IN_ARRAY);
+    if (array == NULL) {
+        goto out;
+    }
+    if (PyArray_DIMS(array)[0] != length) {
+        PyErr_Format(PyExc_ValueError, "'%s' column has the wrong length", key_str);
+        goto out;
+    }
+    *ret_array = array;
+    array = NULL;
+    ret = 0;
+out:
+    Py_XDECREF(array);
+    return ret;
+}
+
+/*
+ * Returns true if the specified demographic event dictionary has columns
+ * of values rather than a single event, i.e., its time is a sequence.
+ */
+static bool
+is_column_event(PyObject *item)
+{
+    PyObject *time = PyDict_GetItemString(item, "time");
+
+    return time != NULL
+        && (PyArray_Check(time) || PyList_Check(time) || PyTuple_Check(time));
+}
+
 static int
 parse_rate_map(PyObject *py_rate_map, size_t *ret_size,
         PyArrayObject **ret_position, PyArrayObject **ret_rate)
@@ -950,6 +1003,66 @@ out:
     return ret;
 }
 
+static int
+Simulator_parse_dtwf_hybrid_model(Simulator *self, PyObject *py_model)
+{
+    int ret = -1;
+    int err;
+    double duration, max_lineage_ratio;
+    PyObject *value;
+
+    value = get_dict_number(py_model, "duration");
+    if (value == NULL) {
+        goto out;
+    }
+    duration = PyFloat_AsDouble(value);
+
+    value = get_dict_number(py_model, "max_lineage_ratio");
+    if (value == NULL) {
+        goto out;
+    }
+    max_lineage_ratio = PyFloat_AsDouble(value);
+
+    err = msp_set_simulation_model_dtwf_hybrid(self->sim, duration, max_lineage_ratio);
+    if (err != 0) {
+        handle_input_error("dtwf hybrid", err);
+        goto out;
+    }
+    ret = 0;
+out:
+    return ret;
+}
+
+static int
+Simulator_parse_wf_ped_model(Simulator *self, PyObject *py_model)
+{
+    int ret = -1;
+    int err;
+    PyObject *py_filename;
+    PyObject *encoded_filename = NULL;
+
+    /* If a pedigree file is given it is memory mapped by the library,
+     * otherwise the pedigree is read from the input tables. */
+    py_filename = PyDict_GetItemString(py_model, "pedigree_file");
+    if (py_filename == NULL || py_filename == Py_None) {
+        err = msp_set_simulation_model_wf_ped(self->sim);
+    } else {
+        if (!PyUnicode_FSConverter(py_filename, &encoded_filename)) {
+            goto out;
+        }
+        err = msp_set_simulation_model_wf_ped_file(
+            self->sim, PyBytes_AS_STRING(encoded_filename));
+    }
+    if (err != 0) {
+        handle_input_error("wf_ped", err);
+        goto out;
+    }
+    ret = 0;
+out:
+    Py_XDECREF(encoded_filename);
+    return ret;
+}
+
 static int
 Simulator_parse_simulation_model(Simulator *self, PyObject *py_model)
 {
@@ -960,13 +1073,14 @@ Simulator_parse_simulation_model(Simulator *self, PyObject *py_model)
     PyObject *smc_s = NULL;
     PyObject *smc_prime_s = NULL;
     PyObject *dtwf_s = NULL;
+    PyObject *dtwf_hybrid_s = NULL;
     PyObject *wf_ped_s = NULL;
     PyObject *dirac_s = NULL;
     PyObject *beta_s = NULL;
     PyObject *sweep_genic_selection_s = NULL;
     PyObject *value;
     int is_hudson, is_dtwf, is_smc, is_smc_prime, is_dirac, is_beta, is_sweep_genic_selection;
-    int is_wf_ped;
+    int is_wf_ped, is_dtwf_hybrid;
     double psi, c, alpha, truncation_point;
 
     hudson_s = Py_BuildValue("s", "hudson");
@@ -977,6 +1091,10 @@ Simulator_parse_simulation_model(Simulator *self, PyObject *py_model)
     if (dtwf_s == NULL) {
         goto out;
     }
+    dtwf_hybrid_s = Py_BuildValue("s", "dtwf_hybrid");
+    if (dtwf_hybrid_s == NULL) {
+        goto out;
+    }
     wf_ped_s = Py_BuildValue("s", "wf_ped");
     if (wf_ped_s == NULL) {
         goto out;
@@ -1025,12 +1143,25 @@ Simulator_parse_simulation_model(Simulator *self, PyObject *py_model)
     if (is_dtwf) {
         err = msp_set_simulation_model_dtwf(self->sim);
     }
+    is_dtwf_hybrid = PyObject_RichCompareBool(py_name, dtwf_hybrid_s, Py_EQ);
+    if (is_dtwf_hybrid == -1) {
+        goto out;
+    }
+    if (is_dtwf_hybrid) {
+        ret = Simulator_parse_dtwf_hybrid_model(self, py_model);
+        if (ret != 0) {
+            goto out;
+        }
+    }
     is_wf_ped = PyObject_RichCompareBool(py_name, wf_ped_s, Py_EQ);
     if (is_wf_ped == -1) {
         goto out;
     }
     if (is_wf_ped) {
-        err = msp_set_simulation_model_wf_ped(self->sim);
+        ret = Simulator_parse_wf_ped_model(self, py_model);
+        if (ret != 0) {
+            goto out;
+        }
     }
 
     is_smc = PyObject_RichCompareBool(py_name, smc_s, Py_EQ);
@@ -1108,7 +1239,8 @@ Simulator_parse_simulation_model(Simulator *self, PyObject *py_model)
     }
 
     if (! (is_hudson || is_dtwf || is_smc || is_smc_prime || is_dirac
-                || is_beta || is_sweep_genic_selection || is_wf_ped)) {
+                || is_beta || is_sweep_genic_selection || is_wf_ped
+                || is_dtwf_hybrid)) {
         PyErr_SetString(PyExc_ValueError, "Unknown simulation model");
         goto out;
     }
@@ -1120,6 +1252,7 @@ Simulator_parse_simulation_model(Simulator *self, PyObject *py_model)
 out:
     Py_XDECREF(hudson_s);
     Py_XDECREF(dtwf_s);
+    Py_XDECREF(dtwf_hybrid_s);
     Py_XDECREF(wf_ped_s);
     Py_XDECREF(smc_s);
     Py_XDECREF(smc_prime_s);
@@ -1157,6 +1290,138 @@ out:
     return ret;
 }
 
+/*
+ * Adds a block of population parameter changes given as columns. This
+ * avoids building a dictionary per event for long piecewise constant
+ * size histories. Missing initial_size or growth_rate columns and NaN
+ * values within them mean the value is left unchanged, as for the
+ * single event form.
+ */
+static int
+Simulator_parse_population_parameters_change_columns(Simulator *self,
+        PyObject *item, Py_ssize_t index)
+{
+    int ret = -1;
+    int err;
+    npy_intp j, num_events;
+    double *time, *initial_size, *growth_rate;
+    int32_t *population;
+    PyArrayObject *time_array = NULL;
+    PyArrayObject *population_array = NULL;
+    PyArrayObject *initial_size_array = NULL;
+    PyArrayObject *growth_rate_array = NULL;
+
+    time_array = (PyArrayObject *) PyArray_FROMANY(
+            PyDict_GetItemString(item, "time"), NPY_FLOAT64, 1, 1,
+            NPY_ARRAY_IN_ARRAY);
+    if (time_array == NULL) {
+        goto out;
+    }
+    num_events = PyArray_DIMS(time_array)[0];
+    if (get_dict_column(item, "population", NPY_INT32, true, num_events,
+                &population_array) != 0) {
+        goto out;
+    }
+    if (get_dict_column(item, "initial_size", NPY_FLOAT64, false, num_events,
+                &initial_size_array) != 0) {
+        goto out;
+    }
+    if (get_dict_column(item, "growth_rate", NPY_FLOAT64, false, num_events,
+                &growth_rate_array) != 0) {
+        goto out;
+    }
+    time = PyArray_DATA(time_array);
+    population = PyArray_DATA(population_array);
+    initial_size = initial_size_array == NULL? NULL: PyArray_DATA(initial_size_array);
+    growth_rate = growth_rate_array == NULL? NULL: PyArray_DATA(growth_rate_array);
+    for (j = 0; j < num_events; j++) {
+        if (time[j] < 0) {
+            PyErr_SetString(PyExc_ValueError, "negative times not valid");
+            goto out;
+        }
+        err = msp_add_population_parameters_change(self->sim, time[j],
+                population[j],
+                initial_size == NULL? GSL_NAN: initial_size[j],
+                growth_rate == NULL? GSL_NAN: growth_rate[j]);
+        if (err != 0) {
+            PyErr_Format(MsprimeInputError,
+                    "Input error in demographic_events[%d][%d]: %s",
+                    (int) index, (int) j, msp_strerror(err));
+            goto out;
+        }
+    }
+    ret = 0;
+out:
+    Py_XDECREF(time_array);
+    Py_XDECREF(population_array);
+    Py_XDECREF(initial_size_array);
+    Py_XDECREF(growth_rate_array);
+    return ret;
+}
+
+/*
+ * Adds a block of migration rate changes given as columns.
+ */
+static int
+Simulator_parse_migration_rate_change_columns(Simulator *self,
+        PyObject *item, Py_ssize_t index)
+{
+    int ret = -1;
+    int err;
+    npy_intp j, num_events;
+    double *time, *migration_rate;
+    int32_t *source, *dest;
+    PyArrayObject *time_array = NULL;
+    PyArrayObject *migration_rate_array = NULL;
+    PyArrayObject *source_array = NULL;
+    PyArrayObject *dest_array = NULL;
+
+    time_array = (PyArrayObject *) PyArray_FROMANY(
+            PyDict_GetItemString(item, "time"), NPY_FLOAT64, 1, 1,
+            NPY_ARRAY_IN_ARRAY);
+    if (time_array == NULL) {
+        goto out;
+    }
+    num_events = PyArray_DIMS(time_array)[0];
+    if (get_dict_column(item, "migration_rate", NPY_FLOAT64, true, num_events,
+                &migration_rate_array) != 0) {
+        goto out;
+    }
+    if (get_dict_column(item, "source", NPY_INT32, true, num_events,
+                &source_array) != 0) {
+        goto out;
+    }
+    if (get_dict_column(item, "dest", NPY_INT32, true, num_events,
+                &dest_array) != 0) {
+        goto out;
+    }
+    time = PyArray_DATA(time_array);
+    migration_rate = PyArray_DATA(migration_rate_array);
+    source = PyArray_DATA(source_array);
+    dest = PyArray_DATA(dest_array);
+    for (j = 0; j < num_events; j++) {
+        if (time[j] < 0) {
+            PyErr_SetString(PyExc_ValueError, "negative times not valid");
+            goto out;
+        }
+        err = msp_add_migration_rate_change(self->sim, time[j], source[j], dest[j],
+                migration_rate[j]);
+        if (err != 0) {
+            PyErr_Format(MsprimeInputError,
+                    "Input error in demographic_events[%d][%d]: %s",
+                    (int) index, (int) j, msp_strerror(err));
+            goto out;
+        }
+    }
+    ret = 0;
+out:
+    Py_XDECREF(time_array);
+    Py_XDECREF(migration_rate_array);
+    Py_XDECREF(source_array);
+    Py_XDECREF(dest_array);
+    return ret;
+}
+
 static int
 Simulator_parse_demographic_events(Simulator *self, PyObject *py_events)
 {
@@ -1164,7 +1429,7 @@ Simulator_parse_demographic_events(Simulator *self, PyObject *py_events)
     Py_ssize_t j;
     double time, initial_size, growth_rate, migration_rate, proportion,
            strength;
-    int err, population_id, source, destination;
+    int err, population_id, source, destination, per_lineage;
     int is_population_parameter_change, is_migration_rate_change, is_mass_migration,
         is_simple_bottleneck, is_instantaneous_bottleneck, is_census_event;
     PyObject *item, *value, *type;
@@ -1219,6 +1484,36 @@ Simulator_parse_demographic_events(Simulator *self, PyObject *py_events)
             PyErr_SetString(PyExc_TypeError, "not a dictionary");
             goto out;
         }
+        if (is_column_event(item)) {
+            type = get_dict_value(item, "type");
+            if (type == NULL) {
+                goto out;
+            }
+            is_population_parameter_change = PyObject_RichCompareBool(type,
+                    population_parameter_change_s, Py_EQ);
+            if (is_population_parameter_change == -1) {
+                goto out;
+            }
+            is_migration_rate_change = PyObject_RichCompareBool(type,
+                    migration_rate_change_s, Py_EQ);
+            if (is_migration_rate_change == -1) {
+                goto out;
+            }
+            if (is_population_parameter_change) {
+                err = Simulator_parse_population_parameters_change_columns(
+                        self, item, j);
+            } else if (is_migration_rate_change) {
+                err = Simulator_parse_migration_rate_change_columns(self, item, j);
+            } else {
+                PyErr_Format(PyExc_ValueError,
+                        "Columns not supported for this demographic event type");
+                goto out;
+            }
+            if (err != 0) {
+                goto out;
+            }
+            continue;
+        }
         value = get_dict_number(item, "time");
         if (value == NULL) {
             goto out;
@@ -1353,7 +1648,16 @@ Simulator_parse_demographic_events(Simulator *self, PyObject *py_events)
             err = msp_add_instantaneous_bottleneck(self->sim, time, population_id,
                     strength);
         } else if (is_census_event) {
-            err = msp_add_census_event(self->sim, time);
+            /* per_lineage is optional and defaults to false */
+            per_lineage = 0;
+            value = PyDict_GetItemString(item, "per_lineage");
+            if (value != NULL) {
+                per_lineage = PyObject_IsTrue(value);
+                if (per_lineage == -1) {
+                    goto out;
+                }
+            }
+            err = msp_add_census_event(self->sim, time, (bool) per_lineage);
         } else {
             PyErr_Format(PyExc_ValueError, "Unknown demographic event type");
             goto out;
@@ -1403,7 +1707,8 @@ Simulator_init(Simulator *self, PyObject *args, PyObject *kwds)
         "node_mapping_block_size", "store_migrations", "start_time",
         "store_full_arg", "num_labels", "gene_conversion_rate",
         "gene_conversion_tract_length", "discrete_genome",
-        "ploidy", NULL};
+        "ploidy", "dtwf_generation_skipping", "dtwf_num_threads",
+        "pedigree_num_threads", "sweep_trajectory_bank_size", NULL};
     PyObject *migration_matrix = NULL;
     PyObject *population_configuration = NULL;
     PyObject *demographic_events = NULL;
@@ -1417,8 +1722,12 @@ Simulator_init(Simulator *self, PyObject *args, PyObject *kwds)
     Py_ssize_t node_mapping_block_size = 10;
     Py_ssize_t num_labels = 1;
     Py_ssize_t num_populations = 1;
+    Py_ssize_t dtwf_num_threads = 1;
+    Py_ssize_t pedigree_num_threads = 1;
+    Py_ssize_t sweep_trajectory_bank_size = 0;
     int store_migrations = false;
     int store_full_arg = false;
+    int dtwf_generation_skipping = false;
     int discrete_genome = true;
     double start_time = -1;
     double gene_conversion_rate = 0;
@@ -1428,7 +1737,7 @@ Simulator_init(Simulator *self, PyObject *args, PyObject *kwds)
     self->sim = NULL;
     self->random_generator = NULL;
     if (!PyArg_ParseTupleAndKeywords(args, kwds,
-            "O!O!|O!O!OO!O!nnnidinddii", kwlist,
+            "O!O!|O!O!OO!O!nnnidinddiiinnn", kwlist,
             &LightweightTableCollectionType, &tables,
             &RandomGeneratorType, &random_generator,
             /* optional */
@@ -1441,7 +1750,8 @@ Simulator_init(Simulator *self, PyObject *args, PyObject *kwds)
             &node_mapping_block_size, &store_migrations, &start_time,
             &store_full_arg, &num_labels,
             &gene_conversion_rate, &gene_conversion_tract_length,
-            &discrete_genome, &ploidy)) {
+            &discrete_genome, &ploidy, &dtwf_generation_skipping,
+            &dtwf_num_threads, &pedigree_num_threads, &sweep_trajectory_bank_size)) {
         goto out;
     }
     self->random_generator = random_generator;
@@ -1560,6 +1870,35 @@ Simulator_init(Simulator *self, PyObject *args, PyObject *kwds)
         }
     }
     msp_set_store_full_arg(self->sim, store_full_arg);
+    msp_set_dtwf_generation_skipping(self->sim, dtwf_generation_skipping);
+    if (dtwf_num_threads < 1) {
+        PyErr_SetString(PyExc_ValueError, "dtwf_num_threads must be >= 1");
+        goto out;
+    }
+    sim_ret = msp_set_dtwf_num_threads(self->sim, (size_t) dtwf_num_threads);
+    if (sim_ret != 0) {
+        handle_input_error("dtwf_num_threads", sim_ret);
+        goto out;
+    }
+    if (pedigree_num_threads < 1) {
+        PyErr_SetString(PyExc_ValueError, "pedigree_num_threads must be >= 1");
+        goto out;
+    }
+    sim_ret = msp_set_pedigree_num_threads(self->sim, (size_t) pedigree_num_threads);
+    if (sim_ret != 0) {
+        handle_input_error("pedigree_num_threads", sim_ret);
+        goto out;
+    }
+    if (sweep_trajectory_bank_size < 0) {
+        PyErr_SetString(PyExc_ValueError, "sweep_trajectory_bank_size must be >= 0");
+        goto out;
+    }
+    sim_ret = msp_set_sweep_trajectory_bank_size(
+        self->sim, (size_t) sweep_trajectory_bank_size);
+    if (sim_ret != 0) {
+        handle_input_error("sweep_trajectory_bank_size", sim_ret);
+        goto out;
+    }
 
     sim_ret = msp_initialise(self->sim);
     if (sim_ret != 0) {
@@ -1622,6 +1961,25 @@ Simulator_get_model(Simulator *self, void *closure)
         }
         Py_DECREF(value);
         value = NULL;
+    } else if (model->type == MSP_MODEL_DTWF_HYBRID) {
+        value = Py_BuildValue("d", model->params.dtwf_hybrid.duration);
+        if (value == NULL) {
+            goto out;
+        }
+        if (PyDict_SetItemString(d, "duration", value) != 0) {
+            goto out;
+        }
+        Py_DECREF(value);
+        value = NULL;
+        value = Py_BuildValue("d", model->params.dtwf_hybrid.max_lineage_ratio);
+        if (value == NULL) {
+            goto out;
+        }
+        if (PyDict_SetItemString(d, "max_lineage_ratio", value) != 0) {
+            goto out;
+        }
+        Py_DECREF(value);
+        value = NULL;
     } else if (model->type == MSP_MODEL_SWEEP) {
         value = Py_BuildValue("d", model->params.sweep.position);
         if (value == NULL) {
@@ -1713,6 +2071,54 @@ out:
 }
 
 
+static PyObject *
+Simulator_get_dtwf_generation_skipping(Simulator *self, void *closure)
+{
+    PyObject *ret = NULL;
+    if (Simulator_check_sim(self) != 0) {
+        goto out;
+    }
+    ret = Py_BuildValue("i",  self->sim->dtwf_generation_skipping);
+out:
+    return ret;
+}
+
+static PyObject *
+Simulator_get_dtwf_num_threads(Simulator *self, void *closure)
+{
+    PyObject *ret = NULL;
+    if (Simulator_check_sim(self) != 0) {
+        goto out;
+    }
+    ret = Py_BuildValue("n", (Py_ssize_t) self->sim->dtwf_num_threads);
+out:
+    return ret;
+}
+
+static PyObject *
+Simulator_get_pedigree_num_threads(Simulator *self, void *closure)
+{
+    PyObject *ret = NULL;
+    if (Simulator_check_sim(self) != 0) {
+        goto out;
+    }
+    ret = Py_BuildValue("n", (Py_ssize_t) self->sim->pedigree_num_threads);
+out:
+    return ret;
+}
+
+static PyObject *
+Simulator_get_sweep_trajectory_bank_size(Simulator *self, void *closure)
+{
+    PyObject *ret = NULL;
+    if (Simulator_check_sim(self) != 0) {
+        goto out;
+    }
+    ret = Py_BuildValue("n", (Py_ssize_t) self->sim->sweep_trajectory_bank_size);
+out:
+    return ret;
+}
+
 static PyObject *
 Simulator_get_num_populations(Simulator *self, void *closure)
 {
@@ -2367,6 +2773,120 @@ out:
     return ret;
 }
 
+static PyObject *
+Simulator_debug_coalescence_rates(Simulator *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *ret = NULL;
+    static char *kwlist[] = {"steps", "num_samples", "min_pop_size", "num_threads",
+        NULL};
+    PyObject *py_steps = NULL;
+    PyObject *py_num_samples = NULL;
+    PyArrayObject *steps_array = NULL;
+    PyArrayObject *num_samples_array = NULL;
+    PyArrayObject *rates_array = NULL;
+    PyArrayObject *uncoalesced_array = NULL;
+    double min_pop_size = 1;
+    int num_threads = 1;
+    npy_intp num_steps;
+    int err;
+
+    if (Simulator_check_sim(self) != 0) {
+        goto out;
+    }
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|di", kwlist,
+            &py_steps, &py_num_samples, &min_pop_size, &num_threads)) {
+        goto out;
+    }
+    steps_array = (PyArrayObject *) PyArray_FROMANY(
+            py_steps, NPY_FLOAT64, 1, 1, NPY_ARRAY_IN_ARRAY);
+    if (steps_array == NULL) {
+        goto out;
+    }
+    num_samples_array = (PyArrayObject *) PyArray_FROMANY(
+            py_num_samples, NPY_FLOAT64, 1, 1, NPY_ARRAY_IN_ARRAY);
+    if (num_samples_array == NULL) {
+        goto out;
+    }
+    if (PyArray_DIMS(num_samples_array)[0]
+            != (npy_intp) msp_get_num_populations(self->sim)) {
+        PyErr_SetString(PyExc_ValueError,
+                "num_samples must have one entry per population");
+        goto out;
+    }
+    num_steps = PyArray_DIMS(steps_array)[0];
+    rates_array = (PyArrayObject *) PyArray_SimpleNew(1, &num_steps, NPY_FLOAT64);
+    uncoalesced_array = (PyArrayObject *) PyArray_SimpleNew(1, &num_steps, NPY_FLOAT64);
+    if (rates_array == NULL || uncoalesced_array == NULL) {
+        goto out;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    err = msp_debug_coalescence_rates(self->sim, (size_t) num_steps,
+            PyArray_DATA(steps_array), PyArray_DATA(num_samples_array),
+            min_pop_size, num_threads,
+            PyArray_DATA(rates_array), PyArray_DATA(uncoalesced_array));
+    Py_END_ALLOW_THREADS
+    if (err != 0) {
+        handle_library_error(err);
+        goto out;
+    }
+    ret = Py_BuildValue("OO", rates_array, uncoalesced_array);
+out:
+    Py_XDECREF(steps_array);
+    Py_XDECREF(num_samples_array);
+    Py_XDECREF(rates_array);
+    Py_XDECREF(uncoalesced_array);
+    return ret;
+}
+
+static PyObject *
+Simulator_debug_lineage_probabilities(Simulator *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *ret = NULL;
+    static char *kwlist[] = {"steps", "sample_time", "num_threads", NULL};
+    PyObject *py_steps = NULL;
+    PyArrayObject *steps_array = NULL;
+    PyArrayObject *probabilities_array = NULL;
+    double sample_time = 0;
+    int num_threads = 1;
+    npy_intp dims[3];
+    int err;
+
+    if (Simulator_check_sim(self) != 0) {
+        goto out;
+    }
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|di", kwlist,
+            &py_steps, &sample_time, &num_threads)) {
+        goto out;
+    }
+    steps_array = (PyArrayObject *) PyArray_FROMANY(
+            py_steps, NPY_FLOAT64, 1, 1, NPY_ARRAY_IN_ARRAY);
+    if (steps_array == NULL) {
+        goto out;
+    }
+    dims[0] = PyArray_DIMS(steps_array)[0];
+    dims[1] = (npy_intp) msp_get_num_populations(self->sim);
+    dims[2] = dims[1];
+    probabilities_array = (PyArrayObject *) PyArray_SimpleNew(3, dims, NPY_FLOAT64);
+    if (probabilities_array == NULL) {
+        goto out;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    err = msp_debug_lineage_probabilities(self->sim, (size_t) dims[0],
+            PyArray_DATA(steps_array), sample_time, num_threads,
+            PyArray_DATA(probabilities_array));
+    Py_END_ALLOW_THREADS
+    if (err != 0) {
+        handle_library_error(err);
+        goto out;
+    }
+    ret = (PyObject *) probabilities_array;
+    probabilities_array = NULL;
+out:
+    Py_XDECREF(steps_array);
+    Py_XDECREF(probabilities_array);
+    return ret;
+}
+
 static PyObject *
 Simulator_fenwick_drift(Simulator *self, PyObject *args)
 {
@@ -2483,6 +3003,16 @@ static PyMethodDef Simulator_methods[] = {
     {"compute_population_size",
             (PyCFunction) Simulator_compute_population_size, METH_VARARGS,
             "Computes the size of a population at a given time. Debug method."},
+    {"debug_coalescence_rates",
+            (PyCFunction) Simulator_debug_coalescence_rates,
+            METH_VARARGS|METH_KEYWORDS,
+            "Computes the coalescence rates and probabilities that a pair of "
+            "lineages has not coalesced at the specified times. Debug method."},
+    {"debug_lineage_probabilities",
+            (PyCFunction) Simulator_debug_lineage_probabilities,
+            METH_VARARGS|METH_KEYWORDS,
+            "Computes the probabilities that a lineage is in each population "
+            "at the specified times. Debug method."},
     {"fenwick_drift",
             (PyCFunction) Simulator_fenwick_drift, METH_VARARGS,
             "Return the numerical drift in the specified label's recombination tree. "
@@ -2600,6 +3130,19 @@ static PyGetSetDef Simulator_getsetters[] = {
     {"record_full_arg",
             (getter) Simulator_get_record_full_arg, NULL,
             "True if the simulator should store the full ARG." },
+    {"dtwf_generation_skipping",
+            (getter) Simulator_get_dtwf_generation_skipping, NULL,
+            "True if the DTWF model skips over generations with no events." },
+    {"dtwf_num_threads",
+            (getter) Simulator_get_dtwf_num_threads, NULL,
+            "The number of threads used to transmit DTWF lineages to their parents." },
+    {"pedigree_num_threads",
+            (getter) Simulator_get_pedigree_num_threads, NULL,
+            "The number of threads used when climbing the pedigree." },
+    {"sweep_trajectory_bank_size",
+            (getter) Simulator_get_sweep_trajectory_bank_size, NULL,
+            "The number of pregenerated sweep trajectories, or 0 if sweeps "
+            "generate their own." },
     {"discrete_genome",
             (getter) Simulator_get_discrete_genome, NULL,
             "True if the simulator has a discrete genome." },
@@ -2689,20 +3232,22 @@ msprime_sim_mutations(PyObject *self, PyObject *args, PyObject *kwds)
     mutation_model_t *model = NULL;
     int discrete_sites = false;
     int kept_mutations_before_end_time = false;
+    Py_ssize_t num_chunks = 1;
+    Py_ssize_t num_threads = 1;
     static char *kwlist[] = {
         "tables", "random_generator", "rate_map", "model",
         "discrete_sites", "keep", "kept_mutations_before_end_time",
-        "start_time", "end_time", NULL};
+        "start_time", "end_time", "num_chunks", "num_threads", NULL};
     mutgen_t mutgen;
     int err;
 
     memset(&mutgen, 0, sizeof(mutgen));
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!O!O!O|iiidd", kwlist,
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!O!O!O|iiiddnn", kwlist,
             &LightweightTableCollectionType, &tables,
             &RandomGeneratorType, &random_generator,
             &PyDict_Type, &rate_map,
             &py_model, &discrete_sites, &keep, &kept_mutations_before_end_time,
-            &start_time, &end_time)) {
+            &start_time, &end_time, &num_chunks, &num_threads)) {
         goto out;
     }
     if (LightweightTableCollection_check_state(tables) != 0
@@ -2737,6 +3282,24 @@ msprime_sim_mutations(PyObject *self, PyObject *args, PyObject *kwds)
         handle_library_error(err);
         goto out;
     }
+    if (num_chunks < 1) {
+        PyErr_SetString(PyExc_ValueError, "num_chunks must be >= 1");
+        goto out;
+    }
+    err = mutgen_set_num_chunks(&mutgen, (size_t) num_chunks);
+    if (err != 0) {
+        handle_library_error(err);
+        goto out;
+    }
+    if (num_threads < 1) {
+        PyErr_SetString(PyExc_ValueError, "num_threads must be >= 1");
+        goto out;
+    }
+    err = mutgen_set_num_threads(&mutgen, (size_t) num_threads);
+    if (err != 0) {
+        handle_library_error(err);
+        goto out;
+    }
     if (discrete_sites) {
         flags |= MSP_DISCRETE_SITES;
     }
@@ -2799,6 +3362,535 @@ out:
     return ret;
 }
 
+/*
+ * Species tree parsing. The Newick string is read in a single pass with the
+ * open internal nodes kept on an explicit stack, so that very deep trees
+ * can't exhaust the C stack. Nodes are numbered in preorder as they are
+ * opened and are closed in postorder. Leaves are assigned population IDs in
+ * the order in which they are closed, and each internal node maps to the
+ * population of its left-most child. The populations of the other children
+ * are merged into this by mass migrations at the time of the node.
+ */
+typedef struct {
+    const char *str;
+    Py_ssize_t length;
+    Py_ssize_t pos;
+    const char *annotation;
+    size_t annotation_length;
+    size_t max_nodes;
+    size_t num_nodes;
+    size_t num_leaves;
+    size_t num_internal;
+    size_t num_mass_migrations;
+    size_t stack_size;
+    int32_t *parent;
+    int32_t *left_child;
+    int32_t *right_child;
+    int32_t *right_sib;
+    int32_t *population;
+    int32_t *stack;
+    int32_t *leaf;
+    int32_t *internal;
+    int32_t *mass_migration_node;
+    int32_t *mass_migration_source;
+    double *branch_length;
+    double *annotation_value;
+    Py_ssize_t *label_start;
+    Py_ssize_t *label_length;
+} newick_parser_t;
+
+static void
+newick_parser_free(newick_parser_t *self)
+{
+    PyMem_Free(self->parent);
+    PyMem_Free(self->left_child);
+    PyMem_Free(self->right_child);
+    PyMem_Free(self->right_sib);
+    PyMem_Free(self->population);
+    PyMem_Free(self->stack);
+    PyMem_Free(self->leaf);
+    PyMem_Free(self->internal);
+    PyMem_Free(self->mass_migration_node);
+    PyMem_Free(self->mass_migration_source);
+    PyMem_Free(self->branch_length);
+    PyMem_Free(self->annotation_value);
+    PyMem_Free(self->label_start);
+    PyMem_Free(self->label_length);
+}
+
+static int
+newick_parser_alloc(newick_parser_t *self, const char *str, Py_ssize_t length,
+        const char *annotation)
+{
+    int ret = -1;
+    Py_ssize_t j;
+    size_t n = 1;
+
+    memset(self, 0, sizeof(*self));
+    self->str = str;
+    self->length = length;
+    self->annotation = annotation;
+    if (annotation != NULL) {
+        self->annotation_length = strlen(annotation);
+    }
+    /* Every node other than the first is opened by a '(' or a ',' */
+    for (j = 0; j < length; j++) {
+        if (str[j] == '(' || str[j] == ',') {
+            n++;
+        }
+    }
+    self->max_nodes = n;
+    self->parent = PyMem_Malloc(n * sizeof(*self->parent));
+    self->left_child = PyMem_Malloc(n * sizeof(*self->left_child));
+    self->right_child = PyMem_Malloc(n * sizeof(*self->right_child));
+    self->right_sib = PyMem_Malloc(n * sizeof(*self->right_sib));
+    self->population = PyMem_Malloc(n * sizeof(*self->population));
+    self->stack = PyMem_Malloc(n * sizeof(*self->stack));
+    self->leaf = PyMem_Malloc(n * sizeof(*self->leaf));
+    self->internal = PyMem_Malloc(n * sizeof(*self->internal));
+    self->mass_migration_node = PyMem_Malloc(n * sizeof(*self->mass_migration_node));
+    self->mass_migration_source = PyMem_Malloc(
+            n * sizeof(*self->mass_migration_source));
+    self->branch_length = PyMem_Malloc(n * sizeof(*self->branch_length));
+    self->annotation_value = PyMem_Malloc(n * sizeof(*self->annotation_value));
+    self->label_start = PyMem_Malloc(n * sizeof(*self->label_start));
+    self->label_length = PyMem_Malloc(n * sizeof(*self->label_length));
+    if (self->parent == NULL || self->left_child == NULL || self->right_child == NULL
+            || self->right_sib == NULL || self->population == NULL
+            || self->stack == NULL || self->leaf == NULL || self->internal == NULL
+            || self->mass_migration_node == NULL
+            || self->mass_migration_source == NULL || self->branch_length == NULL
+            || self->annotation_value == NULL || self->label_start == NULL
+            || self->label_length == NULL) {
+        PyErr_NoMemory();
+        goto out;
+    }
+    ret = 0;
+out:
+    return ret;
+}
+
+static int
+newick_parse_error(newick_parser_t *self, const char *message)
+{
+    PyErr_Format(PyExc_ValueError, "Error parsing newick tree at position %d: %s",
+            (int) self->pos, message);
+    return -1;
+}
+
+static char
+newick_peek(newick_parser_t *self)
+{
+    return self->pos < self->length ? self->str[self->pos] : '\0';
+}
+
+static void
+newick_skip_whitespace(newick_parser_t *self)
+{
+    while (self->pos < self->length && Py_ISSPACE(self->str[self->pos])) {
+        self->pos++;
+    }
+}
+
+/* Reads a label up to the next delimiter, trimming trailing whitespace. */
+static void
+newick_parse_label(newick_parser_t *self, int32_t node)
+{
+    Py_ssize_t start = self->pos;
+    Py_ssize_t end;
+
+    while (self->pos < self->length
+            && strchr("(),:;[]", self->str[self->pos]) == NULL) {
+        self->pos++;
+    }
+    end = self->pos;
+    while (end > start && Py_ISSPACE(self->str[end - 1])) {
+        end--;
+    }
+    self->label_start[node] = start;
+    self->label_length[node] = end - start;
+}
+
+static int
+newick_parse_annotation_value(newick_parser_t *self, int32_t node,
+        Py_ssize_t start, Py_ssize_t end)
+{
+    int ret = -1;
+    char *parse_end;
+    double value;
+
+    if (end - start >= 2 && self->str[start] == '{' && self->str[end - 1] == '}') {
+        start++;
+        end--;
+    }
+    value = strtod(self->str + start, &parse_end);
+    if (start == end || parse_end != self->str + end || !isfinite(value)
+            || value < 0) {
+        PyErr_Format(PyExc_ValueError,
+                "The '%s' annotation must be a single non-negative number",
+                self->annotation);
+        goto out;
+    }
+    self->annotation_value[node] = value;
+    ret = 0;
+out:
+    return ret;
+}
+
+/* Parses a [...] comment. If it is an extended newick annotation of the
+ * form [&key=value,key={value},...], the value for the key we are looking
+ * for (if any) is stored for the node; all other content is ignored. */
+static int
+newick_parse_annotation(newick_parser_t *self, int32_t node)
+{
+    int ret = -1;
+    const char *str = self->str;
+    Py_ssize_t start = self->pos + 1;
+    Py_ssize_t end, j, key_start, key_end, value_start;
+
+    for (end = start; end < self->length && str[end] != ']'; end++) {
+        if (str[end] == '[') {
+            newick_parse_error(self, "Nested '[' in annotation");
+            goto out;
+        }
+    }
+    if (end == self->length) {
+        newick_parse_error(self, "Unterminated annotation");
+        goto out;
+    }
+    self->pos = end + 1;
+    if (self->annotation != NULL && str[start] == '&') {
+        j = start + 1;
+        while (j < end) {
+            key_start = j;
+            while (j < end && str[j] != '=' && str[j] != ',') {
+                j++;
+            }
+            key_end = j;
+            value_start = j;
+            if (j < end && str[j] == '=') {
+                j++;
+                value_start = j;
+                if (j < end && str[j] == '{') {
+                    while (j < end && str[j] != '}') {
+                        j++;
+                    }
+                    if (j == end) {
+                        newick_parse_error(self, "Unterminated '{' in annotation");
+                        goto out;
+                    }
+                }
+                while (j < end && str[j] != ',') {
+                    j++;
+                }
+            }
+            if (value_start > key_end
+                    && (size_t) (key_end - key_start) == self->annotation_length
+                    && strncmp(str + key_start, self->annotation,
+                        self->annotation_length) == 0) {
+                if (newick_parse_annotation_value(self, node, value_start, j) != 0) {
+                    goto out;
+                }
+                break;
+            }
+            j++;
+        }
+    }
+    ret = 0;
+out:
+    return ret;
+}
+
+static int
+newick_parse_annotations(newick_parser_t *self, int32_t node)
+{
+    int ret = 0;
+
+    newick_skip_whitespace(self);
+    while (newick_peek(self) == '[') {
+        ret = newick_parse_annotation(self, node);
+        if (ret != 0) {
+            goto out;
+        }
+        newick_skip_whitespace(self);
+    }
+out:
+    return ret;
+}
+
+static int32_t
+newick_add_node(newick_parser_t *self)
+{
+    int32_t u = (int32_t) self->num_nodes;
+
+    self->num_nodes++;
+    self->parent[u] = self->stack_size == 0? -1: self->stack[self->stack_size - 1];
+    self->left_child[u] = -1;
+    self->right_child[u] = -1;
+    self->right_sib[u] = -1;
+    self->population[u] = -1;
+    self->branch_length[u] = 0;
+    self->annotation_value[u] = GSL_NAN;
+    return u;
+}
+
+/* Reads the annotations and branch length following the label of the
+ * specified node, which is now complete, and attaches it to its parent. */
+static int
+newick_close_node(newick_parser_t *self, int32_t u)
+{
+    int ret = -1;
+    int32_t v, p;
+    char *end;
+    const char *start;
+
+    if (newick_parse_annotations(self, u) != 0) {
+        goto out;
+    }
+    if (newick_peek(self) == ':') {
+        self->pos++;
+        newick_skip_whitespace(self);
+        start = self->str + self->pos;
+        self->branch_length[u] = strtod(start, &end);
+        if (end == start || !isfinite(self->branch_length[u])) {
+            newick_parse_error(self, "Bad branch length");
+            goto out;
+        }
+        self->pos += end - start;
+        if (newick_parse_annotations(self, u) != 0) {
+            goto out;
+        }
+    } else if (self->parent[u] != -1) {
+        newick_parse_error(self, "Missing branch length");
+        goto out;
+    }
+    if (self->annotation != NULL && isnan(self->annotation_value[u])) {
+        PyErr_Format(PyExc_ValueError, "No '%s' annotation for node", self->annotation);
+        goto out;
+    }
+
+    if (self->left_child[u] == -1) {
+        self->population[u] = (int32_t) self->num_leaves;
+        self->leaf[self->num_leaves] = u;
+        self->num_leaves++;
+    } else {
+        self->population[u] = self->population[self->left_child[u]];
+        for (v = self->right_sib[self->left_child[u]]; v != -1; v = self->right_sib[v]) {
+            self->mass_migration_node[self->num_mass_migrations] = u;
+            self->mass_migration_source[self->num_mass_migrations] = self->population[v];
+            self->num_mass_migrations++;
+        }
+        self->internal[self->num_internal] = u;
+        self->num_internal++;
+    }
+    p = self->parent[u];
+    if (p != -1) {
+        if (self->left_child[p] == -1) {
+            self->left_child[p] = u;
+        } else {
+            self->right_sib[self->right_child[p]] = u;
+        }
+        self->right_child[p] = u;
+    }
+    ret = 0;
+out:
+    return ret;
+}
+
+static int
+newick_parse(newick_parser_t *self)
+{
+    int ret = -1;
+    int32_t u;
+    char c;
+
+    while (true) {
+        newick_skip_whitespace(self);
+        u = newick_add_node(self);
+        if (newick_peek(self) == '(') {
+            self->pos++;
+            self->stack[self->stack_size] = u;
+            self->stack_size++;
+            continue;
+        }
+        newick_parse_label(self, u);
+        if (self->label_length[u] == 0) {
+            newick_parse_error(self, "Leaf nodes must be labelled");
+            goto out;
+        }
+        if (newick_close_node(self, u) != 0) {
+            goto out;
+        }
+        /* Close any internal nodes that are now complete */
+        while (self->stack_size > 0) {
+            newick_skip_whitespace(self);
+            c = newick_peek(self);
+            if (c == ',') {
+                self->pos++;
+                break;
+            }
+            if (c != ')') {
+                newick_parse_error(self, "Expected ',' or ')'");
+                goto out;
+            }
+            self->pos++;
+            self->stack_size--;
+            u = self->stack[self->stack_size];
+            newick_skip_whitespace(self);
+            /* Labels on internal nodes are ignored */
+            newick_parse_label(self, u);
+            if (newick_close_node(self, u) != 0) {
+                goto out;
+            }
+        }
+        if (self->stack_size == 0) {
+            break;
+        }
+    }
+    newick_skip_whitespace(self);
+    if (newick_peek(self) == ';') {
+        self->pos++;
+        newick_skip_whitespace(self);
+    }
+    if (self->pos != self->length) {
+        newick_parse_error(self, "Unexpected characters after the end of the tree");
+        goto out;
+    }
+    if (self->num_nodes < 3) {
+        PyErr_SetString(PyExc_ValueError, "Newick tree must have at least three nodes");
+        goto out;
+    }
+    ret = 0;
+out:
+    return ret;
+}
+
+static PyObject *
+msprime_parse_species_tree(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *ret = NULL;
+    static char *kwlist[] = {"tree", "branch_length_multiplier", "annotation", NULL};
+    const char *tree;
+    const char *annotation = NULL;
+    Py_ssize_t tree_length;
+    double branch_length_multiplier, max_depth;
+    double *depth, *mm_time, *ancestor_time, *value;
+    int32_t *mm_source, *mm_dest, *ancestor_population;
+    npy_intp dims;
+    size_t j;
+    int32_t u;
+    newick_parser_t parser;
+    PyObject *name = NULL;
+    PyObject *names = NULL;
+    PyArrayObject *population_annotation = NULL;
+    PyArrayObject *mass_migration_time = NULL;
+    PyArrayObject *mass_migration_source = NULL;
+    PyArrayObject *mass_migration_dest = NULL;
+    PyArrayObject *ancestor_time_array = NULL;
+    PyArrayObject *ancestor_population_array = NULL;
+    PyArrayObject *ancestor_annotation = NULL;
+
+    memset(&parser, 0, sizeof(parser));
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s#d|z", kwlist,
+            &tree, &tree_length, &branch_length_multiplier, &annotation)) {
+        goto out;
+    }
+    if (newick_parser_alloc(&parser, tree, tree_length, annotation) != 0) {
+        goto out;
+    }
+    if (newick_parse(&parser) != 0) {
+        goto out;
+    }
+    /* Parents are numbered before their children, so we can accumulate the
+     * depths in place in a single pass. */
+    depth = parser.branch_length;
+    depth[0] = 0;
+    max_depth = 0;
+    for (j = 1; j < parser.num_nodes; j++) {
+        depth[j] += depth[parser.parent[j]];
+        max_depth = GSL_MAX(max_depth, depth[j]);
+    }
+
+    names = PyList_New((Py_ssize_t) parser.num_leaves);
+    if (names == NULL) {
+        goto out;
+    }
+    dims = (npy_intp) parser.num_leaves;
+    population_annotation = (PyArrayObject *) PyArray_SimpleNew(1, &dims, NPY_FLOAT64);
+    if (population_annotation == NULL) {
+        goto out;
+    }
+    value = PyArray_DATA(population_annotation);
+    for (j = 0; j < parser.num_leaves; j++) {
+        u = parser.leaf[j];
+        name = PyUnicode_DecodeUTF8(tree + parser.label_start[u],
+                parser.label_length[u], "strict");
+        if (name == NULL) {
+            goto out;
+        }
+        PyList_SET_ITEM(names, (Py_ssize_t) j, name);
+        value[j] = parser.annotation_value[u];
+    }
+
+    dims = (npy_intp) parser.num_mass_migrations;
+    mass_migration_time = (PyArrayObject *) PyArray_SimpleNew(1, &dims, NPY_FLOAT64);
+    mass_migration_source = (PyArrayObject *) PyArray_SimpleNew(1, &dims, NPY_INT32);
+    mass_migration_dest = (PyArrayObject *) PyArray_SimpleNew(1, &dims, NPY_INT32);
+    if (mass_migration_time == NULL || mass_migration_source == NULL
+            || mass_migration_dest == NULL) {
+        goto out;
+    }
+    mm_time = PyArray_DATA(mass_migration_time);
+    mm_source = PyArray_DATA(mass_migration_source);
+    mm_dest = PyArray_DATA(mass_migration_dest);
+    for (j = 0; j < parser.num_mass_migrations; j++) {
+        u = parser.mass_migration_node[j];
+        mm_time[j] = (max_depth - depth[u]) * branch_length_multiplier;
+        mm_source[j] = parser.mass_migration_source[j];
+        mm_dest[j] = parser.population[u];
+    }
+
+    dims = (npy_intp) parser.num_internal;
+    ancestor_time_array = (PyArrayObject *) PyArray_SimpleNew(1, &dims, NPY_FLOAT64);
+    ancestor_population_array = (PyArrayObject *) PyArray_SimpleNew(
+            1, &dims, NPY_INT32);
+    ancestor_annotation = (PyArrayObject *) PyArray_SimpleNew(1, &dims, NPY_FLOAT64);
+    if (ancestor_time_array == NULL || ancestor_population_array == NULL
+            || ancestor_annotation == NULL) {
+        goto out;
+    }
+    ancestor_time = PyArray_DATA(ancestor_time_array);
+    ancestor_population = PyArray_DATA(ancestor_population_array);
+    value = PyArray_DATA(ancestor_annotation);
+    for (j = 0; j < parser.num_internal; j++) {
+        u = parser.internal[j];
+        ancestor_time[j] = (max_depth - depth[u]) * branch_length_multiplier;
+        ancestor_population[j] = parser.population[u];
+        value[j] = parser.annotation_value[u];
+    }
+
+    ret = Py_BuildValue("{s:O,s:O,s:O,s:O,s:O,s:O,s:O,s:O}",
+            "population_name", names,
+            "population_annotation", population_annotation,
+            "mass_migration_time", mass_migration_time,
+            "mass_migration_source", mass_migration_source,
+            "mass_migration_dest", mass_migration_dest,
+            "ancestor_time", ancestor_time_array,
+            "ancestor_population", ancestor_population_array,
+            "ancestor_annotation", ancestor_annotation);
+out:
+    newick_parser_free(&parser);
+    Py_XDECREF(names);
+    Py_XDECREF(population_annotation);
+    Py_XDECREF(mass_migration_time);
+    Py_XDECREF(mass_migration_source);
+    Py_XDECREF(mass_migration_dest);
+    Py_XDECREF(ancestor_time_array);
+    Py_XDECREF(ancestor_population_array);
+    Py_XDECREF(ancestor_annotation);
+    return ret;
+}
+
 static PyObject *
 msprime_get_gsl_version(PyObject *self)
 {
@@ -2828,6 +3920,9 @@ static PyMethodDef msprime_methods[] = {
     {"log_likelihood_arg", (PyCFunction) msprime_log_likelihood_arg,
             METH_VARARGS|METH_KEYWORDS,
             "Computes the log-likelihood of an ARG." },
+    {"parse_species_tree", (PyCFunction) msprime_parse_species_tree,
+            METH_VARARGS|METH_KEYWORDS,
+            "Parses a newick species tree into populations and events." },
     {"get_gsl_version", (PyCFunction) msprime_get_gsl_version, METH_NOARGS,
             "Returns the version of GSL we are linking against." },
     {"restore_gsl_error_handler", (PyCFunction) msprime_restore_gsl_error_handler,
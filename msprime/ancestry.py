@@ -22,9 +22,9 @@ Module responsible for defining and running ancestry simulations.
 import collections.abc
 import copy
 import inspect
+import itertools
 import logging
 import math
-import struct
 import sys
 
 import attr
@@ -154,6 +154,61 @@ def _filter_events(demographic_events):
     return filtered_events, model_change_events
 
 
+def _get_ll_demographic_events(demographic_events):
+    """
+    Returns the low-level representation of the specified list of demographic
+    events. Runs of consecutive PopulationParametersChange or
+    MigrationRateChange events are passed down as a single dictionary of
+    columns, which avoids the per-event overhead when there are very many
+    of them (e.g., piecewise constant size histories).
+    """
+    ll_events = []
+    for event_type, group in itertools.groupby(demographic_events, type):
+        group = list(group)
+        if len(group) == 1 or event_type not in (
+            demog.PopulationParametersChange,
+            demog.MigrationRateChange,
+        ):
+            ll_events.extend(event.get_ll_representation() for event in group)
+        elif event_type is demog.PopulationParametersChange:
+            ll_events.append(
+                {
+                    "type": "population_parameters_change",
+                    "time": np.array([e.time for e in group], dtype=np.float64),
+                    "population": np.array(
+                        [e.population for e in group], dtype=np.int32
+                    ),
+                    "initial_size": np.array(
+                        [
+                            np.nan if e.initial_size is None else e.initial_size
+                            for e in group
+                        ],
+                        dtype=np.float64,
+                    ),
+                    "growth_rate": np.array(
+                        [
+                            np.nan if e.growth_rate is None else e.growth_rate
+                            for e in group
+                        ],
+                        dtype=np.float64,
+                    ),
+                }
+            )
+        else:
+            ll_events.append(
+                {
+                    "type": "migration_rate_change",
+                    "time": np.array([e.time for e in group], dtype=np.float64),
+                    "migration_rate": np.array(
+                        [e.rate for e in group], dtype=np.float64
+                    ),
+                    "source": np.array([e.source for e in group], dtype=np.int32),
+                    "dest": np.array([e.dest for e in group], dtype=np.int32),
+                }
+            )
+    return ll_events
+
+
 def _check_population_configurations(population_configurations):
     err = (
         "Population configurations must be a list of PopulationConfiguration instances"
@@ -250,16 +305,32 @@ def _build_initial_tables(*, sequence_length, samples, ploidy, demography, pedig
                     f"at index {index}"
                 )
     else:
-        for parents, time, is_sample in zip(
-            pedigree.parents, pedigree.time, pedigree.is_sample
-        ):
+        num_individuals = pedigree.num_individuals
+        if pedigree.binary_file is None:
             # We encode the parents in the metadata for now, but see
             # https://github.com/tskit-dev/tskit/issues/852
-            encoded_parents = struct.pack("=ii", *parents)
-            ind_id = tables.individuals.add_row(0, metadata=encoded_parents)
-            node_flags = tskit.NODE_IS_SAMPLE if is_sample else 0
-            for _ in range(ploidy):
-                tables.nodes.add_row(node_flags, time, population=0, individual=ind_id)
+            metadata = np.ascontiguousarray(pedigree.parents, dtype="=i4")
+            metadata = metadata.view(np.int8).ravel()
+            metadata_offset = np.arange(num_individuals + 1, dtype=np.uint32)
+            metadata_offset *= pedigree.parents.shape[1] * 4
+        else:
+            # The parents are read directly from the file by the library.
+            metadata = np.zeros(0, dtype=np.int8)
+            metadata_offset = np.zeros(num_individuals + 1, dtype=np.uint32)
+        tables.individuals.set_columns(
+            flags=np.zeros(num_individuals, dtype=np.uint32),
+            metadata=metadata,
+            metadata_offset=metadata_offset,
+        )
+        is_sample = np.asarray(pedigree.is_sample) != 0
+        tables.nodes.set_columns(
+            flags=np.repeat(
+                np.where(is_sample, tskit.NODE_IS_SAMPLE, 0).astype(np.uint32), ploidy
+            ),
+            time=np.repeat(pedigree.time, ploidy),
+            population=np.zeros(num_individuals * ploidy, dtype=np.int32),
+            individual=np.repeat(np.arange(num_individuals, dtype=np.int32), ploidy),
+        )
 
     for population in demography.populations:
         md = population.temporary_hack_for_encoding_old_style_metadata()
@@ -446,6 +517,7 @@ def _parse_simulate(
         num_labels=num_labels,
         demography=demography,
         model_change_events=model_change_events,
+        pedigree_file=None if pedigree is None else pedigree.binary_file,
     )
     return sim
 
@@ -979,7 +1051,9 @@ def _parse_sim_ancestry(
         raise ValueError("ploidy must be >= 1")
 
     model, model_change_events = _parse_model_arg(model)
-    is_dtwf = isinstance(model, DiscreteTimeWrightFisher)
+    is_dtwf = isinstance(
+        model, (DiscreteTimeWrightFisher, DiscreteTimeWrightFisherHybrid)
+    )
 
     # Check the demography. If no demography is specified, we default to a
     # single-population model with a given population size.
@@ -1224,9 +1298,14 @@ class Simulator(_msprime.Simulator):
         model=None,
         store_migrations=False,
         store_full_arg=False,
+        dtwf_generation_skipping=False,
+        dtwf_num_threads=1,
+        pedigree_num_threads=1,
+        sweep_trajectory_bank_size=0,
         start_time=None,
         end_time=None,
         num_labels=None,
+        pedigree_file=None,
     ):
         # We always need at least n segments, so no point in making
         # allocation any smaller than this.
@@ -1242,10 +1321,10 @@ class Simulator(_msprime.Simulator):
         # Now, convert the high-level values into their low-level
         # counterparts.
         ll_simulation_model = model.get_ll_representation()
+        if pedigree_file is not None and ll_simulation_model["name"] == "wf_ped":
+            ll_simulation_model["pedigree_file"] = str(pedigree_file)
         ll_population_configuration = [pop.asdict() for pop in demography.populations]
-        ll_demographic_events = [
-            event.get_ll_representation() for event in demography.events
-        ]
+        ll_demographic_events = _get_ll_demographic_events(demography.events)
         ll_recomb_map = recombination_map.asdict()
         ll_tables = _msprime.LightweightTableCollection(tables.sequence_length)
         ll_tables.fromdict(tables.asdict())
@@ -1267,6 +1346,10 @@ class Simulator(_msprime.Simulator):
             demographic_events=ll_demographic_events,
             store_migrations=store_migrations,
             store_full_arg=store_full_arg,
+            dtwf_generation_skipping=dtwf_generation_skipping,
+            dtwf_num_threads=dtwf_num_threads,
+            pedigree_num_threads=pedigree_num_threads,
+            sweep_trajectory_bank_size=sweep_trajectory_bank_size,
             num_labels=num_labels,
             segment_block_size=segment_block_size,
             avl_node_block_size=avl_node_block_size,
@@ -1533,6 +1616,34 @@ class DiscreteTimeWrightFisher(SimulationModel):
     name = "dtwf"
 
 
+@attr.s
+class DiscreteTimeWrightFisherHybrid(ParametricSimulationModel):
+    """
+    A hybrid of the :class:`.DiscreteTimeWrightFisher` model and the
+    :class:`.StandardCoalescent`. The simulation proceeds generation by
+    generation under the DTWF until it has run for at least ``duration``
+    generations, and the number of lineages in every population is no more
+    than ``max_lineage_ratio`` times its size. It then switches to the
+    standard coalescent for the remainder of the simulation.
+
+    This is equivalent to specifying a list of models with a
+    :class:`.DiscreteTimeWrightFisher` model followed by a
+    :class:`.StandardCoalescent`, except that the time of the switch is
+    chosen automatically.
+
+    :param float duration: The minimum number of generations to simulate
+        under the DTWF.
+    :param float max_lineage_ratio: The maximum ratio of the number of
+        lineages to the population size at which we switch to the
+        coalescent.
+    """
+
+    name = "dtwf_hybrid"
+
+    duration = attr.ib(default=0)
+    max_lineage_ratio = attr.ib(default=0.01)
+
+
 class WrightFisherPedigree(SimulationModel):
     # TODO Complete documentation.
     # TODO Since the pedigree is a necessary parameter for this simulation
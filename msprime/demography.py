@@ -782,14 +782,20 @@ class CensusEvent(DemographicEvent):
     See the :ref:`tutorial<sec_tutorial_demography_census>` for an example.
 
     :param float time: The time at which this event occurs in generations.
+    :param bool per_lineage: If True, add a single node for each lineage
+        present at the census time, rather than one node for each of the
+        lineage's ancestral segments. Defaults to False.
     """
 
+    per_lineage = attr.ib(default=False)
+
     def get_ll_representation(self, num_populations=None):
         # We need to keep the num_populations argument until stdpopsim 0.1 is out
         # https://github.com/tskit-dev/msprime/issues/1037
         return {
             "type": "census_event",
             "time": self.time,
+            "per_lineage": bool(self.per_lineage),
         }
 
     def __str__(self):
@@ -840,6 +846,11 @@ class DemographyDebugger:
     """
     A class to facilitate debugging of population parameters and migration
     rates in the past.
+
+    The numerical methods (:meth:`.coalescence_rate_trajectory`,
+    :meth:`.mean_coalescence_time` and :meth:`.lineage_probabilities`) are
+    computed in C, and the work within each time step can be shared between
+    ``num_threads`` threads, which helps for models with many populations.
     """
 
     def __init__(
@@ -851,8 +862,11 @@ class DemographyDebugger:
         migration_matrix=None,
         demographic_events=None,
         model=None,
+        # Number of threads used for the numerical methods.
+        num_threads=1,
     ):
         self.precision = 3
+        self.num_threads = num_threads
         if demography is None:
             # Support the pre-1.0 syntax
             demography = Demography.from_old_style(
@@ -863,8 +877,11 @@ class DemographyDebugger:
         self._make_epochs()
         self._check_misspecification()
 
-    def _make_epochs(self):
-        self.epochs = []
+    def _make_simulator(self):
+        """
+        Returns a new low-level simulator for the demography, ready for
+        walking through the epochs with the debug methods.
+        """
         # Create some samples to keep the simulator factory happy
         # FIXME samples shouldn't be needed here any more.
         for j, pop in enumerate(self.demography.populations):
@@ -873,9 +890,11 @@ class DemographyDebugger:
                 break
         else:
             raise ValueError("No population with non-zero initial size.")
-        simulator = ancestry._parse_simulate(
-            samples=samples, demography=self.demography
-        )
+        return ancestry._parse_simulate(samples=samples, demography=self.demography)
+
+    def _make_epochs(self):
+        self.epochs = []
+        simulator = self._make_simulator()
         start_time = 0
         end_time = 0
         abs_tol = 1e-9
@@ -1049,78 +1068,15 @@ class DemographyDebugger:
             lineage in any population is zero.
         :return: An array of dimension len(steps) by num pops by num_pops.
         """
-        num_pops = self.num_populations
-        # P[i, j] will be the probability that a lineage that started in i is now in j
-        P = np.eye(num_pops)
-
-        # epochs are defined by mass migration events or changes to population sizes
-        # or migration rates, so we add the epoch interval times to the steps that we
-        # need to account for
-        epoch_breaks = [t for t in self.epoch_times if t not in steps]
-        all_steps = np.concatenate([steps, epoch_breaks])
-
-        sampling = []
-        if sample_time not in all_steps:
-            sampling.append(sample_time)
-        all_steps = np.concatenate((all_steps, sampling))
-
-        ix = np.argsort(all_steps)
-        all_steps = all_steps[ix]
-        # keep track of the steps to report in P_out
-        keep_steps = np.concatenate(
-            [
-                np.repeat(True, len(steps)),
-                np.repeat(False, len(epoch_breaks)),
-                np.repeat(False, len(sampling)),
-            ]
-        )[ix]
-
-        assert len(np.unique(all_steps)) == len(all_steps)
-        assert np.all(steps == all_steps[keep_steps])
-        P_out = np.zeros((len(all_steps), num_pops, num_pops))
-
-        first_step = 0
-        while all_steps[first_step] < sample_time:
-            first_step += 1
-
-        P_out[first_step] = P
-
-        # get ordered mass migration events
-        mass_migration_objects = []
-        mass_migration_times = []
-        for demo in self.demography.events:
-            if isinstance(demo, MassMigration):
-                mass_migration_objects.append(demo)
-                mass_migration_times.append(demo.time)
-
-        for jj in range(first_step, len(all_steps) - 1):
-            t_j = all_steps[jj]
-
-            # apply any mass migration events to P
-            # so if we sample at this time, we do no account for the instantaneous
-            # mass migration events that occur at the same time. that will show up
-            # at the next step
-            if t_j > sample_time:
-                for mass_mig_t, mass_mig_e in zip(
-                    mass_migration_times, mass_migration_objects
-                ):
-                    if mass_mig_t == t_j:
-                        S = np.eye(num_pops, num_pops)
-                        S[mass_mig_e.source, mass_mig_e.dest] = mass_mig_e.proportion
-                        S[mass_mig_e.source, mass_mig_e.source] = (
-                            1 - mass_mig_e.proportion
-                        )
-                        P = np.matmul(P, S)
-
-            # get continuous migration matrix over next interval
-            _, M = self._pop_size_and_migration_at_t(t_j)
-            dt = all_steps[jj + 1] - all_steps[jj]
-            dM = np.diag([sum(s) for s in M])
-            # advance to next interval time (dt) taking into account continuous mig
-            P = P.dot(_matrix_exponential(dt * (M - dM)))
-            P_out[jj + 1] = P
-
-        return P_out[keep_steps]
+        steps = np.array(steps, dtype=float)
+        if not np.all(np.diff(steps) > 0):
+            raise ValueError("`steps` must be a sequence of increasing times.")
+        if np.any(steps < 0):
+            raise ValueError("`steps` must be non-negative")
+        simulator = self._make_simulator()
+        return simulator.debug_lineage_probabilities(
+            steps, sample_time=sample_time, num_threads=self.num_threads
+        )
 
     def possible_lineage_locations(self, samples=None):
         """
@@ -1409,73 +1365,13 @@ class DemographyDebugger:
         return r, p_t
 
     def _calculate_coalescence_rate_trajectory(self, steps, num_samples, min_pop_size):
-        num_pops = self.num_populations
-        P = np.zeros([num_pops ** 2, num_pops ** 2])
-        IA = np.array(range(num_pops ** 2)).reshape([num_pops, num_pops])
-        Identity = np.eye(num_pops)
-        for x in range(num_pops):
-            for y in range(num_pops):
-                P[IA[x, y], IA[x, y]] = num_samples[x] * (num_samples[y] - (x == y))
-        P = P / np.sum(P)
-        # add epoch breaks if not there already but remember which steps they are
-        epoch_breaks = list(
-            set([0.0] + [t for t in self.epoch_times if t not in steps])
+        simulator = self._make_simulator()
+        return simulator.debug_coalescence_rates(
+            np.array(steps, dtype=float),
+            np.array(num_samples, dtype=float),
+            min_pop_size=min_pop_size,
+            num_threads=self.num_threads,
         )
-        steps_b = np.concatenate([steps, epoch_breaks])
-        ix = np.argsort(steps_b)
-        steps_b = steps_b[ix]
-        keep_steps = np.concatenate(
-            [np.repeat(True, len(steps)), np.repeat(False, len(epoch_breaks))]
-        )[ix]
-        assert np.all(steps == steps_b[keep_steps])
-        mass_migration_objects = []
-        mass_migration_times = []
-        for demo in self.demography.events:
-            if type(demo) == MassMigration:
-                mass_migration_objects.append(demo)
-                mass_migration_times.append(demo.time)
-        num_steps = len(steps_b)
-        # recall that steps_b[0] = 0.0
-        r = np.zeros(num_steps)
-        p_t = np.zeros(num_steps)
-        for j in range(num_steps - 1):
-            time = steps_b[j]
-            dt = steps_b[j + 1] - steps_b[j]
-            N, M = self._pop_size_and_migration_at_t(time)
-            C = np.zeros([num_pops ** 2, num_pops ** 2])
-            for idx in range(num_pops):
-                C[IA[idx, idx], IA[idx, idx]] = 1 / (2 * max(min_pop_size, N[idx]))
-            dM = np.diag([sum(s) for s in M])
-            if time in mass_migration_times:
-                idx = mass_migration_times.index(time)
-                a = mass_migration_objects[idx].source
-                b = mass_migration_objects[idx].dest
-                p = mass_migration_objects[idx].proportion
-                S = np.eye(num_pops ** 2, num_pops ** 2)
-                for x in range(num_pops):
-                    if x == a:
-                        S[IA[a, a], IA[a, b]] = S[IA[a, a], IA[b, a]] = p * (1 - p)
-                        S[IA[a, a], IA[b, b]] = p ** 2
-                        S[IA[a, a], IA[a, a]] = (1 - p) ** 2
-                    else:
-                        S[IA[x, a], IA[x, b]] = S[IA[a, x], IA[b, x]] = p
-                        S[IA[x, a], IA[x, a]] = S[IA[a, x], IA[a, x]] = 1 - p
-                P = np.matmul(P, S)
-            p_notcoal = np.sum(P)
-            p_t[j] = p_notcoal
-            if p_notcoal > 0:
-                r[j] = np.sum(np.matmul(P, C)) / np.sum(P)
-            else:
-                r[j] = np.nan
-            G = (np.kron(M - dM, Identity) + np.kron(Identity, M - dM)) - C
-            P = np.matmul(P, _matrix_exponential(dt * G))
-        p_notcoal = np.sum(P)
-        p_t[num_steps - 1] = p_notcoal
-        if p_notcoal > 0:
-            r[num_steps - 1] = np.sum(np.matmul(P, C)) / p_notcoal
-        else:
-            r[num_steps - 1] = np.nan
-        return r[keep_steps], p_t[keep_steps]
 
     def _pop_size_and_migration_at_t(self, t):
         """
@@ -1070,6 +1070,8 @@ def mutate(
     end_time=None,
     discrete=False,
     kept_mutations_before_end_time=False,
+    num_chunks=1,
+    num_threads=1,
 ):
     """
     Simulates mutations on the specified ancestry and returns the resulting
@@ -1108,6 +1110,19 @@ def mutate(
     nodes with time <= ``start_time`` since mutations store the node at the
     bottom (i.e., towards the leaves) of the branch that they occur on.
 
+    Mutations may be placed in parallel by splitting the genome into
+    ``num_chunks`` equal-length chunks, each with its own random number
+    generator seeded from ``random_seed``, and processing these with
+    ``num_threads`` threads. The output depends on the seed and the number
+    of chunks, but not on the number of threads. With ``num_chunks > 1``
+    both the mutations and their alleles are drawn from the chunks' random
+    number generators, so for every mutation model the output for a given
+    seed differs from that with a single chunk. For matrix mutation models
+    the alleles are chosen in parallel. Models that keep track of the
+    alleles they have produced, such as the
+    :class:`.InfiniteAllelesMutationModel` and :class:`.SLiMMutationModel`,
+    choose alleles for the chunks in order, on a single thread.
+
     :param tskit.TreeSequence tree_sequence: The tree sequence onto which we
         wish to throw mutations.
     :param float rate: The rate of mutation per generation, as either a
@@ -1135,6 +1150,10 @@ def mutate(
     :param bool kept_mutations_before_end_time: Whether to allow mutations to be added
         ancestrally to existing (kept) mutations. This flag has no effect
         if either keep or discrete are False.
+    :param int num_chunks: The number of chunks into which the genome is split
+        when generating mutations (default: 1).
+    :param int num_threads: The number of threads used to generate mutations
+        in the chunks (default: 1).
     :return: The :class:`tskit.TreeSequence` object resulting from overlaying
         mutations on the input tree sequence.
     :rtype: :class:`tskit.TreeSequence`
@@ -1172,6 +1191,8 @@ def mutate(
     keep = bool(keep)
     discrete = bool(discrete)
     kept_mutations_before_end_time = bool(kept_mutations_before_end_time)
+    num_chunks = int(num_chunks)
+    num_threads = int(num_threads)
 
     model = mutation_model_factory(model)
 
@@ -1198,6 +1219,8 @@ def mutate(
         kept_mutations_before_end_time=kept_mutations_before_end_time,
         start_time=start_time,
         end_time=end_time,
+        num_chunks=num_chunks,
+        num_threads=num_threads,
     )
 
     tables = tskit.TableCollection.fromdict(lwt.asdict())
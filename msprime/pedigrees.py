@@ -43,6 +43,18 @@ import numpy as np
 # sets the individuals 0 and 1 to be the samples.
 
 
+_BINARY_MAGIC = b"MSPPED01"
+_BINARY_VERSION = 1
+_BINARY_HEADER = np.dtype(
+    [
+        ("magic", "S8"),
+        ("version", "=u4"),
+        ("ploidy", "=u4"),
+        ("num_individuals", "=u8"),
+    ]
+)
+
+
 class Pedigree:
     """
     Class representing a pedigree for simulations.
@@ -76,16 +88,19 @@ class Pedigree:
         if np.min(individual) <= 0:
             raise ValueError("Individual IDs must be > 0")
 
-        self.individual = individual.astype(np.int32)
+        self.individual = individual.astype(np.int32, copy=False)
         self.num_individuals = len(individual)
-        self.parents = parents.astype(np.int32)
-        self.time = time.astype(np.float64)
+        self.parents = parents.astype(np.int32, copy=False)
+        self.time = time.astype(np.float64, copy=False)
         self.sex = sex
         self.ploidy = int(ploidy)
+        # Set when the pedigree is read from a binary file, which the
+        # simulation then maps directly.
+        self.binary_file = None
 
         self.is_sample = None
         if is_sample is not None:
-            self.is_sample = is_sample.astype(np.uint32)
+            self.is_sample = is_sample.astype(np.uint32, copy=False)
             self.samples = np.array(is_sample)[np.where(is_sample == 1)]
             self.num_samples = len(self.samples)
 
@@ -365,6 +380,78 @@ class Pedigree:
         pedarray = self.build_array()
         np.save(fname, pedarray)
 
+    @staticmethod
+    def _binary_layout(num_individuals, ploidy):
+        # See MSP_PEDIGREE_FILE_MAGIC in lib/msprime.h for the format.
+        def align(offset):
+            return (offset + 7) & ~7
+
+        individual_offset = _BINARY_HEADER.itemsize
+        parents_offset = align(individual_offset + 4 * num_individuals)
+        time_offset = align(parents_offset + 4 * num_individuals * ploidy)
+        is_sample_offset = align(time_offset + 8 * num_individuals)
+        size = is_sample_offset + 4 * num_individuals
+        return individual_offset, parents_offset, time_offset, is_sample_offset, size
+
+    def save_binary(self, fname):
+        """
+        Saves pedigree in the binary columnar format, which simulations
+        read by memory mapping the file. Samples must be set.
+        """
+        if self.is_sample is None:
+            raise ValueError("Samples must be set before saving a binary pedigree")
+        header = np.zeros(1, dtype=_BINARY_HEADER)
+        header["magic"] = _BINARY_MAGIC
+        header["version"] = _BINARY_VERSION
+        header["ploidy"] = self.ploidy
+        header["num_individuals"] = self.num_individuals
+        layout = self._binary_layout(self.num_individuals, self.ploidy)
+        columns = [
+            self.individual.astype(np.int32),
+            self.parents.astype(np.int32),
+            self.time.astype(np.float64),
+            self.is_sample.astype(np.uint32),
+        ]
+        with open(fname, "wb") as f:
+            f.write(header.tobytes())
+            for offset, column in zip(layout[:-1], columns):
+                f.write(b"\0" * (offset - f.tell()))
+                f.write(column.tobytes())
+
+    @staticmethod
+    def read_binary(fname, **kwargs):
+        """
+        Reads pedigree from the binary columnar format written by
+        :meth:`.save_binary`. The columns are memory mapped rather than
+        copied, and simulations using the returned pedigree map the file
+        directly.
+        """
+        header = np.fromfile(fname, dtype=_BINARY_HEADER, count=1)
+        if (
+            len(header) != 1
+            or header["magic"][0] != _BINARY_MAGIC
+            or header["version"][0] != _BINARY_VERSION
+        ):
+            raise ValueError(f"{fname} is not a binary pedigree file")
+        num_individuals = int(header["num_individuals"][0])
+        ploidy = int(header["ploidy"][0])
+        layout = Pedigree._binary_layout(num_individuals, ploidy)
+        data = np.memmap(fname, dtype=np.uint8, mode="r", shape=(layout[-1],))
+
+        def column(offset, dtype, count):
+            return np.frombuffer(data, dtype=dtype, count=count, offset=offset)
+
+        ped = Pedigree(
+            column(layout[0], np.int32, num_individuals),
+            column(layout[1], np.int32, num_individuals * ploidy).reshape(-1, ploidy),
+            column(layout[2], np.float64, num_individuals),
+            is_sample=column(layout[3], np.uint32, num_individuals),
+            ploidy=ploidy,
+            **kwargs,
+        )
+        ped.binary_file = fname
+        return ped
+
     def asdict(self):
         """
         Returns a dict of arguments to recreate this pedigree
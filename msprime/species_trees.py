@@ -19,11 +19,8 @@
 """
 Module responsible for parsing species trees.
 """
-import re
-
-import newick
-
 from . import demography as demog
+from msprime import _msprime
 
 
 def parse_starbeast(tree, generation_time, branch_length_units="myr"):
@@ -104,9 +101,8 @@ def parse_starbeast(tree, generation_time, branch_length_units="myr"):
 
     translate_string, tree_string = parse_nexus(tree)
     species_name_map = parse_translate_command(translate_string)
-    clean_tree_string = strip_extra_annotations(tree_string)
     return process_starbeast_tree(
-        clean_tree_string, generations_per_branch_length_unit, species_name_map
+        tree_string, generations_per_branch_length_unit, species_name_map
     )
 
 
@@ -203,42 +199,38 @@ def parse_species_tree(tree, Ne, branch_length_units="gen", generation_time=None
         branch_length_units, generation_time
     )
 
-    # Parse the tree with the newick library.
-    root = parse_newick(tree, generations_per_branch_length_unit)
-
     # Define populations and demographic events according to the
     # specified population size and the divergence times in the species tree.
     # Per divergence event (node in the tree), a mass migration with a proportion
     # of 1 of the population is used. The destination is the left-most leaf for
-    # each node. Because we are using the n leaf populations, we map each node back
-    # to the leaf population that it corresponds to.
-    populations = []
-    events = []
-    leaf_map = {}
-    for node in root.walk("postorder"):
-        if len(node.descendants) == 0:
-            # Per extant species (= leaf node) in the tree, add a population with
-            # size Ne. Species names are stored as metadata with the "species_name"
-            # tag.
-            populations.append(
-                demog.Population(initial_size=Ne, name=node.name.strip())
-            )
-            leaf_map[node] = len(populations) - 1
-        else:
-            # Per internal node, add one (if the node is bifurcating) or multiple
-            # (if the node is multi-furcating) MassMigrations. The parent species
-            # maps implicitly to the left-most child species, so we don't generate
-            # any MassMigrations for that.
-            leaf_map[node] = leaf_map[node.descendants[0]]
-            # For each child species after the left-most one, we create
-            # a MassMigration into the left-most species.
-            for child in node.descendants[1:]:
-                events.append(
-                    demog.MassMigration(
-                        source=leaf_map[child], dest=leaf_map[node], time=node.time
-                    )
-                )
-    return demog.Demography(populations=populations, events=events)
+    # each node, and the parser maps each node back to the leaf population that
+    # it corresponds to.
+    parsed = _msprime.parse_species_tree(tree, generations_per_branch_length_unit)
+    # Per extant species (= leaf node) in the tree, add a population with
+    # size Ne. Species names are stored as metadata with the "species_name"
+    # tag.
+    populations = [
+        demog.Population(initial_size=Ne, name=name)
+        for name in parsed["population_name"]
+    ]
+    return demog.Demography(populations=populations, events=get_mass_migrations(parsed))
+
+
+def get_mass_migrations(parsed):
+    """
+    Returns the list of MassMigrations for the specified parsed species tree.
+    Per internal node, there is one MassMigration (if the node is bifurcating)
+    or multiple (if the node is multi-furcating) from each child species after
+    the left-most one into the left-most species.
+    """
+    return [
+        demog.MassMigration(time=time, source=source, dest=dest)
+        for time, source, dest in zip(
+            parsed["mass_migration_time"].tolist(),
+            parsed["mass_migration_source"].tolist(),
+            parsed["mass_migration_dest"].tolist(),
+        )
+    ]
 
 
 def process_starbeast_tree(
@@ -246,65 +238,39 @@ def process_starbeast_tree(
 ):
     """
     Process the specified starbeast newick string with embedded dmv annotations
-    (but no others) and return the resulting population_configurations and
-    demographic_events.
+    and return the resulting demography.
     """
-    root = parse_newick(tree_string, generations_per_branch_length_unit)
+    parsed = _msprime.parse_species_tree(
+        tree_string, generations_per_branch_length_unit, annotation="dmv"
+    )
     populations = []
-    events = []
-    # The destination is the left-most leaf for each node. Because we are
-    # using the n leaf populations, we map each node back to the leaf
-    # population that it corresponds to.
-    leaf_map = {}
-    for node in root.walk("postorder"):
-        if node.name is None:
-            raise ValueError("Annotation missing for one or more nodes.")
-        find_pattern = "\\&dmv=\\{([\\d\\.]+?)\\}"
-        dmv_patterns = re.search(find_pattern, node.name)
-        if dmv_patterns is None:
-            raise ValueError("No dmv annotation for node")
-        pop_size = float(dmv_patterns.group(1)) * generations_per_branch_length_unit
-
-        if len(node.descendants) == 0:
-            # Per extant species (= leaf node) in the tree, add a population with
-            # size pop_size. Species names are stored as metadata with the "species_name"
-            # tag.
-            newick_id = node.name.strip().split("[")[0]
-            species_name = species_name_map[newick_id]
-            populations.append(
-                demog.Population(initial_size=pop_size, name=species_name)
-            )
-            leaf_map[node] = len(populations) - 1
-        else:
-            # Per internal node, add one (if the node is bifurcating) or multiple
-            # (if the node is multi-furcating) MassMigrations. The parent species
-            # maps implicitly to the left-most child species, so we don't generate
-            # any MassMigrations for that.
-            leaf_map[node] = leaf_map[node.descendants[0]]
-            # For each child species after the left-most one, we create
-            # a MassMigration into the left-most species.
-            for child in node.descendants[1:]:
-                events.append(
-                    demog.MassMigration(
-                        source=leaf_map[child], dest=leaf_map[node], time=node.time
-                    )
-                )
-            events.append(
-                demog.PopulationParametersChange(
-                    node.time, initial_size=pop_size, population_id=leaf_map[node]
-                )
+    pop_sizes = parsed["population_annotation"] * generations_per_branch_length_unit
+    for newick_id, pop_size in zip(parsed["population_name"], pop_sizes.tolist()):
+        # Per extant species (= leaf node) in the tree, add a population with
+        # size pop_size. Species names are stored as metadata with the
+        # "species_name" tag.
+        if newick_id not in species_name_map:
+            raise ValueError(f"Newick ID {newick_id} not defined in translation")
+        populations.append(
+            demog.Population(initial_size=pop_size, name=species_name_map[newick_id])
+        )
+    events = get_mass_migrations(parsed)
+    # The size of the ancestral species at each internal node is set for the
+    # population that it maps to.
+    pop_sizes = parsed["ancestor_annotation"] * generations_per_branch_length_unit
+    for time, population, pop_size in zip(
+        parsed["ancestor_time"].tolist(),
+        parsed["ancestor_population"].tolist(),
+        pop_sizes.tolist(),
+    ):
+        events.append(
+            demog.PopulationParametersChange(
+                time, initial_size=pop_size, population=population
             )
+        )
     return demog.Demography(populations=populations, events=events)
 
 
-def is_number(s):
-    try:
-        float(s)
-        return True
-    except ValueError:
-        return False
-
-
 def check_generation_time(generation_time):
     try:
         generation_time = float(generation_time)
@@ -329,134 +295,6 @@ def get_generations_per_branch_length_unit(branch_length_units, generation_time)
     return generations_per_branch_length_unit
 
 
-def parse_newick(tree, branch_length_multiplier):
-    """
-    Parses the newick tree and annotates the resulting nodes with their
-    time values, appropriately scaled.
-    """
-    # Parse the newick tree string.
-    parsed = newick.loads(tree)
-    if len(parsed) == 0:
-        raise ValueError(f"Not a valid newick tree: '{tree}'")
-    root = parsed[0]
-
-    # Set node depths (distances from root).
-    stack = [(root, 0)]
-    num_nodes = 0
-    max_depth = 0
-    while len(stack) > 0:
-        node, depth = stack.pop()
-        if depth > max_depth:
-            max_depth = depth
-        num_nodes += 1
-        node.depth = depth
-        for child in node.descendants:
-            stack.append((child, depth + child.length))
-    if num_nodes < 3:
-        raise ValueError("Newick tree must have at least three nodes")
-
-    # Set node times (distances from present).
-    for node in root.walk():
-        node.time = (max_depth - node.depth) * branch_length_multiplier
-
-    return root
-
-
-def strip_extra_annotations(tree_string):
-    """
-    Takes the input newick string and strips all extended newick annotations
-    other than the dmv attribute, returning the simplified newick string.
-    """
-    if "[" not in tree_string:
-        raise ValueError("No annotation in tree string.")
-    if tree_string.count("[") != tree_string.count("]"):
-        raise ValueError("Unbalanced square brackets in annotation.")
-    if "&dmv={" not in tree_string:
-        raise ValueError("No dmv tag in annotation.")
-    if "}" not in tree_string:
-        raise ValueError("No closing curly brackets in annotation.")
-
-    # Make sure that each substring that begins with an opening square bracket and ends
-    # with a closing square bracket does not contain any further square or round brackets
-    # in it and that it does include the dmv tag.
-    in_annotation = False
-    annotation_string = ""
-    for x in range(len(tree_string)):
-        if tree_string[x] == "[":
-            in_annotation = True
-            annotation_string += tree_string[x]
-        elif tree_string[x] == "]":
-            in_annotation = False
-            annotation_string += tree_string[x]
-            assert "[" not in annotation_string[1:-1], "Square bracket in annotation"
-            assert "]" not in annotation_string[1:-1], "Square bracket in annotation"
-            assert annotation_string.count("&dmv=") == 1, "Multiple or no dmv tags"
-            # Make sure that the dmv tag is followed by a closing curly bracket.
-            # Also ensure that the dmv tag is the first in the annotation.
-            dmv_string = ""
-            in_dmv = False
-            for y in range(len(annotation_string)):
-                dmv_string += annotation_string[y]
-                if annotation_string[y] == "}":
-                    break
-            err = "Uneven curly parentheses in dmv annotation"
-            assert dmv_string.count("{") == dmv_string.count("}"), err
-            assert dmv_string.count("{") == 1, "Multiple or no values in dmv annotation"
-            annotation_string = ""
-            # Make sure that a positive number is found between curly brackets.
-            clean_dmv_string = dmv_string.split("{")[1][0:-1]
-            assert is_number(clean_dmv_string), "dmv annotation is not a number"
-            assert float(clean_dmv_string) >= 0, "dmv annotation is negative"
-        elif in_annotation:
-            annotation_string += tree_string[x]
-
-    # Because the newick module doesn't support parsing extended newick attributes
-    # in general, we have to clean thing up manually before parsing the tree. Here,
-    # we get rid of all annotations except for dmv.
-    clean_tree_string = ""
-    in_annotation = False
-    in_dmv = False
-    for x in range(len(tree_string)):
-        if tree_string[x] == "[":
-            in_annotation = True
-            clean_tree_string += tree_string[x]
-        elif tree_string[x] == "]":
-            in_annotation = False
-            clean_tree_string += tree_string[x]
-        elif in_annotation:
-            if tree_string[x - 1] == "[" and tree_string[x] == "&":
-                clean_tree_string += "&"
-            if tree_string[x - 5 : x] == "dmv={":
-                in_dmv = True
-                clean_tree_string += "dmv={"
-            if in_dmv:
-                clean_tree_string += tree_string[x]
-            if tree_string[x] == "}":
-                in_dmv = False
-        else:
-            clean_tree_string += tree_string[x]
-
-    # Make sure that only dmv annotation remains in the tree string.
-    in_annotation = False
-    annotation_string = ""
-    for x in range(len(clean_tree_string)):
-        if clean_tree_string[x] == "[":
-            in_annotation = True
-            annotation_string += clean_tree_string[x]
-        elif clean_tree_string[x] == "]":
-            in_annotation = False
-            annotation_string += clean_tree_string[x]
-            assert annotation_string[0:7] == "[&dmv={", "Annotation could not be read"
-            assert annotation_string[-2:] == "}]", "Annotation could not be read"
-            assert is_number(annotation_string[7:-2]), "dmv annotation is not a number"
-            assert float(annotation_string[7:-2]) >= 0, "dmv annotation is negative"
-            annotation_string = ""
-        elif in_annotation:
-            annotation_string += clean_tree_string[x]
-
-    return clean_tree_string
-
-
 def parse_translate_command(translate_command):
     """
     Parses the species IDs used in a nexus newick string to their
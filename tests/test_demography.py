@@ -280,7 +280,7 @@ class TestIntrospectionInterface:
 
     def test_census(self):
         event = msprime.CensusEvent(time=1)
-        repr_s = "CensusEvent(time=1)"
+        repr_s = "CensusEvent(time=1, per_lineage=False)"
         str_s = "Census event"
         assert repr(event) == repr_s
         assert str(event) == str_s
@@ -2570,6 +2570,46 @@ class TestLowLevelConversions:
                 }
                 assert d == dp
 
+    def test_event_columns(self):
+        events = [
+            msprime.PopulationParametersChange(time=1, initial_size=2),
+            msprime.PopulationParametersChange(time=2, growth_rate=0.5, population=1),
+            msprime.MassMigration(time=3, source=0, dest=1),
+            msprime.MigrationRateChange(time=4, rate=0.1),
+            msprime.MigrationRateChange(time=5, rate=0.2, source=0, dest=1),
+            msprime.PopulationParametersChange(time=6, initial_size=3),
+        ]
+        ll_events = ancestry._get_ll_demographic_events(events)
+        assert len(ll_events) == 4
+        d = ll_events[0]
+        assert d["type"] == "population_parameters_change"
+        np.testing.assert_array_equal(d["time"], [1, 2])
+        np.testing.assert_array_equal(d["population"], [-1, 1])
+        np.testing.assert_array_equal(d["initial_size"], [2, np.nan])
+        np.testing.assert_array_equal(d["growth_rate"], [np.nan, 0.5])
+        assert ll_events[1] == events[2].get_ll_representation()
+        d = ll_events[2]
+        assert d["type"] == "migration_rate_change"
+        np.testing.assert_array_equal(d["time"], [4, 5])
+        np.testing.assert_array_equal(d["migration_rate"], [0.1, 0.2])
+        np.testing.assert_array_equal(d["source"], [-1, 0])
+        np.testing.assert_array_equal(d["dest"], [-1, 1])
+        assert ll_events[3] == events[5].get_ll_representation()
+
+    def test_many_size_changes(self):
+        times = np.linspace(0.01, 100, 1000)
+        sizes = np.exp(np.sin(times))
+        demography = msprime.Demography.simple_model()
+        demography.events = [
+            msprime.PopulationParametersChange(time=t, initial_size=size)
+            for t, size in zip(times, sizes)
+        ]
+        ts = msprime.sim_ancestry(4, demography=demography, random_seed=2)
+        assert ts.num_trees == 1
+        dd = demography.debug()
+        assert len(dd.epochs) == len(times) + 1
+        assert dd.epochs[-1].populations[0].start_size == sizes[-1]
+
 
 class HistoricalSamplingMixin:
     """
@@ -3109,6 +3149,28 @@ class TestCensusEvent:
         )
         self.verify(ts, census_time)
 
+    def test_per_lineage(self):
+        census_time = 0.5
+        kwargs = dict(sample_size=10, random_seed=5, recombination_rate=2)
+        ts1 = msprime.simulate(
+            demographic_events=[msprime.CensusEvent(time=census_time)], **kwargs
+        )
+        ts2 = msprime.simulate(
+            demographic_events=[
+                msprime.CensusEvent(time=census_time, per_lineage=True)
+            ],
+            **kwargs,
+        )
+        self.verify(ts1, census_time)
+        self.verify(ts2, census_time)
+        flags1 = ts1.tables.nodes.flags
+        flags2 = ts2.tables.nodes.flags
+        num_census1 = np.sum(flags1 == msprime.NODE_IS_CEN_EVENT)
+        num_census2 = np.sum(flags2 == msprime.NODE_IS_CEN_EVENT)
+        assert num_census2 < num_census1
+        # The census uses no random numbers, so the genealogies are the same.
+        assert ts1.simplify().tables.edges == ts2.simplify().tables.edges
+
     def test_population_IDs(self):
         census_time = 100
         pop = msprime.PopulationConfiguration(sample_size=8, initial_size=500)
@@ -377,6 +377,38 @@ class TestModule:
         _msprime.restore_gsl_error_handler()
         _msprime.unset_gsl_error_handler()
 
+    def test_parse_species_tree(self):
+        d = _msprime.parse_species_tree("((a:1,b:1):1,(c:1,d:1,e:1):1)", 2)
+        assert d["population_name"] == ["a", "b", "c", "d", "e"]
+        assert np.all(np.isnan(d["population_annotation"]))
+        np.testing.assert_array_equal(d["mass_migration_time"], [2, 2, 2, 4])
+        np.testing.assert_array_equal(d["mass_migration_source"], [1, 3, 4, 2])
+        np.testing.assert_array_equal(d["mass_migration_dest"], [0, 2, 2, 0])
+        np.testing.assert_array_equal(d["ancestor_time"], [2, 2, 4])
+        np.testing.assert_array_equal(d["ancestor_population"], [0, 2, 0])
+
+    def test_parse_species_tree_annotations(self):
+        tree = "(a[&x=1,dmv={0.5}]:1,b[&dmv=2]:1)[&dmv={3},y={1,2}]"
+        d = _msprime.parse_species_tree(tree, 1, annotation="dmv")
+        np.testing.assert_array_equal(d["population_annotation"], [0.5, 2])
+        np.testing.assert_array_equal(d["ancestor_annotation"], [3])
+        for bad_annotation in ["x", "y", "dm"]:
+            with pytest.raises(ValueError):
+                _msprime.parse_species_tree(tree, 1, annotation=bad_annotation)
+
+    def test_parse_species_tree_errors(self):
+        with pytest.raises(TypeError):
+            _msprime.parse_species_tree()
+        with pytest.raises(TypeError):
+            _msprime.parse_species_tree("(a:1,b:1)")
+        with pytest.raises(TypeError):
+            _msprime.parse_species_tree(None, 1)
+        with pytest.raises(TypeError):
+            _msprime.parse_species_tree("(a:1,b:1)", 1, annotation=1)
+        for bad_tree in ["(a,b)", "(a:1,b:x)", "(a:1,b:1", "(a:1,:1)", "(a:1,b:1)("]:
+            with pytest.raises(ValueError):
+                _msprime.parse_species_tree(bad_tree, 1)
+
 
 def get_random_population_models(n):
     """
@@ -987,6 +1019,82 @@ class TestSimulator(LowLevelTestCase):
             with pytest.raises(_msprime.InputError):
                 f(bad_ploidy)
 
+    def test_dtwf_generation_skipping(self):
+        for skipping in [True, False]:
+            sim = make_sim(
+                10,
+                sequence_length=100,
+                model=get_simulation_model("dtwf"),
+                population_configuration=[
+                    get_population_configuration(initial_size=1000)
+                ],
+                recombination_map=uniform_rate_map(100, 1e-5),
+                dtwf_generation_skipping=skipping,
+            )
+            assert sim.dtwf_generation_skipping == skipping
+            assert sim.run() == _msprime.EXIT_COALESCENCE
+            assert sim.time == int(sim.time)
+        with pytest.raises(TypeError):
+            make_sim(10, dtwf_generation_skipping="sdf")
+
+    def test_dtwf_num_threads(self):
+        num_populations = 3
+        tables = []
+        for num_threads in [1, 2, 5]:
+            sim = make_sim(
+                [(j % num_populations, 0) for j in range(12)],
+                sequence_length=100,
+                num_populations=num_populations,
+                model=get_simulation_model("dtwf"),
+                population_configuration=[
+                    get_population_configuration(initial_size=100)
+                    for _ in range(num_populations)
+                ],
+                migration_matrix=get_migration_matrix(num_populations, 0.01),
+                recombination_map=uniform_rate_map(100, 1e-3),
+                dtwf_generation_skipping=True,
+                dtwf_num_threads=num_threads,
+            )
+            assert sim.dtwf_num_threads == num_threads
+            assert sim.run() == _msprime.EXIT_COALESCENCE
+            tables.append(tskit.TableCollection.fromdict(sim.tables.asdict()))
+        # A single thread runs the serial algorithm; otherwise the output
+        # does not depend on the number of threads
+        assert tables[1].nodes == tables[2].nodes
+        assert tables[1].edges == tables[2].edges
+        for bad_value in [0, -1]:
+            with pytest.raises(ValueError):
+                make_sim(10, dtwf_num_threads=bad_value)
+        with pytest.raises(TypeError):
+            make_sim(10, dtwf_num_threads="sdf")
+
+    def test_pedigree_num_threads(self):
+        for num_threads in [1, 2, 5]:
+            sim = make_sim(10, pedigree_num_threads=num_threads)
+            assert sim.pedigree_num_threads == num_threads
+        for bad_value in [0, -1]:
+            with pytest.raises(ValueError):
+                make_sim(10, pedigree_num_threads=bad_value)
+        with pytest.raises(TypeError):
+            make_sim(10, pedigree_num_threads="sdf")
+
+    def test_sweep_trajectory_bank_size(self):
+        model = get_sweep_genic_selection_model(
+            position=0.5, start_frequency=0.1, end_frequency=0.9, alpha=0.1, dt=0.01
+        )
+        for bank_size in [0, 1, 10]:
+            sim = make_sim(
+                10, model=model, num_labels=2, sweep_trajectory_bank_size=bank_size
+            )
+            assert sim.sweep_trajectory_bank_size == bank_size
+            for _ in range(3):
+                sim.run()
+                sim.reset()
+        with pytest.raises(ValueError):
+            make_sim(10, sweep_trajectory_bank_size=-1)
+        with pytest.raises(TypeError):
+            make_sim(10, sweep_trajectory_bank_size="sdf")
+
     @pytest.mark.skipif(IS_WINDOWS, reason="windows IO is weird")
     def test_print_state_errors(self):
         sim = make_sim(10)
@@ -1697,6 +1805,100 @@ class TestSimulator(LowLevelTestCase):
             message = str(e)
         assert message.startswith("Input error in demographic_events[1]")
 
+    def test_demographic_event_columns(self):
+        N = 2
+        times = np.linspace(0.1, 10, 50)
+        sizes = np.linspace(1, 5, 50)
+        rates = np.linspace(0, 0.5, 50)
+        column_events = [
+            {
+                "type": "population_parameters_change",
+                "time": times,
+                "population": np.zeros(50, dtype=np.int32),
+                "initial_size": sizes,
+            },
+            get_mass_migration_event(time=20, source=0, dest=1, proportion=0.5),
+            {
+                "type": "migration_rate_change",
+                "time": list(times + 20),
+                "migration_rate": list(rates),
+                "source": [-1] * 50,
+                "dest": [-1] * 50,
+            },
+        ]
+        dict_events = (
+            [
+                get_population_parameters_change_event(t, 0, initial_size=size)
+                for t, size in zip(times, sizes)
+            ]
+            + [column_events[1]]
+            + [
+                get_migration_rate_change_event(time=t + 20, migration_rate=rate)
+                for t, rate in zip(times, rates)
+            ]
+        )
+        sims = [
+            make_sim(
+                num_populations=N,
+                population_configuration=[get_population_configuration()] * N,
+                migration_matrix=get_migration_matrix(N),
+                demographic_events=events,
+            )
+            for events in [column_events, dict_events]
+        ]
+        while True:
+            t = [sim.debug_demography() for sim in sims]
+            assert t[0] == t[1]
+            assert sims[0].population_configuration == sims[1].population_configuration
+            assert np.array_equal(sims[0].migration_matrix, sims[1].migration_matrix)
+            if math.isinf(t[0]):
+                break
+        assert sims[0].population_configuration[0]["initial_size"] == 5
+        assert np.all(sims[0].migration_matrix[[0, 1], [1, 0]] == 0.5)
+
+    def test_bad_demographic_event_columns(self):
+        def f(event):
+            return make_sim(
+                num_populations=2,
+                population_configuration=[get_population_configuration()] * 2,
+                migration_matrix=get_migration_matrix(2),
+                demographic_events=[event],
+            )
+
+        event = {
+            "type": "population_parameters_change",
+            "time": [0, 1],
+            "population": [0, 1],
+            "initial_size": [1, 1],
+        }
+        f(event)
+        with pytest.raises(ValueError):
+            f({**event, "initial_size": [1]})
+        with pytest.raises(ValueError):
+            f({**event, "time": [[0, 1]]})
+        with pytest.raises(ValueError):
+            f({**event, "time": [-1, 1]})
+        with pytest.raises(ValueError):
+            f({k: v for k, v in event.items() if k != "population"})
+        with pytest.raises(ValueError):
+            f({**event, "type": "mass_migration"})
+        for bad_event in [
+            {**event, "population": [0, 2]},
+            {**event, "initial_size": [1, -1]},
+            {**event, "time": [1, 0]},
+            {
+                "type": "migration_rate_change",
+                "time": [0, 1],
+                "migration_rate": [0, 1],
+                "source": [0, 0],
+                "dest": [1, 0],
+            },
+        ]:
+            with pytest.raises(_msprime.InputError) as excinfo:
+                f(bad_event)
+            message = str(excinfo.value)
+            assert message.startswith("Input error in demographic_events[0][1]")
+
     def test_unsorted_demographic_events(self):
         event_generators = [
             get_size_change_event,
@@ -2346,6 +2548,16 @@ class TestSimMutations:
                 generate(start_time=bad_type)
             with pytest.raises(TypeError):
                 generate(end_time=bad_type)
+            with pytest.raises(TypeError):
+                generate(num_chunks=bad_type)
+            with pytest.raises(TypeError):
+                generate(num_threads=bad_type)
+        for bad_value in [0, -1]:
+            with pytest.raises(ValueError):
+                generate(num_chunks=bad_value)
+            with pytest.raises(ValueError):
+                generate(num_threads=bad_value)
+        generate(num_chunks=10, num_threads=3)
 
     def test_tables(self):
         imap = uniform_rate_map(1)
@@ -2527,6 +2739,49 @@ class TestDemographyDebugger:
             sim.run()
         assert math.isinf(sim.debug_demography())
 
+    def test_coalescence_rates(self):
+        steps = np.linspace(0, 10, 11)
+        for num_threads in [1, 2]:
+            sim = self.get_simulator([])
+            N = sim.population_configuration[0]["initial_size"]
+            rates, p = sim.debug_coalescence_rates(
+                steps, [2], num_threads=num_threads
+            )
+            assert np.allclose(rates, 1 / (2 * N))
+            assert np.allclose(p, np.exp(-steps / (2 * N)))
+            # We have walked through all the epochs, so can't do this again.
+            with pytest.raises(_msprime.LibraryError):
+                sim.debug_coalescence_rates(steps, [2])
+
+    def test_coalescence_rates_errors(self):
+        sim = self.get_simulator([])
+        with pytest.raises(ValueError):
+            sim.debug_coalescence_rates([0, 1], [2, 2])
+        with pytest.raises(TypeError):
+            sim.debug_coalescence_rates([0, 1], [2], min_pop_size="1")
+        for steps in [[1, 0], [-1, 0], [0, np.inf], [0, 0]]:
+            sim = self.get_simulator([])
+            with pytest.raises(_msprime.LibraryError):
+                sim.debug_coalescence_rates(steps, [2])
+        for num_threads in [-1, 0]:
+            sim = self.get_simulator([])
+            with pytest.raises(_msprime.LibraryError):
+                sim.debug_coalescence_rates([0, 1], [2], num_threads=num_threads)
+        sim = self.get_simulator([])
+        with pytest.raises(_msprime.LibraryError):
+            sim.debug_coalescence_rates([0, 1], [1])
+
+    def test_lineage_probabilities(self):
+        sim = self.get_simulator([])
+        P = sim.debug_lineage_probabilities([0, 1, 2], sample_time=0.5)
+        assert P.shape == (3, 1, 1)
+        assert np.array_equal(P[:, 0, 0], [0, 1, 1])
+        with pytest.raises(_msprime.LibraryError):
+            sim.debug_lineage_probabilities([0, 1, 2])
+        sim = self.get_simulator([])
+        with pytest.raises(_msprime.LibraryError):
+            sim.debug_lineage_probabilities([0, 1, 2], sample_time=-1)
+
 
 class TestLikelihood:
     """
@@ -57,6 +57,14 @@ class TestIntrospectionInterface:
         assert repr(model) == repr_s
         assert str(model) == repr_s
 
+    def test_dtwf_hybrid(self):
+        model = msprime.DiscreteTimeWrightFisherHybrid(
+            duration=10, max_lineage_ratio=0.5
+        )
+        repr_s = "DiscreteTimeWrightFisherHybrid(duration=10, max_lineage_ratio=0.5)"
+        assert repr(model) == repr_s
+        assert str(model) == repr_s
+
     def test_wf_pedigree(self):
         model = msprime.WrightFisherPedigree()
         repr_s = "WrightFisherPedigree()"
@@ -411,6 +419,19 @@ class TestParametricModels:
                 d = model.get_ll_representation()
                 assert d == {"name": "dirac", "psi": psi, "c": c}
 
+    def test_dtwf_hybrid_parameters(self):
+        for duration in [0, 10, 1e6]:
+            for ratio in [0, 0.01, 1]:
+                model = msprime.DiscreteTimeWrightFisherHybrid(duration, ratio)
+                assert model.duration == duration
+                assert model.max_lineage_ratio == ratio
+                d = model.get_ll_representation()
+                assert d == {
+                    "name": "dtwf_hybrid",
+                    "duration": duration,
+                    "max_lineage_ratio": ratio,
+                }
+
 
 class TestMultipleMergerModels:
     """
@@ -523,6 +544,46 @@ class TestDtwf:
             assert right < 50 or right > 100
 
 
+class TestDtwfHybrid:
+    """
+    Tests for the automatic DTWF to coalescent hybrid model.
+    """
+
+    def test_switches_to_hudson(self):
+        sim = ancestry._parse_sim_ancestry(
+            10,
+            population_size=100,
+            sequence_length=10,
+            recombination_rate=0.01,
+            model=msprime.DiscreteTimeWrightFisherHybrid(5, 0.1),
+            random_seed=2,
+        )
+        assert sim.model["name"] == "dtwf_hybrid"
+        sim.run()
+        assert sim.model["name"] == "hudson"
+        ts = sim.copy_tables().tree_sequence()
+        assert all(tree.num_roots == 1 for tree in ts.trees())
+
+    def test_never_switches(self):
+        ts = msprime.sim_ancestry(
+            10,
+            population_size=100,
+            model=msprime.DiscreteTimeWrightFisherHybrid(1e9, 0.1),
+            random_seed=2,
+        )
+        # All nodes are in integer generations under the DTWF
+        assert np.all(ts.tables.nodes.time == np.floor(ts.tables.nodes.time))
+
+    def test_bad_parameters(self):
+        for duration, ratio in [(-1, 0), (0, -1)]:
+            with pytest.raises(_msprime.InputError):
+                msprime.sim_ancestry(
+                    10,
+                    population_size=100,
+                    model=msprime.DiscreteTimeWrightFisherHybrid(duration, ratio),
+                )
+
+
 class TestUnsupportedFullArg:
     """
     Full ARG recording isn't supported on the discrete time Wright-Fisher model
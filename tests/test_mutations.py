@@ -347,6 +347,58 @@ class TestMutate(MutateMixin):
         assert all(tables[0].sites == t.sites for t in tables[1:])
         assert all(tables[0].mutations == t.mutations for t in tables[1:])
 
+    def test_chunks_independent_of_threads(self):
+        ts = msprime.simulate(10, length=10, recombination_rate=1, random_seed=2)
+        for discrete in [True, False]:
+            mutated = [
+                msprime.mutate(
+                    ts,
+                    rate=1,
+                    random_seed=3,
+                    discrete=discrete,
+                    num_chunks=7,
+                    num_threads=num_threads,
+                )
+                for num_threads in [1, 2, 8]
+            ]
+            assert mutated[0].num_sites > 0
+            tables = [other_ts.dump_tables() for other_ts in mutated]
+            assert all(tables[0].sites == t.sites for t in tables[1:])
+            assert all(tables[0].mutations == t.mutations for t in tables[1:])
+
+    def test_chunks_independent_of_threads_infinite_alleles(self):
+        ts = msprime.simulate(10, length=10, recombination_rate=1, random_seed=2)
+        mutated = [
+            msprime.mutate(
+                ts,
+                rate=1,
+                random_seed=3,
+                model=msprime.InfiniteAllelesMutationModel(),
+                num_chunks=5,
+                num_threads=num_threads,
+            )
+            for num_threads in [1, 4]
+        ]
+        assert mutated[0].num_sites > 0
+        assert mutated[0].tables.sites == mutated[1].tables.sites
+        assert mutated[0].tables.mutations == mutated[1].tables.mutations
+
+    def test_one_chunk(self):
+        ts = msprime.simulate(10, length=10, recombination_rate=1, random_seed=2)
+        ts1 = msprime.mutate(ts, rate=1, random_seed=3, num_threads=4)
+        ts2 = msprime.mutate(ts, rate=1, random_seed=3, num_chunks=1)
+        assert ts1.num_sites > 0
+        assert ts1.tables.sites == ts2.tables.sites
+        assert ts1.tables.mutations == ts2.tables.mutations
+
+    def test_bad_chunks(self):
+        ts = msprime.simulate(10, random_seed=2)
+        for bad_value in [0, -1]:
+            with pytest.raises(ValueError):
+                msprime.mutate(ts, rate=1, num_chunks=bad_value)
+            with pytest.raises(ValueError):
+                msprime.mutate(ts, rate=1, num_threads=bad_value)
+
     def test_default_alphabet(self):
         ts = msprime.simulate(10, random_seed=2)
         mutated = msprime.mutate(ts, rate=1, random_seed=2)
@@ -1515,6 +1567,36 @@ class TestPythonMutationGenerator:
         assert ts.num_sites > 1
         self.verify(ts, random_seed=789)
 
+    def test_caterpillar_tree(self):
+        # A deep tree with many mutations per site, so that the C version
+        # switches to finding parent mutations with an Euler tour.
+        n = 50
+        tables = tskit.TableCollection(10)
+        for _ in range(n):
+            tables.nodes.add_row(flags=tskit.NODE_IS_SAMPLE, time=0)
+        for j in range(1, n):
+            u = tables.nodes.add_row(time=j)
+            tables.edges.add_row(0, 10, u, 0 if j == 1 else u - 1)
+            tables.edges.add_row(0, 10, u, j)
+        tables.sort()
+        ts = tables.tree_sequence()
+        model = msprime.MatrixMutationModel(
+            ["0", "1"], [0.5, 0.5], [[0.5, 0.5], [0.5, 0.5]]
+        )
+        for discrete in [True, False]:
+            ts1 = msprime.mutate(
+                ts, rate=1, discrete=discrete, model=model, random_seed=5
+            )
+            ts2 = py_mutate(ts, rate=1, discrete=discrete, model=model, random_seed=5)
+            assert ts1.num_sites > 0
+            if discrete:
+                assert ts1.num_mutations > ts1.num_sites
+            tables1 = ts1.dump_tables()
+            tables2 = ts2.dump_tables()
+            tables1.provenances.clear()
+            tables2.provenances.clear()
+            assert tables1 == tables2
+
 
 ####################################################
 # Python implementation of lib/mutgen.c algorithms #
@@ -1671,12 +1753,40 @@ class PythonMutationMatrixModel(PythonMutationModel):
     root_distribution = attr.ib()
     transition_matrix = attr.ib()
 
+    def alias_table(self, distribution):
+        # Vose's method, following alias_table_init in the C library.
+        n = len(distribution)
+        scaled = [p * n for p in distribution]
+        threshold = [1.0] * n
+        alias = list(range(n))
+        small = [j for j in range(n) if scaled[j] < 1]
+        large = [j for j in range(n) if scaled[j] >= 1]
+        while len(small) > 0 and len(large) > 0:
+            j = small.pop()
+            k = large.pop()
+            threshold[j] = scaled[j]
+            alias[j] = k
+            scaled[k] = (scaled[k] + scaled[j]) - 1.0
+            if scaled[k] < 1:
+                small.append(k)
+            else:
+                large.append(k)
+        max_index = 0
+        for j in range(n):
+            if distribution[j] > distribution[max_index]:
+                max_index = j
+        for j in small:
+            if distribution[j] <= 0:
+                threshold[j] = 0.0
+                alias[j] = max_index
+        return threshold, alias
+
     def choose_allele(self, rng, distribution):
-        u = rng.flat(0, 1)
-        j = 0
-        while u > distribution[j]:
-            u -= distribution[j]
-            j += 1
+        threshold, alias = self.alias_table(distribution)
+        n = len(distribution)
+        u = rng.flat(0, n)
+        k = min(int(u), n - 1)
+        j = k if u - k < threshold[k] else alias[k]
         return self.alleles[j]
 
     def root_allele(self, rng):
@@ -94,6 +94,48 @@ class TestPedigree(unittest.TestCase):
         # TODO compre this to the file above.
         assert isinstance(ped_from_npy, msprime.Pedigree)
 
+    def test_pedigree_binary(self):
+        individual = np.array([1, 2, 3, 4])
+        parents = np.array([2, 3, 2, 3, -1, -1, -1, -1]).reshape(-1, 2)
+        time = np.array([0, 0, 1, 1])
+        is_sample = np.array([1, 1, 0, 0])
+        ped = msprime.Pedigree(individual, parents, time, is_sample)
+        path = os.path.join(self.temp_dir, "pedigree.bin")
+        ped.save_binary(path)
+
+        ped_from_binary = msprime.Pedigree.read_binary(path)
+        assert ped_from_binary.binary_file == path
+        assert np.array_equal(ped.individual, ped_from_binary.individual)
+        assert np.array_equal(ped.parents, ped_from_binary.parents)
+        assert np.array_equal(ped.time, ped_from_binary.time)
+        assert np.array_equal(ped.is_sample, ped_from_binary.is_sample)
+
+        ts1 = msprime.simulate(
+            2, pedigree=ped, model="wf_ped", recombination_rate=1, random_seed=5
+        )
+        ts2 = msprime.simulate(
+            2,
+            pedigree=ped_from_binary,
+            model="wf_ped",
+            recombination_rate=1,
+            random_seed=5,
+        )
+        assert ts1.tables.nodes == ts2.tables.nodes
+        assert ts1.tables.edges == ts2.tables.edges
+
+    def test_pedigree_binary_errors(self):
+        individual = np.array([1, 2, 3, 4])
+        parents = np.array([2, 3, 2, 3, -1, -1, -1, -1]).reshape(-1, 2)
+        time = np.array([0, 0, 1, 1])
+        ped = msprime.Pedigree(individual, parents, time)
+        path = os.path.join(self.temp_dir, "pedigree.bin")
+        with pytest.raises(ValueError):
+            ped.save_binary(path)
+        with open(path, "wb") as f:
+            f.write(b"not a pedigree")
+        with pytest.raises(ValueError):
+            msprime.Pedigree.read_binary(path)
+
     def test_pedigree_times(self):
         individual = np.array([1, 2, 3, 4])
         time = np.array([0, 0, 1, 1])
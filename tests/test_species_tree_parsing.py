@@ -41,20 +41,6 @@ def get_non_binary_tree(n):
     return tree
 
 
-class TestIsNumber:
-    """
-    Test the is_number function.
-    """
-
-    def test_good_examples(self):
-        for x in ["2", "2.0", "1000", "-1e3", "1e-6"]:
-            assert species_trees.is_number(x)
-
-    def test_bad_examples(self):
-        for x in ["", "x2.0", "1000x", ";-1e3", ";;"]:
-            assert not species_trees.is_number(x)
-
-
 class TestSpeciesTreeRoundTrip(unittest.TestCase):
     """
     Tests that we get what we expect when we parse trees produced from
@@ -508,6 +494,20 @@ class TestSpeciesTreeExamples:
             pop = 2 if j < 2 else 0
             assert ts.node(u).population == pop
 
+    def test_deep_tree(self):
+        # A caterpillar tree is deeper than we could parse recursively.
+        n = 10 ** 4
+        tree = "0:1"
+        for j in range(1, n):
+            tree = f"({tree},{j}:{j}):1"
+        spec = msprime.parse_species_tree(tree[:-2], Ne=1)
+        assert [pop.name for pop in spec.populations] == [str(j) for j in range(n)]
+        assert len(spec.events) == n - 1
+        for j, event in enumerate(spec.events, 1):
+            assert event.time == j
+            assert event.source == j
+            assert event.dest == 0
+
 
 class TestStarbeastParsingErrors:
     """
@@ -569,23 +569,37 @@ class TestStarbeastParsingErrors:
                 )
 
     def test_bad_annotations(self):
-        good = "((1[&dmv={0.1}]:1,2[&dmv={0.2}]:1)[&dmv={0.3}])"
-        assert species_trees.strip_extra_annotations(good) == good
+        name_map = {"1": "spc1", "2": "spc2"}
+        good = "(1[&dmv={0.1}]:1,2[&dmv={0.2},x={1,2}]:1)[&height=1,dmv={0.3}]"
+        spec = species_trees.process_starbeast_tree(good, 10, name_map)
+        assert [pop.initial_size for pop in spec.populations] == [1, 2]
+        assert [pop.name for pop in spec.populations] == ["spc1", "spc2"]
+        assert spec.events[1].initial_size == pytest.approx(3)
         bad_examples = [
             # No annotations
             "((1:1,2:1)",
+            "(1:1,2:1)",
             # Mismatched annotations
             "((1[]:1,2[]:1)[]]",
             "((1[]:1,2[]:1)[",
             "((1[]:1,2[]:1)]",
+            "(1[[&dmv={1}]]:1,2[&dmv={1}]:1)[&dmv={1}]",
             # Missing all dmvs
             "((1[]:1,2[]:1)[]",
+            "(1[]:1,2[]:1)[]",
             # Missing closing }
             "((1[&dmv={]:1,2[]:1)[]",
+            "(1[&dmv={1]:1,2[&dmv={1}]:1)[&dmv={1}]",
+            # Bad values
+            "(1[&dmv={-1}]:1,2[&dmv={1}]:1)[&dmv={1}]",
+            "(1[&dmv={x}]:1,2[&dmv={1}]:1)[&dmv={1}]",
+            "(1[&dmv={1,2}]:1,2[&dmv={1}]:1)[&dmv={1}]",
+            # Unknown newick ID
+            "(1[&dmv={1}]:1,3[&dmv={1}]:1)[&dmv={1}]",
         ]
         for example in bad_examples:
             with pytest.raises(ValueError):
-                species_trees.strip_extra_annotations(example)
+                species_trees.process_starbeast_tree(example, 1, name_map)
 
     def test_bad_annotations_in_tree(self):
         name_map = {f"{j}": f"{j}" for j in range(3)}